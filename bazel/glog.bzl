@@ -82,6 +82,9 @@ def glog_library(with_gflags = 1, **kwargs):
         "-DHAVE_SYS_TYPES_H",
         # For src/utilities.cc.
         "-DHAVE_SYS_SYSCALL_H",
+        # For src/system_log_sink.cc.
+        "-DHAVE_SYS_SOCKET_H",
+        "-DHAVE_SYS_UN_H",
         # For src/logging.cc to create symlinks.
         "-fvisibility-inlines-hidden",
         "-fvisibility=hidden",
@@ -177,6 +180,7 @@ def glog_library(with_gflags = 1, **kwargs):
             "src/demangle.cc",
             "src/demangle.h",
             "src/flags.cc",
+            "src/flight_recorder.cc",
             "src/logging.cc",
             "src/raw_logging.cc",
             "src/signalhandler.cc",
@@ -190,6 +194,7 @@ def glog_library(with_gflags = 1, **kwargs):
             "src/stacktrace_x86-inl.h",
             "src/symbolize.cc",
             "src/symbolize.h",
+            "src/system_log_sink.cc",
             "src/utilities.cc",
             "src/utilities.h",
             "src/vlog_is_on.cc",
@@ -236,6 +241,7 @@ def glog_library(with_gflags = 1, **kwargs):
         # "demangle", # Broken
         # "logging", # Broken
         # "mock-log", # Broken
+        "sharded_log_every_n",
         # "signalhandler", # Pointless
         "stacktrace",
         "stl_logging",
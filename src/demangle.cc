@@ -37,7 +37,9 @@
 #include "demangle.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cstdlib>
+#include <cstring>
 #include <limits>
 
 #include "utilities.h"
@@ -1350,8 +1352,13 @@ bool Demangle(const char* mangled, char* out, size_t out_size) {
     return false;
   }
 
-  std::copy_n(unmangled.get(), std::min(n, out_size), out);
-  return status == 0;
+  // Fail rather than return a truncated name without a terminating '\0'.
+  const std::size_t length = std::strlen(unmangled.get());
+  if (status != 0 || length >= out_size) {
+    return false;
+  }
+  std::copy_n(unmangled.get(), length + 1, out);
+  return true;
 #else
   State state;
   InitState(&state, mangled, out, out_size);
@@ -1359,5 +1366,78 @@ bool Demangle(const char* mangled, char* out, size_t out_size) {
 #endif
 }
 
+namespace {
+
+// A direct-mapped cache of the demangled names of recent mangled names that
+// are shorter than kMaxCachedNameSize.  Stack traces keep repeating the same
+// symbols, which are then demangled only once.  The cache is statically
+// allocated, and it is guarded by a flag that is only tried rather than waited
+// for, so that it can be used by signal handlers as well: the cache is
+// bypassed while another thread, or the interrupted one, uses it.
+constexpr size_t kNumCachedNames = 256;
+constexpr size_t kMaxCachedNameSize = 256;
+
+struct CachedName {
+  uint64 hash;
+  char mangled[kMaxCachedNameSize];
+  char demangled[kMaxCachedNameSize];
+};
+
+CachedName cached_names[kNumCachedNames];
+std::atomic_flag cached_names_busy = ATOMIC_FLAG_INIT;
+
+// FNV-1a hash of "str", whose length is stored to "length".
+uint64 HashName(const char* str, size_t* length) {
+  uint64 hash = 14695981039346656037ULL;
+  size_t i = 0;
+  for (; str[i] != '\0'; ++i) {
+    hash = (hash ^ static_cast<unsigned char>(str[i])) * 1099511628211ULL;
+  }
+  *length = i;
+  // 0 marks unused entries.
+  return hash != 0 ? hash : 1;
+}
+
+}  // namespace
+
+bool DemangleWithCache(const char* mangled, char* out, size_t out_size) {
+  size_t mangled_length;
+  const uint64 hash = HashName(mangled, &mangled_length);
+  if (mangled_length >= kMaxCachedNameSize) {
+    return Demangle(mangled, out, out_size);
+  }
+  CachedName& entry = cached_names[hash % kNumCachedNames];
+  if (!cached_names_busy.test_and_set(std::memory_order_acquire)) {
+    bool found = false;
+    bool fits = false;
+    if (entry.hash == hash &&
+        memcmp(entry.mangled, mangled, mangled_length + 1) == 0) {
+      found = true;
+      const size_t size = strlen(entry.demangled) + 1;
+      fits = size <= out_size;
+      if (fits) {
+        memcpy(out, entry.demangled, size);
+      }
+    }
+    cached_names_busy.clear(std::memory_order_release);
+    if (found) {
+      return fits;
+    }
+  }
+
+  if (!Demangle(mangled, out, out_size)) {
+    return false;
+  }
+  const size_t size = strlen(out) + 1;
+  if (size <= kMaxCachedNameSize &&
+      !cached_names_busy.test_and_set(std::memory_order_acquire)) {
+    entry.hash = hash;
+    memcpy(entry.mangled, mangled, mangled_length + 1);
+    memcpy(entry.demangled, out, size);
+    cached_names_busy.clear(std::memory_order_release);
+  }
+  return true;
+}
+
 }  // namespace glog_internal_namespace_
 }  // namespace google
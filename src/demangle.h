@@ -88,6 +88,12 @@ inline namespace glog_internal_namespace_ {
 // "out" is modified even if demangling is unsuccessful.
 bool GLOG_NO_EXPORT Demangle(const char* mangled, char* out, size_t out_size);
 
+// Same as Demangle(), but look up "mangled" in a small cache of recently
+// demangled symbol names first, and add it to the cache on success.  The
+// cache is bounded and statically allocated.
+bool GLOG_NO_EXPORT DemangleWithCache(const char* mangled, char* out,
+                                      size_t out_size);
+
 }  // namespace glog_internal_namespace_
 }  // namespace google
 
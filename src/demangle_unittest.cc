@@ -36,6 +36,8 @@
 #include <fstream>
 #include <iostream>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "config.h"
 #include "glog/logging.h"
@@ -121,27 +123,59 @@ TEST(Demangle, Clones) {
   EXPECT_FALSE(Demangle("_ZL3Foov.isra.2.constprop.", tmp, sizeof(tmp)));
 }
 
-TEST(Demangle, FromFile) {
-  string test_file = FLAGS_test_srcdir + "/src/demangle_unittest.txt";
-  ifstream f(test_file.c_str());  // The file should exist.
-  EXPECT_FALSE(f.fail());
-
-  string line;
-  while (getline(f, line)) {
-    // Lines start with '#' are considered as comments.
-    if (line.empty() || line[0] == '#') {
-      continue;
+// Reads the pairs of mangled and demangled names of demangle_unittest.txt.
+static const vector<pair<string, string>>& TestNames() {
+  static const vector<pair<string, string>> names = [] {
+    vector<pair<string, string>> result;
+    string test_file = FLAGS_test_srcdir + "/src/demangle_unittest.txt";
+    ifstream f(test_file.c_str());  // The file should exist.
+    EXPECT_FALSE(f.fail());
+
+    string line;
+    while (getline(f, line)) {
+      // Lines start with '#' are considered as comments.
+      if (line.empty() || line[0] == '#') {
+        continue;
+      }
+      // Each line should contain a mangled name and a demangled name
+      // separated by '\t'.  Example: "_Z3foo\tfoo"
+      string::size_type tab_pos = line.find('\t');
+      EXPECT_NE(string::npos, tab_pos);
+      result.emplace_back(line.substr(0, tab_pos), line.substr(tab_pos + 1));
     }
-    // Each line should contain a mangled name and a demangled name
-    // separated by '\t'.  Example: "_Z3foo\tfoo"
-    string::size_type tab_pos = line.find('\t');
-    EXPECT_NE(string::npos, tab_pos);
-    string mangled = line.substr(0, tab_pos);
-    string demangled = line.substr(tab_pos + 1);
+    return result;
+  }();
+  return names;
+}
+
+TEST(Demangle, FromFile) {
+  for (const auto& name : TestNames()) {
+    const string& mangled = name.first;
+    const string& demangled = name.second;
     EXPECT_EQ(demangled, DemangleIt(mangled.c_str()));
   }
 }
 
+static void BM_Demangle(int iters) {
+  const vector<pair<string, string>>& names = TestNames();
+  char demangled[4096];
+  for (int i = 0; i < iters; ++i) {
+    const string& mangled = names[static_cast<size_t>(i) % names.size()].first;
+    Demangle(mangled.c_str(), demangled, sizeof(demangled));
+  }
+}
+BENCHMARK(BM_Demangle)
+
+static void BM_DemangleWithCache(int iters) {
+  const vector<pair<string, string>>& names = TestNames();
+  char demangled[4096];
+  for (int i = 0; i < iters; ++i) {
+    const string& mangled = names[static_cast<size_t>(i) % names.size()].first;
+    DemangleWithCache(mangled.c_str(), demangled, sizeof(demangled));
+  }
+}
+BENCHMARK(BM_DemangleWithCache)
+
 #endif
 
 int main(int argc, char** argv) {
@@ -152,6 +186,7 @@ int main(int argc, char** argv) {
 
   FLAGS_logtostderr = true;
   InitGoogleLogging(argv[0]);
+  RunSpecifiedBenchmarks();
   if (FLAGS_demangle_filter) {
     // Read from cin and write to cout.
     string line;
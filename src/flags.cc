@@ -30,11 +30,14 @@
 
 #include "glog/flags.h"
 
+#include <atomic>
 #include <cstdlib>
 #include <cstring>
 
 #include "base/commandlineflags.h"
+#include "base/googleinit.h"
 #include "glog/log_severity.h"
+#include "utilities.h"
 
 namespace {
 
@@ -73,6 +76,11 @@ GLOG_DEFINE_bool(colorlogtostdout, false,
                  "color messages logged to stdout (if supported by terminal)");
 GLOG_DEFINE_bool(logtostdout, BoolFromEnv("GOOGLE_LOGTOSTDOUT", false),
                  "log messages go to stdout instead of logfiles");
+GLOG_DEFINE_uint32(console_buffer_bytes, 0,
+                   "Write log messages to stderr and stdout from a background "
+                   "thread through a buffer of this many bytes per stream; "
+                   "messages which do not fit are dropped (0 means write "
+                   "them synchronously)");
 #ifdef GLOG_OS_LINUX
 GLOG_DEFINE_bool(
     drop_log_memory, true,
@@ -104,6 +112,41 @@ GLOG_DEFINE_bool(log_year_in_prefix, true,
 GLOG_DEFINE_int32(minloglevel, 0,
                   "Messages logged at a lower level than this don't "
                   "actually get logged anywhere");
+GLOG_DEFINE_string(
+    minloglevel_module, "",
+    "per-module minloglevel."
+    " Argument is a comma-separated list of <module name>=<level>."
+    " <module name> is a glob pattern, matched against the filename base"
+    " (that is, name ignoring .cc/.h./-inl.h)."
+    " Messages below <level> from matching modules are suppressed in"
+    " addition to those below --minloglevel.");
+GLOG_DEFINE_uint32(log_rate_limit_bytes, 0,
+                   "Approximate number of bytes per second that may be logged "
+                   "below ERROR; messages beyond this budget are shed "
+                   "(0 means no limit)");
+GLOG_DEFINE_int32(log_rate_limit_summary_secs, 60,
+                  "Log a summary of shed messages at most every this many "
+                  "seconds");
+GLOG_DEFINE_int32(log_dedup_window_ms, 0,
+                  "Count exact repeats of a message from the same site "
+                  "within this many milliseconds instead of logging them "
+                  "(0 means log every message)");
+GLOG_DEFINE_uint32(stl_logging_max_elements, 100,
+                   "Print at most this many elements of a container streamed "
+                   "with glog/stl_logging.h, including the elements of the "
+                   "containers nested into it");
+GLOG_DEFINE_uint32(stl_logging_max_bytes, 0,
+                   "Stop printing the elements of a container streamed with "
+                   "glog/stl_logging.h, including the containers nested into "
+                   "it, after this many bytes (0 means no limit)");
+GLOG_DEFINE_uint32(flight_recorder_bytes, 0,
+                   "Keep the most recent log messages of each thread in a "
+                   "ring buffer of this many bytes, to be dumped on crashes "
+                   "(0 means no flight recorder)");
+GLOG_DEFINE_int32(flight_recorder_v, -1,
+                  "Also record in the flight recorder the messages suppressed "
+                  "by --minloglevel and the VLOG(m) messages for m <= this "
+                  "(-1 means record only the messages which are logged)");
 GLOG_DEFINE_int32(logbuflevel, 0,
                   "Buffer log messages logged at this level or lower"
                   " (-1 means don't buffer; 0 means buffer INFO only;"
@@ -119,6 +162,19 @@ GLOG_DEFINE_int32(logemaillevel, 999,
                   " (0 means email all; 3 means email FATAL only;"
                   " ...)");
 GLOG_DEFINE_string(logmailer, "", "Mailer used to send logging email");
+GLOG_DEFINE_int32(logemailsecs, 60,
+                  "Send at most one logging email, with all the messages "
+                  "logged in the meantime, every this many seconds");
+
+GLOG_DEFINE_bool(logtojournald, false,
+                 "log messages go to the systemd journal in addition to the "
+                 "other destinations");
+GLOG_DEFINE_string(journald_socket, "/run/systemd/journal/socket",
+                   "Path of the socket of the systemd journal");
+GLOG_DEFINE_bool(logtosyslog, false,
+                 "log messages go to syslog, in the RFC 5424 format, in "
+                 "addition to the other destinations");
+GLOG_DEFINE_string(syslog_socket, "/dev/log", "Path of the syslog socket");
 
 GLOG_DEFINE_int32(logfile_mode, 0664, "Log file mode/permissions.");
 
@@ -156,3 +212,46 @@ GLOG_DEFINE_string(
 
 GLOG_DEFINE_bool(symbolize_stacktrace, true,
                  "Symbolize the stack trace in the tombstone");
+GLOG_DEFINE_bool(symbolize_cache, false,
+                 "Cache the module map and sorted symbol tables of object "
+                 "files, and recently demangled names, across "
+                 "symbolizations");
+GLOG_DEFINE_bool(symbolize_offline, false,
+                 "Print raw program counters followed by a module map instead "
+                 "of symbol names in stack traces, for symbolization with "
+                 "glog_symbolize");
+GLOG_DEFINE_string(symbolize_debug_root, "/usr/lib/debug",
+                   "Look up the separate debug files of stripped object files "
+                   "by build-id and .gnu_debuglink under this directory "
+                   "(empty means only next to the object files)");
+GLOG_DEFINE_bool(symbolize_line_numbers, false,
+                 "Append the source file and line, decoded from the DWARF "
+                 "line tables of object files, to the symbol names of stack "
+                 "traces");
+GLOG_DEFINE_bool(stacktrace_frame_pointers, false,
+                 "Obtain stack traces by walking the frame pointers instead of "
+                 "the unwind tables (requires code built with "
+                 "-fno-omit-frame-pointer)");
+GLOG_DEFINE_bool(dump_all_threads_on_failure, false,
+                 "Dump the stack traces of all threads, not only of the "
+                 "failing one, from the failure signal handler (Linux only)");
+GLOG_DEFINE_int32(dump_all_threads_timeout_ms, 1000,
+                  "Milliseconds to wait for the other threads to take their "
+                  "stack traces in a dump of all threads");
+
+// Set by the last dynamic initializer of this file, so after the string flags
+// above are constructed.
+static std::atomic<bool> g_flags_constructed{false};
+
+namespace google {
+inline namespace glog_internal_namespace_ {
+
+bool FlagsConstructed() {
+  return g_flags_constructed.load(std::memory_order_acquire);
+}
+
+}  // namespace glog_internal_namespace_
+}  // namespace google
+
+REGISTER_MODULE_INITIALIZER(flags, g_flags_constructed.store(
+                                       true, std::memory_order_release))
@@ -0,0 +1,368 @@
+// Copyright (c) 2024, Google Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// The flight recorder keeps the most recent log messages of each thread in
+// memory, to dump them when the program crashes.
+//
+// Each thread appends its messages, unformatted, to a ring buffer of its own,
+// so recording takes no lock.  The dump formats them with async-signal-safe
+// code only.
+//
+// A ring is allocated by the first message of the first thread taking it, and
+// is never freed: later threads reuse the rings of the threads which exited.
+// The rings are not preallocated since most of the kMaxRecordingThreads rings
+// are usually never used.  A thread records nothing if its ring cannot be
+// allocated.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <thread>
+
+#include "config.h"
+#include "glog/logging.h"
+#include "utilities.h"
+
+#if defined(HAVE_SYS_SYSCALL_H)
+#  include <sys/syscall.h>
+#endif
+#if defined(HAVE_UNISTD_H)
+#  include <unistd.h>
+#endif
+
+namespace google {
+namespace glog_internal_namespace_ {
+namespace {
+
+// At most this many threads record at the same time.
+constexpr size_t kMaxRecordingThreads = 256;
+// Longer file names and messages are truncated.
+constexpr size_t kMaxFileBytes = 64;
+constexpr size_t kMaxMessageBytes = 30000;  // As LogMessage::kMaxLogMessageLen
+
+// Precedes the file name and the message of each record.
+struct RecordHeader {
+  int64 usec;  // Since the epoch.
+  uint64 thread_id;
+  int32 gmtoffset;  // In seconds.
+  int32 line;
+  uint32 message_size;
+  uint16_t file_size;
+  uint8_t severity;
+};
+
+// The ring buffer of a thread, written by the thread which owns it only.
+// Records are placed at offsets which grow monotonically, modulo the size.
+struct Ring {
+  std::atomic<bool> owned{false};
+  std::atomic<char*> buffer{nullptr};
+  size_t size = 0;
+  std::atomic<uint64> begin{0};  // Of the oldest record.
+  std::atomic<uint64> end{0};    // Past the newest record.
+};
+
+Ring rings[kMaxRecordingThreads];
+std::atomic<bool> crash_dumped{false};
+
+// Releases the ring of a thread when it exits.  The records are kept: they
+// are dumped, and overwritten by the next thread taking the ring.
+struct RingOwner {
+  ~RingOwner() {
+    if (ring != nullptr) {
+      ring->owned.store(false, std::memory_order_release);
+    }
+    // Messages logged by the destructors of other thread_local objects run
+    // after this one are not recorded, rather than written into a ring which
+    // another thread may have taken meanwhile.
+    ring = nullptr;
+    exhausted = true;
+  }
+
+  Ring* ring = nullptr;
+  bool exhausted = false;
+  uint64 thread_id = 0;
+};
+
+thread_local RingOwner ring_owner;
+
+Ring* ThreadRing(size_t size) {
+  if (ring_owner.ring != nullptr || ring_owner.exhausted) {
+    return ring_owner.ring;
+  }
+  for (Ring& ring : rings) {
+    bool owned = false;
+    if (!ring.owned.compare_exchange_strong(owned, true,
+                                            std::memory_order_acquire)) {
+      continue;
+    }
+    // The size of a ring is set by its first thread.
+    if (ring.buffer.load(std::memory_order_relaxed) == nullptr) {
+      char* buffer = new (std::nothrow) char[size];
+      if (buffer == nullptr) {
+        ring.owned.store(false, std::memory_order_release);
+        break;
+      }
+      ring.size = size;
+      ring.buffer.store(buffer, std::memory_order_release);
+    }
+#if defined(HAVE_SYS_SYSCALL_H) && defined(SYS_gettid)
+    ring_owner.thread_id = static_cast<uint64>(syscall(SYS_gettid));
+#else
+    ring_owner.thread_id =
+        std::hash<std::thread::id>{}(std::this_thread::get_id());
+#endif
+    ring_owner.ring = &ring;
+    return &ring;
+  }
+  ring_owner.exhausted = true;
+  return nullptr;
+}
+
+void CopyIn(Ring* ring, uint64 offset, const void* data, size_t size) {
+  char* buffer = ring->buffer.load(std::memory_order_relaxed);
+  const size_t start = static_cast<size_t>(offset % ring->size);
+  const size_t first = std::min(size, ring->size - start);
+  memcpy(buffer + start, data, first);
+  memcpy(buffer, static_cast<const char*>(data) + first, size - first);
+}
+
+void CopyOut(const Ring* ring, uint64 offset, void* data, size_t size) {
+  const char* buffer = ring->buffer.load(std::memory_order_acquire);
+  const size_t start = static_cast<size_t>(offset % ring->size);
+  const size_t first = std::min(size, ring->size - start);
+  memcpy(data, buffer + start, first);
+  memcpy(static_cast<char*>(data) + first, buffer, size - first);
+}
+
+// Async-signal-safe formatting of the dump.
+class DumpWriter {
+ public:
+  explicit DumpWriter(void (*writer)(const char* data, size_t size))
+      : writer_(writer) {}
+  ~DumpWriter() { Flush(); }
+
+  void Append(const char* data, size_t size) {
+    while (size > 0) {
+      if (size_ == sizeof(buffer_)) {
+        Flush();
+      }
+      const size_t n = std::min(size, sizeof(buffer_) - size_);
+      memcpy(buffer_ + size_, data, n);
+      size_ += n;
+      data += n;
+      size -= n;
+    }
+  }
+  void Append(const char* str) { Append(str, strlen(str)); }
+  void Append(char c) { Append(&c, 1); }
+
+  // Appends "number" in decimal with at least "width" digits.
+  void AppendNumber(uint64 number, int width = 1) {
+    char digits[20];
+    int n = 0;
+    do {
+      digits[n++] = static_cast<char>('0' + number % 10);
+      number /= 10;
+    } while (number > 0 || n < width);
+    while (n > 0) {
+      Append(digits[--n]);
+    }
+  }
+
+  void Flush() {
+    if (size_ > 0) {
+      writer_(buffer_, size_);
+      size_ = 0;
+    }
+  }
+
+ private:
+  void (*writer_)(const char* data, size_t size);
+  char buffer_[1024];
+  size_t size_ = 0;
+};
+
+// Appends the time as the log prefix does, in local time computed from the
+// offset recorded with it since localtime_r() is not async-signal-safe.
+void AppendTime(DumpWriter* out, int64 usec, int32 gmtoffset) {
+  const int64 local = usec / 1000000 + gmtoffset;
+  int64 days = local / 86400;
+  int64 secs = local % 86400;
+  if (secs < 0) {
+    secs += 86400;
+    --days;
+  }
+  // The civil date of the days since 1970-01-01, in the proleptic Gregorian
+  // calendar of years starting on March 1st.
+  days += 719468;
+  const int64 era = (days >= 0 ? days : days - 146096) / 146097;
+  const int64 day_of_era = days - era * 146097;
+  const int64 year_of_era = (day_of_era - day_of_era / 1460 +
+                             day_of_era / 36524 - day_of_era / 146096) /
+                            365;
+  const int64 day_of_year =
+      day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+  const int64 shifted_month = (5 * day_of_year + 2) / 153;
+  const int64 day = day_of_year - (153 * shifted_month + 2) / 5 + 1;
+  const int64 month =
+      shifted_month < 10 ? shifted_month + 3 : shifted_month - 9;
+  const int64 year = year_of_era + era * 400 + (month <= 2 ? 1 : 0);
+
+  out->AppendNumber(static_cast<uint64>(year), 4);
+  out->AppendNumber(static_cast<uint64>(month), 2);
+  out->AppendNumber(static_cast<uint64>(day), 2);
+  out->Append(' ');
+  out->AppendNumber(static_cast<uint64>(secs / 3600), 2);
+  out->Append(':');
+  out->AppendNumber(static_cast<uint64>(secs / 60 % 60), 2);
+  out->Append(':');
+  out->AppendNumber(static_cast<uint64>(secs % 60), 2);
+  out->Append('.');
+  out->AppendNumber(static_cast<uint64>(usec % 1000000), 6);
+}
+
+}  // namespace
+
+void RecordInFlightRecorder(LogSeverity severity, const char* file, int line,
+                            const LogMessageTime& time, const char* message,
+                            size_t message_size) {
+  const size_t size = FLAGS_flight_recorder_bytes;
+  if (size == 0) {
+    return;
+  }
+  Ring* ring = ThreadRing(std::max<size_t>(size, 4096));
+  if (ring == nullptr) {
+    return;
+  }
+
+  RecordHeader header;
+  header.usec = std::chrono::duration_cast<std::chrono::microseconds>(
+                    time.when().time_since_epoch())
+                    .count();
+  header.thread_id = ring_owner.thread_id;
+  header.gmtoffset = static_cast<int32>(time.gmtoffset().count());
+  header.line = line;
+  header.severity = static_cast<uint8_t>(severity);
+  header.file_size =
+      static_cast<uint16_t>(std::min<size_t>(strlen(file), kMaxFileBytes));
+  // Long messages are truncated to a quarter of the ring as well.
+  header.message_size = static_cast<uint32>(
+      std::min({message_size, kMaxMessageBytes,
+                ring->size / 4 - sizeof(header) - header.file_size}));
+
+  // Drop the oldest records until the new one fits, announcing it before
+  // overwriting them.
+  const uint64 end = ring->end.load(std::memory_order_relaxed);
+  const uint64 record_end =
+      end + sizeof(header) + header.file_size + header.message_size;
+  uint64 begin = ring->begin.load(std::memory_order_relaxed);
+  while (record_end - begin > ring->size) {
+    RecordHeader oldest;
+    CopyOut(ring, begin, &oldest, sizeof(oldest));
+    begin += sizeof(oldest) + oldest.file_size + oldest.message_size;
+  }
+  ring->begin.store(begin, std::memory_order_release);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  CopyIn(ring, end, &header, sizeof(header));
+  CopyIn(ring, end + sizeof(header), file, header.file_size);
+  CopyIn(ring, end + sizeof(header) + header.file_size, message,
+         header.message_size);
+  ring->end.store(record_end, std::memory_order_release);
+}
+
+void WriteFlightRecorder(void (*writer)(const char* data, size_t size)) {
+  // A single dump at a time: the record buffer is shared.
+  static std::atomic<bool> dumping{false};
+  static char record[sizeof(RecordHeader) + kMaxFileBytes + kMaxMessageBytes];
+  if (dumping.exchange(true, std::memory_order_acquire)) {
+    return;
+  }
+
+  DumpWriter out(writer);
+  out.Append("*** Flight recorder: recent log messages by thread ***\n");
+  for (const Ring& ring : rings) {
+    if (ring.buffer.load(std::memory_order_acquire) == nullptr) {
+      continue;
+    }
+    const uint64 end = ring.end.load(std::memory_order_acquire);
+    uint64 offset = ring.begin.load(std::memory_order_acquire);
+    while (offset < end) {
+      RecordHeader header;
+      CopyOut(&ring, offset, &header, sizeof(header));
+      const size_t size =
+          sizeof(header) + header.file_size + header.message_size;
+      if (size > ring.size || size > sizeof(record) ||
+          header.severity >= NUM_SEVERITIES) {
+        break;
+      }
+      CopyOut(&ring, offset, record, size);
+      // The thread may have overwritten the record meanwhile.
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (ring.begin.load(std::memory_order_relaxed) > offset) {
+        offset = ring.begin.load(std::memory_order_relaxed);
+        continue;
+      }
+      offset += size;
+
+      out.Append(GetLogSeverityName(static_cast<LogSeverity>(header.severity))
+                     [0]);
+      AppendTime(&out, header.usec, header.gmtoffset);
+      out.Append(' ');
+      out.AppendNumber(header.thread_id);
+      out.Append(' ');
+      out.Append(record + sizeof(header), header.file_size);
+      out.Append(':');
+      out.AppendNumber(static_cast<uint64>(header.line));
+      out.Append("] ");
+      out.Append(record + sizeof(header) + header.file_size,
+                 header.message_size);
+      if (header.message_size == 0 || record[size - 1] != '\n') {
+        out.Append('\n');
+      }
+    }
+  }
+  out.Append("*** End of flight recorder ***\n");
+  out.Flush();
+  dumping.store(false, std::memory_order_release);
+}
+
+void WriteFlightRecorderOnCrash(void (*writer)(const char* data, size_t size)) {
+  if (FLAGS_flight_recorder_bytes > 0 &&
+      !crash_dumped.exchange(true, std::memory_order_relaxed)) {
+    WriteFlightRecorder(writer);
+  }
+}
+
+}  // namespace glog_internal_namespace_
+}  // namespace google
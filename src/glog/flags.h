@@ -117,6 +117,10 @@ DECLARE_bool(timestamp_in_logfile_name);
 // Set whether log messages go to stdout instead of logfiles
 DECLARE_bool(logtostdout);
 
+// Write log messages to stderr and stdout from a background thread through a
+// buffer of this many bytes per stream (0 means write them synchronously)
+DECLARE_uint32(console_buffer_bytes);
+
 // Set color messages logged to stdout (if supported by terminal).
 DECLARE_bool(colorlogtostdout);
 
@@ -153,6 +157,38 @@ DECLARE_int32(logbufsecs);
 // are suppressed.
 DECLARE_int32(minloglevel);
 
+// Per-module minloglevel, e.g. "rpc*=2,frontend=1". A module threshold
+// suppresses messages below it in addition to --minloglevel.
+DECLARE_string(minloglevel_module);  // also in vlog_is_on.cc
+
+// Budget of the elements, and of the bytes (0 means no limit), printed for a
+// container streamed with glog/stl_logging.h and the containers nested in it.
+DECLARE_uint32(stl_logging_max_elements);
+DECLARE_uint32(stl_logging_max_bytes);
+
+// Size in bytes of the ring buffer of each thread keeping its most recent
+// messages for crash dumps; 0 disables the flight recorder.
+DECLARE_uint32(flight_recorder_bytes);
+
+// The flight recorder also records the messages suppressed by --minloglevel
+// and the VLOG(m) messages for m <= this; -1 disables it.
+DECLARE_int32(flight_recorder_v);
+
+// Approximate number of bytes per second that may be logged below ERROR.
+// Messages beyond this budget are shed; 0 disables the limit.  Under pressure
+// a call site gets a fair share of the budget per logging thread.
+DECLARE_uint32(log_rate_limit_bytes);
+
+// Sets the minimum number of seconds between summaries of shed messages.
+// FlushLogFiles() and ShutdownGoogleLogging() log a pending summary at once.
+DECLARE_int32(log_rate_limit_summary_secs);
+
+// Exact repeats of a message from the same site within this many
+// milliseconds are counted instead of logged; 0 disables coalescing.  The
+// counts are logged when the window expires, and by FlushLogFiles() and
+// ShutdownGoogleLogging(), also for threads which have exited since.
+DECLARE_int32(log_dedup_window_ms);
+
 // If specified, logfiles are written into this directory instead of the
 // default logging directory.
 DECLARE_string(log_dir);
@@ -180,8 +216,46 @@ DECLARE_bool(log_utc_time);
 // Mailer used to send logging email
 DECLARE_string(logmailer);
 
+// Send at most one logging email every this many seconds
+DECLARE_int32(logemailsecs);
+
+// Set whether log messages go to the systemd journal, and its socket path
+DECLARE_bool(logtojournald);
+DECLARE_string(journald_socket);
+
+// Set whether log messages go to syslog, and its socket path
+DECLARE_bool(logtosyslog);
+DECLARE_string(syslog_socket);
+
 DECLARE_bool(symbolize_stacktrace);
 
+// Cache the module map and sorted symbol tables of object files, and recently
+// demangled names, across symbolizations.
+DECLARE_bool(symbolize_cache);
+
+// Print raw program counters followed by a module map instead of symbol names
+// in stack traces, for symbolization with glog_symbolize.
+DECLARE_bool(symbolize_offline);
+
+// Directory searched for the separate debug files of stripped object files.
+DECLARE_string(symbolize_debug_root);
+
+// Append the source file and line, decoded from the DWARF line tables, to the
+// symbol names of stack traces.  Set it before InstallFailureSignalHandler()
+// so that the line tables are not decoded by the signal handler.
+DECLARE_bool(symbolize_line_numbers);
+
+// Walk the chain of frame pointers instead of the unwind tables to obtain
+// stack traces.  Requires code built with -fno-omit-frame-pointer.
+DECLARE_bool(stacktrace_frame_pointers);
+
+// Dump the stack traces of all threads, not only of the failing one, from the
+// failure signal handler.
+DECLARE_bool(dump_all_threads_on_failure);
+
+// Milliseconds to wait for the other threads to take their stack traces.
+DECLARE_int32(dump_all_threads_timeout_ms);
+
 #pragma pop_macro("DECLARE_VARIABLE")
 #pragma pop_macro("DECLARE_bool")
 #pragma pop_macro("DECLARE_string")
@@ -49,6 +49,7 @@
 #include <sstream>
 #include <string>
 #include <thread>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
@@ -386,6 +387,37 @@ struct GLOG_EXPORT LogMessageTime {
 #  define COMPACT_GOOGLE_LOG_DFATAL google::NullStreamFatal()
 #endif
 
+// Whether messages of a severity pass --minloglevel and --minloglevel_module.
+// FATAL messages are never suppressed because they terminate the program.
+#define GOOGLE_LOG_IS_ON(severity) \
+  ((severity) >= FLAGS_minloglevel && MINLOGLEVEL_IS_ON(severity))
+#define GOOGLE_LOG_IS_ON_INFO GOOGLE_LOG_IS_ON(google::GLOG_INFO)
+#define GOOGLE_LOG_IS_ON_WARNING GOOGLE_LOG_IS_ON(google::GLOG_WARNING)
+#define GOOGLE_LOG_IS_ON_ERROR GOOGLE_LOG_IS_ON(google::GLOG_ERROR)
+#define GOOGLE_LOG_IS_ON_FATAL true
+#if DCHECK_IS_ON()
+#  define GOOGLE_LOG_IS_ON_DFATAL true
+#else
+#  define GOOGLE_LOG_IS_ON_DFATAL GOOGLE_LOG_IS_ON_ERROR
+#endif
+
+// Whether the flight recorder records the messages which are suppressed, as
+// --flight_recorder_v asks, and the messages it records instead.
+#if GOOGLE_STRIP_LOG == 0
+#  define GOOGLE_LOG_IS_RECORDED(verboselevel) \
+    (FLAGS_flight_recorder_v >= (verboselevel))
+#else
+#  define GOOGLE_LOG_IS_RECORDED(verboselevel) false
+#endif
+#define GOOGLE_LOG_RECORDED(severity)                   \
+  google::LogMessage(__FILE__, __LINE__, (severity), 0, \
+                     &google::LogMessage::SendToFlightRecorder)
+#define GOOGLE_LOG_RECORDED_INFO GOOGLE_LOG_RECORDED(google::GLOG_INFO)
+#define GOOGLE_LOG_RECORDED_WARNING GOOGLE_LOG_RECORDED(google::GLOG_WARNING)
+#define GOOGLE_LOG_RECORDED_ERROR GOOGLE_LOG_RECORDED(google::GLOG_ERROR)
+#define GOOGLE_LOG_RECORDED_FATAL GOOGLE_LOG_RECORDED(google::GLOG_FATAL)
+#define GOOGLE_LOG_RECORDED_DFATAL GOOGLE_LOG_RECORDED_ERROR
+
 #define GOOGLE_LOG_INFO(counter)                                     \
   google::LogMessage(__FILE__, __LINE__, google::GLOG_INFO, counter, \
                      &google::LogMessage::SendToLog)
@@ -447,7 +479,18 @@ struct GLOG_EXPORT LogMessageTime {
 // impossible to stream something like a string directly to an unnamed
 // ostream. We employ a neat hack by calling the stream() member
 // function of LogMessage which seems to avoid the problem.
-#define LOG(severity) COMPACT_GOOGLE_LOG_##severity.stream()
+//
+// Messages below --minloglevel or --minloglevel_module are suppressed before
+// the LogMessage is constructed, so that they cost a few loads and branches:
+// they are streamed into a per-thread NullStream instead.  Note that the
+// streamed arguments are still evaluated; LOG_IF() and VLOG() do not evaluate
+// them either.
+#define LOG(severity)                                \
+  (GOOGLE_LOG_IS_ON_##severity                       \
+       ? COMPACT_GOOGLE_LOG_##severity.stream()      \
+   : GOOGLE_LOG_IS_RECORDED(0)                       \
+       ? GOOGLE_LOG_RECORDED_##severity.stream()     \
+       : google::logging::internal::SuppressedLogStream())
 #define SYSLOG(severity) SYSLOG_##severity(0).stream()
 
 namespace google {
@@ -476,6 +519,34 @@ using PrefixFormatterCallback = void (*)(std::ostream&, const LogMessage&,
 GLOG_EXPORT void InstallPrefixFormatter(PrefixFormatterCallback callback,
                                         void* data = nullptr);
 
+// Alternative to PrefixFormatterCallback which writes the prefix into
+// [buffer, buffer + size) and returns the number of characters written.  The
+// log stream and its formatting state are not involved, so that a prefix
+// costs a copy of the written characters.
+using PrefixWriterCallback = size_t (*)(char* buffer, size_t size,
+                                        const LogMessage&, void*);
+
+// Installs a PrefixWriterCallback, which replaces any installed
+// PrefixFormatterCallback and vice versa.
+GLOG_EXPORT void InstallPrefixWriter(PrefixWriterCallback callback,
+                                     void* data = nullptr);
+
+// Helpers for a PrefixWriterCallback which write a part of the default prefix
+// into [buffer, buffer + size), and return the number of characters written or
+// 0 if they do not fit.
+//
+// Writes the time, e.g. "1103 11:57:31.739339", with the year first if
+// --log_year_in_prefix is set.
+GLOG_EXPORT size_t WriteLogPrefixTime(char* buffer, size_t size,
+                                      const LogMessageTime& time) noexcept;
+// Writes the first letter of the name of the severity, e.g. "I".
+GLOG_EXPORT size_t WriteLogPrefixSeverity(char* buffer, size_t size,
+                                          LogSeverity severity) noexcept;
+// Writes the thread ID as streaming it would, without the padding of the
+// default prefix.
+GLOG_EXPORT size_t WriteLogPrefixThreadId(char* buffer, size_t size,
+                                          const std::thread::id& id);
+
 // Install a function which will be called after LOG(FATAL). Returns the
 // previously set function.
 GLOG_EXPORT logging_fail_func_t
@@ -529,11 +600,12 @@ class LogSink;  // defined below
   LOG_TO_STRING_##severity(static_cast<std::vector<std::string>*>(outvec)) \
       .stream()
 
-#define LOG_IF(severity, condition) \
-  static_cast<void>(0),             \
-      !(condition)                  \
-          ? (void)0                 \
-          : google::logging::internal::LogMessageVoidify() & LOG(severity)
+#define LOG_IF(severity, condition)                          \
+  static_cast<void>(0),                                      \
+      !(condition) || !GOOGLE_LOG_IS_ON_##severity           \
+          ? (void)0                                          \
+          : google::logging::internal::LogMessageVoidify() & \
+                COMPACT_GOOGLE_LOG_##severity.stream()
 #define SYSLOG_IF(severity, condition) \
   static_cast<void>(0),                \
       !(condition)                     \
@@ -553,9 +625,58 @@ class LogSink;  // defined below
   LOG_IF(FATAL, GOOGLE_PREDICT_BRANCH_NOT_TAKEN(!(condition))) \
       << "Check failed: " #condition " "
 
+namespace base_logging {
+
+// LogMessage::LogStream is a std::ostream backed by this streambuf.
+// This class ignores overflow and leaves two bytes at the end of the
+// buffer to allow for a '\n' and '\0'.
+class GLOG_EXPORT LogStreamBuf : public std::streambuf {
+ public:
+  // REQUIREMENTS: "len" must be >= 2 to account for the '\n' and '\0'.
+  LogStreamBuf(char* buf, int len) { setp(buf, buf + len - 2); }
+
+  // This effectively ignores overflow.
+  int_type overflow(int_type ch) { return ch; }
+
+  // Supports tellp() only, which reports the number of characters written.
+  pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+                   std::ios_base::openmode which = std::ios_base::in |
+                                                   std::ios_base::out) {
+    if (off != 0 || dir != std::ios_base::cur ||
+        (which & std::ios_base::out) == 0) {
+      return pos_type(off_type(-1));
+    }
+    return pos_type(static_cast<off_type>(pcount()));
+  }
+
+  // Legacy public ostrstream method.
+  size_t pcount() const { return static_cast<size_t>(pptr() - pbase()); }
+  char* pbase() const { return std::streambuf::pbase(); }
+};
+
+}  // namespace base_logging
+
 namespace logging {
 namespace internal {
 
+// The elements and bytes which the containers printed into a stream by
+// glog/stl_logging.h may still use.  The pword() of the stream at
+// SequenceBudgetIndex() points to the budget in use, and is set by the first
+// container printed.  A log message keeps a budget for its whole statement,
+// which LogMessage resets for each message; on other streams, it only spans
+// the outermost container.
+struct SequenceBudgetState {
+  bool started{false};
+  size_t elements_left{0};
+  std::streamoff bytes_end{-1};
+};
+
+GLOG_EXPORT int SequenceBudgetIndex();
+
+// Returns the budget of the log message whose stream is "out", or nullptr if
+// "out" is not the stream of a log message.
+GLOG_EXPORT SequenceBudgetState* MessageSequenceBudget(std::ostream& out);
+
 // A container for a string pointer which can be evaluated to a bool -
 // true iff the pointer is nullptr.
 struct CheckOpString {
@@ -566,6 +687,25 @@ struct CheckOpString {
   std::unique_ptr<std::string> str_;
 };
 
+// The message of a failing check as used by the CHECK macros, which can be
+// evaluated to a bool - true iff there is a message.  Unlike CheckOpString it
+// does not own the message, which is either formatted into a static buffer,
+// and valid until it is copied into the fatal log message, or a string with
+// static storage duration, so that failing checks do not allocate memory.
+struct CheckOpMessage {
+  CheckOpMessage(std::nullptr_t = nullptr) noexcept {}
+  explicit CheckOpMessage(const char* str) noexcept : str_(str) {}
+  explicit operator bool() const noexcept {
+    return GOOGLE_PREDICT_BRANCH_NOT_TAKEN(str_ != nullptr);
+  }
+  const char* str_{nullptr};
+};
+
+// Writes the message of a failing check, as the CHECK_STR* macros do, and
+// releases the buffer it was formatted into.
+GLOG_EXPORT std::ostream& operator<<(std::ostream& os,
+                                     const CheckOpMessage& message);
+
 // Function is overloaded for integral types to allow static const
 // integrals declared in classes and not defined to be used as arguments to
 // CHECK* macros. It's not encouraged though.
@@ -631,6 +771,17 @@ std::unique_ptr<std::string> MakeCheckOpString(const T1& v1, const T2& v2,
 #endif
     ;
 
+// Same as MakeCheckOpString, without allocating the message.
+template <typename T1, typename T2>
+CheckOpMessage MakeCheckOpMessage(const T1& v1, const T2& v2,
+                                  const char* exprtext)
+#if defined(__has_attribute)
+#  if __has_attribute(used)
+    __attribute__((noinline))
+#  endif
+#endif
+    ;
+
 // A helper class for formatting "expr (V1 vs. V2)" in a CHECK_XX
 // statement.  See MakeCheckOpString for sample usage.  Other
 // approaches were considered: use of a template method (e.g.,
@@ -654,6 +805,31 @@ class GLOG_EXPORT CheckOpMessageBuilder {
   std::ostringstream* stream_;
 };
 
+// Same as CheckOpMessageBuilder, but formats the message into a static
+// buffer, truncated to LogMessage::kMaxLogMessageLen, instead of an allocated
+// string.  The buffer is held by one failing check at a time; the message of
+// a check failing meanwhile in another thread is only "exprtext".
+class GLOG_EXPORT CheckOpMessageWriter {
+ public:
+  // Inserts "prefix", "exprtext" and " (" to the stream.
+  explicit CheckOpMessageWriter(const char* exprtext, const char* prefix = "");
+  CheckOpMessageWriter(const CheckOpMessageWriter&) = delete;
+  CheckOpMessageWriter& operator=(const CheckOpMessageWriter&) = delete;
+  // For inserting the first variable.
+  std::ostream* ForVar1() { return &stream_; }
+  // For inserting the second variable (adds an intermediate " vs. ").
+  std::ostream* ForVar2();
+  // Get the result (inserts the closing ")").
+  CheckOpMessage NewMessage();
+
+ private:
+  const char* exprtext_;
+  char* buffer_;  // nullptr if the buffer is held by another check.
+  char discard_[2];
+  base_logging::LogStreamBuf streambuf_;
+  std::ostream stream_;
+};
+
 template <typename T1, typename T2>
 std::unique_ptr<std::string> MakeCheckOpString(const T1& v1, const T2& v2,
                                                const char* exprtext) {
@@ -663,10 +839,20 @@ std::unique_ptr<std::string> MakeCheckOpString(const T1& v1, const T2& v2,
   return comb.NewString();
 }
 
+template <typename T1, typename T2>
+CheckOpMessage MakeCheckOpMessage(const T1& v1, const T2& v2,
+                                  const char* exprtext) {
+  CheckOpMessageWriter comb(exprtext);
+  MakeCheckOpValueString(comb.ForVar1(), v1);
+  MakeCheckOpValueString(comb.ForVar2(), v2);
+  return comb.NewMessage();
+}
+
 // Helper functions for CHECK_OP macro.
 // The (int, int) specialization works around the issue that the compiler
 // will not instantiate the template version of the function on values of
-// unnamed enum type - see comment below.
+// unnamed enum type - see comment below.  The CHECK_OP macro uses the
+// name##Message variants, which do not allocate the message.
 #define DEFINE_CHECK_OP_IMPL(name, op)                                       \
   template <typename T1, typename T2>                                        \
   inline std::unique_ptr<std::string> name##Impl(const T1& v1, const T2& v2, \
@@ -679,6 +865,18 @@ std::unique_ptr<std::string> MakeCheckOpString(const T1& v1, const T2& v2,
   inline std::unique_ptr<std::string> name##Impl(int v1, int v2,             \
                                                  const char* exprtext) {     \
     return name##Impl<int, int>(v1, v2, exprtext);                           \
+  }                                                                          \
+  template <typename T1, typename T2>                                        \
+  inline CheckOpMessage name##Message(const T1& v1, const T2& v2,            \
+                                      const char* exprtext) {                \
+    if (GOOGLE_PREDICT_TRUE(v1 op v2)) {                                     \
+      return nullptr;                                                        \
+    }                                                                        \
+    return MakeCheckOpMessage(v1, v2, exprtext);                             \
+  }                                                                          \
+  inline CheckOpMessage name##Message(int v1, int v2,                        \
+                                      const char* exprtext) {                \
+    return name##Message<int, int>(v1, v2, exprtext);                        \
   }
 
 // We use the full name Check_EQ, Check_NE, etc. in case the file including
@@ -700,37 +898,17 @@ DEFINE_CHECK_OP_IMPL(Check_GT, >)
 #if defined(STATIC_ANALYSIS)
 // Only for static analysis tool to know that it is equivalent to assert
 #  define CHECK_OP_LOG(name, op, val1, val2, log) CHECK((val1)op(val2))
-#elif DCHECK_IS_ON()
-// In debug mode, avoid constructing CheckOpStrings if possible,
-// to reduce the overhead of CHECK statements by 2x.
-// Real DCHECK-heavy tests have seen 1.5x speedups.
-
-// The meaning of "string" might be different between now and
-// when this macro gets invoked (e.g., if someone is experimenting
-// with other string implementations that get defined after this
-// file is included).  Save the current meaning now and use it
-// in the macro.
-using _Check_string = std::string;
-#  define CHECK_OP_LOG(name, op, val1, val2, log)                              \
-    while (std::unique_ptr<google::logging::internal::_Check_string> _result = \
-               google::logging::internal::Check##name##Impl(                   \
-                   google::logging::internal::GetReferenceableValue(val1),     \
-                   google::logging::internal::GetReferenceableValue(val2),     \
-                   #val1 " " #op " " #val2))                                   \
-    log(__FILE__, __LINE__,                                                    \
-        google::logging::internal::CheckOpString(std::move(_result)))          \
-        .stream()
 #else
-// In optimized mode, use CheckOpString to hint to compiler that
-// the while condition is unlikely.
+// Use CheckOpMessage to hint to compiler that the while condition is
+// unlikely.  It is free to destroy, and a failing check does not allocate.
 #  define CHECK_OP_LOG(name, op, val1, val2, log)                          \
-    while (google::logging::internal::CheckOpString _result =              \
-               google::logging::internal::Check##name##Impl(               \
+    while (google::logging::internal::CheckOpMessage _result =             \
+               google::logging::internal::Check##name##Message(            \
                    google::logging::internal::GetReferenceableValue(val1), \
                    google::logging::internal::GetReferenceableValue(val2), \
                    #val1 " " #op " " #val2))                               \
     log(__FILE__, __LINE__, _result).stream()
-#endif  // STATIC_ANALYSIS, DCHECK_IS_ON()
+#endif  // STATIC_ANALYSIS
 
 #if GOOGLE_STRIP_LOG <= 3
 #  define CHECK_OP(name, op, val1, val2) \
@@ -776,6 +954,8 @@ using _Check_string = std::string;
 // To avoid bloat, the definitions are in logging.cc.
 #define DECLARE_CHECK_STROP_IMPL(func, expected)                        \
   GLOG_EXPORT std::unique_ptr<std::string> Check##func##expected##Impl( \
+      const char* s1, const char* s2, const char* names);               \
+  GLOG_EXPORT CheckOpMessage Check##func##expected##Message(            \
       const char* s1, const char* s2, const char* names);
 
 DECLARE_CHECK_STROP_IMPL(strcmp, true)
@@ -790,11 +970,11 @@ DECLARE_CHECK_STROP_IMPL(strcasecmp, false)
 
 // Helper macro for string comparisons.
 // Don't use this macro directly in your code, use CHECK_STREQ et al below.
-#define CHECK_STROP(func, op, expected, s1, s2)                      \
-  while (google::logging::internal::CheckOpString _result =          \
-             google::logging::internal::Check##func##expected##Impl( \
-                 (s1), (s2), #s1 " " #op " " #s2))                   \
-  LOG(FATAL) << (*_result.str_)
+#define CHECK_STROP(func, op, expected, s1, s2)                         \
+  while (google::logging::internal::CheckOpMessage _result =            \
+             google::logging::internal::Check##func##expected##Message( \
+                 (s1), (s2), #s1 " " #op " " #s2))                      \
+  LOG(FATAL) << _result
 
 // String (char*) equality/inequality checks.
 // CASE versions are case-insensitive.
@@ -902,44 +1082,121 @@ namespace google {
   if (LOG_TIME_DELTA > LOG_TIME_PERIOD)                                        \
   google::LogMessage(__FILE__, __LINE__, google::GLOG_##severity).stream()
 
-#define SOME_KIND_OF_LOG_EVERY_N(severity, n, what_to_do)               \
-  static std::atomic<int> LOG_OCCURRENCES(0), LOG_OCCURRENCES_MOD_N(0); \
-  GLOG_IFDEF_THREAD_SANITIZER(AnnotateBenignRaceSized(                  \
-      __FILE__, __LINE__, &LOG_OCCURRENCES, sizeof(int), ""));          \
-  GLOG_IFDEF_THREAD_SANITIZER(AnnotateBenignRaceSized(                  \
-      __FILE__, __LINE__, &LOG_OCCURRENCES_MOD_N, sizeof(int), ""));    \
-  ++LOG_OCCURRENCES;                                                    \
-  if (++LOG_OCCURRENCES_MOD_N > n) LOG_OCCURRENCES_MOD_N -= n;          \
-  if (LOG_OCCURRENCES_MOD_N == 1)                                       \
-  google::LogMessage(__FILE__, __LINE__, google::GLOG_##severity,       \
-                     LOG_OCCURRENCES, &what_to_do)                      \
-      .stream()
+// Sharded LOG_EVERY_N counters, selected by defining GLOG_SHARDED_LOG_EVERY_N
+// before including this header.  Each thread counts the occurrences of a
+// site in a thread-local counter and only merges them into the site-wide
+// counter every min(n, 64) occurrences, so that hot sites executed by many
+// threads no longer contend on a shared cache line.  The first occurrence
+// in each thread is merged right away.
+//
+// The semantics become approximate: a message is logged when a merged batch
+// contains the 1st, (n+1)th, (2n+1)th, ... occurrence of the site, which can
+// be up to 64 occurrences (per thread) later than with the exact counters.
+// google::COUNTER is the site-wide count at the time of the merge; for
+// LOG_IF_EVERY_N it only counts the occurrences where the condition held.
+namespace logging {
+namespace internal {
+GLOG_INLINE_VARIABLE constexpr int kShardedEveryNMaxBatch = 64;
+
+inline bool ShardedEveryN(std::atomic<int>& total, int& pending, int n,
+                          int* ctr) {
+  const int stride = n < kShardedEveryNMaxBatch ? n : kShardedEveryNMaxBatch;
+  int batch;
+  if (pending == 0) {
+    batch = 1;
+  } else if (++pending <= stride) {
+    return false;
+  } else {
+    batch = pending - 1;
+  }
+  pending = 1;
+  const int prev = total.fetch_add(batch, std::memory_order_relaxed);
+  *ctr = prev + batch;
+  // Log if the batch contains an occurrence k with k % n == 1 % n.
+  return (prev + batch + n - 1) / n > (prev + n - 1) / n;
+}
+}  // namespace internal
+}  // namespace logging
 
-#define SOME_KIND_OF_LOG_IF_EVERY_N(severity, condition, n, what_to_do)       \
-  static std::atomic<int> LOG_OCCURRENCES(0), LOG_OCCURRENCES_MOD_N(0);       \
-  GLOG_IFDEF_THREAD_SANITIZER(AnnotateBenignRaceSized(                        \
-      __FILE__, __LINE__, &LOG_OCCURRENCES, sizeof(int), ""));                \
-  GLOG_IFDEF_THREAD_SANITIZER(AnnotateBenignRaceSized(                        \
-      __FILE__, __LINE__, &LOG_OCCURRENCES_MOD_N, sizeof(int), ""));          \
-  ++LOG_OCCURRENCES;                                                          \
-  if ((condition) &&                                                          \
-      ((LOG_OCCURRENCES_MOD_N = (LOG_OCCURRENCES_MOD_N + 1) % n) == (1 % n))) \
-  google::LogMessage(__FILE__, __LINE__, google::GLOG_##severity,             \
-                     LOG_OCCURRENCES, &what_to_do)                            \
-      .stream()
+#if defined(GLOG_SHARDED_LOG_EVERY_N)
+#  define LOG_OCCURRENCES_PENDING \
+    LOG_EVERY_N_VARNAME(occurrences_pending_, __LINE__)
+#  define LOG_OCCURRENCES_CTR LOG_EVERY_N_VARNAME(occurrences_ctr_, __LINE__)
+
+#  define SOME_KIND_OF_LOG_EVERY_N(severity, n, what_to_do)         \
+    static std::atomic<int> LOG_OCCURRENCES(0);                     \
+    static thread_local int LOG_OCCURRENCES_PENDING = 0;            \
+    int LOG_OCCURRENCES_CTR = 0;                                    \
+    if (google::logging::internal::ShardedEveryN(                   \
+            LOG_OCCURRENCES, LOG_OCCURRENCES_PENDING, n,            \
+            &LOG_OCCURRENCES_CTR))                                  \
+    google::LogMessage(__FILE__, __LINE__, google::GLOG_##severity, \
+                       LOG_OCCURRENCES_CTR, &what_to_do)            \
+        .stream()
 
-#define SOME_KIND_OF_PLOG_EVERY_N(severity, n, what_to_do)              \
-  static std::atomic<int> LOG_OCCURRENCES(0), LOG_OCCURRENCES_MOD_N(0); \
-  GLOG_IFDEF_THREAD_SANITIZER(AnnotateBenignRaceSized(                  \
-      __FILE__, __LINE__, &LOG_OCCURRENCES, sizeof(int), ""));          \
-  GLOG_IFDEF_THREAD_SANITIZER(AnnotateBenignRaceSized(                  \
-      __FILE__, __LINE__, &LOG_OCCURRENCES_MOD_N, sizeof(int), ""));    \
-  ++LOG_OCCURRENCES;                                                    \
-  if (++LOG_OCCURRENCES_MOD_N > n) LOG_OCCURRENCES_MOD_N -= n;          \
-  if (LOG_OCCURRENCES_MOD_N == 1)                                       \
-  google::ErrnoLogMessage(__FILE__, __LINE__, google::GLOG_##severity,  \
-                          LOG_OCCURRENCES, &what_to_do)                 \
-      .stream()
+#  define SOME_KIND_OF_LOG_IF_EVERY_N(severity, condition, n, what_to_do) \
+    static std::atomic<int> LOG_OCCURRENCES(0);                           \
+    static thread_local int LOG_OCCURRENCES_PENDING = 0;                  \
+    int LOG_OCCURRENCES_CTR = 0;                                          \
+    if ((condition) &&                                                    \
+        google::logging::internal::ShardedEveryN(                         \
+            LOG_OCCURRENCES, LOG_OCCURRENCES_PENDING, n,                  \
+            &LOG_OCCURRENCES_CTR))                                        \
+    google::LogMessage(__FILE__, __LINE__, google::GLOG_##severity,       \
+                       LOG_OCCURRENCES_CTR, &what_to_do)                  \
+        .stream()
+
+#  define SOME_KIND_OF_PLOG_EVERY_N(severity, n, what_to_do)             \
+    static std::atomic<int> LOG_OCCURRENCES(0);                          \
+    static thread_local int LOG_OCCURRENCES_PENDING = 0;                 \
+    int LOG_OCCURRENCES_CTR = 0;                                         \
+    if (google::logging::internal::ShardedEveryN(                        \
+            LOG_OCCURRENCES, LOG_OCCURRENCES_PENDING, n,                 \
+            &LOG_OCCURRENCES_CTR))                                       \
+    google::ErrnoLogMessage(__FILE__, __LINE__, google::GLOG_##severity, \
+                            LOG_OCCURRENCES_CTR, &what_to_do)            \
+        .stream()
+#else  // !defined(GLOG_SHARDED_LOG_EVERY_N)
+#  define SOME_KIND_OF_LOG_EVERY_N(severity, n, what_to_do)               \
+    static std::atomic<int> LOG_OCCURRENCES(0), LOG_OCCURRENCES_MOD_N(0); \
+    GLOG_IFDEF_THREAD_SANITIZER(AnnotateBenignRaceSized(                  \
+        __FILE__, __LINE__, &LOG_OCCURRENCES, sizeof(int), ""));          \
+    GLOG_IFDEF_THREAD_SANITIZER(AnnotateBenignRaceSized(                  \
+        __FILE__, __LINE__, &LOG_OCCURRENCES_MOD_N, sizeof(int), ""));    \
+    ++LOG_OCCURRENCES;                                                    \
+    if (++LOG_OCCURRENCES_MOD_N > n) LOG_OCCURRENCES_MOD_N -= n;          \
+    if (LOG_OCCURRENCES_MOD_N == 1)                                       \
+    google::LogMessage(__FILE__, __LINE__, google::GLOG_##severity,       \
+                       LOG_OCCURRENCES, &what_to_do)                      \
+        .stream()
+
+#  define SOME_KIND_OF_LOG_IF_EVERY_N(severity, condition, n, what_to_do) \
+    static std::atomic<int> LOG_OCCURRENCES(0), LOG_OCCURRENCES_MOD_N(0); \
+    GLOG_IFDEF_THREAD_SANITIZER(AnnotateBenignRaceSized(                  \
+        __FILE__, __LINE__, &LOG_OCCURRENCES, sizeof(int), ""));          \
+    GLOG_IFDEF_THREAD_SANITIZER(AnnotateBenignRaceSized(                  \
+        __FILE__, __LINE__, &LOG_OCCURRENCES_MOD_N, sizeof(int), ""));    \
+    ++LOG_OCCURRENCES;                                                    \
+    if ((condition) &&                                                    \
+        ((LOG_OCCURRENCES_MOD_N = (LOG_OCCURRENCES_MOD_N + 1) % n) ==     \
+         (1 % n)))                                                        \
+    google::LogMessage(__FILE__, __LINE__, google::GLOG_##severity,       \
+                       LOG_OCCURRENCES, &what_to_do)                      \
+        .stream()
+
+#  define SOME_KIND_OF_PLOG_EVERY_N(severity, n, what_to_do)              \
+    static std::atomic<int> LOG_OCCURRENCES(0), LOG_OCCURRENCES_MOD_N(0); \
+    GLOG_IFDEF_THREAD_SANITIZER(AnnotateBenignRaceSized(                  \
+        __FILE__, __LINE__, &LOG_OCCURRENCES, sizeof(int), ""));          \
+    GLOG_IFDEF_THREAD_SANITIZER(AnnotateBenignRaceSized(                  \
+        __FILE__, __LINE__, &LOG_OCCURRENCES_MOD_N, sizeof(int), ""));    \
+    ++LOG_OCCURRENCES;                                                    \
+    if (++LOG_OCCURRENCES_MOD_N > n) LOG_OCCURRENCES_MOD_N -= n;          \
+    if (LOG_OCCURRENCES_MOD_N == 1)                                       \
+    google::ErrnoLogMessage(__FILE__, __LINE__, google::GLOG_##severity,  \
+                            LOG_OCCURRENCES, &what_to_do)                 \
+        .stream()
+#endif  // defined(GLOG_SHARDED_LOG_EVERY_N)
 
 #define SOME_KIND_OF_LOG_FIRST_N(severity, n, what_to_do)         \
   static std::atomic<int> LOG_OCCURRENCES(0);                     \
@@ -988,6 +1245,8 @@ GLOG_INLINE_VARIABLE constexpr Counter_t COUNTER{};
 // to keep using this syntax, we define this macro to do the same thing
 // as COMPACT_GOOGLE_LOG_ERROR.
 #  define COMPACT_GOOGLE_LOG_0 COMPACT_GOOGLE_LOG_ERROR
+#  define GOOGLE_LOG_IS_ON_0 GOOGLE_LOG_IS_ON_ERROR
+#  define GOOGLE_LOG_RECORDED_0 GOOGLE_LOG_RECORDED_ERROR
 #  define SYSLOG_0 SYSLOG_ERROR
 #  define LOG_TO_STRING_0 LOG_TO_STRING_ERROR
 // Needed for LOG_IS_ON(ERROR).
@@ -1001,6 +1260,8 @@ constexpr LogSeverity GLOG_0 = GLOG_ERROR;
 #  define GLOG_ERROR_MSG \
     ERROR_macro_is_defined_Define_GLOG_NO_ABBREVIATED_SEVERITIES_before_including_logging_h_See_the_document_for_detail
 #  define COMPACT_GOOGLE_LOG_0 GLOG_ERROR_MSG
+#  define GOOGLE_LOG_IS_ON_0 GLOG_ERROR_MSG
+#  define GOOGLE_LOG_RECORDED_0 GLOG_ERROR_MSG
 #  define SYSLOG_0 GLOG_ERROR_MSG
 #  define LOG_TO_STRING_0 GLOG_ERROR_MSG
 #  define GLOG_0 GLOG_ERROR_MSG
@@ -1130,7 +1391,30 @@ constexpr LogSeverity GLOG_0 = GLOG_ERROR;
 
 // Log only in verbose mode.
 
-#define VLOG(verboselevel) LOG_IF(INFO, VLOG_IS_ON(verboselevel))
+#if GOOGLE_STRIP_LOG == 0
+// Suppressed VLOG() messages may still be recorded by the flight recorder.
+// VLOG_IS_ON() is expanded and evaluated once, into vlog_mode__: 0 drops the
+// message, 1 logs it and 2 only records it.  The switch binds vlog_mode__
+// without capturing an else which follows the statement.
+#  define VLOG(verboselevel)                                                \
+    switch (const int vlog_mode__ =                                         \
+                VLOG_IS_ON(verboselevel) && GOOGLE_LOG_IS_ON_INFO ? 1       \
+                : GOOGLE_LOG_IS_RECORDED(verboselevel)            ? 2       \
+                                                                  : 0)      \
+    case 0:                                                                 \
+    default:                                                                \
+      vlog_mode__ == 0                                                      \
+          ? (void)0                                                         \
+          : google::logging::internal::LogMessageVoidify() &                \
+                google::LogMessage(                                         \
+                    __FILE__, __LINE__, google::GLOG_INFO, 0,               \
+                    vlog_mode__ == 1                                        \
+                        ? &google::LogMessage::SendToLog                    \
+                        : &google::LogMessage::SendToFlightRecorder)        \
+                    .stream()
+#else
+#  define VLOG(verboselevel) LOG_IF(INFO, VLOG_IS_ON(verboselevel))
+#endif
 
 #define VLOG_IF(verboselevel, condition) \
   LOG_IF(INFO, (condition) && VLOG_IS_ON(verboselevel))
@@ -1141,25 +1425,71 @@ constexpr LogSeverity GLOG_0 = GLOG_ERROR;
 #define VLOG_IF_EVERY_N(verboselevel, condition, n) \
   LOG_IF_EVERY_N(INFO, (condition) && VLOG_IS_ON(verboselevel), n)
 
-namespace base_logging {
-
-// LogMessage::LogStream is a std::ostream backed by this streambuf.
-// This class ignores overflow and leaves two bytes at the end of the
-// buffer to allow for a '\n' and '\0'.
-class GLOG_EXPORT LogStreamBuf : public std::streambuf {
+// A typed key/value field of a log message, attached with
+// LogMessage::LogStream::With().  The key and string values of the fields of
+// a log message are NUL-terminated and valid until the message is sent.
+class GLOG_EXPORT LogField {
  public:
-  // REQUIREMENTS: "len" must be >= 2 to account for the '\n' and '\0'.
-  LogStreamBuf(char* buf, int len) { setp(buf, buf + len - 2); }
+  enum Type { kBool, kInt, kUInt, kDouble, kString };
 
-  // This effectively ignores overflow.
-  int_type overflow(int_type ch) { return ch; }
+  LogField() noexcept : LogField("", false) {}
+  LogField(const char* key, bool value) noexcept : key_(key), type_(kBool) {
+    value_.bool_value = value;
+  }
+  LogField(const char* key, int64 value) noexcept : key_(key), type_(kInt) {
+    value_.int_value = value;
+  }
+  LogField(const char* key, uint64 value) noexcept : key_(key), type_(kUInt) {
+    value_.uint_value = value;
+  }
+  LogField(const char* key, double value) noexcept
+      : key_(key), type_(kDouble) {
+    value_.double_value = value;
+  }
+  LogField(const char* key, const char* value, size_t size) noexcept
+      : key_(key), type_(kString), string_size_(size) {
+    value_.string_value = value;
+  }
 
-  // Legacy public ostrstream method.
-  size_t pcount() const { return static_cast<size_t>(pptr() - pbase()); }
-  char* pbase() const { return std::streambuf::pbase(); }
+  const char* key() const noexcept { return key_; }
+  Type type() const noexcept { return type_; }
+  bool bool_value() const noexcept { return value_.bool_value; }
+  int64 int_value() const noexcept { return value_.int_value; }
+  uint64 uint_value() const noexcept { return value_.uint_value; }
+  double double_value() const noexcept { return value_.double_value; }
+  const char* string_value() const noexcept { return value_.string_value; }
+  size_t string_size() const noexcept { return string_size_; }
+
+ private:
+  const char* key_;
+  Type type_;
+  union {
+    bool bool_value;
+    int64 int_value;
+    uint64 uint_value;
+    double double_value;
+    const char* string_value;
+  } value_;
+  size_t string_size_{0};
 };
 
-}  // namespace base_logging
+// The fields of a log message, in the order they were attached.
+class GLOG_EXPORT LogFields {
+ public:
+  LogFields() noexcept = default;
+  LogFields(const LogField* fields, size_t size) noexcept
+      : fields_(fields), size_(size) {}
+
+  const LogField* begin() const noexcept { return fields_; }
+  const LogField* end() const noexcept { return fields_ + size_; }
+  size_t size() const noexcept { return size_; }
+  bool empty() const noexcept { return size_ == 0; }
+  const LogField& operator[](size_t i) const noexcept { return fields_[i]; }
+
+ private:
+  const LogField* fields_{nullptr};
+  size_t size_{0};
+};
 
 namespace logging {
 namespace internal {
@@ -1226,6 +1556,24 @@ class GLOG_EXPORT LogMessage {
     void set_ctr(int64 ctr) { ctr_ = ctr; }
     LogStream* self() const { return self_; }
 
+    // Attaches the field "key" with "value" to the log message as a typed
+    // LogField rather than as text, e.g.
+    //
+    //   LOG(INFO).With("user", id).With("latency_us", t) << "served";
+    //
+    // Booleans, integers, floating-point numbers and strings keep their
+    // types; other values are formatted with operator<< into strings.  The
+    // key and string values are copied.  A message has room for 16 fields
+    // and 1024 bytes of keys and string values; fields beyond are dropped
+    // and long strings truncated.  Does nothing for suppressed messages.
+    template <typename T>
+    LogStream& With(const char* key, const T& value) {
+      if (logging::internal::LogMessageData* data = message_data()) {
+        WithValue(data, key, value);
+      }
+      return *this;
+    }
+
     // Legacy std::streambuf methods.
     size_t pcount() const { return streambuf_.pcount(); }
     char* pbase() const { return streambuf_.pbase(); }
@@ -1235,6 +1583,71 @@ class GLOG_EXPORT LogMessage {
     LogStream& operator=(const LogStream&) = delete;
 
    private:
+    static void WithValue(logging::internal::LogMessageData* data,
+                          const char* key, bool value) {
+      AddField(data, LogField(key, value));
+    }
+    template <typename T,
+              std::enable_if_t<std::is_integral<T>::value &&
+                                   std::is_signed<T>::value &&
+                                   !std::is_same<T, char>::value,
+                               int> = 0>
+    static void WithValue(logging::internal::LogMessageData* data,
+                          const char* key, T value) {
+      AddField(data, LogField(key, static_cast<int64>(value)));
+    }
+    template <typename T,
+              std::enable_if_t<std::is_integral<T>::value &&
+                                   std::is_unsigned<T>::value &&
+                                   !std::is_same<T, bool>::value &&
+                                   !std::is_same<T, char>::value,
+                               int> = 0>
+    static void WithValue(logging::internal::LogMessageData* data,
+                          const char* key, T value) {
+      AddField(data, LogField(key, static_cast<uint64>(value)));
+    }
+    template <typename T,
+              std::enable_if_t<std::is_floating_point<T>::value, int> = 0>
+    static void WithValue(logging::internal::LogMessageData* data,
+                          const char* key, T value) {
+      AddField(data, LogField(key, static_cast<double>(value)));
+    }
+    static void WithValue(logging::internal::LogMessageData* data,
+                          const char* key, const char* value) {
+      if (value == nullptr) {
+        value = "(null)";
+      }
+      AddField(data, LogField(key, value, std::strlen(value)));
+    }
+    static void WithValue(logging::internal::LogMessageData* data,
+                          const char* key, const std::string& value) {
+      AddField(data, LogField(key, value.data(), value.size()));
+    }
+    template <typename T,
+              std::enable_if_t<!std::is_arithmetic<T>::value &&
+                                   !std::is_convertible<T, const char*>::value,
+                               int> = 0>
+    static void WithValue(logging::internal::LogMessageData* data,
+                          const char* key, const T& value) {
+      char buf[256];
+      base_logging::LogStreamBuf streambuf(buf, sizeof(buf));
+      std::ostream stream(&streambuf);
+      stream << value;
+      AddField(data, LogField(key, buf, streambuf.pcount()));
+    }
+    template <typename T,
+              std::enable_if_t<std::is_same<T, char>::value, int> = 0>
+    static void WithValue(logging::internal::LogMessageData* data,
+                          const char* key, T value) {
+      AddField(data, LogField(key, &value, 1));
+    }
+
+    // Returns the log message this stream belongs to, if any.
+    logging::internal::LogMessageData* message_data();
+    // Copies "field" into the fields of the log message "data".
+    static void AddField(logging::internal::LogMessageData* data,
+                         const LogField& field);
+
     base_logging::LogStreamBuf streambuf_;
     int64 ctr_;        // Counter hack (for the LOG_EVERY_X() macro)
     LogStream* self_;  // Consistency check hack
@@ -1285,6 +1698,8 @@ class GLOG_EXPORT LogMessage {
   // A special constructor used for check failures
   LogMessage(const char* file, int line,
              const logging::internal::CheckOpString& result);
+  LogMessage(const char* file, int line,
+             const logging::internal::CheckOpMessage& result);
 
   ~LogMessage() noexcept(false);
 
@@ -1301,11 +1716,12 @@ class GLOG_EXPORT LogMessage {
   // only passed as SendMethod arguments to other LogMessage methods:
   void SendToLog();           // Actually dispatch to the logs
   void SendToSyslogAndLog();  // Actually dispatch to syslog and the logs
+  void SendToFlightRecorder();  // Only record in the flight recorder
 
   // Call abort() or similar to perform LOG(FATAL) crash.
   [[noreturn]] static void Fail();
 
-  std::ostream& stream();
+  LogStream& stream();
 
   int preserved_errno() const;
 
@@ -1319,6 +1735,17 @@ class GLOG_EXPORT LogMessage {
   const char* basename() const noexcept;
   const LogMessageTime& time() const noexcept;
 
+  // The fields attached with LogStream::With().
+  LogFields fields() const noexcept;
+  // While the message is sent: the message alone, without the log prefix and
+  // the fields.
+  const char* message_text() const noexcept;
+  size_t message_text_size() const noexcept;
+  // While the message is sent: the message in the text format, i.e. the log
+  // prefix, the message, the fields as " key=value" and '\n'.
+  const char* formatted_text() const noexcept;
+  size_t formatted_text_size() const noexcept;
+
   LogMessage(const LogMessage&) = delete;
   LogMessage& operator=(const LogMessage&) = delete;
 
@@ -1358,6 +1785,8 @@ class GLOG_EXPORT LogMessageFatal : public LogMessage {
   LogMessageFatal(const char* file, int line);
   LogMessageFatal(const char* file, int line,
                   const logging::internal::CheckOpString& result);
+  LogMessageFatal(const char* file, int line,
+                  const logging::internal::CheckOpMessage& result);
   [[noreturn]] ~LogMessageFatal() noexcept(false);
 };
 
@@ -1411,7 +1840,7 @@ namespace internal {
 template <typename T>
 T CheckNotNull(const char* file, int line, const char* names, T&& t) {
   if (t == nullptr) {
-    LogMessageFatal(file, line, std::make_unique<std::string>(names));
+    LogMessageFatal(file, line, logging::internal::CheckOpMessage(names));
   }
   return std::forward<T>(t);
 }
@@ -1483,6 +1912,14 @@ class GLOG_EXPORT LogSink {
   // See our unittest for an example.
   virtual void WaitTillSent();
 
+  // Like send(), with the typed fields attached to the message with
+  // LogMessage::LogStream::With().  This is the method the library calls;
+  // by default it calls send(), which gets the message without the fields.
+  virtual void SendWithFields(LogSeverity severity, const char* full_filename,
+                              const char* base_filename, int line,
+                              const LogMessageTime& time, const char* message,
+                              size_t message_len, const LogFields& fields);
+
   // Returns the normal text output of the log message.
   // Can be useful to implement send().
   static std::string ToString(LogSeverity severity, const char* file, int line,
@@ -1494,6 +1931,157 @@ class GLOG_EXPORT LogSink {
 GLOG_EXPORT void AddLogSink(LogSink* destination);
 GLOG_EXPORT void RemoveLogSink(LogSink* destination);
 
+// Encodes log messages and their fields for a log destination; see
+// SetLogEncoder().
+class GLOG_EXPORT LogEncoder {
+ public:
+  virtual ~LogEncoder();
+
+  // Writes the encoding of "message", ending with '\n', into "buf" of "size"
+  // bytes and returns its length.  The encoding is truncated to fit.  This
+  // method is called with the logging mutex held, and must neither log nor
+  // allocate memory.
+  virtual size_t Encode(const LogMessage& message, char* buf,
+                        size_t size) const = 0;
+};
+
+// The built-in encoders: the text format of the log files, with the fields
+// appended as " key=value"; JSON lines, with the time, severity, file, line,
+// thread, message and fields as members of an object; and logfmt, with the
+// same keys and the fields as key=value pairs.
+GLOG_EXPORT const LogEncoder& TextLogEncoder();
+GLOG_EXPORT const LogEncoder& JsonLogEncoder();
+GLOG_EXPORT const LogEncoder& LogfmtLogEncoder();
+
+// Encode the messages written to the log file of a particular severity, or to
+// stderr (and stdout with --logtostdout), with "encoder".  The text format is
+// used by default, or if "encoder" is nullptr.  The encoder must outlive its
+// use.  Thread-safe.
+GLOG_EXPORT void SetLogEncoder(LogSeverity severity, const LogEncoder* encoder);
+GLOG_EXPORT void SetStderrLogEncoder(const LogEncoder* encoder);
+
+class SystemLogSender;
+
+// Sends the messages to the systemd journal using its native protocol, as
+// datagrams to the journal socket at "socket_path".  The severity, the source
+// file and line, the thread and the program name are sent as the journal
+// fields PRIORITY, CODE_FILE, CODE_LINE, TID and SYSLOG_IDENTIFIER, and the
+// fields of structured messages with their keys in upper case.
+//
+// Messages up to --logbuflevel are batched like the log files buffer them:
+// the batch is sent once it is full, once a message of a higher severity is
+// logged, once --logbufsecs passed, on Flush() or on FlushLogFiles().  The
+// socket is never waited for: messages are dropped if the journal does not
+// keep up or the socket cannot be written, and where Unix domain sockets are
+// not available.  --logtojournald sends all messages to the journal.
+class GLOG_EXPORT JournaldLogSink : public LogSink {
+ public:
+  explicit JournaldLogSink(
+      const char* socket_path = "/run/systemd/journal/socket");
+  ~JournaldLogSink() override;
+
+  void send(LogSeverity severity, const char* full_filename,
+            const char* base_filename, int line, const LogMessageTime& time,
+            const char* message, size_t message_len) override;
+  void SendWithFields(LogSeverity severity, const char* full_filename,
+                      const char* base_filename, int line,
+                      const LogMessageTime& time, const char* message,
+                      size_t message_len, const LogFields& fields) override;
+
+  // Sends the batched messages.
+  void Flush();
+
+  // The number of messages dropped so far.
+  uint64 dropped() const;
+
+ private:
+  std::unique_ptr<SystemLogSender> sender_;
+};
+
+// Sends the messages in the syslog protocol of RFC 5424, as datagrams to the
+// Unix domain socket at "socket_path" with the given syslog facility (1 for
+// user-level messages).  The source file and line, the thread, the severity
+// and the fields of structured messages are sent as the parameters of the
+// structured data element "glog@11129".  Messages are batched and dropped as
+// by JournaldLogSink.  --logtosyslog sends all messages to syslog.
+class GLOG_EXPORT SyslogLogSink : public LogSink {
+ public:
+  explicit SyslogLogSink(const char* socket_path = "/dev/log",
+                         int facility = 1);
+  ~SyslogLogSink() override;
+
+  void send(LogSeverity severity, const char* full_filename,
+            const char* base_filename, int line, const LogMessageTime& time,
+            const char* message, size_t message_len) override;
+  void SendWithFields(LogSeverity severity, const char* full_filename,
+                      const char* base_filename, int line,
+                      const LogMessageTime& time, const char* message,
+                      size_t message_len, const LogFields& fields) override;
+
+  // Sends the batched messages.
+  void Flush();
+
+  // The number of messages dropped so far.
+  uint64 dropped() const;
+
+ private:
+  std::unique_ptr<SystemLogSender> sender_;
+  int facility_;
+  std::string hostname_;
+};
+
+class StreamSender;
+
+// Streams the messages to a log shipper over a TCP connection to "address"
+// given as "host:port", or over the Unix domain stream socket "unix:path".
+// Each message is a record preceded by its size as a 32-bit big-endian
+// integer.  Text records hold the message as written to the log files.
+// Binary records hold, all integers big-endian:
+//
+//   uint8   severity
+//   int64   time in microseconds since the epoch
+//   uint32  line
+//   uint16  size of the file name, followed by the base file name
+//   uint32  size of the message, followed by the message
+//   uint16  number of fields, followed by each field as
+//           uint16 size of the key, the key,
+//           uint32 size of the value, the value in text
+//
+// Messages are appended to a buffer of "buffer_bytes", which a background
+// thread sends in batches; messages which do not fit are dropped and
+// counted.  While the peer is unavailable, the thread reconnects with
+// exponential backoff and, given a "spill_file", moves the buffered messages
+// there (up to --max_log_size), to send them first once it is connected
+// again.  Messages may be sent twice when a connection breaks.
+class GLOG_EXPORT StreamLogSink : public LogSink {
+ public:
+  enum Format { kText, kBinary };
+
+  explicit StreamLogSink(const char* address, Format format = kText,
+                         size_t buffer_bytes = 1024 * 1024,
+                         const char* spill_file = nullptr);
+  ~StreamLogSink() override;
+
+  void send(LogSeverity severity, const char* full_filename,
+            const char* base_filename, int line, const LogMessageTime& time,
+            const char* message, size_t message_len) override;
+  void SendWithFields(LogSeverity severity, const char* full_filename,
+                      const char* base_filename, int line,
+                      const LogMessageTime& time, const char* message,
+                      size_t message_len, const LogFields& fields) override;
+
+  // Waits, for at most 10 seconds, until the buffered messages are sent or
+  // spilled.  Returns whether they are.
+  bool Flush();
+
+  // The number of messages dropped so far.
+  uint64 dropped() const;
+
+ private:
+  std::unique_ptr<StreamSender> sender_;
+  Format format_;
+};
+
 //
 // Specify an "extension" added to the filename specified via
 // SetLogDestination.  This applies to all severity levels.  It's
@@ -1613,6 +2201,8 @@ class GLOG_EXPORT NullStream : public LogMessage::LogStream {
   NullStream();
   NullStream(const char* /*file*/, int /*line*/,
              const logging::internal::CheckOpString& /*result*/);
+  NullStream(const char* /*file*/, int /*line*/,
+             const logging::internal::CheckOpMessage& /*result*/);
   NullStream& stream();
 
  private:
@@ -1633,6 +2223,13 @@ inline NullStream& operator<<(NullStream& str, const T&) {
   return str;
 }
 
+namespace logging {
+namespace internal {
+// Returns the per-thread stream that LOG() writes suppressed messages to.
+GLOG_EXPORT NullStream& SuppressedLogStream();
+}  // namespace internal
+}  // namespace logging
+
 // Similar to NullStream, but aborts the program (without stack
 // trace), like LogMessageFatal.
 class GLOG_EXPORT NullStreamFatal : public NullStream {
@@ -1657,8 +2254,10 @@ class GLOG_EXPORT NullStreamFatal : public NullStream {
 //
 // The function should be called before threads are created, if you want
 // to use the failure signal handler for all threads.  The stack trace
-// will be shown only for the thread that receives the signal.  In other
-// words, stack traces of other threads won't be shown.
+// will be shown only for the thread that receives the signal, unless
+// --dump_all_threads_on_failure is set on Linux, which reserves the real-time
+// signal SIGRTMAX - 1 to have the other threads take their stack traces (see
+// DumpAllThreadStacks()).
 GLOG_EXPORT void InstallFailureSignalHandler();
 
 // Returns true if FailureSignalHandler is installed.
@@ -1671,6 +2270,47 @@ GLOG_EXPORT bool IsFailureSignalHandlerInstalled();
 GLOG_EXPORT void InstallFailureWriter(void (*writer)(const char* data,
                                                      size_t size));
 
+// Dumps the stack traces of all threads with "writer", or with the failure
+// writer if it is nullptr, and lets the program continue.  The stack traces of
+// the other threads are taken as with --dump_all_threads_on_failure, and only
+// on Linux; elsewhere only the stack trace of the calling thread is dumped.
+// This, like the functions below, reserves the real-time signal SIGRTMAX - 1,
+// whose handler the first dump installs.  If the program handles or ignores
+// that signal itself, the stack traces of other threads are not dumped.
+GLOG_EXPORT void DumpAllThreadStacks(void (*writer)(const char* data,
+                                                    size_t size) = nullptr);
+
+// Dumps the messages kept by the flight recorder (see --flight_recorder_bytes)
+// with "writer", or with the failure writer if it is nullptr.  Each thread's
+// messages are dumped oldest first.  Async-signal-safe.  The failure signal
+// handler and LOG(FATAL) dump them as well.
+GLOG_EXPORT void DumpFlightRecorder(void (*writer)(const char* data,
+                                                   size_t size) = nullptr);
+
+// Installs a handler for "signal_number", typically SIGQUIT, that dumps the
+// stack traces of all threads with the failure writer as
+// DumpAllThreadStacks() does, without terminating the program.
+GLOG_EXPORT void InstallStackDumpSignalHandler(int signal_number);
+
+// Takes "num_samples" samples of the stack traces of all other threads,
+// "interval" apart, and dumps each distinct stack trace once with the number
+// of samples it appeared in, most frequent first.  Blocks the calling thread
+// until all samples are taken.  Only supported on Linux.
+GLOG_EXPORT void SampleAllThreadStacks(
+    int num_samples, std::chrono::milliseconds interval,
+    void (*writer)(const char* data, size_t size) = nullptr);
+
+// Starts sampling the stack traces of all other threads every "interval" in a
+// background thread, until StopThreadStackSampling().  Returns false if
+// sampling has been started already, or is not supported.
+GLOG_EXPORT bool StartThreadStackSampling(std::chrono::milliseconds interval);
+
+// Stops the sampling started by StartThreadStackSampling(), and dumps the
+// samples taken as SampleAllThreadStacks() does, with "writer" or with the
+// failure writer if it is nullptr.  Does nothing if sampling is not running.
+GLOG_EXPORT void StopThreadStackSampling(
+    void (*writer)(const char* data, size_t size) = nullptr);
+
 // Dump stack trace as a string.
 GLOG_EXPORT std::string GetStackTrace();
 
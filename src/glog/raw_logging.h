@@ -44,7 +44,12 @@
 #  error <glog/raw_logging.h> was not included correctly. See the documentation for how to consume the library.
 #endif
 
+#include <cstddef>
+#include <cstdlib>
+#include <type_traits>
+
 #include "glog/log_severity.h"
+#include "glog/types.h"
 #include "glog/vlog_is_on.h"
 
 namespace google {
@@ -57,6 +62,8 @@ namespace google {
 // * it logs straight and ONLY to STDERR w/o buffering
 // * it uses an explicit format and arguments list
 // * it will silently chop off really long message strings
+// * it formats the message without std::vsnprintf, unless format uses
+//   conversions that RAW_LOG_TYPED below does not support
 // Usage example:
 //   RAW_LOG(ERROR, "Failed foo with %i: %s", status, error);
 //   RAW_VLOG(3, "status is %i", status);
@@ -128,6 +135,40 @@ namespace google {
     } while (0)
 #endif  // STRIP_LOG <= 3
 
+#if !defined(STRIP_LOG)
+#  define GLOG_RAW_STRIP_LOG 0
+#else
+#  define GLOG_RAW_STRIP_LOG STRIP_LOG
+#endif
+
+// Same as RAW_LOG and RAW_VLOG, but the arguments keep their types instead of
+// being passed through "...": a conversion cannot read an argument as another
+// type, and the types the formatter does not support, such as floating-point
+// numbers, do not compile.  The format supports the conversions %d, %i, %u,
+// %x, %X, %c, %s and %p with the flags '-', '+', ' ', '#' and '0', a width, a
+// precision and the length modifiers hh, h, l, ll, j, z and t, which are
+// ignored since the argument types are known.  The message is formatted
+// without std::vsnprintf, so its cost is bounded, and without allocating
+// memory or acquiring locks, so that it can be used by signal handlers.
+// Usage example:
+//   RAW_LOG_TYPED(ERROR, "Failed foo with %d: %s", status, error);
+#define RAW_LOG_TYPED(severity, ...)                                       \
+  do {                                                                     \
+    if (google::GLOG_##severity >= GLOG_RAW_STRIP_LOG) {                   \
+      google::RawLogTyped__(google::GLOG_##severity, __FILE__, __LINE__,   \
+                            __VA_ARGS__);                                  \
+    } else if (google::GLOG_##severity == google::GLOG_FATAL) {            \
+      exit(EXIT_FAILURE);                                                  \
+    }                                                                      \
+  } while (0)
+
+#define RAW_VLOG_TYPED(verboselevel, ...) \
+  do {                                    \
+    if (VLOG_IS_ON(verboselevel)) {       \
+      RAW_LOG_TYPED(INFO, __VA_ARGS__);   \
+    }                                     \
+  } while (0)
+
 // Similar to CHECK(condition) << message,
 // but for low-level modules: we use only RAW_LOG that does not allocate memory.
 // We do not want to provide args list here to encourage this usage:
@@ -171,6 +212,76 @@ GLOG_EXPORT void RawLog__(LogSeverity severity, const char* file, int line,
 #  endif
 #endif
     ;
+
+namespace logging {
+namespace internal {
+
+// An argument of RAW_LOG_TYPED, which remembers its type and size.
+class RawLogArg {
+ public:
+  enum Type { kSigned, kUnsigned, kChar, kString, kPointer };
+
+  template <class T, std::enable_if_t<std::is_integral<T>::value &&
+                                      std::is_signed<T>::value>* = nullptr>
+  constexpr RawLogArg(T value) noexcept  // NOLINT(google-explicit-constructor)
+      : type_{kSigned}, size_{sizeof(T)}, signed_{value} {}
+  template <class T, std::enable_if_t<std::is_integral<T>::value &&
+                                      std::is_unsigned<T>::value>* = nullptr>
+  constexpr RawLogArg(T value) noexcept  // NOLINT(google-explicit-constructor)
+      : type_{kUnsigned}, size_{sizeof(T)}, unsigned_{value} {}
+  template <class T, std::enable_if_t<std::is_enum<T>::value>* = nullptr>
+  constexpr RawLogArg(T value) noexcept  // NOLINT(google-explicit-constructor)
+      : RawLogArg{static_cast<std::underlying_type_t<T>>(value)} {}
+  template <class T,
+            std::enable_if_t<std::is_floating_point<T>::value>* = nullptr>
+  RawLogArg(T value) = delete;  // Not supported by the formatter.
+  constexpr RawLogArg(char value) noexcept  // NOLINT
+      : type_{kChar}, size_{sizeof(char)}, signed_{value} {}
+  constexpr RawLogArg(const char* value) noexcept  // NOLINT
+      : type_{kString}, size_{sizeof(value)}, string_{value} {}
+  constexpr RawLogArg(const void* value) noexcept  // NOLINT
+      : type_{kPointer}, size_{sizeof(value)}, pointer_{value} {}
+  constexpr RawLogArg(std::nullptr_t) noexcept  // NOLINT
+      : RawLogArg{static_cast<const void*>(nullptr)} {}
+
+  Type type() const noexcept { return type_; }
+  // The size of the argument, in bytes.
+  std::size_t size() const noexcept { return size_; }
+  int64 signed_value() const noexcept { return signed_; }
+  uint64 unsigned_value() const noexcept { return unsigned_; }
+  const char* string_value() const noexcept { return string_; }
+  const void* pointer_value() const noexcept { return pointer_; }
+
+ private:
+  Type type_;
+  std::size_t size_;
+  union {
+    int64 signed_;
+    uint64 unsigned_;
+    const char* string_;
+    const void* pointer_;
+  };
+};
+
+}  // namespace internal
+}  // namespace logging
+
+// Helper function to implement RAW_LOG_TYPED: logs format, with the
+// num_args arguments in args, at "severity" level, reporting it as called
+// from file:line.
+// This does not allocate memory or acquire locks.
+GLOG_EXPORT void RawLogArgs__(LogSeverity severity, const char* file, int line,
+                              const char* format,
+                              const logging::internal::RawLogArg* args,
+                              std::size_t num_args);
+
+template <class... Args>
+inline void RawLogTyped__(LogSeverity severity, const char* file, int line,
+                          const char* format, const Args&... args) {
+  // Terminated by an unused argument since arrays cannot be empty.
+  const logging::internal::RawLogArg list[] = {args..., nullptr};
+  RawLogArgs__(severity, file, line, format, list, sizeof...(Args));
+}
 }  // namespace google
 
 #endif  // GLOG_RAW_LOGGING_H
@@ -39,16 +39,33 @@
 #ifndef GLOG_STL_LOGGING_H
 #define GLOG_STL_LOGGING_H
 
+#include <algorithm>
+#include <cstddef>
 #include <deque>
+#include <ios>
+#include <iterator>
 #include <list>
+#include <locale>
 #include <map>
 #include <ostream>
 #include <set>
+#include <type_traits>
 #include <unordered_map>
 #include <unordered_set>
 #include <utility>
 #include <vector>
 
+#if defined(__has_include)
+#  if (__cplusplus >= 201703L || \
+       (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)) && \
+      __has_include(<charconv>)
+#    include <charconv>
+#    define GLOG_STL_LOGGING_HAVE_TO_CHARS
+#  endif
+#endif
+
+#include "glog/logging.h"
+
 // Forward declare these two, and define them after all the container streams
 // operators so that we can recurse from pair -> container -> container -> pair
 // properly.
@@ -69,7 +86,22 @@ void PrintSequence(std::ostream& out, Iter begin, Iter end);
     return out;                                                  \
   }
 
-OUTPUT_TWO_ARG_CONTAINER(std::vector)
+// Vectors are printed from their data() so that vectors of numbers take the
+// fast path of PrintSequence.
+template <class T1, class T2>
+inline std::ostream& operator<<(std::ostream& out,
+                                const std::vector<T1, T2>& seq) {
+  google::PrintSequence(out, seq.data(), seq.data() + seq.size());
+  return out;
+}
+
+template <class T>
+inline std::ostream& operator<<(std::ostream& out,
+                                const std::vector<bool, T>& seq) {
+  google::PrintSequence(out, seq.begin(), seq.end());
+  return out;
+}
+
 OUTPUT_TWO_ARG_CONTAINER(std::deque)
 OUTPUT_TWO_ARG_CONTAINER(std::list)
 #undef OUTPUT_TWO_ARG_CONTAINER
@@ -123,16 +155,280 @@ inline std::ostream& operator<<(std::ostream& out,
 
 namespace google {
 
+namespace logging {
+namespace internal {
+
+// The budget of the elements and bytes of a container printed by
+// PrintSequence(), shared with the containers nested into it through the
+// pword() of the stream, so that --stl_logging_max_elements and
+// --stl_logging_max_bytes bound the whole output rather than each nested
+// container.  On a log message, the budget is shared by all the containers of
+// the statement.  Otherwise, the outermost PrintSequence() owns it.
+class SequenceBudget {
+ public:
+  explicit SequenceBudget(std::ostream& out) : out_(out) {
+    void*& shared = out.pword(SequenceBudgetIndex());
+    if (shared == nullptr) {
+      shared = MessageSequenceBudget(out);
+    }
+    if (shared == nullptr) {
+      shared = &own_;
+      owner_ = true;
+    }
+    state_ = static_cast<SequenceBudgetState*>(shared);
+    if (state_->started) {
+      return;
+    }
+    state_->started = true;
+    state_->elements_left = FLAGS_stl_logging_max_elements;
+    if (FLAGS_stl_logging_max_bytes > 0) {
+      // Streams which cannot report their position are not bounded in bytes.
+      const std::streamoff start = out.tellp();
+      if (start >= 0) {
+        state_->bytes_end = start + FLAGS_stl_logging_max_bytes;
+      }
+    }
+  }
+  ~SequenceBudget() {
+    if (owner_) {
+      out_.pword(SequenceBudgetIndex()) = nullptr;
+    }
+  }
+  SequenceBudget(const SequenceBudget&) = delete;
+  SequenceBudget& operator=(const SequenceBudget&) = delete;
+
+  size_t ElementsLeft() const { return state_->elements_left; }
+
+  // Takes up to count elements from the budget and returns how many were
+  // granted.
+  size_t TakeElements(size_t count) {
+    if (count > state_->elements_left) {
+      count = state_->elements_left;
+    }
+    state_->elements_left -= count;
+    return count;
+  }
+
+  // Returns the number of bytes which may still be written, or -1 if the
+  // output is not bounded in bytes.
+  std::streamoff BytesLeft() const {
+    if (state_->bytes_end < 0) return -1;
+    const std::streamoff position = out_.tellp();
+    if (position < 0) return -1;
+    return position < state_->bytes_end ? state_->bytes_end - position : 0;
+  }
+
+ private:
+  std::ostream& out_;
+  SequenceBudgetState* state_;
+  SequenceBudgetState own_;
+  bool owner_{false};
+};
+
+template <class T>
+struct IsCharacter
+    : std::integral_constant<
+          bool, std::is_same<T, char>::value ||
+                    std::is_same<T, signed char>::value ||
+                    std::is_same<T, unsigned char>::value ||
+                    std::is_same<T, wchar_t>::value ||
+                    std::is_same<T, char16_t>::value ||
+#if defined(__cpp_char8_t)
+                    std::is_same<T, char8_t>::value ||
+#endif
+                    std::is_same<T, char32_t>::value> {
+};
+
+// Numbers in contiguous storage are formatted in bulk into a local buffer
+// instead of being streamed one by one.  Floating point numbers need
+// std::to_chars() to be formatted exactly like operator<<.
+template <class T>
+struct IsFormattedInBulk
+    : std::integral_constant<
+          bool, (std::is_integral<T>::value && !std::is_same<T, bool>::value &&
+                 !IsCharacter<T>::value)
+#if defined(__cpp_lib_to_chars)
+                    || std::is_floating_point<T>::value
+#endif
+          > {
+};
+
+// Longest text of a number formatted in bulk, and the largest precision for
+// which floating point numbers are formatted in bulk.
+constexpr size_t kMaxBulkPrecision = 40;
+constexpr size_t kMaxBulkNumberSize = kMaxBulkPrecision + 16;
+
+template <class T>
+constexpr bool IsNegative(T value, std::true_type /*is_signed*/) {
+  return value < 0;
+}
+template <class T>
+constexpr bool IsNegative(T /*value*/, std::false_type /*is_signed*/) {
+  return false;
+}
+
+template <class T>
+inline char* FormatInBulk(char* buffer, char* end, T value,
+                          std::true_type /*is_integral*/,
+                          const std::ostream& /*out*/) {
+#if defined(GLOG_STL_LOGGING_HAVE_TO_CHARS)
+  return std::to_chars(buffer, end, value).ptr;
+#else
+  (void)end;
+  using Unsigned = std::make_unsigned_t<T>;
+  auto magnitude = static_cast<Unsigned>(value);
+  if (IsNegative(value, std::is_signed<T>{})) {
+    *buffer++ = '-';
+    magnitude = static_cast<Unsigned>(Unsigned{0} - magnitude);
+  }
+  char digits[3 * sizeof(T)];
+  char* digit = digits;
+  do {
+    *digit++ = static_cast<char>('0' + magnitude % 10);
+    magnitude = static_cast<Unsigned>(magnitude / 10);
+  } while (magnitude != 0);
+  while (digit != digits) {
+    *buffer++ = *--digit;
+  }
+  return buffer;
+#endif
+}
+
+#if defined(__cpp_lib_to_chars)
+template <class T>
+inline char* FormatInBulk(char* buffer, char* end, T value,
+                          std::false_type /*is_integral*/,
+                          const std::ostream& out) {
+  // The default floatfield of a stream formats like %g.
+  return std::to_chars(buffer, end, value, std::chars_format::general,
+                       static_cast<int>(out.precision()))
+      .ptr;
+}
+#endif
+
+// Whether the stream prints numbers like a default constructed one.
+inline bool HasDefaultNumberFormat(const std::ostream& out) {
+  return out.flags() == (std::ios_base::dec | std::ios_base::skipws) &&
+         out.width() == 0 &&
+         static_cast<size_t>(out.precision()) <= kMaxBulkPrecision &&
+         out.getloc() == std::locale::classic();
+}
+
 template <class Iter>
-inline void PrintSequence(std::ostream& out, Iter begin, Iter end) {
-  // Output at most 100 elements -- appropriate if used for logging.
-  for (int i = 0; begin != end && i < 100; ++i, ++begin) {
-    if (i > 0) out << ' ';
-    out << *begin;
+inline void PrintEach(std::ostream& out, SequenceBudget& budget, Iter begin,
+                      Iter end) {
+  for (Iter it = begin; it != end; ++it) {
+    if (budget.TakeElements(1) == 0 || budget.BytesLeft() == 0) {
+      out << (it == begin ? "..." : " ...");
+      return;
+    }
+    if (it != begin) out << ' ';
+    out << *it;
   }
-  if (begin != end) {
-    out << " ...";
+}
+
+template <class T>
+inline void PrintNumbers(std::ostream& out, SequenceBudget& budget,
+                         const T* begin, const T* end,
+                         std::false_type /*in_bulk*/) {
+  PrintEach(out, budget, begin, end);
+}
+
+template <class T>
+inline void PrintNumbers(std::ostream& out, SequenceBudget& budget,
+                         const T* begin, const T* end,
+                         std::true_type /*in_bulk*/) {
+  if (!HasDefaultNumberFormat(out)) {
+    PrintEach(out, budget, begin, end);
+    return;
   }
+  const size_t count =
+      std::min(budget.ElementsLeft(), static_cast<size_t>(end - begin));
+  const std::streamoff bytes_left = budget.BytesLeft();
+  char buffer[512];
+  size_t used = 0;
+  std::streamoff written = 0;
+  const T* it = begin;
+  for (; it != begin + count; ++it) {
+    if (bytes_left >= 0 && written >= bytes_left) break;
+    if (used + kMaxBulkNumberSize + 1 > sizeof(buffer)) {
+      out.write(buffer, static_cast<std::streamsize>(used));
+      used = 0;
+    }
+    char* const start = buffer + used;
+    char* next = start;
+    if (it != begin) *next++ = ' ';
+    next = FormatInBulk(next, buffer + sizeof(buffer), *it,
+                        std::is_integral<T>{}, out);
+    used += static_cast<size_t>(next - start);
+    written += next - start;
+  }
+  out.write(buffer, static_cast<std::streamsize>(used));
+  // Only the elements written are charged, not those cut off by the byte
+  // limit.
+  budget.TakeElements(static_cast<size_t>(it - begin));
+  if (it != end) {
+    out << (it == begin ? "..." : " ...");
+  }
+}
+
+template <class Iter>
+inline void PrintElements(std::ostream& out, SequenceBudget& budget,
+                          Iter begin, Iter end) {
+  PrintEach(out, budget, begin, end);
+}
+
+template <class T>
+inline void PrintElements(std::ostream& out, SequenceBudget& budget,
+                          const T* begin, const T* end) {
+  PrintNumbers(out, budget, begin, end, IsFormattedInBulk<T>{});
+}
+
+template <class T>
+inline void PrintElements(std::ostream& out, SequenceBudget& budget, T* begin,
+                          T* end) {
+  PrintNumbers(out, budget, static_cast<const T*>(begin),
+               static_cast<const T*>(end), IsFormattedInBulk<T>{});
+}
+
+template <class Range>
+inline auto PrintRange(std::ostream& out, const Range& range, int)
+    -> decltype(range.data() + range.size(), void()) {
+  google::PrintSequence(out, range.data(), range.data() + range.size());
+}
+
+template <class Range>
+inline void PrintRange(std::ostream& out, const Range& range, long) {
+  using std::begin;
+  using std::end;
+  google::PrintSequence(out, begin(range), end(range));
+}
+
+}  // namespace internal
+}  // namespace logging
+
+// Prints the elements of [begin, end) separated by spaces.  At most
+// --stl_logging_max_elements elements are printed, and printing stops once
+// --stl_logging_max_bytes bytes were written; " ..." marks the elements left
+// out.  Both limits are shared with the containers nested into the printed
+// elements, and by all the containers printed into one log message.
+template <class Iter>
+inline void PrintSequence(std::ostream& out, Iter begin, Iter end) {
+  logging::internal::SequenceBudget budget(out);
+  logging::internal::PrintElements(out, budget, begin, end);
+}
+
+// Prints the elements of a range, e.g. an array or a std::span, like
+// PrintSequence(out, std::begin(range), std::end(range)).
+template <class Range>
+inline void PrintSequence(std::ostream& out, const Range& range) {
+  logging::internal::PrintRange(out, range, 0);
+}
+
+// Prints the size elements starting at data.
+template <class T>
+inline void PrintSequence(std::ostream& out, const T* data, size_t size) {
+  PrintSequence(out, data, data + size);
 }
 
 }  // namespace google
@@ -55,6 +55,10 @@
 // SetVLOGLevel helper function is provided to do limited dynamic control over
 // V-logging by overriding the per-module settings given via --vmodule flag.
 //
+// The same mechanism drives --minloglevel_module, a per-module counterpart of
+// --minloglevel that LOG(severity) consults through MINLOGLEVEL_IS_ON, and
+// SetModuleMinLogLevel which adjusts it at runtime.
+//
 // CAVEAT: --vmodule functionality is not available in non gcc compilers.
 //
 
@@ -98,6 +102,24 @@
 #  define VLOG_IS_ON(verboselevel) (FLAGS_v >= (verboselevel))
 #endif
 
+// Like VLOG_IS_ON, every MINLOGLEVEL_IS_ON(severity) site caches a pointer to
+// either FLAGS_minloglevel or the --minloglevel_module entry matching the
+// current source file, so after the first hit the check is one pointer load.
+// The static site flag lives in a lambda rather than a statement expression,
+// so that LOG() stays an expression usable anywhere, e.g. outside of function
+// bodies, and works with every compiler.  The caller checks FLAGS_minloglevel
+// first: module levels only suppress messages in addition to it.
+#define MINLOGLEVEL_IS_ON(severity)                                      \
+  ([](google::int32 severity__) {                                        \
+    static google::SiteFlag mlocal__ = {nullptr, nullptr, 0, nullptr};  \
+    GLOG_IFDEF_THREAD_SANITIZER(AnnotateBenignRaceSized(                 \
+        __FILE__, __LINE__, &mlocal__, sizeof(google::SiteFlag), ""));   \
+    return mlocal__.level == nullptr                                     \
+               ? google::InitMinLogLevel__(&mlocal__, &FLAGS_minloglevel, \
+                                           __FILE__, severity__)         \
+               : severity__ >= *mlocal__.level;                          \
+  }(severity))
+
 namespace google {
 
 // Set VLOG(_IS_ON) level for module_pattern to log_level.
@@ -110,6 +132,15 @@ namespace google {
 //       the value of FLAGS_v will continue to control them.)
 extern GLOG_EXPORT int SetVLOGLevel(const char* module_pattern, int log_level);
 
+// Set the minimum severity logged by LOG sites in modules matching
+// module_pattern, as the --minloglevel_module flag does.  The level only
+// suppresses messages in addition to FLAGS_minloglevel: a level below
+// FLAGS_minloglevel has no effect.
+// Returns the level that previously applied to module_pattern.
+// The same NOTE as for SetVLOGLevel applies to sites that already executed.
+extern GLOG_EXPORT int SetModuleMinLogLevel(const char* module_pattern,
+                                            int min_log_level);
+
 // Various declarations needed for VLOG_IS_ON above: =========================
 
 struct SiteFlag {
@@ -131,6 +162,12 @@ extern GLOG_EXPORT bool InitVLOG3__(SiteFlag* site_flag,
                                     int32* site_default,
                                     const char* fname,
                                     int32 verbose_level);
+
+// Same as InitVLOG3__ for MINLOGLEVEL_IS_ON: site_default is normally
+// &FLAGS_minloglevel and the return value is severity >= *site_flag->level.
+extern GLOG_EXPORT bool InitMinLogLevel__(SiteFlag* site_flag,
+                                          int32* site_default,
+                                          const char* fname, int32 severity);
 } // namespace google
 
 #endif  // GLOG_VLOG_IS_ON_H
@@ -0,0 +1,189 @@
+// Copyright (c) 2024, Google Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Symbolizes stack traces written with --symbolize_offline.
+//
+// Usage: glog_symbolize [LOGFILE]...
+//
+// Reads the log files (or the standard input) and copies them to the standard
+// output, appending symbol names and, where the object files have DWARF line
+// tables, source lines to the stack frames.  A stack trace written
+// with --symbolize_offline consists of raw program counters followed by a
+// module map listing the object files they belong to; the object files are
+// read from the paths recorded in the module map.  Lines are written as they
+// are read, except that a stack trace is held back until its module map ends.
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <regex>
+#include <string>
+#include <vector>
+
+#include "symbolize.h"
+
+namespace {
+
+struct Module {
+  uint64_t start_address;
+  uint64_t end_address;
+  uint64_t base_address;
+  std::string build_id;
+  std::string file_name;
+};
+
+// A stack frame line awaiting the module map which follows it.
+struct Frame {
+  size_t line;
+  uint64_t pc;
+};
+
+const std::regex kFrameRegex{R"(^.*@\s+0x([0-9a-fA-F]+)\s*$)"};
+const std::regex kModuleRegex{
+    R"(^\s*module 0x([0-9a-f]+)-0x([0-9a-f]+) base 0x([0-9a-f]+) )"
+    R"(build-id (\S+) (.*)$)"};
+
+// Returns the line table of the object file |file_name|, which is decoded
+// once for all the stack traces referring to it.
+const google::ObjectFileLineTable& GetLineTable(const std::string& file_name) {
+  static std::map<std::string, std::unique_ptr<google::ObjectFileLineTable>>
+      line_tables;
+  std::unique_ptr<google::ObjectFileLineTable>& line_table =
+      line_tables[file_name];
+  if (line_table == nullptr) {
+    line_table.reset(new google::ObjectFileLineTable(file_name.c_str()));
+  }
+  return *line_table;
+}
+
+std::string SymbolizeFrame(const std::vector<Module>& modules, uint64_t pc) {
+  for (const Module& module : modules) {
+    if (pc < module.start_address || pc >= module.end_address) {
+      continue;
+    }
+    char offset[32];
+    std::snprintf(offset, sizeof(offset), "+0x%" PRIx64,
+                  pc - module.base_address);
+    char build_id[129];
+    if (module.build_id != "-" &&
+        (!google::GetObjectFileBuildId(module.file_name.c_str(), build_id,
+                                       sizeof(build_id)) ||
+         module.build_id != build_id)) {
+      return "(" + module.file_name + offset + ", build-id mismatch)";
+    }
+    // Symbolizes the previous address of pc because pc may be in the
+    // next function, as Symbolize() callers do.
+    char symbol[1024];
+    if (google::SymbolizeObjectFileAddress(module.file_name.c_str(), pc - 1,
+                                           module.base_address, symbol,
+                                           sizeof(symbol))) {
+      GetLineTable(module.file_name)
+          .AppendSourceLine(pc - 1, module.base_address, symbol,
+                            sizeof(symbol));
+      return symbol;
+    }
+    return "(" + module.file_name + offset + ")";
+  }
+  return "(unknown)";
+}
+
+void Symbolize(std::istream& in) {
+  // The lines from the first frame of a stack trace to the end of the module
+  // map which follows it.  All other lines are copied as they are read.
+  std::vector<std::string> lines;
+  std::vector<Frame> frames;
+  std::vector<Module> modules;
+  bool in_module_map = false;
+
+  // Once the module map ends, symbolize the frames seen so far and print the
+  // lines buffered since the first one.
+  auto flush = [&] {
+    for (const Frame& frame : frames) {
+      std::string& line = lines[frame.line];
+      line.erase(line.find_last_not_of(" \t") + 1);
+      line += "  " + SymbolizeFrame(modules, frame.pc);
+    }
+    for (const std::string& line : lines) {
+      std::cout << line << '\n';
+    }
+    lines.clear();
+    frames.clear();
+    modules.clear();
+  };
+
+  std::string line;
+  std::smatch match;
+  while (std::getline(in, line)) {
+    if (!frames.empty() && std::regex_search(line, match, kModuleRegex)) {
+      in_module_map = true;
+      modules.push_back(Module{std::stoull(match[1], nullptr, 16),
+                               std::stoull(match[2], nullptr, 16),
+                               std::stoull(match[3], nullptr, 16), match[4],
+                               match[5]});
+    } else if (in_module_map) {
+      in_module_map = false;
+      flush();
+    }
+    if (std::regex_match(line, match, kFrameRegex)) {
+      frames.push_back(Frame{lines.size(), std::stoull(match[1], nullptr, 16)});
+    }
+    if (frames.empty()) {
+      std::cout << line << '\n';
+    } else {
+      lines.push_back(line);
+    }
+  }
+  flush();
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    Symbolize(std::cin);
+    return 0;
+  }
+  int status = 0;
+  for (int i = 1; i < argc; ++i) {
+    std::ifstream in(argv[i]);
+    if (!in) {
+      std::cerr << argv[0] << ": cannot open " << argv[i] << ": "
+                << std::strerror(errno) << std::endl;
+      status = 1;
+      continue;
+    }
+    Symbolize(in);
+  }
+  return status;
+}
@@ -32,10 +32,14 @@
 #include "glog/logging.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <chrono>
+#include <cmath>
+#include <condition_variable>
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <iomanip>
 #include <iterator>
 #include <memory>
@@ -284,13 +288,49 @@ const size_t LogMessage::kMaxLogMessageLen = 30000;
 
 namespace logging {
 namespace internal {
+// The stream of a log message, which knows the message it belongs to.
+class LogMessageStream : public LogMessage::LogStream {
+ public:
+  LogMessageStream(char* buf, int len, LogMessageData* data)
+      : LogStream(buf, len, 0), data_(data) {
+#ifdef DISABLE_RTTI
+    pword(DataIndex()) = data;
+#endif
+  }
+
+  LogMessageData* data() const { return data_; }
+
+#ifdef DISABLE_RTTI
+  // Without RTTI, the stream of a log message is recognized by the data
+  // pointer it stores in this stream word.
+  static int DataIndex() {
+    static const int index = std::ios_base::xalloc();
+    return index;
+  }
+#endif
+
+ private:
+  LogMessageData* data_;
+};
+
+// Returns the log message "out" is the stream of, or nullptr.
+static LogMessageData* MessageData(std::ostream& out) {
+#ifdef DISABLE_RTTI
+  return static_cast<LogMessageData*>(
+      out.pword(LogMessageStream::DataIndex()));
+#else
+  auto* stream = dynamic_cast<LogMessageStream*>(&out);
+  return stream != nullptr ? stream->data() : nullptr;
+#endif
+}
+
 struct LogMessageData {
   LogMessageData();
 
   int preserved_errno_;  // preserved errno
   // Buffer space; contains complete message text.
   char message_text_[LogMessage::kMaxLogMessageLen + 1];
-  LogMessage::LogStream stream_;
+  LogMessageStream stream_;
   LogSeverity severity_;  // What level is this LogMessage logged at?
   int line_;              // line number where logging call is.
   void (LogMessage::*send_method_)();  // Call this in destructor to send
@@ -308,6 +348,19 @@ struct LogMessageData {
   bool has_been_flushed_;       // false => data has not been flushed
   bool first_fatal_;            // true => this was first fatal msg
   std::thread::id thread_id_;
+  size_t num_message_chars_;  // # of chars of msg without prefix and fields
+
+  // Fields attached with LogStream::With(), whose keys and string values are
+  // copied into field_text_.
+  static constexpr size_t kMaxFields = 16;
+  static constexpr size_t kMaxFieldText = 1024;
+  LogField fields_[kMaxFields];
+  size_t num_fields_;
+  char field_text_[kMaxFieldText];
+  size_t field_text_size_;
+
+  // Shared by the containers of glog/stl_logging.h printed into stream_.
+  SequenceBudgetState sequence_budget_;
 
   LogMessageData(const LogMessageData&) = delete;
   LogMessageData& operator=(const LogMessageData&) = delete;
@@ -315,6 +368,198 @@ struct LogMessageData {
 }  // namespace internal
 }  // namespace logging
 
+namespace {
+
+// Writes encoded log messages into a fixed buffer, truncating what does not
+// fit, so that encoding never allocates memory.
+class EncodeBuffer {
+ public:
+  EncodeBuffer(char* buf, size_t size)
+      : begin_(buf), cursor_(buf), end_(buf + size) {}
+
+  size_t size() const { return static_cast<size_t>(cursor_ - begin_); }
+
+  void Append(const char* data, size_t size) {
+    size = std::min(size, static_cast<size_t>(end_ - cursor_));
+    memcpy(cursor_, data, size);
+    cursor_ += size;
+  }
+  void Append(const char* str) { Append(str, strlen(str)); }
+  void Append(char c) {
+    if (cursor_ != end_) {
+      *cursor_++ = c;
+    }
+  }
+  template <typename... Args>
+  void AppendFormat(const char* format, Args... args) {
+    char buf[64];
+    const int size = std::snprintf(buf, sizeof(buf), format, args...);
+    if (size > 0) {
+      Append(buf, std::min(static_cast<size_t>(size), sizeof(buf) - 1));
+    }
+  }
+
+  // Ends the buffer with '\n', in place of the last character if it is full,
+  // and returns its size.
+  size_t Finish() {
+    if (cursor_ == end_ && cursor_ != begin_) {
+      --cursor_;
+    }
+    Append('\n');
+    return size();
+  }
+
+ private:
+  char* begin_;
+  char* cursor_;
+  char* end_;
+};
+
+void AppendDouble(EncodeBuffer* out, double value) {
+  // The shortest of the usual precisions which reads back as the value.
+  char buf[32];
+  std::snprintf(buf, sizeof(buf), "%.15g", value);
+  if (std::strtod(buf, nullptr) != value) {
+    std::snprintf(buf, sizeof(buf), "%.17g", value);
+  }
+  out->Append(buf);
+}
+
+// Appends a field value other than a string.
+void AppendScalar(EncodeBuffer* out, const LogField& field) {
+  switch (field.type()) {
+    case LogField::kBool:
+      out->Append(field.bool_value() ? "true" : "false");
+      break;
+    case LogField::kInt:
+      out->AppendFormat("%lld", static_cast<long long>(field.int_value()));
+      break;
+    case LogField::kUInt:
+      out->AppendFormat("%llu",
+                        static_cast<unsigned long long>(field.uint_value()));
+      break;
+    case LogField::kDouble:
+      AppendDouble(out, field.double_value());
+      break;
+    case LogField::kString:
+      break;
+  }
+}
+
+// Appends a logfmt value, quoted if it is empty or contains spaces, '=',
+// quotes or control characters.
+void AppendLogfmtString(EncodeBuffer* out, const char* str, size_t size) {
+  bool quote = size == 0;
+  for (size_t i = 0; i < size && !quote; ++i) {
+    const auto c = static_cast<unsigned char>(str[i]);
+    quote = c <= ' ' || c == '=' || c == '"' || c == 0x7f;
+  }
+  if (!quote) {
+    out->Append(str, size);
+    return;
+  }
+  out->Append('"');
+  for (size_t i = 0; i < size; ++i) {
+    const char c = str[i];
+    if (c == '"' || c == '\\') {
+      out->Append('\\');
+      out->Append(c);
+    } else if (c == '\n') {
+      out->Append("\\n");
+    } else if (c == '\t') {
+      out->Append("\\t");
+    } else if (static_cast<unsigned char>(c) < ' ') {
+      out->AppendFormat("\\x%02x", static_cast<unsigned>(c));
+    } else {
+      out->Append(c);
+    }
+  }
+  out->Append('"');
+}
+
+// Returns the size of the well-formed UTF-8 sequence of a code point other
+// than ASCII at the start of [str, str + size), or 0 if there is none.
+size_t Utf8SequenceSize(const unsigned char* str, size_t size) {
+  size_t sequence_size;
+  unsigned char min = 0x80;
+  unsigned char max = 0xbf;
+  if (str[0] >= 0xc2 && str[0] <= 0xdf) {
+    sequence_size = 2;
+  } else if (str[0] >= 0xe0 && str[0] <= 0xef) {
+    sequence_size = 3;
+    if (str[0] == 0xe0) {
+      min = 0xa0;  // Overlong
+    } else if (str[0] == 0xed) {
+      max = 0x9f;  // Surrogate
+    }
+  } else if (str[0] >= 0xf0 && str[0] <= 0xf4) {
+    sequence_size = 4;
+    if (str[0] == 0xf0) {
+      min = 0x90;  // Overlong
+    } else if (str[0] == 0xf4) {
+      max = 0x8f;  // Beyond U+10FFFF
+    }
+  } else {
+    return 0;
+  }
+  if (size < sequence_size || str[1] < min || str[1] > max) {
+    return 0;
+  }
+  for (size_t i = 2; i < sequence_size; ++i) {
+    if ((str[i] & 0xc0) != 0x80) {
+      return 0;
+    }
+  }
+  return sequence_size;
+}
+
+// Appends "str" as a JSON string.  Bytes which are not part of well-formed
+// UTF-8 are replaced with U+FFFD, so that the result is valid JSON.
+void AppendJsonString(EncodeBuffer* out, const char* str, size_t size) {
+  out->Append('"');
+  for (size_t i = 0; i < size; ++i) {
+    const char c = str[i];
+    if (c == '"' || c == '\\') {
+      out->Append('\\');
+      out->Append(c);
+    } else if (c == '\n') {
+      out->Append("\\n");
+    } else if (c == '\t') {
+      out->Append("\\t");
+    } else if (static_cast<unsigned char>(c) < ' ') {
+      out->AppendFormat("\\u%04x", static_cast<unsigned>(c));
+    } else if (static_cast<unsigned char>(c) >= 0x80) {
+      const size_t sequence_size = Utf8SequenceSize(
+          reinterpret_cast<const unsigned char*>(str + i), size - i);
+      if (sequence_size == 0) {
+        out->Append("\\ufffd");
+      } else {
+        out->Append(str + i, sequence_size);
+        i += sequence_size - 1;
+      }
+    } else {
+      out->Append(c);
+    }
+  }
+  out->Append('"');
+}
+
+// Appends the fields as " key=value", as in the text format.
+void AppendTextFields(EncodeBuffer* out, LogFields fields) {
+  for (const LogField& field : fields) {
+    out->Append(' ');
+    out->Append(field.key());
+    out->Append('=');
+    if (field.type() == LogField::kString) {
+      AppendLogfmtString(out, field.string_value(), field.string_size());
+    } else {
+      AppendScalar(out, field);
+    }
+  }
+}
+
+}  // namespace
+
 // A mutex that allows only one thread to log at a time, to keep things from
 // getting jumbled.  Some other very uncommon logging operations (like
 // changing the destination file for log messages of a given severity) also
@@ -352,12 +597,27 @@ class PrefixFormatter {
  public:
   PrefixFormatter(PrefixFormatterCallback callback, void* data) noexcept
       : version{V2}, callback_v2{callback}, data{data} {}
+  PrefixFormatter(PrefixWriterCallback callback, void* data) noexcept
+      : version{V3}, callback_v3{callback}, data{data} {}
 
+  // Whether the callback leaves the formatting state of the stream alone.
+  bool writes_into_buffer() const noexcept { return version == V3; }
+
+  // Streams the prefix followed by a space.
   void operator()(std::ostream& s, const LogMessage& message) const {
     switch (version) {
       case V2:
         callback_v2(s, message, data);
+        s << ' ';
+        break;
+      case V3: {
+        char buffer[kMaxPrefixLen + 1];
+        size_t size = callback_v3(buffer, kMaxPrefixLen, message, data);
+        size = std::min(size, kMaxPrefixLen);
+        buffer[size++] = ' ';
+        s.write(buffer, static_cast<std::streamsize>(size));
         break;
+      }
     }
   }
 
@@ -365,9 +625,13 @@ class PrefixFormatter {
   PrefixFormatter& operator=(const PrefixFormatter& other) = delete;
 
  private:
-  enum Version { V2 } version;
+  // Longest prefix written by a PrefixWriterCallback.
+  static constexpr size_t kMaxPrefixLen = 256;
+
+  enum Version { V2, V3 } version;
   union {
     PrefixFormatterCallback callback_v2;
+    PrefixWriterCallback callback_v3;
   };
   // User-provided data to pass to the callback:
   void* data;
@@ -486,6 +750,8 @@ class LogDestination {
   static void SetLogFilenameExtension(const char* filename_extension);
   static void SetStderrLogging(LogSeverity min_severity);
   static void SetEmailLogging(LogSeverity min_severity, const char* addresses);
+  static void SetLogEncoder(LogSeverity severity, const LogEncoder* encoder);
+  static void SetStderrLogEncoder(const LogEncoder* encoder);
   static void LogToStderr();
   // Flush all log files that are at least at the given severity level
   static void FlushLogFiles(int min_severity);
@@ -519,10 +785,18 @@ class LogDestination {
   friend std::default_delete<LogDestination>;
   ~LogDestination();
 
+  // Returns "log_message" encoded with "encoder", or "message" of "*len"
+  // bytes in the text format if either is nullptr, and sets "*len" to the
+  // length of the result.  The encoding is valid until the next call.
+  static const char* Encode(const LogEncoder* encoder,
+                            const LogMessage* log_message,
+                            const char* message, size_t* len);
+
   // Take a log message of a particular severity and log it to stderr
   // iff it's of a high enough severity to deserve it.
   static void MaybeLogToStderr(LogSeverity severity, const char* message,
-                               size_t message_len, size_t prefix_len);
+                               size_t message_len, size_t prefix_len,
+                               const LogMessage* log_message = nullptr);
 
   // Take a log message of a particular severity and log it to email
   // iff it's of a high enough severity to deserve it.
@@ -537,16 +811,25 @@ class LogDestination {
   // Take a log message of a particular severity and log it to the file
   // for that severity and also for all files with severity less than
   // this severity.
+  // Encodes "log_message" for each log file if it is not nullptr.
   static void LogToAllLogfiles(
       LogSeverity severity,
       const std::chrono::system_clock::time_point& timestamp,
-      const char* message, size_t len);
+      const char* message, size_t len,
+      const LogMessage* log_message = nullptr);
 
   // Send logging info to all registered sinks.
   static void LogToSinks(LogSeverity severity, const char* full_filename,
                          const char* base_filename, int line,
                          const LogMessageTime& time, const char* message,
-                         size_t message_len);
+                         size_t message_len, const LogFields& fields);
+
+  // Send logging info to the systemd journal and to syslog if enabled by
+  // --logtojournald and --logtosyslog.  Under log_mutex.
+  static void LogToSystemLogs(LogSeverity severity, const char* full_filename,
+                              const char* base_filename, int line,
+                              const LogMessageTime& time, const char* message,
+                              size_t message_len, const LogFields& fields);
 
   // Wait for all registered sinks via WaitTillSent
   // including the optional one in "data".
@@ -567,9 +850,22 @@ class LogDestination {
   static string hostname_;
   static bool terminal_supports_color_;
 
+  // Encoders of the log files and of stderr; nullptr means the text format.
+  // Under log_mutex, as is encoded_message_.
+  static const LogEncoder* encoders_[NUM_SEVERITIES];
+  static const LogEncoder* stderr_encoder_;
+  static char encoded_message_[LogMessage::kMaxLogMessageLen + 1];
+
   // arbitrary global logging destinations.
   static std::unique_ptr<vector<LogSink*>> sinks_;
 
+  // Sinks of --logtojournald and --logtosyslog, created on first use and
+  // again when the socket flags change.  Under log_mutex.
+  static std::unique_ptr<JournaldLogSink> journald_sink_;
+  static string journald_socket_;
+  static std::unique_ptr<SyslogLogSink> syslog_sink_;
+  static string syslog_socket_;
+
   // Protects the vector sinks_,
   // but not the LogSink objects its elements reference.
   static SinkMutex sink_mutex_;
@@ -586,7 +882,15 @@ std::underlying_type_t<LogSeverity> LogDestination::email_logging_severity_ =
 string LogDestination::addresses_;
 string LogDestination::hostname_;
 
+const LogEncoder* LogDestination::encoders_[NUM_SEVERITIES];
+const LogEncoder* LogDestination::stderr_encoder_ = nullptr;
+char LogDestination::encoded_message_[LogMessage::kMaxLogMessageLen + 1];
+
 std::unique_ptr<vector<LogSink*>> LogDestination::sinks_;
+std::unique_ptr<JournaldLogSink> LogDestination::journald_sink_;
+string LogDestination::journald_socket_;
+std::unique_ptr<SyslogLogSink> LogDestination::syslog_sink_;
+string LogDestination::syslog_socket_;
 LogDestination::SinkMutex LogDestination::sink_mutex_;
 bool LogDestination::terminal_supports_color_ = TerminalSupportsColor();
 
@@ -644,6 +948,7 @@ inline void LogDestination::FlushLogFiles(int min_severity) {
       log->logger_->Flush();
     }
   }
+  FlushSystemLogSinks();
 }
 
 inline void LogDestination::SetLogDestination(LogSeverity severity,
@@ -698,6 +1003,31 @@ inline void LogDestination::SetStderrLogging(LogSeverity min_severity) {
   FLAGS_stderrthreshold = min_severity;
 }
 
+inline void LogDestination::SetLogEncoder(LogSeverity severity,
+                                          const LogEncoder* encoder) {
+  CHECK_GE(severity, 0);
+  CHECK_LT(severity, NUM_SEVERITIES);
+  std::lock_guard<std::mutex> l{log_mutex};
+  encoders_[severity] = encoder;
+}
+
+inline void LogDestination::SetStderrLogEncoder(const LogEncoder* encoder) {
+  std::lock_guard<std::mutex> l{log_mutex};
+  stderr_encoder_ = encoder;
+}
+
+const char* LogDestination::Encode(const LogEncoder* encoder,
+                                   const LogMessage* log_message,
+                                   const char* message, size_t* len) {
+  if (encoder == nullptr || log_message == nullptr) {
+    return message;
+  }
+  *len = encoder->Encode(*log_message, encoded_message_,
+                         sizeof(encoded_message_) - 1);
+  encoded_message_[*len] = '\0';
+  return encoded_message_;
+}
+
 inline void LogDestination::LogToStderr() {
   // *Don't* put this stuff in a mutex lock, since SetStderrLogging &
   // SetLogDestination already do the locking!
@@ -717,6 +1047,214 @@ inline void LogDestination::SetEmailLogging(LogSeverity min_severity,
   LogDestination::addresses_ = addresses;
 }
 
+#if !defined(GLOG_OS_WINDOWS) && defined(HAVE_UNISTD_H)
+// Writes the messages to stderr and stdout from a background thread if
+// --console_buffer_bytes is set, so that logging does not block while
+// holding log_mutex when the output is consumed slowly, for instance by a
+// pipe to a log collector.
+//
+// Each message is copied along with its color codes into the buffer of its
+// stream, which the thread empties with a single write().  Messages which do
+// not fit in the buffer are dropped and counted; their number is reported on
+// stderr once the buffer was written.  FATAL messages are written
+// synchronously after the buffered ones, and so are the messages of a child
+// forked after the thread started.
+class ConsoleWriter {
+ public:
+  // Returns false if the message is to be written synchronously.
+  static bool Write(FILE* output, GLogColor color, LogSeverity severity,
+                    const char* message, size_t len);
+
+  // Writes the buffered messages and waits until they are written, but at
+  // most kFlushTimeout.
+  static void Flush();
+
+ private:
+  static constexpr std::chrono::seconds kFlushTimeout{10};
+  // How often the idle thread checks for messages it was not woken up for.
+  static constexpr std::chrono::seconds kIdlePeriod{1};
+
+  struct Stream {
+    int fd;
+    string pending;  // Messages to be written.
+    string writing;  // Messages being written by the thread.
+  };
+
+  static ConsoleWriter& Get();
+  // Writes the buffered messages and stops the thread at exit, waiting for it
+  // at most kFlushTimeout.  Later messages are written synchronously.
+  static void Stop();
+
+  // Whether this is a child forked after the thread started; see
+  // EmailAlerter::Forked().
+  bool Forked() const { return thread_.joinable() && pid_ != getpid(); }
+  bool Empty() const {
+    return streams_[0].pending.empty() && streams_[1].pending.empty();
+  }
+  void Run();
+  static void WriteFully(int fd, const char* data, size_t size);
+
+  std::mutex mutex_;
+  std::condition_variable wakeup_;
+  std::condition_variable idle_;
+  Stream streams_[2]{{STDERR_FILENO, {}, {}}, {STDOUT_FILENO, {}, {}}};
+  uint64 dropped_ = 0;
+  bool writing_ = false;
+  bool stop_ = false;
+  bool stopped_ = false;  // Whether Run() returned.
+  std::thread thread_;
+  int32 pid_ = 0;  // Of the process which started thread_.
+};
+
+constexpr std::chrono::seconds ConsoleWriter::kFlushTimeout;
+constexpr std::chrono::seconds ConsoleWriter::kIdlePeriod;
+
+ConsoleWriter& ConsoleWriter::Get() {
+  // Never destroyed; see EmailAlerter::Get().
+  static ConsoleWriter* writer = new ConsoleWriter;
+  return *writer;
+}
+
+bool ConsoleWriter::Write(FILE* output, GLogColor color, LogSeverity severity,
+                          const char* message, size_t len) {
+  const size_t capacity = FLAGS_console_buffer_bytes;
+  if (capacity == 0) {
+    return false;
+  }
+  ConsoleWriter& writer = Get();
+  std::unique_lock<std::mutex> l{writer.mutex_};
+  if (writer.stop_) {
+    // Messages logged by other exit handlers or threads after Stop().
+    return false;
+  }
+  if (severity == GLOG_FATAL || writer.Forked()) {
+    l.unlock();
+    Flush();
+    return false;
+  }
+  if (!writer.thread_.joinable()) {
+    // What was written through stdio so far comes first.
+    fflush(stderr);
+    fflush(stdout);
+    writer.pid_ = getpid();
+    writer.thread_ = std::thread(&ConsoleWriter::Run, &writer);
+    std::atexit(&ConsoleWriter::Stop);
+  }
+
+  const char* color_code = GetAnsiColorCode(color);
+  const size_t color_len = color == COLOR_DEFAULT
+                               ? 0
+                               : std::strlen("\033[0;3m") +
+                                     std::strlen(color_code) +
+                                     std::strlen("\033[m");
+  Stream& stream = writer.streams_[output == stdout ? 1 : 0];
+  if (stream.pending.size() + color_len + len > capacity) {
+    ++writer.dropped_;
+    return true;
+  }
+  const bool was_empty = writer.Empty();
+  if (stream.pending.capacity() < capacity) {
+    stream.pending.reserve(capacity);
+  }
+  if (color != COLOR_DEFAULT) {
+    stream.pending.append("\033[0;3").append(color_code).append("m");
+  }
+  stream.pending.append(message, len);
+  if (color != COLOR_DEFAULT) {
+    stream.pending.append("\033[m");  // Resets the terminal to default.
+  }
+  l.unlock();
+  // The thread only needs waking up if it could be waiting.
+  if (was_empty) {
+    writer.wakeup_.notify_one();
+  }
+  return true;
+}
+
+void ConsoleWriter::Flush() {
+  ConsoleWriter& writer = Get();
+  std::unique_lock<std::mutex> l{writer.mutex_};
+  if (!writer.thread_.joinable() || writer.Forked()) {
+    return;
+  }
+  writer.wakeup_.notify_one();
+  writer.idle_.wait_for(l, kFlushTimeout, [&writer] {
+    return writer.Empty() && !writer.writing_;
+  });
+}
+
+void ConsoleWriter::Stop() {
+  ConsoleWriter& writer = Get();
+  std::unique_lock<std::mutex> l{writer.mutex_};
+  if (writer.Forked()) {
+    return;
+  }
+  writer.stop_ = true;
+  writer.wakeup_.notify_one();
+  const bool stopped = writer.idle_.wait_for(
+      l, kFlushTimeout, [&writer] { return writer.stopped_; });
+  l.unlock();
+  if (stopped) {
+    writer.thread_.join();
+  } else {
+    // The output blocks; let the thread go rather than the program.
+    writer.thread_.detach();
+  }
+}
+
+void ConsoleWriter::WriteFully(int fd, const char* data, size_t size) {
+  while (size > 0) {
+    const ssize_t written = write(fd, data, size);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return;
+    }
+    data += written;
+    size -= static_cast<size_t>(written);
+  }
+}
+
+void ConsoleWriter::Run() {
+  std::unique_lock<std::mutex> l{mutex_};
+  for (;;) {
+    if (Empty()) {
+      if (stop_) {
+        break;
+      }
+      wakeup_.wait_for(l, kIdlePeriod);
+      continue;
+    }
+    for (Stream& stream : streams_) {
+      stream.writing.swap(stream.pending);
+    }
+    const uint64 dropped = dropped_;
+    dropped_ = 0;
+    writing_ = true;
+    l.unlock();
+    for (Stream& stream : streams_) {
+      WriteFully(stream.fd, stream.writing.data(), stream.writing.size());
+      stream.writing.clear();
+    }
+    if (dropped > 0) {
+      char note[128];
+      const int size = std::snprintf(
+          note, sizeof(note),
+          "*** %llu log messages were dropped because the output was slow "
+          "***\n",
+          static_cast<unsigned long long>(dropped));
+      WriteFully(STDERR_FILENO, note, static_cast<size_t>(size));
+    }
+    l.lock();
+    writing_ = false;
+    idle_.notify_all();
+  }
+  stopped_ = true;
+  idle_.notify_all();
+}
+#endif  // !defined(GLOG_OS_WINDOWS) && defined(HAVE_UNISTD_H)
+
 static void ColoredWriteToStderrOrStdout(FILE* output, LogSeverity severity,
                                          const char* message, size_t len) {
   bool is_stdout = (output == stdout);
@@ -726,6 +1264,12 @@ static void ColoredWriteToStderrOrStdout(FILE* output, LogSeverity severity,
                               ? SeverityToColor(severity)
                               : COLOR_DEFAULT;
 
+#if !defined(GLOG_OS_WINDOWS) && defined(HAVE_UNISTD_H)
+  if (ConsoleWriter::Write(output, color, severity, message, len)) {
+    return;
+  }
+#endif
+
   // Avoid using cerr from this module since we may get called during
   // exit code, and cerr may be partially or fully destroyed by then.
   if (COLOR_DEFAULT == color) {
@@ -783,15 +1327,249 @@ static void WriteToStderr(const char* message, size_t len) {
 inline void LogDestination::MaybeLogToStderr(LogSeverity severity,
                                              const char* message,
                                              size_t message_len,
-                                             size_t prefix_len) {
+                                             size_t prefix_len,
+                                             const LogMessage* log_message) {
   if ((severity >= FLAGS_stderrthreshold) || FLAGS_alsologtostderr) {
-    ColoredWriteToStderr(severity, message, message_len);
+    size_t len = message_len;
+    const char* text = Encode(stderr_encoder_, log_message, message, &len);
+    ColoredWriteToStderr(severity, text, len);
     AlsoErrorWrite(severity,
                    glog_internal_namespace_::ProgramInvocationShortName(),
                    message + prefix_len);
   }
 }
 
+// Sends the emails of LogDestination::MaybeLogToEmail() from a background
+// thread, so that logging does not wait for the mailer while holding
+// log_mutex.
+//
+// The messages are queued and sent as a single email per destination at most
+// every --logemailsecs seconds.  At most kMaxQueued messages wait; further
+// ones are dropped and counted in the next email.  A FATAL message is queued
+// regardless, and sent along with the queued ones by FlushFatal(), which
+// LogMessage::Flush() calls once log_mutex is released, as the program is
+// about to die.
+class EmailAlerter {
+ public:
+  static void Send(LogSeverity severity, string dest, const string& hostname,
+                   const char* message, size_t len);
+
+  // Sends the queued messages and waits until they are sent, but at most
+  // kFlushTimeout so that a hanging mailer cannot hang the program.  Without
+  // the thread, sends them from the calling thread.
+  static void Flush();
+  // Flush() if a FATAL message was queued.
+  static void FlushFatal() {
+    if (fatal_queued_.exchange(false)) {
+      Flush();
+    }
+  }
+
+ private:
+  static constexpr size_t kMaxQueued = 100;
+  static constexpr std::chrono::seconds kFlushTimeout{10};
+  // How often the idle thread checks for messages it was not woken up for.
+  static constexpr std::chrono::seconds kIdlePeriod{1};
+
+  struct Alert {
+    LogSeverity severity;
+    string dest;
+    string message;
+  };
+
+  struct Batch {
+    std::vector<Alert> alerts;
+    size_t dropped = 0;
+    string hostname;
+  };
+
+  static EmailAlerter& Get();
+
+  static std::atomic<bool> fatal_queued_;
+
+  // Sends the queued messages and stops the thread at exit, waiting for it at
+  // most kFlushTimeout.
+  static void Stop();
+
+  // Whether this is a child forked after the thread started.  The child has
+  // neither the thread nor usable condition variables and so sends the
+  // emails itself.
+  bool Forked() const { return thread_.joinable() && pid_ != getpid(); }
+  void Run();
+  // Takes the queued messages; requires mutex_.
+  Batch TakeBatch();
+  static void SendBatch(const Batch& batch);
+
+  std::mutex mutex_;
+  std::condition_variable wakeup_;
+  std::condition_variable idle_;
+  std::vector<Alert> queue_;
+  size_t dropped_ = 0;
+  string hostname_;
+  bool sending_ = false;
+  bool flush_ = false;
+  bool stop_ = false;
+  bool stopped_ = false;  // Whether Run() returned.
+  std::chrono::steady_clock::time_point last_sent_;
+  std::thread thread_;
+  int32 pid_ = 0;  // Of the process which started thread_.
+};
+
+constexpr std::chrono::seconds EmailAlerter::kFlushTimeout;
+constexpr std::chrono::seconds EmailAlerter::kIdlePeriod;
+std::atomic<bool> EmailAlerter::fatal_queued_{false};
+
+EmailAlerter& EmailAlerter::Get() {
+  // Never destroyed, since destroying the condition variables would wait
+  // forever for the thread in a forked child.
+  static EmailAlerter* alerter = new EmailAlerter;
+  return *alerter;
+}
+
+void EmailAlerter::Stop() {
+  EmailAlerter& alerter = Get();
+  std::unique_lock<std::mutex> l{alerter.mutex_};
+  if (alerter.Forked()) {
+    return;
+  }
+  alerter.stop_ = true;
+  alerter.wakeup_.notify_one();
+  const bool stopped = alerter.idle_.wait_for(
+      l, kFlushTimeout, [&alerter] { return alerter.stopped_; });
+  l.unlock();
+  if (stopped) {
+    alerter.thread_.join();
+  } else {
+    // The mailer hangs; let the thread go rather than the program.
+    alerter.thread_.detach();
+  }
+}
+
+void EmailAlerter::Send(LogSeverity severity, string dest,
+                        const string& hostname, const char* message,
+                        size_t len) {
+  EmailAlerter& alerter = Get();
+  std::unique_lock<std::mutex> l{alerter.mutex_};
+  alerter.hostname_ = hostname;
+  if (severity == GLOG_FATAL) {
+    // Sent by FlushFatal() once the caller released log_mutex.
+    alerter.queue_.push_back(
+        Alert{severity, std::move(dest), string(message, len)});
+    fatal_queued_ = true;
+    return;
+  }
+  if (alerter.Forked()) {
+    Batch batch = alerter.TakeBatch();
+    l.unlock();
+    batch.alerts.push_back(
+        Alert{severity, std::move(dest), string(message, len)});
+    SendBatch(batch);
+    return;
+  }
+  if (alerter.queue_.size() >= kMaxQueued) {
+    ++alerter.dropped_;
+    return;
+  }
+  alerter.queue_.push_back(
+      Alert{severity, std::move(dest), string(message, len)});
+  if (!alerter.thread_.joinable()) {
+    alerter.pid_ = getpid();
+    alerter.thread_ = std::thread(&EmailAlerter::Run, &alerter);
+    std::atexit(&EmailAlerter::Stop);
+  }
+  l.unlock();
+  alerter.wakeup_.notify_one();
+}
+
+void EmailAlerter::Flush() {
+  EmailAlerter& alerter = Get();
+  std::unique_lock<std::mutex> l{alerter.mutex_};
+  if (!alerter.thread_.joinable() || alerter.Forked()) {
+    const Batch batch = alerter.TakeBatch();
+    l.unlock();
+    if (!batch.alerts.empty()) {
+      SendBatch(batch);
+    }
+    return;
+  }
+  alerter.flush_ = true;
+  alerter.wakeup_.notify_one();
+  alerter.idle_.wait_for(l, kFlushTimeout, [&alerter] {
+    return alerter.queue_.empty() && !alerter.sending_;
+  });
+  alerter.flush_ = false;
+}
+
+EmailAlerter::Batch EmailAlerter::TakeBatch() {
+  Batch batch;
+  batch.alerts.swap(queue_);
+  batch.dropped = dropped_;
+  batch.hostname = hostname_;
+  dropped_ = 0;
+  return batch;
+}
+
+void EmailAlerter::Run() {
+  std::unique_lock<std::mutex> l{mutex_};
+  for (;;) {
+    if (queue_.empty()) {
+      if (stop_) {
+        break;
+      }
+      wakeup_.wait_for(l, kIdlePeriod);
+      continue;
+    }
+    // Coalesce the messages logged until the next email is due.
+    const auto due = last_sent_ + std::chrono::seconds(FLAGS_logemailsecs);
+    wakeup_.wait_until(l, due, [this] { return stop_ || flush_; });
+
+    const Batch batch = TakeBatch();
+    sending_ = true;
+    l.unlock();
+    SendBatch(batch);
+    l.lock();
+    sending_ = false;
+    last_sent_ = std::chrono::steady_clock::now();
+    idle_.notify_all();
+  }
+  stopped_ = true;
+  idle_.notify_all();
+}
+
+void EmailAlerter::SendBatch(const Batch& batch) {
+  // Emails the messages of each destination in the order they were logged.
+  std::vector<bool> sent(batch.alerts.size());
+  for (size_t i = 0; i < batch.alerts.size(); ++i) {
+    if (sent[i]) {
+      continue;
+    }
+    const string& dest = batch.alerts[i].dest;
+    LogSeverity severity = batch.alerts[i].severity;
+    size_t count = 0;
+    string body(batch.hostname);
+    body += "\n\n";
+    for (size_t j = i; j < batch.alerts.size(); ++j) {
+      if (batch.alerts[j].dest == dest) {
+        severity = std::max(severity, batch.alerts[j].severity);
+        body += batch.alerts[j].message;
+        sent[j] = true;
+        ++count;
+      }
+    }
+    if (batch.dropped > 0) {
+      body += std::to_string(batch.dropped) +
+              " more messages were not emailed because too many were queued\n";
+    }
+    string subject(string("[LOG] ") + LogSeverityNames[severity] + ": " +
+                   glog_internal_namespace_::ProgramInvocationShortName());
+    if (count > 1) {
+      subject += " (" + std::to_string(count) + " messages)";
+    }
+    // Don't log the failures, as this may well be about an email failure.
+    SendEmailInternal(dest.c_str(), subject.c_str(), body.c_str(), false);
+  }
+}
+
 inline void LogDestination::MaybeLogToEmail(LogSeverity severity,
                                             const char* message, size_t len) {
   if (severity >= email_logging_severity_ || severity >= FLAGS_logemaillevel) {
@@ -802,18 +1580,9 @@ inline void LogDestination::MaybeLogToEmail(LogSeverity severity,
       }
       to += addresses_;
     }
-    const string subject(
-        string("[LOG] ") + LogSeverityNames[severity] + ": " +
-        glog_internal_namespace_::ProgramInvocationShortName());
-    string body(hostname());
-    body += "\n\n";
-    body.append(message, len);
-
-    // should NOT use SendEmail().  The caller of this function holds the
-    // log_mutex and SendEmail() calls LOG/VLOG which will block trying to
-    // acquire the log_mutex object.  Use SendEmailInternal() and set
-    // use_logging to false.
-    SendEmailInternal(to.c_str(), subject.c_str(), body.c_str(), false);
+    // The caller of this function holds the log_mutex, so the email is sent
+    // in the background.
+    EmailAlerter::Send(severity, std::move(to), hostname(), message, len);
   }
 }
 
@@ -829,15 +1598,19 @@ inline void LogDestination::MaybeLogToLogfile(
 inline void LogDestination::LogToAllLogfiles(
     LogSeverity severity,
     const std::chrono::system_clock::time_point& timestamp, const char* message,
-    size_t len) {
+    size_t len, const LogMessage* log_message) {
   if (FLAGS_logtostdout) {  // global flag: never log to file
-    ColoredWriteToStdout(severity, message, len);
+    const char* text = Encode(stderr_encoder_, log_message, message, &len);
+    ColoredWriteToStdout(severity, text, len);
   } else if (FLAGS_logtostderr) {  // global flag: never log to file
-    ColoredWriteToStderr(severity, message, len);
+    const char* text = Encode(stderr_encoder_, log_message, message, &len);
+    ColoredWriteToStderr(severity, text, len);
   } else {
     for (int i = severity; i >= 0; --i) {
+      size_t text_len = len;
+      const char* text = Encode(encoders_[i], log_message, message, &text_len);
       LogDestination::MaybeLogToLogfile(static_cast<LogSeverity>(i), timestamp,
-                                        message, len);
+                                        text, text_len);
     }
   }
 }
@@ -847,13 +1620,40 @@ inline void LogDestination::LogToSinks(LogSeverity severity,
                                        const char* base_filename, int line,
                                        const LogMessageTime& time,
                                        const char* message,
-                                       size_t message_len) {
+                                       size_t message_len,
+                                       const LogFields& fields) {
+  LogToSystemLogs(severity, full_filename, base_filename, line, time, message,
+                  message_len, fields);
   std::shared_lock<SinkMutex> l{sink_mutex_};
   if (sinks_) {
     for (size_t i = sinks_->size(); i-- > 0;) {
-      (*sinks_)[i]->send(severity, full_filename, base_filename, line, time,
-                         message, message_len);
+      (*sinks_)[i]->SendWithFields(severity, full_filename, base_filename,
+                                   line, time, message, message_len, fields);
+    }
+  }
+}
+
+inline void LogDestination::LogToSystemLogs(
+    LogSeverity severity, const char* full_filename, const char* base_filename,
+    int line, const LogMessageTime& time, const char* message,
+    size_t message_len, const LogFields& fields) {
+  if (FLAGS_logtojournald) {
+    if (journald_sink_ == nullptr ||
+        journald_socket_ != FLAGS_journald_socket) {
+      journald_socket_ = FLAGS_journald_socket;
+      journald_sink_ =
+          std::make_unique<JournaldLogSink>(journald_socket_.c_str());
+    }
+    journald_sink_->SendWithFields(severity, full_filename, base_filename,
+                                   line, time, message, message_len, fields);
+  }
+  if (FLAGS_logtosyslog) {
+    if (syslog_sink_ == nullptr || syslog_socket_ != FLAGS_syslog_socket) {
+      syslog_socket_ = FLAGS_syslog_socket;
+      syslog_sink_ = std::make_unique<SyslogLogSink>(syslog_socket_.c_str());
     }
+    syslog_sink_->SendWithFields(severity, full_filename, base_filename, line,
+                                 time, message, message_len, fields);
   }
 }
 
@@ -890,6 +1690,8 @@ void LogDestination::DeleteLogDestinations() {
   }
   SinkLock l{sink_mutex_};
   sinks_.reset();
+  journald_sink_.reset();
+  syslog_sink_.reset();
 }
 
 namespace {
@@ -1493,31 +2295,543 @@ bool LogCleaner::IsLogLastModifiedOver(
   return false;
 }
 
-}  // namespace
-
-// Static log data space to avoid alloc failures in a LOG(FATAL)
+// Log volume governor, enabled by --log_rate_limit_bytes.
 //
-// Since multiple threads may call LOG(FATAL), and we want to preserve
-// the data from the first call, we allocate two sets of space.  One
-// for exclusive use by the first thread, and one for shared use by
-// all other threads.
-static std::mutex fatal_msg_lock;
-static logging::internal::CrashReason crash_reason;
-static bool fatal_msg_exclusive = true;
-static logging::internal::LogMessageData fatal_msg_data_exclusive;
-static logging::internal::LogMessageData fatal_msg_data_shared;
+// The shared pool holds at most one second worth of byte budget and is
+// refilled continuously.  Threads withdraw the budget in slices and spend it
+// locally, so that in the common case a message touches no shared state.
+// INFO messages may not withdraw the last quarter of the pool, which is kept
+// for WARNING.  ERROR and FATAL messages are never shed.  While the pool is
+// under pressure, a call site that has used more than its fair share of the
+// budget in the current second is shed before quieter sites get their turn.
+// Call sites are tracked per thread, so the fair share applies to what a site
+// logs from each thread rather than from all of them.
+//
+// What was shed is summarized at most every --log_rate_limit_summary_secs,
+// and on FlushLogFiles() and ShutdownGoogleLogging().  Threads publish what
+// they shed when they refill, flush or exit.
+class LogGovernor {
+ public:
+  // Returns true if a message of the given size from file:line may be
+  // logged at time now_ns (nanoseconds since the epoch).
+  static bool Admit(LogSeverity severity, const char* file, int line,
+                    size_t bytes, int64 now_ns);
 
-#ifdef GLOG_THREAD_LOCAL_STORAGE
-// Static thread-local log data space to use, because typically at most one
-// LogMessageData object exists (in this case glog makes zero heap memory
-// allocations).
-static thread_local bool thread_data_available = true;
+  // Logs the summary of what was shed so far, if anything.
+  static void Flush(int64 now_ns);
 
-#  if defined(__cpp_lib_byte) && __cpp_lib_byte >= 201603L
-// std::aligned_storage is deprecated in C++23
-alignas(logging::internal::LogMessageData) static thread_local std::byte
-    thread_msg_data[sizeof(logging::internal::LogMessageData)];
-#  else   // !(defined(__cpp_lib_byte) && __cpp_lib_byte >= 201603L)
+ private:
+  // Number of slices the budget is handed out in.
+  static constexpr int64 kSlices = 32;
+  // Maximum fraction (1/kSiteShare) of the budget a single call site may
+  // use per second while the pool is under pressure.
+  static constexpr int64 kSiteShare = 8;
+  // Number of call sites tracked per thread.
+  static constexpr size_t kSites = 64;
+  static constexpr int64 kNanosPerSec = 1000000000;
+
+  struct Site {
+    const char* file;
+    int line;
+    int64 second;  // The second |bytes| were accounted in.
+    int64 bytes;
+    int64 shed;
+  };
+
+  struct ThreadState {
+    int64 tokens;        // Budget this thread may spend without refilling.
+    int64 retry_ns;      // Don't try to refill before this time.
+    int64 publish_ns;    // Don't publish shed messages before this time.
+    bool pressure;       // Pool was below half at the last refill.
+    bool summarizing;    // Currently logging the summary.
+    int64 shed_messages[NUM_SEVERITIES];
+    int64 shed_bytes;
+    Site sites[kSites];
+
+    // Publishes what the exiting thread shed.
+    ~ThreadState();
+  };
+
+  static Site* FindSite(ThreadState& state, const char* file, int line);
+  static bool Refill(ThreadState& state, LogSeverity severity, int64 budget,
+                     int64 now_ns, string* summary);
+  // Adds what state shed to the shared counts, and formats their summary
+  // into *summary if it is due or force is set.  Requires mutex_.
+  static void Publish(ThreadState& state, int64 budget, int64 now_ns,
+                      bool force, string* summary);
+
+  // Shared state, protected by mutex_.
+  static std::mutex mutex_;
+  static int64 pool_;
+  static int64 last_refill_ns_;
+  static int64 last_summary_ns_;
+  static int64 shed_messages_[NUM_SEVERITIES];
+  static int64 shed_bytes_;
+  static const char* top_file_;
+  static int top_line_;
+  static int64 top_shed_;
+#ifdef GLOG_THREAD_LOCAL_STORAGE
+  static thread_local ThreadState state_;
+#else
+  // Without thread-local storage all threads share a single state, which
+  // Admit() then has to protect with mutex_.
+  static ThreadState state_;
+#endif
+};
+
+std::mutex LogGovernor::mutex_;
+int64 LogGovernor::pool_ = 0;
+int64 LogGovernor::last_refill_ns_ = 0;
+int64 LogGovernor::last_summary_ns_ = 0;
+int64 LogGovernor::shed_messages_[NUM_SEVERITIES] = {0, 0, 0, 0};
+int64 LogGovernor::shed_bytes_ = 0;
+const char* LogGovernor::top_file_ = nullptr;
+int LogGovernor::top_line_ = 0;
+int64 LogGovernor::top_shed_ = 0;
+#ifdef GLOG_THREAD_LOCAL_STORAGE
+thread_local LogGovernor::ThreadState LogGovernor::state_;
+#else
+LogGovernor::ThreadState LogGovernor::state_;
+#endif
+
+LogGovernor::Site* LogGovernor::FindSite(ThreadState& state, const char* file,
+                                         int line) {
+  // Call sites are identified by the address of their (static) file name and
+  // their line, so hashing these never touches the file name itself.
+  size_t h = reinterpret_cast<uintptr_t>(file) ^
+             static_cast<size_t>(line) * 0x9e3779b1U;
+  Site* site = &state.sites[(h ^ (h >> 7)) % kSites];
+  if (site->file != file || site->line != line) {
+    // Evict whatever was there: the table is a cache, not an exact count.
+    site->file = file;
+    site->line = line;
+    site->second = 0;
+    site->bytes = 0;
+    site->shed = 0;
+  }
+  return site;
+}
+
+LogGovernor::ThreadState::~ThreadState() {
+#ifdef GLOG_THREAD_LOCAL_STORAGE
+  std::lock_guard<std::mutex> l{mutex_};
+#endif
+  Publish(*this, 0, 0, false, nullptr);
+}
+
+void LogGovernor::Publish(ThreadState& state, int64 budget, int64 now_ns,
+                          bool force, string* summary) {
+  Site* top = nullptr;
+  for (Site& site : state.sites) {
+    if (site.shed > 0 && (top == nullptr || site.shed > top->shed)) {
+      top = &site;
+    }
+  }
+  if (top != nullptr && top->shed > top_shed_) {
+    top_file_ = top->file;
+    top_line_ = top->line;
+    top_shed_ = top->shed;
+  }
+  for (Site& site : state.sites) {
+    site.shed = 0;
+  }
+  for (int i = 0; i < NUM_SEVERITIES; ++i) {
+    shed_messages_[i] += state.shed_messages[i];
+    state.shed_messages[i] = 0;
+  }
+  shed_bytes_ += state.shed_bytes;
+  state.shed_bytes = 0;
+
+  if (summary == nullptr) {
+    return;
+  }
+  const int64 summary_ns =
+      static_cast<int64>(FLAGS_log_rate_limit_summary_secs) * kNanosPerSec;
+  int64 shed_total = 0;
+  for (int64 shed : shed_messages_) {
+    shed_total += shed;
+  }
+  if (shed_total > 0 && (force || now_ns - last_summary_ns_ >= summary_ns)) {
+    std::ostringstream os;
+    os << "Log rate limit of " << budget << " bytes/s exceeded: shed "
+       << shed_total << " messages (" << shed_bytes_ << " bytes) in the last "
+       << (now_ns - last_summary_ns_) / 1000000 << " ms;";
+    for (int i = 0; i < NUM_SEVERITIES; ++i) {
+      if (shed_messages_[i] > 0) {
+        os << ' ' << LogSeverityNames[i] << '=' << shed_messages_[i];
+      }
+      shed_messages_[i] = 0;
+    }
+    if (top_file_ != nullptr) {
+      os << "; noisiest site " << const_basename(top_file_) << ':' << top_line_;
+    }
+    *summary = os.str();
+    shed_bytes_ = 0;
+    top_file_ = nullptr;
+    top_line_ = 0;
+    top_shed_ = 0;
+    last_summary_ns_ = now_ns;
+  }
+}
+
+bool LogGovernor::Refill(ThreadState& state, LogSeverity severity,
+                         int64 budget, int64 now_ns, string* summary) {
+#ifdef GLOG_THREAD_LOCAL_STORAGE
+  std::lock_guard<std::mutex> l{mutex_};
+#endif
+
+  if (last_refill_ns_ == 0 || now_ns - last_refill_ns_ >= kNanosPerSec) {
+    pool_ = budget;
+  } else if (now_ns > last_refill_ns_) {
+    pool_ = std::min(budget, pool_ + (now_ns - last_refill_ns_) * budget /
+                                         kNanosPerSec);
+  }
+  if (now_ns > last_refill_ns_) {
+    last_refill_ns_ = now_ns;
+  }
+  if (last_summary_ns_ == 0) {
+    last_summary_ns_ = now_ns;
+  }
+
+  // Publish what this thread has shed since its last refill.
+  Publish(state, budget, now_ns, false, summary);
+
+  // Hand out a slice, but keep a reserve for WARNING messages.
+  const int64 slice = std::max<int64>(budget / kSlices, 1);
+  const int64 reserve = severity == GLOG_INFO ? budget / 4 : 0;
+  state.pressure = pool_ < budget / 2;
+  state.publish_ns = now_ns + kNanosPerSec / kSlices;
+  if (state.tokens >= slice) {
+    return true;
+  }
+  if (pool_ - reserve <= 0) {
+    // Don't come back before the pool had a chance to refill a slice.
+    state.retry_ns = now_ns + kNanosPerSec / kSlices;
+    return false;
+  }
+  const int64 granted = std::min(slice, pool_ - reserve);
+  pool_ -= granted;
+  state.tokens += granted;
+  state.retry_ns = 0;
+  return true;
+}
+
+bool LogGovernor::Admit(LogSeverity severity, const char* file, int line,
+                        size_t bytes, int64 now_ns) {
+  const int64 budget = static_cast<int64>(FLAGS_log_rate_limit_bytes);
+  if (budget == 0) {
+    return true;
+  }
+#ifndef GLOG_THREAD_LOCAL_STORAGE
+  std::unique_lock<std::mutex> l{mutex_};
+#endif
+  ThreadState& state = state_;
+  if (state.summarizing || severity >= GLOG_ERROR) {
+    return true;
+  }
+
+  const int64 size = static_cast<int64>(bytes);
+  const int64 second = now_ns / kNanosPerSec;
+  Site* site = FindSite(state, file, line);
+  if (site->second != second) {
+    site->second = second;
+    site->bytes = 0;
+  }
+
+  // Go to the shared pool when out of budget or to publish what was shed,
+  // but at most kSlices times per second each.
+  string summary;
+  if ((state.tokens < size && state.retry_ns <= now_ns) ||
+      (state.shed_bytes > 0 && state.publish_ns <= now_ns)) {
+    Refill(state, severity, budget, now_ns, &summary);
+  }
+
+  // A message larger than a slice is still admitted once the thread managed
+  // to get budget, and charged in full against later messages.
+  bool admit = !(state.pressure && site->bytes + size > budget / kSiteShare) &&
+               (state.tokens >= size ||
+                (state.tokens > 0 && size > budget / kSlices));
+  if (admit) {
+    state.tokens -= size;
+    site->bytes += size;
+  } else {
+    ++state.shed_messages[severity];
+    state.shed_bytes += size;
+    ++site->shed;
+  }
+
+  if (!summary.empty()) {
+#ifndef GLOG_THREAD_LOCAL_STORAGE
+    l.unlock();
+#endif
+    state.summarizing = true;
+    LogMessage(__FILE__, __LINE__, GLOG_WARNING).stream() << summary;
+    state.summarizing = false;
+  }
+  return admit;
+}
+
+void LogGovernor::Flush(int64 now_ns) {
+  const int64 budget = static_cast<int64>(FLAGS_log_rate_limit_bytes);
+  string summary;
+  {
+    std::lock_guard<std::mutex> l{mutex_};
+    ThreadState& state = state_;
+    if (state.summarizing) {
+      return;
+    }
+    if (last_summary_ns_ == 0) {
+      last_summary_ns_ = now_ns;
+    }
+    Publish(state, budget, now_ns, true, &summary);
+  }
+  if (!summary.empty()) {
+    ThreadState& state = state_;
+    state.summarizing = true;
+    LogMessage(__FILE__, __LINE__, GLOG_WARNING).stream() << summary;
+    state.summarizing = false;
+  }
+}
+
+// Duplicate message coalescing, enabled by --log_dedup_window_ms.
+//
+// Each thread remembers the last message of up to kSlots call sites by a
+// hash of its text.  An exact repeat from the same site within the window
+// is suppressed and counted.  Once the window expired, or the site logged
+// something else, a single line reporting the number of repeats is logged
+// from the same site.  FlushLogFiles() and ShutdownGoogleLogging() also
+// report the repeats still counted by all threads, including those which
+// exited since.  FATAL messages are never suppressed.
+class LogDeduplicator {
+ public:
+  // Returns true if the message body should be logged.
+  static bool Admit(LogSeverity severity, const char* file, int line,
+                    const char* body, size_t len, int64 now_ns);
+
+  // Reports the repeats counted by all threads.
+  static void Flush();
+
+ private:
+  static constexpr size_t kSlots = 16;
+
+  struct Slot {
+    const char* file;
+    int line;
+    LogSeverity severity;
+    uint64 hash;
+    int64 first_ns;  // Time the window started.
+    int64 last_ns;   // Time of the last suppressed repeat.
+    int64 repeats;
+  };
+
+  struct ThreadState {
+    bool reporting;  // Currently logging a repeat count.
+    Slot slots[kSlots];
+#ifdef GLOG_THREAD_LOCAL_STORAGE
+    // Protects slots against Flush() from other threads.
+    std::mutex mutex;
+    bool registered;  // Whether the state is in the list of states_.
+    ThreadState* next;
+
+    // Queues the repeats of the exiting thread for the next Flush().
+    ~ThreadState();
+#endif
+  };
+
+  // Takes the repeat count of slot, to be reported by Report().
+  static void Take(Slot& slot, std::vector<Slot>* reports);
+  static void Report(ThreadState& state, const Slot& slot);
+
+#ifdef GLOG_THREAD_LOCAL_STORAGE
+  static thread_local ThreadState state_;
+  // The states of the threads which counted repeats, and the repeats of the
+  // threads which exited since the last Flush(), protected by
+  // states_mutex_.  Exiting threads do not report their repeats themselves
+  // since logging touches other thread_local objects which may already have
+  // been destroyed.  exited_ is never freed, as threads may still exit
+  // during static destruction.
+  static std::mutex states_mutex_;
+  static ThreadState* states_;
+  static std::vector<Slot>* exited_;
+#else
+  // Without thread-local storage all threads share a single state, which is
+  // protected by mutex_.  Report() re-enters Admit() while holding it.
+  static std::recursive_mutex mutex_;
+  static ThreadState state_;
+#endif
+};
+
+#ifdef GLOG_THREAD_LOCAL_STORAGE
+thread_local LogDeduplicator::ThreadState LogDeduplicator::state_;
+std::mutex LogDeduplicator::states_mutex_;
+LogDeduplicator::ThreadState* LogDeduplicator::states_ = nullptr;
+std::vector<LogDeduplicator::Slot>* LogDeduplicator::exited_ = nullptr;
+
+LogDeduplicator::ThreadState::~ThreadState() {
+  if (!registered) {
+    return;
+  }
+  std::lock_guard<std::mutex> l{states_mutex_};
+  for (ThreadState** it = &states_; *it != nullptr; it = &(*it)->next) {
+    if (*it == this) {
+      *it = next;
+      break;
+    }
+  }
+  for (Slot& slot : slots) {
+    if (slot.repeats > 0) {
+      if (exited_ == nullptr) {
+        exited_ = new std::vector<Slot>;
+      }
+      Take(slot, exited_);
+    }
+  }
+}
+#else
+std::recursive_mutex LogDeduplicator::mutex_;
+LogDeduplicator::ThreadState LogDeduplicator::state_;
+#endif
+
+void LogDeduplicator::Take(Slot& slot, std::vector<Slot>* reports) {
+  if (slot.repeats > 0) {
+    reports->push_back(slot);
+    slot.repeats = 0;
+  }
+}
+
+void LogDeduplicator::Report(ThreadState& state, const Slot& slot) {
+  const int64 span_ms = (slot.last_ns - slot.first_ns) / 1000000;
+  state.reporting = true;
+  LogMessage(slot.file, slot.line, slot.severity).stream()
+      << "Last message repeated " << slot.repeats << " times over " << span_ms
+      << " ms";
+  state.reporting = false;
+}
+
+void LogDeduplicator::Flush() {
+  std::vector<Slot> reports;
+#ifdef GLOG_THREAD_LOCAL_STORAGE
+  ThreadState& state = state_;
+  if (state.reporting) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> l{states_mutex_};
+    if (exited_ != nullptr) {
+      reports.swap(*exited_);
+    }
+    for (ThreadState* other = states_; other != nullptr; other = other->next) {
+      std::lock_guard<std::mutex> slots_lock{other->mutex};
+      for (Slot& slot : other->slots) {
+        Take(slot, &reports);
+      }
+    }
+  }
+#else
+  std::lock_guard<std::recursive_mutex> l{mutex_};
+  ThreadState& state = state_;
+  if (state.reporting) {
+    return;
+  }
+  for (Slot& slot : state.slots) {
+    Take(slot, &reports);
+  }
+#endif
+  for (const Slot& slot : reports) {
+    Report(state, slot);
+  }
+}
+
+bool LogDeduplicator::Admit(LogSeverity severity, const char* file, int line,
+                            const char* body, size_t len, int64 now_ns) {
+  const int64 window_ns =
+      static_cast<int64>(FLAGS_log_dedup_window_ms) * 1000000;
+  if (window_ns <= 0 || severity == GLOG_FATAL) {
+    return true;
+  }
+#ifndef GLOG_THREAD_LOCAL_STORAGE
+  std::lock_guard<std::recursive_mutex> l{mutex_};
+#endif
+  ThreadState& state = state_;
+  if (state.reporting) {
+    return true;
+  }
+#ifdef GLOG_THREAD_LOCAL_STORAGE
+  if (!state.registered) {
+    std::lock_guard<std::mutex> states_lock{states_mutex_};
+    state.next = states_;
+    states_ = &state;
+    state.registered = true;
+  }
+  std::unique_lock<std::mutex> slots_lock{state.mutex};
+#endif
+
+  // FNV-1a over the message body.
+  uint64 hash = UINT64_C(14695981039346656037);
+  for (size_t i = 0; i < len; ++i) {
+    hash = (hash ^ static_cast<unsigned char>(body[i])) *
+           UINT64_C(1099511628211);
+  }
+
+  size_t h = reinterpret_cast<uintptr_t>(file) ^
+             static_cast<size_t>(line) * 0x9e3779b1U;
+  Slot& slot = state.slots[(h ^ (h >> 7)) % kSlots];
+  if (slot.file == file && slot.line == line && slot.hash == hash &&
+      now_ns - slot.first_ns < window_ns) {
+    ++slot.repeats;
+    slot.last_ns = now_ns;
+    return false;
+  }
+
+  // Report the repeats this slot is about to forget, and those of any other
+  // site whose window has expired by now.
+  std::vector<Slot> reports;
+  for (Slot& other : state.slots) {
+    if (&other == &slot || now_ns - other.first_ns >= window_ns) {
+      Take(other, &reports);
+    }
+  }
+  slot.file = file;
+  slot.line = line;
+  slot.severity = severity;
+  slot.hash = hash;
+  slot.first_ns = now_ns;
+  slot.last_ns = now_ns;
+  slot.repeats = 0;
+#ifdef GLOG_THREAD_LOCAL_STORAGE
+  slots_lock.unlock();
+#endif
+  for (const Slot& report : reports) {
+    Report(state, report);
+  }
+  return true;
+}
+
+}  // namespace
+
+// Static log data space to avoid alloc failures in a LOG(FATAL)
+//
+// Since multiple threads may call LOG(FATAL), and we want to preserve
+// the data from the first call, we allocate two sets of space.  One
+// for exclusive use by the first thread, and one for shared use by
+// all other threads.
+static std::mutex fatal_msg_lock;
+static logging::internal::CrashReason crash_reason;
+static bool fatal_msg_exclusive = true;
+static logging::internal::LogMessageData fatal_msg_data_exclusive;
+static logging::internal::LogMessageData fatal_msg_data_shared;
+
+#ifdef GLOG_THREAD_LOCAL_STORAGE
+// Static thread-local log data space to use, because typically at most one
+// LogMessageData object exists (in this case glog makes zero heap memory
+// allocations).
+static thread_local bool thread_data_available = true;
+
+#  if defined(__cpp_lib_byte) && __cpp_lib_byte >= 201603L
+// std::aligned_storage is deprecated in C++23
+alignas(logging::internal::LogMessageData) static thread_local std::byte
+    thread_msg_data[sizeof(logging::internal::LogMessageData)];
+#  else   // !(defined(__cpp_lib_byte) && __cpp_lib_byte >= 201603L)
 static thread_local std::aligned_storage<
     sizeof(logging::internal::LogMessageData),
     alignof(logging::internal::LogMessageData)>::type thread_msg_data;
@@ -1525,7 +2839,54 @@ static thread_local std::aligned_storage<
 #endif    // defined(GLOG_THREAD_LOCAL_STORAGE)
 
 logging::internal::LogMessageData::LogMessageData()
-    : stream_(message_text_, LogMessage::kMaxLogMessageLen, 0) {}
+    : stream_(message_text_, LogMessage::kMaxLogMessageLen, this) {}
+
+logging::internal::LogMessageData* LogMessage::LogStream::message_data() {
+  return logging::internal::MessageData(*this);
+}
+
+void LogMessage::LogStream::AddField(logging::internal::LogMessageData* data,
+                                     const LogField& field) {
+  const size_t key_size = strlen(field.key()) + 1;
+  if (data->num_fields_ == data->kMaxFields ||
+      data->field_text_size_ + key_size > data->kMaxFieldText) {
+    return;
+  }
+  char* const key = data->field_text_ + data->field_text_size_;
+  memcpy(key, field.key(), key_size);
+  data->field_text_size_ += key_size;
+  LogField& copy = data->fields_[data->num_fields_++];
+  switch (field.type()) {
+    case LogField::kBool:
+      copy = LogField(key, field.bool_value());
+      break;
+    case LogField::kInt:
+      copy = LogField(key, field.int_value());
+      break;
+    case LogField::kUInt:
+      copy = LogField(key, field.uint_value());
+      break;
+    case LogField::kDouble:
+      copy = LogField(key, field.double_value());
+      break;
+    case LogField::kString: {
+      // Truncate the string to the remaining space, if any.
+      const char* value = key + key_size - 1;  // The empty string.
+      size_t size = 0;
+      if (data->field_text_size_ < data->kMaxFieldText) {
+        char* const text = data->field_text_ + data->field_text_size_;
+        size = std::min(field.string_size(),
+                        data->kMaxFieldText - data->field_text_size_ - 1);
+        memcpy(text, field.string_value(), size);
+        text[size] = '\0';
+        data->field_text_size_ += size + 1;
+        value = text;
+      }
+      copy = LogField(key, value, size);
+      break;
+    }
+  }
+}
 
 LogMessage::LogMessage(const char* file, int line, LogSeverity severity,
                        int64 ctr, void (LogMessage::*send_method)())
@@ -1534,6 +2895,27 @@ LogMessage::LogMessage(const char* file, int line, LogSeverity severity,
   data_->stream_.set_ctr(ctr);
 }
 
+// The messages of failing checks are formatted into this buffer rather than
+// into allocated strings, since checks may fail when memory is exhausted or
+// inside an allocator.  A check claims it until its message is copied into
+// the fatal log message.
+static char check_op_buffer[LogMessage::kMaxLogMessageLen + 1];
+static std::atomic<bool> check_op_buffer_claimed{false};
+
+static char* ClaimCheckOpBuffer() {
+  return check_op_buffer_claimed.exchange(true, std::memory_order_acquire)
+             ? nullptr
+             : check_op_buffer;
+}
+
+// Releases the buffer once the message of result is no longer needed.
+static void ReleaseCheckOpMessage(
+    const logging::internal::CheckOpMessage& result) {
+  if (result.str_ == check_op_buffer) {
+    check_op_buffer_claimed.store(false, std::memory_order_release);
+  }
+}
+
 LogMessage::LogMessage(const char* file, int line,
                        const logging::internal::CheckOpString& result)
     : allocated_(nullptr) {
@@ -1541,6 +2923,14 @@ LogMessage::LogMessage(const char* file, int line,
   stream() << "Check failed: " << (*result.str_) << " ";
 }
 
+LogMessage::LogMessage(const char* file, int line,
+                       const logging::internal::CheckOpMessage& result)
+    : allocated_(nullptr) {
+  Init(file, line, GLOG_FATAL, &LogMessage::SendToLog);
+  stream() << "Check failed: " << result.str_ << " ";
+  ReleaseCheckOpMessage(result);
+}
+
 LogMessage::LogMessage(const char* file, int line) : allocated_(nullptr) {
   Init(file, line, GLOG_INFO, &LogMessage::SendToLog);
 }
@@ -1619,12 +3009,20 @@ void LogMessage::Init(const char* file, int line, LogSeverity severity,
   data_->fullname_ = file;
   data_->has_been_flushed_ = false;
   data_->thread_id_ = std::this_thread::get_id();
+  data_->num_message_chars_ = 0;
+  data_->num_fields_ = 0;
+  data_->field_text_size_ = 0;
+  data_->sequence_budget_ = logging::internal::SequenceBudgetState();
 
   // If specified, prepend a prefix to each line.  For example:
   //    I20201018 160715 f5d4fbb0 logging.cc:1153]
   //    (log level, GMT year, month, date, time, thread_id, file basename, line)
   // We exclude the thread_id for the default thread.
-  if (FLAGS_log_prefix && (line != kNoLogPrefix)) {
+  if (FLAGS_log_prefix && (line != kNoLogPrefix) &&
+      g_prefix_formatter != nullptr &&
+      g_prefix_formatter->writes_into_buffer()) {
+    (*g_prefix_formatter)(stream(), *this);
+  } else if (FLAGS_log_prefix && (line != kNoLogPrefix)) {
     std::ios saved_fmt(nullptr);
     saved_fmt.copyfmt(stream());
     stream().fill('0');
@@ -1641,7 +3039,6 @@ void LogMessage::Init(const char* file, int line, LogSeverity severity,
                << ':' << data_->line_ << "] ";
     } else {
       (*g_prefix_formatter)(stream(), *this);
-      stream() << " ";
     }
     stream().copyfmt(saved_fmt);
   }
@@ -1668,6 +3065,21 @@ const std::thread::id& LogMessage::thread_id() const noexcept {
 const char* LogMessage::fullname() const noexcept { return data_->fullname_; }
 const char* LogMessage::basename() const noexcept { return data_->basename_; }
 const LogMessageTime& LogMessage::time() const noexcept { return time_; }
+LogFields LogMessage::fields() const noexcept {
+  return LogFields(data_->fields_, data_->num_fields_);
+}
+const char* LogMessage::message_text() const noexcept {
+  return data_->message_text_ + data_->num_prefix_chars_;
+}
+size_t LogMessage::message_text_size() const noexcept {
+  return data_->num_message_chars_;
+}
+const char* LogMessage::formatted_text() const noexcept {
+  return data_->message_text_;
+}
+size_t LogMessage::formatted_text_size() const noexcept {
+  return data_->num_chars_to_log_;
+}
 
 LogMessage::~LogMessage() noexcept(false) {
   Flush();
@@ -1706,18 +3118,52 @@ LogMessage::~LogMessage() noexcept(false) {
 
 int LogMessage::preserved_errno() const { return data_->preserved_errno_; }
 
-ostream& LogMessage::stream() { return data_->stream_; }
+LogMessage::LogStream& LogMessage::stream() { return data_->stream_; }
+
+// The size of the message given to sinks: the message without the log prefix,
+// the fields and the trailing '\n'.
+static size_t SinkMessageSize(const logging::internal::LogMessageData& data) {
+  const char* message = data.message_text_ + data.num_prefix_chars_;
+  size_t size = data.num_message_chars_;
+  if (size > 0 && message[size - 1] == '\n') {
+    --size;
+  }
+  return size;
+}
 
 // Flush buffered message, called by the destructor, or any other function
 // that needs to synchronize the log.
 void LogMessage::Flush() {
-  if (data_->has_been_flushed_ || data_->severity_ < FLAGS_minloglevel) {
+  // Messages suppressed by --minloglevel are only recorded, as are those sent
+  // to the flight recorder by LOG() and VLOG().
+  const bool suppressed = data_->severity_ < FLAGS_minloglevel;
+  const bool recorded_only =
+      data_->send_method_ == &LogMessage::SendToFlightRecorder ||
+      (suppressed && FLAGS_flight_recorder_v >= 0);
+  if (data_->has_been_flushed_ || (suppressed && !recorded_only)) {
     return;
   }
 
   data_->num_chars_to_log_ = data_->stream_.pcount();
-  data_->num_chars_to_syslog_ =
+  data_->num_message_chars_ =
       data_->num_chars_to_log_ - data_->num_prefix_chars_;
+  if (data_->num_fields_ > 0) {
+    // Append the fields in the text format, leaving room for '\n' and '\0'.
+    EncodeBuffer fields(
+        data_->message_text_ + data_->num_chars_to_log_,
+        LogMessage::kMaxLogMessageLen - 1 - data_->num_chars_to_log_);
+    AppendTextFields(&fields, this->fields());
+    data_->num_chars_to_log_ += fields.size();
+  }
+  // syslog() gets the message without the fields, as the sinks do.
+  data_->num_chars_to_syslog_ = data_->num_message_chars_;
+  RecordInFlightRecorder(data_->severity_, data_->basename_, data_->line_,
+                         time_, data_->message_text_ + data_->num_prefix_chars_,
+                         data_->num_chars_to_log_ - data_->num_prefix_chars_);
+  if (recorded_only) {
+    data_->has_been_flushed_ = true;
+    return;
+  }
 
   // Do we need to add a \n to the end of this message?
   bool append_newline =
@@ -1735,6 +3181,29 @@ void LogMessage::Flush() {
   }
   data_->message_text_[data_->num_chars_to_log_] = '\0';
 
+  // Drop the message if it repeats the previous one from this site or exceeds
+  // the log volume budget.  Messages that are captured into strings, vectors
+  // or sent to explicit sinks are neither coalesced nor governed.
+  if (data_->send_method_ == &LogMessage::SendToLog ||
+      data_->send_method_ == &LogMessage::SendToSyslogAndLog) {
+    const int64 now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                             time_.when().time_since_epoch())
+                             .count();
+    if (!LogDeduplicator::Admit(
+            data_->severity_, data_->fullname_, data_->line_,
+            data_->message_text_ + data_->num_prefix_chars_,
+            data_->num_chars_to_log_ - data_->num_prefix_chars_, now_ns) ||
+        !LogGovernor::Admit(data_->severity_, data_->fullname_, data_->line_,
+                            data_->num_chars_to_log_, now_ns)) {
+      if (append_newline) {
+        data_->message_text_[data_->num_chars_to_log_ - 1] =
+            original_final_char;
+      }
+      data_->has_been_flushed_ = true;
+      return;
+    }
+  }
+
   // Prevent any subtle race conditions by wrapping a mutex lock around
   // the actual logging action per se.
   {
@@ -1743,6 +3212,10 @@ void LogMessage::Flush() {
     ++num_messages_[static_cast<int>(data_->severity_)];
   }
   LogDestination::WaitForSinks(data_);
+  if (data_->severity_ == GLOG_FATAL) {
+    // Send the email of a FATAL message, now that log_mutex is released.
+    EmailAlerter::FlushFatal();
+  }
 
   if (append_newline) {
     // Fix the ostrstream back how it was before we screwed with it.
@@ -1803,34 +3276,35 @@ void LogMessage::SendToLog() EXCLUSIVE_LOCKS_REQUIRED(log_mutex) {
   // file if we haven't parsed the command line flags to get the
   // program name.
   if (FLAGS_logtostderr || FLAGS_logtostdout || !IsGoogleLoggingInitialized()) {
+    size_t len = data_->num_chars_to_log_;
+    const char* text = LogDestination::Encode(
+        LogDestination::stderr_encoder_, this, data_->message_text_, &len);
     if (FLAGS_logtostdout) {
-      ColoredWriteToStdout(data_->severity_, data_->message_text_,
-                           data_->num_chars_to_log_);
+      ColoredWriteToStdout(data_->severity_, text, len);
     } else {
-      ColoredWriteToStderr(data_->severity_, data_->message_text_,
-                           data_->num_chars_to_log_);
+      ColoredWriteToStderr(data_->severity_, text, len);
     }
 
     // this could be protected by a flag if necessary.
     LogDestination::LogToSinks(
         data_->severity_, data_->fullname_, data_->basename_, data_->line_,
         time_, data_->message_text_ + data_->num_prefix_chars_,
-        (data_->num_chars_to_log_ - data_->num_prefix_chars_ - 1));
+        SinkMessageSize(*data_), fields());
   } else {
     // log this message to all log files of severity <= severity_
     LogDestination::LogToAllLogfiles(data_->severity_, time_.when(),
                                      data_->message_text_,
-                                     data_->num_chars_to_log_);
+                                     data_->num_chars_to_log_, this);
 
     LogDestination::MaybeLogToStderr(data_->severity_, data_->message_text_,
                                      data_->num_chars_to_log_,
-                                     data_->num_prefix_chars_);
+                                     data_->num_prefix_chars_, this);
     LogDestination::MaybeLogToEmail(data_->severity_, data_->message_text_,
                                     data_->num_chars_to_log_);
     LogDestination::LogToSinks(
         data_->severity_, data_->fullname_, data_->basename_, data_->line_,
         time_, data_->message_text_ + data_->num_prefix_chars_,
-        (data_->num_chars_to_log_ - data_->num_prefix_chars_ - 1));
+        SinkMessageSize(*data_), fields());
     // NOTE: -1 removes trailing \n
   }
 
@@ -1850,6 +3324,7 @@ void LogMessage::SendToLog() EXCLUSIVE_LOCKS_REQUIRED(log_mutex) {
       memcpy(fatal_message, data_->message_text_, copy);
       fatal_message[copy] = '\0';
       fatal_time = time_.when();
+      WriteFlightRecorderOnCrash(&WriteToStderr);
     }
 
     if (!FLAGS_logtostderr && !FLAGS_logtostdout) {
@@ -1885,8 +3360,46 @@ NullStream::NullStream() : LogMessage::LogStream(message_buffer_, 2, 0) {}
 NullStream::NullStream(const char* /*file*/, int /*line*/,
                        const logging::internal::CheckOpString& /*result*/)
     : LogMessage::LogStream(message_buffer_, 2, 0) {}
+NullStream::NullStream(const char* /*file*/, int /*line*/,
+                       const logging::internal::CheckOpMessage& result)
+    : LogMessage::LogStream(message_buffer_, 2, 0) {
+  ReleaseCheckOpMessage(result);
+}
 NullStream& NullStream::stream() { return *this; }
 
+namespace logging {
+namespace internal {
+namespace {
+// A NullStream in a failed state, so that insertions return right away
+// instead of formatting their arguments.
+class SuppressedStream : public NullStream {
+ public:
+  SuppressedStream() { setstate(std::ios_base::badbit); }
+};
+}  // namespace
+
+int SequenceBudgetIndex() {
+  static const int index = std::ios_base::xalloc();
+  return index;
+}
+
+SequenceBudgetState* MessageSequenceBudget(std::ostream& out) {
+  LogMessageData* data = MessageData(out);
+  return data != nullptr ? &data->sequence_budget_ : nullptr;
+}
+
+NullStream& SuppressedLogStream() {
+#ifdef GLOG_THREAD_LOCAL_STORAGE
+  static thread_local SuppressedStream stream;
+#else
+  // Shared by all threads.  Nothing is ever stored in its buffer.
+  static SuppressedStream stream;
+#endif
+  return stream;
+}
+}  // namespace internal
+}  // namespace logging
+
 NullStreamFatal::~NullStreamFatal() {
   // Cannot use g_logging_fail_func here as it may output the backtrace which
   // would be inconsistent with NullStream behavior.
@@ -1905,10 +3418,10 @@ void LogMessage::SendToSink() EXCLUSIVE_LOCKS_REQUIRED(log_mutex) {
     RAW_DCHECK(data_->num_chars_to_log_ > 0 &&
                    data_->message_text_[data_->num_chars_to_log_ - 1] == '\n',
                "");
-    data_->sink_->send(
+    data_->sink_->SendWithFields(
         data_->severity_, data_->fullname_, data_->basename_, data_->line_,
         time_, data_->message_text_ + data_->num_prefix_chars_,
-        (data_->num_chars_to_log_ - data_->num_prefix_chars_ - 1));
+        SinkMessageSize(*data_), fields());
   }
 }
 
@@ -1946,6 +3459,9 @@ void LogMessage::WriteToStringAndLog() EXCLUSIVE_LOCKS_REQUIRED(log_mutex) {
   SendToLog();
 }
 
+// Flush() records the message in the flight recorder and sends it nowhere.
+void LogMessage::SendToFlightRecorder() {}
+
 // L >= log_mutex (callers must hold the log_mutex).
 void LogMessage::SendToSyslogAndLog() {
 #ifdef HAVE_SYSLOG_H
@@ -2010,8 +3526,22 @@ ErrnoLogMessage::~ErrnoLogMessage() {
            << "]";
 }
 
+// Logs the repeat counts and summaries held back by the deduplicator and the
+// rate limiter.
+static void FlushLogSummaries() {
+  const int64 now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           std::chrono::system_clock::now().time_since_epoch())
+                           .count();
+  LogDeduplicator::Flush();
+  LogGovernor::Flush(now_ns);
+}
+
 void FlushLogFiles(LogSeverity min_severity) {
+  FlushLogSummaries();
   LogDestination::FlushLogFiles(min_severity);
+#if !defined(GLOG_OS_WINDOWS) && defined(HAVE_UNISTD_H)
+  ConsoleWriter::Flush();
+#endif
 }
 
 void FlushLogFilesUnsafe(LogSeverity min_severity) {
@@ -2032,6 +3562,14 @@ void LogSink::WaitTillSent() {
   // noop default
 }
 
+void LogSink::SendWithFields(LogSeverity severity, const char* full_filename,
+                             const char* base_filename, int line,
+                             const LogMessageTime& time, const char* message,
+                             size_t message_len, const LogFields& /*fields*/) {
+  send(severity, full_filename, base_filename, line, time, message,
+       message_len);
+}
+
 string LogSink::ToString(LogSeverity severity, const char* file, int line,
                          const LogMessageTime& time, const char* message,
                          size_t message_len) {
@@ -2062,6 +3600,133 @@ void RemoveLogSink(LogSink* destination) {
   LogDestination::RemoveLogSink(destination);
 }
 
+LogEncoder::~LogEncoder() = default;
+
+namespace {
+
+// Appends the time of "message" in RFC 3339 format.
+void AppendTime(EncodeBuffer* out, const LogMessage& message) {
+  const LogMessageTime& time = message.time();
+  out->AppendFormat("%04d-%02d-%02dT%02d:%02d:%02d.%06ld", 1900 + time.year(),
+                    1 + time.month(), time.day(), time.hour(), time.min(),
+                    time.sec(), time.usec());
+  const long offset = static_cast<long>(time.gmtoffset().count()) / 60;
+  if (offset == 0) {
+    out->Append('Z');
+  } else {
+    out->AppendFormat("%c%02ld:%02ld", offset < 0 ? '-' : '+',
+                      std::labs(offset) / 60, std::labs(offset) % 60);
+  }
+}
+
+// Formats the thread ID of "message" into "buf" as the text format does.
+const char* FormatThreadId(const LogMessage& message, char* buf, int size) {
+  base_logging::LogStreamBuf streambuf(buf, size);
+  std::ostream stream(&streambuf);
+  stream << message.thread_id();
+  buf[streambuf.pcount()] = '\0';
+  return buf;
+}
+
+class TextEncoder : public LogEncoder {
+ public:
+  size_t Encode(const LogMessage& message, char* buf,
+                size_t size) const override {
+    EncodeBuffer out(buf, size);
+    // The text format, with the fields, is what LogMessage writes; Finish()
+    // puts back its final '\n'.
+    size_t text_size = message.formatted_text_size();
+    if (text_size > 0 && message.formatted_text()[text_size - 1] == '\n') {
+      --text_size;
+    }
+    out.Append(message.formatted_text(), text_size);
+    return out.Finish();
+  }
+};
+
+class JsonEncoder : public LogEncoder {
+ public:
+  size_t Encode(const LogMessage& message, char* buf,
+                size_t size) const override {
+    EncodeBuffer out(buf, size);
+    out.Append("{\"time\":\"");
+    AppendTime(&out, message);
+    out.Append("\",\"severity\":\"");
+    out.Append(LogSeverityNames[message.severity()]);
+    out.Append("\",\"file\":");
+    AppendJsonString(&out, message.basename(), strlen(message.basename()));
+    out.AppendFormat(",\"line\":%d,\"thread\":\"", message.line());
+    char thread_id[32];
+    out.Append(FormatThreadId(message, thread_id, sizeof(thread_id)));
+    out.Append("\",\"message\":");
+    AppendJsonString(&out, message.message_text(),
+                     message.message_text_size());
+    for (const LogField& field : message.fields()) {
+      out.Append(',');
+      AppendJsonString(&out, field.key(), strlen(field.key()));
+      out.Append(':');
+      if (field.type() == LogField::kString) {
+        AppendJsonString(&out, field.string_value(), field.string_size());
+      } else if (field.type() == LogField::kDouble &&
+                 !std::isfinite(field.double_value())) {
+        out.Append("null");
+      } else {
+        AppendScalar(&out, field);
+      }
+    }
+    out.Append('}');
+    return out.Finish();
+  }
+};
+
+class LogfmtEncoder : public LogEncoder {
+ public:
+  size_t Encode(const LogMessage& message, char* buf,
+                size_t size) const override {
+    EncodeBuffer out(buf, size);
+    out.Append("time=");
+    AppendTime(&out, message);
+    out.Append(" severity=");
+    out.Append(LogSeverityNames[message.severity()]);
+    out.Append(" file=");
+    AppendLogfmtString(&out, message.basename(), strlen(message.basename()));
+    out.AppendFormat(" line=%d thread=", message.line());
+    char thread_id[32];
+    FormatThreadId(message, thread_id, sizeof(thread_id));
+    AppendLogfmtString(&out, thread_id, strlen(thread_id));
+    out.Append(" message=");
+    AppendLogfmtString(&out, message.message_text(),
+                       message.message_text_size());
+    AppendTextFields(&out, message.fields());
+    return out.Finish();
+  }
+};
+
+}  // namespace
+
+const LogEncoder& TextLogEncoder() {
+  static const TextEncoder encoder;
+  return encoder;
+}
+
+const LogEncoder& JsonLogEncoder() {
+  static const JsonEncoder encoder;
+  return encoder;
+}
+
+const LogEncoder& LogfmtLogEncoder() {
+  static const LogfmtEncoder encoder;
+  return encoder;
+}
+
+void SetLogEncoder(LogSeverity severity, const LogEncoder* encoder) {
+  LogDestination::SetLogEncoder(severity, encoder);
+}
+
+void SetStderrLogEncoder(const LogEncoder* encoder) {
+  LogDestination::SetStderrLogEncoder(encoder);
+}
+
 void SetLogFilenameExtension(const char* ext) {
   LogDestination::SetLogFilenameExtension(ext);
 }
@@ -2174,12 +3839,12 @@ static bool SendEmailInternal(const char* dest, const char* subject,
       // [1]
       // https://html.spec.whatwg.org/multipage/input.html#valid-e-mail-address
       // [2] e.g. https://nvd.nist.gov/vuln/detail/CVE-2004-2771
-      if (!std::regex_match(
-              s,
-              std::regex("^[a-zA-Z0-9]"
-                         "[a-zA-Z0-9.!#$%&'*+/=?^_`{|}~-]*@[a-zA-Z0-9]"
-                         "(?:[a-zA-Z0-9-]{0,61}[a-zA-Z0-9])?(?:\\.[a-zA-Z0-9]"
-                         "(?:[a-zA-Z0-9-]{0,61}[a-zA-Z0-9])?)*$"))) {
+      static const std::regex email_address_regex(
+          "^[a-zA-Z0-9]"
+          "[a-zA-Z0-9.!#$%&'*+/=?^_`{|}~-]*@[a-zA-Z0-9]"
+          "(?:[a-zA-Z0-9-]{0,61}[a-zA-Z0-9])?(?:\\.[a-zA-Z0-9]"
+          "(?:[a-zA-Z0-9-]{0,61}[a-zA-Z0-9])?)*$");
+      if (!std::regex_match(s, email_address_regex)) {
         if (use_logging) {
           VLOG(1) << "Invalid destination email address:" << s;
         } else {
@@ -2452,19 +4117,26 @@ void TruncateStdoutStderr() {
 namespace logging {
 namespace internal {
 // Helper functions for string comparisons.
-#define DEFINE_CHECK_STROP_IMPL(name, func, expected)                         \
-  std::unique_ptr<string> Check##func##expected##Impl(                        \
-      const char* s1, const char* s2, const char* names) {                    \
-    bool equal = s1 == s2 || (s1 && s2 && !func(s1, s2));                     \
-    if (equal == (expected))                                                  \
-      return nullptr;                                                         \
-    else {                                                                    \
-      ostringstream ss;                                                       \
-      if (!s1) s1 = "";                                                       \
-      if (!s2) s2 = "";                                                       \
-      ss << #name " failed: " << names << " (" << s1 << " vs. " << s2 << ")"; \
-      return std::make_unique<std::string>(ss.str());                         \
-    }                                                                         \
+#define DEFINE_CHECK_STROP_IMPL(name, func, expected)                      \
+  CheckOpMessage Check##func##expected##Message(                           \
+      const char* s1, const char* s2, const char* names) {                 \
+    bool equal = s1 == s2 || (s1 && s2 && !func(s1, s2));                  \
+    if (equal == (expected))                                               \
+      return nullptr;                                                      \
+    else {                                                                 \
+      CheckOpMessageWriter comb(names, #name " failed: ");                 \
+      *comb.ForVar1() << (s1 ? s1 : "");                                   \
+      *comb.ForVar2() << (s2 ? s2 : "");                                   \
+      return comb.NewMessage();                                            \
+    }                                                                      \
+  }                                                                        \
+  std::unique_ptr<string> Check##func##expected##Impl(                     \
+      const char* s1, const char* s2, const char* names) {                 \
+    CheckOpMessage result = Check##func##expected##Message(s1, s2, names); \
+    if (!result) return nullptr;                                           \
+    auto str = std::make_unique<std::string>(result.str_);                 \
+    ReleaseCheckOpMessage(result);                                         \
+    return str;                                                            \
   }
 DEFINE_CHECK_STROP_IMPL(CHECK_STREQ, strcmp, true)
 DEFINE_CHECK_STROP_IMPL(CHECK_STRNE, strcmp, false)
@@ -2555,6 +4227,11 @@ LogMessageFatal::LogMessageFatal(const char* file, int line,
                                  const logging::internal::CheckOpString& result)
     : LogMessage(file, line, result) {}
 
+LogMessageFatal::LogMessageFatal(
+    const char* file, int line,
+    const logging::internal::CheckOpMessage& result)
+    : LogMessage(file, line, result) {}
+
 LogMessageFatal::~LogMessageFatal() noexcept(false) {
   Flush();
   LogMessage::Fail();
@@ -2580,6 +4257,39 @@ std::unique_ptr<string> CheckOpMessageBuilder::NewString() {
   return std::make_unique<std::string>(stream_->str());
 }
 
+CheckOpMessageWriter::CheckOpMessageWriter(const char* exprtext,
+                                           const char* prefix)
+    : exprtext_(exprtext),
+      buffer_(ClaimCheckOpBuffer()),
+      streambuf_(buffer_ != nullptr ? buffer_ : discard_,
+                 buffer_ != nullptr ? static_cast<int>(sizeof(check_op_buffer))
+                                    : static_cast<int>(sizeof(discard_))),
+      stream_(&streambuf_) {
+  stream_ << prefix << exprtext << " (";
+}
+
+ostream* CheckOpMessageWriter::ForVar2() {
+  stream_ << " vs. ";
+  return &stream_;
+}
+
+std::ostream& operator<<(std::ostream& os, const CheckOpMessage& message) {
+  os << message.str_;
+  ReleaseCheckOpMessage(message);
+  return os;
+}
+
+CheckOpMessage CheckOpMessageWriter::NewMessage() {
+  if (buffer_ == nullptr) {
+    // Another check is failing at the same time.
+    return CheckOpMessage(exprtext_);
+  }
+  stream_ << ")";
+  // The stream buffer leaves room for the terminating '\0'.
+  buffer_[streambuf_.pcount()] = '\0';
+  return CheckOpMessage(buffer_);
+}
+
 template <>
 void MakeCheckOpValueString(std::ostream* os, const char& v) {
   if (v >= 32 && v <= 126) {
@@ -2625,7 +4335,92 @@ void InstallPrefixFormatter(PrefixFormatterCallback callback, void* data) {
   }
 }
 
+void InstallPrefixWriter(PrefixWriterCallback callback, void* data) {
+  if (callback != nullptr) {
+    g_prefix_formatter = std::make_unique<PrefixFormatter>(callback, data);
+  } else {
+    g_prefix_formatter = nullptr;
+  }
+}
+
+namespace {
+
+// Writes value as width digits, padded with zeros.
+char* WriteZeroPadded(char* p, int value, int width) noexcept {
+  for (char* digit = p + width; digit != p; value /= 10) {
+    *--digit = static_cast<char>('0' + value % 10);
+  }
+  return p + width;
+}
+
+}  // namespace
+
+size_t WriteLogPrefixTime(char* buffer, size_t size,
+                          const LogMessageTime& time) noexcept {
+  // "mmdd hh:mm:ss.uuuuuu", preceded by "yyyy".
+  const size_t needed = FLAGS_log_year_in_prefix ? 24 : 20;
+  if (size < needed) {
+    return 0;
+  }
+  char* p = buffer;
+  if (FLAGS_log_year_in_prefix) {
+    p = WriteZeroPadded(p, 1900 + time.year(), 4);
+  }
+  p = WriteZeroPadded(p, 1 + time.month(), 2);
+  p = WriteZeroPadded(p, time.day(), 2);
+  *p++ = ' ';
+  p = WriteZeroPadded(p, time.hour(), 2);
+  *p++ = ':';
+  p = WriteZeroPadded(p, time.min(), 2);
+  *p++ = ':';
+  p = WriteZeroPadded(p, time.sec(), 2);
+  *p++ = '.';
+  p = WriteZeroPadded(p, static_cast<int>(time.usec()), 6);
+  return static_cast<size_t>(p - buffer);
+}
+
+size_t WriteLogPrefixSeverity(char* buffer, size_t size,
+                              LogSeverity severity) noexcept {
+  if (size < 1) {
+    return 0;
+  }
+  buffer[0] = LogSeverityNames[severity][0];
+  return 1;
+}
+
+size_t WriteLogPrefixThreadId(char* buffer, size_t size,
+                              const std::thread::id& id) {
+  // Thread IDs can only be formatted by streaming them.  Most prefixes show
+  // the calling thread, whose ID is formatted once.
+#ifdef GLOG_THREAD_LOCAL_STORAGE
+  static thread_local std::thread::id formatted_id;
+  static thread_local char formatted[32];
+  static thread_local size_t formatted_size = 0;
+#else
+  std::thread::id formatted_id;
+  char formatted[32];
+  size_t formatted_size = 0;
+#endif
+  if (formatted_size == 0 || formatted_id != id) {
+    base_logging::LogStreamBuf streambuf(formatted, sizeof(formatted));
+    std::ostream stream(&streambuf);
+    stream << id;
+    formatted_id = id;
+    formatted_size = streambuf.pcount();
+  }
+  if (size < formatted_size) {
+    return 0;
+  }
+  std::memcpy(buffer, formatted, formatted_size);
+  return formatted_size;
+}
+
 void ShutdownGoogleLogging() {
+  FlushLogSummaries();
+  EmailAlerter::Flush();
+#if !defined(GLOG_OS_WINDOWS) && defined(HAVE_UNISTD_H)
+  ConsoleWriter::Flush();
+#endif
   ShutdownGoogleLoggingUtilities();
   LogDestination::DeleteLogDestinations();
   logging_directories_list = nullptr;
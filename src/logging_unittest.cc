@@ -57,6 +57,12 @@
 #ifdef HAVE_SYS_WAIT_H
 #  include <sys/wait.h>
 #endif
+#if defined(HAVE_SYS_SOCKET_H) && defined(HAVE_SYS_UN_H)
+#  include <netinet/in.h>
+#  include <poll.h>
+#  include <sys/socket.h>
+#  include <sys/un.h>
+#endif
 
 #include "base/commandlineflags.h"
 #include "glog/logging.h"
@@ -180,6 +186,16 @@ static void BM_logspeed(int n) {
 }
 BENCHMARK(BM_logspeed)
 
+static void BM_log_suppressed(int n) {
+  const int32 minloglevel = FLAGS_minloglevel;
+  FLAGS_minloglevel = GLOG_WARNING;
+  while (n-- > 0) {
+    LOG(INFO) << "test message";
+  }
+  FLAGS_minloglevel = minloglevel;
+}
+BENCHMARK(BM_log_suppressed)
+
 static void BM_vlog(int n) {
   while (n-- > 0) {
     VLOG(1) << "test message";
@@ -187,6 +203,44 @@ static void BM_vlog(int n) {
 }
 BENCHMARK(BM_vlog)
 
+#if defined(HAVE_SYS_SOCKET_H) && defined(HAVE_SYS_UN_H)
+// Streams to a receiver on the loopback interface.
+static void BM_StreamLogSink(int n) {
+  const int listener = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t address_size = sizeof(address);
+  CHECK_EQ(0, bind(listener, reinterpret_cast<const sockaddr*>(&address),
+                   sizeof(address)));
+  CHECK_EQ(0, listen(listener, 1));
+  CHECK_EQ(0, getsockname(listener, reinterpret_cast<sockaddr*>(&address),
+                          &address_size));
+  std::thread receiver([listener] {
+    const int fd = accept(listener, nullptr, nullptr);
+    char buf[65536];
+    while (read(fd, buf, sizeof(buf)) > 0) {
+    }
+    close(fd);
+  });
+  {
+    StreamLogSink sink(
+        ("127.0.0.1:" + std::to_string(ntohs(address.sin_port))).c_str(),
+        StreamLogSink::kBinary);
+    AddLogSink(&sink);
+    while (n-- > 0) {
+      LOG(INFO) << "test message";
+    }
+    sink.Flush();
+    RemoveLogSink(&sink);
+  }
+  receiver.join();
+  close(listener);
+}
+BENCHMARK(BM_StreamLogSink)
+#endif
+
 namespace {
 
 // Dynamically generate a prefix using the default format and write it to the
@@ -206,6 +260,8 @@ void PrefixAttacher(std::ostream& s, const LogMessage& m, void* data) {
     << m.basename() << ':' << m.line() << "]";
 }
 
+string prefix_attacher_data = "good data";
+
 }  // namespace
 
 int main(int argc, char** argv) {
@@ -227,7 +283,6 @@ int main(int argc, char** argv) {
 
   // Setting a custom prefix generator (it will use the default format so that
   // the golden outputs can be reused):
-  string prefix_attacher_data = "good data";
   InitGoogleLogging(argv[0]);
   InstallPrefixFormatter(&PrefixAttacher, &prefix_attacher_data);
 
@@ -555,6 +610,70 @@ TEST(DeathRawCHECK, logging) {
                      "RAW: Check 1 == 2 failed: failure 2");
 }
 
+// Returns the message of the RAW_LOG line in output.
+static string RawLogMessage(const string& output) {
+  const size_t start = output.find("RAW: ");
+  return start == string::npos ? output : output.substr(start + 5);
+}
+
+#define EXPECT_RAW_LOG_AS_SNPRINTF(...)                           \
+  do {                                                            \
+    char expected[256];                                           \
+    std::snprintf(expected, sizeof(expected), __VA_ARGS__);       \
+    CaptureTestStderr();                                          \
+    RAW_LOG(INFO, __VA_ARGS__);                                   \
+    EXPECT_EQ(string(expected) + "\n",                            \
+              RawLogMessage(GetCapturedTestStderr()));            \
+  } while (0)
+
+TEST(RawLogging, FormatsLikeSnprintf) {
+  const char* str = "string";
+  void* p = reinterpret_cast<void*>(PTR_TEST_VALUE);
+  EXPECT_RAW_LOG_AS_SNPRINTF("%d|%i|%5d|%-5d|%05d|%+d|% d|%.3d|%.0d", -42, 42,
+                             42, 42, -42, 7, 7, 7, 0);
+  EXPECT_RAW_LOG_AS_SNPRINTF("%u|%x|%X|%#x|%#X|%08x|%#08x|%-#8x|", 4000000000U,
+                             255U, 255U, 255U, 255U, 255U, 255U, 255U);
+  EXPECT_RAW_LOG_AS_SNPRINTF(
+      "%hhd|%hhx|%hd|%hx|%ld|%lx|%lld|%llu|%jd|%zu|%zx|%td", -1, 0x1ff, -1,
+      0x1ffff, -1L, 255UL, -9223372036854775807LL - 1,
+      18446744073709551615ULL, static_cast<std::intmax_t>(-5), sizeof(str),
+      static_cast<size_t>(-1), static_cast<std::ptrdiff_t>(-3));
+  EXPECT_RAW_LOG_AS_SNPRINTF("%s|%.3s|%8s|%-8s|%c|%3c|%-3c|%%|100%%", str, str,
+                             str, str, 'x', 'y', 'z');
+  EXPECT_RAW_LOG_AS_SNPRINTF("%p|%p|%20p|%-20p|", p,
+                             static_cast<void*>(nullptr), p, p);
+  EXPECT_RAW_LOG_AS_SNPRINTF("%*d|%-*d|%*d|%.*s|%.*d", 6, 42, 6, 42, -6, 42, 2,
+                             str, 4, 42);
+}
+
+TEST(RawLogging, TypedArguments) {
+  enum Color { kRed = 1 };
+  const string typed_str = "typed";
+  CaptureTestStderr();
+  {
+    NewHook new_hook;
+    RAW_LOG_TYPED(INFO, "%d %u %x %hhx %zu %c %s %s %s %p %d", -1, -1,
+                  static_cast<int8_t>(-1), static_cast<int8_t>(-1),
+                  sizeof(int32), 'a', typed_str.c_str(), 42, 'b', nullptr,
+                  kRed);
+  }
+  char null_str[32];
+  std::snprintf(null_str, sizeof(null_str), "%p", static_cast<void*>(nullptr));
+  // Negative numbers are printed as unsigned with the size of their type.
+  EXPECT_EQ(string("-1 4294967295 ff ff 4 a typed 42 b ") + null_str + " 1\n",
+            RawLogMessage(GetCapturedTestStderr()));
+
+  CaptureTestStderr();
+  RAW_LOG_TYPED(INFO, "%d and %d, %s %f", 1);
+  EXPECT_EQ("1 and (missing), (missing) %f\n",
+            RawLogMessage(GetCapturedTestStderr()));
+
+  CaptureTestStderr();
+  RAW_LOG_TYPED(INFO, "%5s|%-4d|%08.3d|%#x", "abc", 7, 7, 0x2aU);
+  EXPECT_EQ("  abc|7   |     007|0x2a\n",
+            RawLogMessage(GetCapturedTestStderr()));
+}
+
 void TestLogString() {
   vector<string> errors;
   vector<string>* no_errors = nullptr;
@@ -728,6 +847,72 @@ TEST(DeathSTREQ, logging) {
   ASSERT_DEATH(CHECK_STREQ((string("a") + "b").c_str(), "abc"), "");
 }
 
+// Releases the buffer of a check failure message, as the fatal message does.
+static void ConsumeCheckOpMessage(const logging::internal::CheckOpMessage& m) {
+  NullStream(__FILE__, __LINE__, m);
+}
+
+TEST(CheckOp, FailureMessageDoesNotAllocate) {
+  using logging::internal::CheckOpMessage;
+  const string hello = "hello";
+  const string world = "world";
+  bool messages_ok = true;
+  {
+    NewHook new_hook;
+    for (int i = 0; i < 10; ++i) {
+      CheckOpMessage eq =
+          logging::internal::Check_EQMessage(hello, world, "hello == world");
+      messages_ok = messages_ok &&
+                    strcmp(eq.str_, "hello == world (hello vs. world)") == 0;
+      ConsumeCheckOpMessage(eq);
+      CheckOpMessage lt = logging::internal::Check_LTMessage(2, 1, "2 < 1");
+      messages_ok = messages_ok && strcmp(lt.str_, "2 < 1 (2 vs. 1)") == 0;
+      ConsumeCheckOpMessage(lt);
+      CheckOpMessage streq =
+          logging::internal::CheckstrcmptrueMessage("a", "b", "a == b");
+      messages_ok =
+          messages_ok &&
+          strcmp(streq.str_, "CHECK_STREQ failed: a == b (a vs. b)") == 0;
+      ConsumeCheckOpMessage(streq);
+    }
+  }
+  EXPECT_TRUE(messages_ok);
+  EXPECT_FALSE(
+      logging::internal::Check_EQMessage(hello, hello, "hello == hello"));
+
+  // The allocating variants are kept for callers of the internal API.
+  std::unique_ptr<string> eq =
+      logging::internal::Check_EQImpl(hello, world, "hello == world");
+  ASSERT_TRUE(eq != nullptr);
+  EXPECT_EQ("hello == world (hello vs. world)", *eq);
+  std::unique_ptr<string> streq =
+      logging::internal::CheckstrcmptrueImpl("a", "b", "a == b");
+  ASSERT_TRUE(streq != nullptr);
+  EXPECT_EQ("CHECK_STREQ failed: a == b (a vs. b)", *streq);
+  EXPECT_TRUE(logging::internal::Check_EQImpl(hello, hello, "") == nullptr);
+}
+
+TEST(CheckOp, ConcurrentFailureReportsExpression) {
+  logging::internal::CheckOpMessage lt =
+      logging::internal::Check_LTMessage(2, 1, "2 < 1");
+  string other;
+  std::thread([&other] {
+    logging::internal::CheckOpMessage eq =
+        logging::internal::Check_EQMessage(1, 2, "1 == 2");
+    other = eq.str_;
+    ConsumeCheckOpMessage(eq);
+  }).join();
+  // The message of the first failure is kept until it is consumed.
+  EXPECT_EQ("1 == 2", other);
+  EXPECT_STREQ("2 < 1 (2 vs. 1)", lt.str_);
+  ConsumeCheckOpMessage(lt);
+
+  logging::internal::CheckOpMessage eq =
+      logging::internal::Check_EQMessage(1, 2, "1 == 2");
+  EXPECT_STREQ("1 == 2 (1 vs. 2)", eq.str_);
+  ConsumeCheckOpMessage(eq);
+}
+
 TEST(CheckNOTNULL, Simple) {
   int64 t;
   void* ptr = static_cast<void*>(&t);
@@ -1322,10 +1507,10 @@ class TestLogSinkWriter {
 
   // data ---------------
 
-  std::thread t_;
   std::mutex mutex_;
   bool should_exit_{false};
   queue<string> messages_;  // messages to be logged
+  std::thread t_;           // last, so that Run() sees the members above
 };
 
 // A log sink that exercises WaitTillSent:
@@ -1585,6 +1770,92 @@ TEST(LogMsgTime, gmtoff) {
   EXPECT_TRUE((gmtoff >= utc_min_offset) && (gmtoff <= utc_max_offset));
 }
 
+// Writes the default prefix with the helpers, after the request ID in data.
+static size_t PrefixWriter(char* buffer, size_t size, const LogMessage& m,
+                           void* data) {
+  const string& request_id = *static_cast<string*>(data);
+  if (size < request_id.size() + 1) return 0;
+  size_t used = request_id.size();
+  memcpy(buffer, request_id.data(), used);
+  buffer[used++] = ' ';
+  used += WriteLogPrefixSeverity(buffer + used, size - used, m.severity());
+  used += WriteLogPrefixTime(buffer + used, size - used, m.time());
+  if (used < size) buffer[used++] = ' ';
+  used += WriteLogPrefixThreadId(buffer + used, size - used, m.thread_id());
+  return used;
+}
+
+TEST(LogPrefix, WriterHelpers) {
+  const LogMessageTime time(std::chrono::system_clock::from_time_t(86400 * 40) +
+                            std::chrono::microseconds(1234));
+  ostringstream expected;
+  expected.fill('0');
+  expected << setw(2) << 1 + time.month() << setw(2) << time.day() << ' '
+           << setw(2) << time.hour() << ':' << setw(2) << time.min() << ':'
+           << setw(2) << time.sec() << '.' << setw(6) << time.usec();
+  const bool log_year_in_prefix = FLAGS_log_year_in_prefix;
+  FLAGS_log_year_in_prefix = false;
+  char buffer[64];
+  size_t size = WriteLogPrefixTime(buffer, sizeof(buffer), time);
+  EXPECT_EQ(string(buffer, size), expected.str());
+  EXPECT_EQ(WriteLogPrefixTime(buffer, size - 1, time), 0u);
+
+  FLAGS_log_year_in_prefix = true;
+  size = WriteLogPrefixTime(buffer, sizeof(buffer), time);
+  EXPECT_EQ(string(buffer, size),
+            std::to_string(1900 + time.year()) + expected.str());
+  FLAGS_log_year_in_prefix = log_year_in_prefix;
+
+  size = WriteLogPrefixSeverity(buffer, sizeof(buffer), GLOG_WARNING);
+  EXPECT_EQ(string(buffer, size), "W");
+
+  for (int i = 0; i < 2; i++) {
+    ostringstream thread_id;
+    thread_id << std::this_thread::get_id();
+    size = WriteLogPrefixThreadId(buffer, sizeof(buffer),
+                                  std::this_thread::get_id());
+    EXPECT_EQ(string(buffer, size), thread_id.str());
+  }
+  std::thread([] {
+    std::thread::id other = std::this_thread::get_id();
+    ostringstream thread_id;
+    thread_id << other;
+    char other_buffer[64];
+    const size_t other_size =
+        WriteLogPrefixThreadId(other_buffer, sizeof(other_buffer), other);
+    EXPECT_EQ(string(other_buffer, other_size), thread_id.str());
+  }).join();
+}
+
+TEST(LogPrefix, Writer) {
+  string request_id = "req-42";
+  const bool log_year_in_prefix = FLAGS_log_year_in_prefix;
+  FLAGS_log_year_in_prefix = false;
+  InstallPrefixWriter(&PrefixWriter, &request_id);
+  CaptureTestStderr();
+  LOG(INFO) << std::setw(4) << 7 << ' ' << 1.5;
+  const string captured = GetCapturedTestStderr();
+  InstallPrefixFormatter(&PrefixAttacher, &prefix_attacher_data);
+  FLAGS_log_year_in_prefix = log_year_in_prefix;
+
+  ostringstream thread_id;
+  thread_id << std::this_thread::get_id();
+  // "req-42 Immdd hh:mm:ss.uuuuuu <thread id>    7 1.5"
+  ASSERT_GT(captured.size(), 29u);
+  EXPECT_EQ(captured.substr(0, 8), "req-42 I");
+  EXPECT_EQ(captured.substr(29), thread_id.str() + "    7 1.5\n");
+}
+
+static void BM_logspeed_prefix_writer(int n) {
+  string request_id = "req-42";
+  InstallPrefixWriter(&PrefixWriter, &request_id);
+  while (n-- > 0) {
+    LOG(INFO) << "test message";
+  }
+  InstallPrefixFormatter(&PrefixAttacher, &prefix_attacher_data);
+}
+BENCHMARK(BM_logspeed_prefix_writer)
+
 TEST(EmailLogging, ValidAddress) {
   FlagSaver saver;
   FLAGS_logmailer = "/usr/bin/true";
@@ -1616,6 +1887,991 @@ TEST(EmailLogging, MaliciousAddress) {
       SendEmail("!/bin/true@example.com", "Example subject", "Example body"));
 }
 
+#if !defined(GLOG_OS_WINDOWS) && !defined(GLOG_OS_EMSCRIPTEN)
+static size_t CountMatches(const string& text, const string& pattern) {
+  size_t count = 0;
+  for (size_t pos = text.find(pattern); pos != string::npos;
+       pos = text.find(pattern, pos + 1)) {
+    ++count;
+  }
+  return count;
+}
+
+TEST(EmailLogging, CoalescesMessagesInBackground) {
+  FlagSaver saver;
+  FLAGS_logtostderr = false;
+  FLAGS_stderrthreshold = NUM_SEVERITIES;
+
+  // A mailer which records its subject argument and the body.
+  const string mailbox = FLAGS_test_tmpdir + "/logging_test_mailbox";
+  const string mailer = FLAGS_test_tmpdir + "/logging_test_mailer.sh";
+  unlink(mailbox.c_str());
+  {
+    std::ofstream script(mailer.c_str());
+    script << "#!/bin/sh\n"
+           << "{ echo \"$1\"; cat; echo \"== END ==\"; } >> " << mailbox
+           << "\n";
+  }
+  chmod(mailer.c_str(), 0755);
+  FLAGS_logmailer = mailer;
+  FLAGS_alsologtoemail = "oncall@example.com";
+  FLAGS_logemaillevel = GLOG_ERROR;
+  FLAGS_logemailsecs = 1;
+
+  const auto read_mailbox = [&mailbox](size_t emails) {
+    string text;
+    for (int i = 0; i < 100; ++i) {
+      std::ifstream in(mailbox.c_str());
+      text.assign(std::istreambuf_iterator<char>(in),
+                  std::istreambuf_iterator<char>());
+      if (CountMatches(text, "== END ==") >= emails) {
+        break;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    return text;
+  };
+
+  LOG(ERROR) << "first alert";
+  read_mailbox(1);
+  // Logged within --logemailsecs of the first email, hence coalesced.
+  LOG(ERROR) << "second alert";
+  LOG(WARNING) << "not emailed";
+  LOG(ERROR) << "third alert";
+  const string text = read_mailbox(2);
+  // A FATAL message is emailed before the program dies, hence the mailbox is
+  // read without waiting.
+  ASSERT_DEATH(LOG(FATAL) << "fatal alert", "");
+  string fatal_text;
+  {
+    std::ifstream in(mailbox.c_str());
+    fatal_text.assign(std::istreambuf_iterator<char>(in),
+                      std::istreambuf_iterator<char>());
+  }
+  FLAGS_logemaillevel = 999;
+  FLAGS_alsologtoemail = "";
+  FLAGS_logemailsecs = 60;
+
+  EXPECT_EQ(2, CountMatches(text, "== END =="));
+  EXPECT_EQ(1, CountMatches(text, "(2 messages)")) << text;
+  EXPECT_LT(text.find("first alert"), text.find("(2 messages)"));
+  EXPECT_LT(text.find("(2 messages)"), text.find("second alert"));
+  EXPECT_LT(text.find("second alert"), text.find("third alert"));
+  EXPECT_EQ(string::npos, text.find("not emailed"));
+  EXPECT_EQ(3, CountMatches(fatal_text, "== END =="));
+  EXPECT_LT(text.size(), fatal_text.find("[LOG] FATAL")) << fatal_text;
+  EXPECT_NE(string::npos, fatal_text.find("fatal alert")) << fatal_text;
+  unlink(mailer.c_str());
+  unlink(mailbox.c_str());
+}
+#endif
+
+#if !defined(GLOG_OS_WINDOWS) && defined(HAVE_UNISTD_H)
+#  ifdef HAVE_SYS_WAIT_H
+// Comes first, since the child has to start the background thread itself.
+TEST(ConsoleBuffer, WritesSynchronouslyAfterStop) {
+  int fds[2];
+  ASSERT_EQ(0, pipe(fds));
+  const pid_t pid = fork();
+  ASSERT_NE(-1, pid);
+  if (pid == 0) {
+    dup2(fds[1], STDERR_FILENO);
+    FLAGS_logtostderr = true;
+    FLAGS_colorlogtostderr = false;
+    FLAGS_console_buffer_bytes = 4096;
+    // Registered before the thread starts, so it runs after it stopped.
+    std::atexit([] {
+      LOG(INFO) << "logged after stop";
+      fputs("written after stop\n", stderr);
+    });
+    LOG(INFO) << "logged before exit";
+    exit(EXIT_SUCCESS);
+  }
+  close(fds[1]);
+  string output;
+  char buf[4096];
+  ssize_t size;
+  while ((size = read(fds[0], buf, sizeof(buf))) > 0) {
+    output.append(buf, static_cast<size_t>(size));
+  }
+  close(fds[0]);
+  int status;
+  ASSERT_EQ(pid, waitpid(pid, &status, 0));
+  EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+
+  const size_t before = output.find("logged before exit");
+  EXPECT_NE(string::npos, before) << output;
+  const size_t after = output.find("logged after stop", before);
+  EXPECT_NE(string::npos, after) << output;
+  // Not written by a new thread.
+  EXPECT_NE(string::npos, output.find("written after stop", after)) << output;
+}
+#  endif
+
+TEST(ConsoleBuffer, WritesInBackground) {
+  FlagSaver saver;
+  FLAGS_logtostderr = true;
+  FLAGS_colorlogtostderr = false;
+  FLAGS_console_buffer_bytes = 64 * 1024;
+
+  CaptureTestStderr();
+  for (int i = 0; i < 10; ++i) {
+    LOG(INFO) << "buffered message " << i;
+  }
+  FlushLogFiles(GLOG_INFO);
+  const string output = GetCapturedTestStderr();
+  FLAGS_console_buffer_bytes = 0;
+
+  size_t pos = 0;
+  for (int i = 0; i < 10; ++i) {
+    pos = output.find("buffered message " + std::to_string(i), pos);
+    EXPECT_NE(string::npos, pos) << output;
+  }
+}
+
+TEST(ConsoleBuffer, DropsMessagesWhenOutputIsSlow) {
+  FlagSaver saver;
+  FLAGS_logtostderr = true;
+  FLAGS_colorlogtostderr = false;
+  FLAGS_console_buffer_bytes = 4096;
+
+  // Nobody reads the pipe until the logging is done, so the writes block
+  // once the pipe is full.
+  int fds[2];
+  ASSERT_EQ(0, pipe(fds));
+  const int saved_stderr = dup(STDERR_FILENO);
+  dup2(fds[1], STDERR_FILENO);
+  const string padding(1000, 'x');
+  for (int i = 0; i < 200; ++i) {
+    LOG(INFO) << "slow " << i << padding;
+  }
+
+  string output;
+  std::thread reader([&output, fd = fds[0]] {
+    char buf[4096];
+    ssize_t size;
+    while ((size = read(fd, buf, sizeof(buf))) > 0) {
+      output.append(buf, static_cast<size_t>(size));
+    }
+  });
+  FlushLogFiles(GLOG_INFO);
+  dup2(saved_stderr, STDERR_FILENO);
+  close(saved_stderr);
+  close(fds[1]);
+  reader.join();
+  close(fds[0]);
+  FLAGS_console_buffer_bytes = 0;
+
+  EXPECT_NE(string::npos, output.find("slow 0x")) << output.size();
+  EXPECT_EQ(string::npos, output.find("slow 199x")) << output.size();
+  EXPECT_NE(string::npos,
+            output.find("log messages were dropped because the output was "
+                        "slow"))
+      << output.size();
+}
+#endif
+
+namespace {
+// Records the address of the stream it is streamed into.
+struct StreamAddress {
+  const std::ostream** address;
+};
+std::ostream& operator<<(std::ostream& s, StreamAddress a) {
+  *a.address = &s;
+  return s;
+}
+}  // namespace
+
+namespace {
+class CollectingLogSink : public LogSink {
+ public:
+  void send(LogSeverity /* severity */, const char* /* full_filename */,
+            const char* /* base_filename */, int /* line */,
+            const LogMessageTime& /* time */, const char* message,
+            size_t message_len) override {
+    messages.emplace_back(message, message_len);
+  }
+
+  vector<string> messages;
+};
+}  // namespace
+
+TEST(LogMinLogLevel, DoesNotConstructSuppressedMessages) {
+  FlagSaver saver;
+  const int32 minloglevel = FLAGS_minloglevel;
+  FLAGS_minloglevel = GLOG_ERROR;
+  int evaluated = 0;
+  auto count = [&evaluated] { return ++evaluated; };
+
+  EXPECT_EQ(&logging::internal::SuppressedLogStream(), &LOG(INFO));
+  EXPECT_EQ(&logging::internal::SuppressedLogStream(), &LOG(WARNING));
+  const std::ostream* error_stream = nullptr;
+  LOG(ERROR) << StreamAddress{&error_stream} << "not suppressed";
+  EXPECT_NE(&logging::internal::SuppressedLogStream(), error_stream);
+  LOG_IF(INFO, true) << count();
+  VLOG(0) << count();
+  EXPECT_EQ(0, evaluated);
+
+  FLAGS_minloglevel = minloglevel;
+}
+
+TEST(LogMinLogLevel, PerModuleThreshold) {
+  FlagSaver saver;
+  FLAGS_logtostderr = false;
+  FLAGS_stderrthreshold = NUM_SEVERITIES;
+
+  CollectingLogSink sink;
+  AddLogSink(&sink);
+  auto log_info = [](int n) { LOG(INFO) << "info " << n; };
+  log_info(1);
+  log_info(1);
+  EXPECT_EQ(FLAGS_minloglevel,
+            SetModuleMinLogLevel("logging_unittest", GLOG_WARNING));
+  // The site cached FLAGS_minloglevel and must now follow the module level.
+  log_info(2);
+  // Suppressed messages are not constructed.
+  EXPECT_EQ(&logging::internal::SuppressedLogStream(), &LOG(INFO));
+  LOG(WARNING) << "warning 2";
+  // A module level below --minloglevel does not log more.
+  const int32 minloglevel = FLAGS_minloglevel;
+  FLAGS_minloglevel = GLOG_ERROR;
+  EXPECT_EQ(GLOG_WARNING, SetModuleMinLogLevel("logging_unittest", GLOG_INFO));
+  LOG(WARNING) << "warning 3";
+  FLAGS_minloglevel = minloglevel;
+  log_info(4);
+  RemoveLogSink(&sink);
+
+  const vector<string> expected = {"info 1", "info 1", "warning 2", "info 4"};
+  EXPECT_EQ(expected, sink.messages);
+}
+
+// LOG() is an ordinary expression, usable outside of function bodies.
+static int logged_at_namespace_scope = (LOG(INFO) << "at namespace scope", 1);
+
+TEST(LogMinLogLevel, AtNamespaceScope) {
+  EXPECT_EQ(1, logged_at_namespace_scope);
+}
+
+TEST(ShardedEveryN, SingleThread) {
+  std::atomic<int> total(0);
+  int pending = 0;
+  int ctr = 0;
+  int logged = 0;
+  for (int i = 0; i < 1000; ++i) {
+    if (logging::internal::ShardedEveryN(total, pending, 10, &ctr)) {
+      ++logged;
+    }
+  }
+  // The first occurrence is merged right away, then batches of 10.
+  EXPECT_EQ(991, total.load());
+  EXPECT_EQ(991, ctr);
+  EXPECT_EQ(100, logged);
+}
+
+TEST(ShardedEveryN, ManyThreads) {
+  constexpr int kThreads = 8;
+  constexpr int kIterations = 100000;
+  constexpr int kN = 1000;
+  std::atomic<int> total(0);
+  std::atomic<int> logged(0);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&total, &logged] {
+      int pending = 0;
+      int ctr;
+      for (int i = 0; i < kIterations; ++i) {
+        if (logging::internal::ShardedEveryN(total, pending, kN, &ctr)) {
+          ++logged;
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  // Each thread leaves at most a batch unmerged.
+  constexpr int kMaxBatch = logging::internal::kShardedEveryNMaxBatch;
+  EXPECT_GE(total.load(), kThreads * (kIterations - kMaxBatch));
+  EXPECT_LE(total.load(), kThreads * kIterations);
+  EXPECT_EQ((total.load() + kN - 1) / kN, logged.load());
+}
+
+namespace {
+class CountingLogSink : public LogSink {
+ public:
+  void send(LogSeverity severity, const char* /* full_filename */,
+            const char* /* base_filename */, int /* line */,
+            const LogMessageTime& /* time */, const char* message,
+            size_t message_len) override {
+    ++counts[severity];
+    if (severity == GLOG_WARNING) {
+      last_warning.assign(message, message_len);
+    }
+  }
+
+  int counts[NUM_SEVERITIES] = {};
+  string last_warning;
+};
+}  // namespace
+
+TEST(LogRateLimit, ShedsBelowErrorOnly) {
+  FlagSaver saver;
+  FLAGS_logtostderr = false;
+  FLAGS_stderrthreshold = NUM_SEVERITIES;
+  FLAGS_log_rate_limit_bytes = 4096;
+  FLAGS_log_rate_limit_summary_secs = 0;
+
+  CountingLogSink sink;
+  AddLogSink(&sink);
+  for (int i = 0; i < 1000; ++i) {
+    LOG(INFO) << "rate limited message " << i;
+    if (i % 100 == 0) {
+      LOG(ERROR) << "never shed " << i;
+    }
+  }
+  // The summary is logged once the pool had a chance to refill.
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  LOG(INFO) << "after the burst";
+  RemoveLogSink(&sink);
+  FLAGS_log_rate_limit_bytes = 0;
+  FLAGS_log_rate_limit_summary_secs = 60;
+
+  EXPECT_EQ(10, sink.counts[GLOG_ERROR]);
+  EXPECT_GT(sink.counts[GLOG_INFO], 0);
+  EXPECT_LT(sink.counts[GLOG_INFO], 1001);
+  EXPECT_NE(string::npos, sink.last_warning.find("INFO="));
+}
+
+TEST(LogRateLimit, SummarizesOnFlush) {
+  FlagSaver saver;
+  FLAGS_logtostderr = false;
+  FLAGS_stderrthreshold = NUM_SEVERITIES;
+  FLAGS_log_rate_limit_bytes = 4096;
+  FLAGS_log_rate_limit_summary_secs = 3600;
+
+  CountingLogSink sink;
+  AddLogSink(&sink);
+  // What a thread shed is published when it exits.
+  std::thread([] {
+    for (int i = 0; i < 1000; ++i) {
+      LOG(INFO) << "rate limited message " << i;
+    }
+  }).join();
+  EXPECT_EQ(string::npos, sink.last_warning.find("INFO="));
+  FlushLogFiles(GLOG_INFO);
+  RemoveLogSink(&sink);
+  FLAGS_log_rate_limit_bytes = 0;
+  FLAGS_log_rate_limit_summary_secs = 60;
+
+  EXPECT_NE(string::npos, sink.last_warning.find("INFO="));
+}
+
+TEST(LogDedup, CoalescesRepeats) {
+  FlagSaver saver;
+  FLAGS_logtostderr = false;
+  FLAGS_stderrthreshold = NUM_SEVERITIES;
+  FLAGS_log_dedup_window_ms = 60 * 1000;
+
+  CollectingLogSink sink;
+  AddLogSink(&sink);
+  for (int i = 0; i < 100; ++i) {
+    LOG(ERROR) << (i < 99 ? "storm" : "calm");
+  }
+  LOG(ERROR) << "calm";
+  RemoveLogSink(&sink);
+  FLAGS_log_dedup_window_ms = 0;
+
+  ASSERT_EQ(4, sink.messages.size());
+  EXPECT_EQ("storm", sink.messages[0]);
+  EXPECT_EQ(0, sink.messages[1].find("Last message repeated 98 times over"));
+  EXPECT_EQ("calm", sink.messages[2]);
+  // A message from another site is not a repeat.
+  EXPECT_EQ("calm", sink.messages[3]);
+}
+
+TEST(LogDedup, ReportsRepeatsOfExitedThreadsOnFlush) {
+  FlagSaver saver;
+  FLAGS_logtostderr = false;
+  FLAGS_stderrthreshold = NUM_SEVERITIES;
+  FLAGS_log_dedup_window_ms = 60 * 1000;
+
+  CollectingLogSink sink;
+  AddLogSink(&sink);
+  std::thread([] {
+    for (int i = 0; i < 3; ++i) {
+      LOG(ERROR) << "thread storm";
+    }
+  }).join();
+  for (int i = 0; i < 5; ++i) {
+    LOG(ERROR) << "storm";
+  }
+  // The exited thread left its count to be reported by the next flush.
+  EXPECT_EQ(2, sink.messages.size());
+  FlushLogFiles(GLOG_INFO);
+  RemoveLogSink(&sink);
+  FLAGS_log_dedup_window_ms = 0;
+
+  ASSERT_EQ(4, sink.messages.size());
+  EXPECT_EQ("thread storm", sink.messages[0]);
+  EXPECT_EQ("storm", sink.messages[1]);
+  EXPECT_EQ(0, sink.messages[2].find("Last message repeated 2 times over"));
+  EXPECT_EQ(0, sink.messages[3].find("Last message repeated 4 times over"));
+}
+
+namespace {
+class FieldsLogSink : public LogSink {
+ public:
+  void send(LogSeverity /* severity */, const char* /* full_filename */,
+            const char* /* base_filename */, int /* line */,
+            const LogMessageTime& /* time */, const char* /* message */,
+            size_t /* message_len */) override {
+    // Not called, the overload below is.
+  }
+  void SendWithFields(LogSeverity /* severity */,
+                      const char* /* full_filename */,
+                      const char* /* base_filename */, int /* line */,
+                      const LogMessageTime& /* time */, const char* message,
+                      size_t message_len, const LogFields& fields) override {
+    messages.emplace_back(message, message_len);
+    for (const LogField& field : fields) {
+      if (field.type() == LogField::kInt) {
+        ints.emplace_back(field.key(), field.int_value());
+      } else if (field.type() == LogField::kString) {
+        strings.emplace_back(field.key(), string(field.string_value(),
+                                                 field.string_size()));
+      }
+    }
+  }
+
+  vector<string> messages;
+  vector<std::pair<string, int64>> ints;
+  vector<std::pair<string, string>> strings;
+};
+}  // namespace
+
+TEST(StructuredLogging, SinkGetsTypedFields) {
+  FlagSaver saver;
+  FLAGS_logtostderr = false;
+  FLAGS_stderrthreshold = NUM_SEVERITIES;
+
+  FieldsLogSink sink;
+  CollectingLogSink legacy_sink;
+  AddLogSink(&sink);
+  AddLogSink(&legacy_sink);
+  LOG(INFO).With("user", 42).With("path", string("/a b")) << "served";
+  LOG(INFO).With("user", 43) << "line\n";
+  RemoveLogSink(&legacy_sink);
+  RemoveLogSink(&sink);
+
+  // Sinks get the message without the fields, as before they existed.
+  ASSERT_EQ(2, sink.messages.size());
+  EXPECT_EQ("served", sink.messages[0]);
+  EXPECT_EQ("line", sink.messages[1]);
+  EXPECT_EQ(sink.messages, legacy_sink.messages);
+  ASSERT_EQ(2, sink.ints.size());
+  EXPECT_EQ("user", sink.ints[0].first);
+  EXPECT_EQ(42, sink.ints[0].second);
+  ASSERT_EQ(1, sink.strings.size());
+  EXPECT_EQ("/a b", sink.strings[0].second);
+}
+
+namespace {
+// Encodes messages with the built-in encoders while they are sent.
+class CapturingLogEncoder : public LogEncoder {
+ public:
+  size_t Encode(const LogMessage& message, char* buf,
+                size_t size) const override {
+    json.assign(buf, JsonLogEncoder().Encode(message, buf, size));
+    logfmt.assign(buf, LogfmtLogEncoder().Encode(message, buf, size));
+    truncated = JsonLogEncoder().Encode(message, buf, 16);
+    truncated_end = buf[15];
+    text.assign(message.formatted_text(), message.formatted_text_size());
+    return TextLogEncoder().Encode(message, buf, size);
+  }
+
+  mutable string json;
+  mutable string logfmt;
+  mutable string text;
+  mutable size_t truncated = 0;
+  mutable char truncated_end = 0;
+};
+}  // namespace
+
+TEST(StructuredLogging, Encoders) {
+  FlagSaver saver;
+  FLAGS_logtostderr = true;
+
+  CapturingLogEncoder encoder;
+  SetStderrLogEncoder(&encoder);
+  LogMessage("foo.cc", 7, GLOG_WARNING).stream().With("ok", true).With(
+      "ratio", 0.5).With("name", "a\"b")
+      << "hello";
+  SetStderrLogEncoder(nullptr);
+
+  EXPECT_EQ(0, encoder.json.find("{\"time\":\"")) << encoder.json;
+  EXPECT_NE(string::npos,
+            encoder.json.find("\",\"severity\":\"WARNING\",\"file\":"
+                              "\"foo.cc\",\"line\":7,\"thread\":\""))
+      << encoder.json;
+  EXPECT_NE(string::npos,
+            encoder.json.find("\"message\":\"hello\",\"ok\":true,"
+                              "\"ratio\":0.5,\"name\":\"a\\\"b\"}\n"))
+      << encoder.json;
+
+  EXPECT_EQ(0, encoder.logfmt.find("time=")) << encoder.logfmt;
+  EXPECT_NE(string::npos,
+            encoder.logfmt.find(" severity=WARNING file=foo.cc line=7 thread="))
+      << encoder.logfmt;
+  EXPECT_NE(string::npos,
+            encoder.logfmt.find(
+                " message=hello ok=true ratio=0.5 name=\"a\\\"b\"\n"))
+      << encoder.logfmt;
+
+  EXPECT_NE(string::npos,
+            encoder.text.find("] hello ok=true ratio=0.5 name=\"a\\\"b\"\n"))
+      << encoder.text;
+
+  // A message which does not fit is truncated, still ending with '\n'.
+  EXPECT_EQ(16, encoder.truncated);
+  EXPECT_EQ('\n', encoder.truncated_end);
+
+  // Bytes which are not well-formed UTF-8 are replaced in JSON: a stray
+  // continuation byte, an overlong encoding, a surrogate and a truncated
+  // sequence, around a valid U+00E9.
+  SetStderrLogEncoder(&encoder);
+  LogMessage("foo.cc", 8, GLOG_WARNING).stream().With(
+      "bytes", "\x80\xc3\xa9\xc0\xaf\xed\xa0\x80\xe2\x82")
+      << "hello";
+  SetStderrLogEncoder(nullptr);
+  EXPECT_NE(string::npos,
+            encoder.json.find("\"bytes\":\"\\ufffd\xc3\xa9\\ufffd\\ufffd"
+                              "\\ufffd\\ufffd\\ufffd\\ufffd\\ufffd\"}"))
+      << encoder.json;
+}
+
+TEST(StructuredLogging, DoesNotAllocate) {
+  FlagSaver saver;
+  FLAGS_logtostderr = false;
+  FLAGS_stderrthreshold = NUM_SEVERITIES;
+
+  SetLogEncoder(GLOG_INFO, &JsonLogEncoder());
+  {
+    NewHook new_hook;
+    LOG(INFO).With("user", 42).With("name", "x").With("ratio", 1.5) << "hi";
+  }
+  SetLogEncoder(GLOG_INFO, nullptr);
+}
+
+namespace {
+string* flight_recorder_dump;
+void CaptureFlightRecorder(const char* data, size_t size) {
+  flight_recorder_dump->append(data, size);
+}
+}  // namespace
+
+TEST(FlightRecorder, RecordsSuppressedMessages) {
+  FlagSaver saver;
+  FLAGS_logtostderr = false;
+  FLAGS_stderrthreshold = NUM_SEVERITIES;
+  FLAGS_v = 0;
+  const int32 minloglevel = FLAGS_minloglevel;
+  FLAGS_minloglevel = GLOG_WARNING;
+  FLAGS_flight_recorder_bytes = 4096;
+  FLAGS_flight_recorder_v = 2;
+
+  FieldsLogSink sink;
+  AddLogSink(&sink);
+  const int line = __LINE__ + 1;
+  LOG(WARNING) << "recorded and logged";
+  LOG(INFO) << "below minloglevel";
+  VLOG(2) << "verbose detail";
+  VLOG(3) << "too verbose";
+  RemoveLogSink(&sink);
+  FLAGS_minloglevel = minloglevel;
+  FLAGS_flight_recorder_v = -1;
+  FLAGS_flight_recorder_bytes = 0;
+
+  ASSERT_EQ(1, sink.messages.size());
+  EXPECT_EQ("recorded and logged", sink.messages[0]);
+
+  string dump;
+  flight_recorder_dump = &dump;
+  DumpFlightRecorder(&CaptureFlightRecorder);
+  const size_t logged = dump.find(" logging_unittest.cc:" +
+                                  std::to_string(line) +
+                                  "] recorded and logged\n");
+  ASSERT_NE(string::npos, logged) << dump;
+  EXPECT_EQ('W', dump[dump.rfind('\n', logged) + 1]);
+  EXPECT_LT(logged, dump.find("] below minloglevel\n"));
+  EXPECT_LT(dump.find("] below minloglevel\n"),
+            dump.find("] verbose detail\n"));
+  EXPECT_NE(string::npos, dump.find("] verbose detail\n"));
+  EXPECT_EQ(string::npos, dump.find("too verbose"));
+}
+
+TEST(FlightRecorder, KeepsMostRecentMessages) {
+  FlagSaver saver;
+  FLAGS_logtostderr = false;
+  FLAGS_stderrthreshold = NUM_SEVERITIES;
+  FLAGS_flight_recorder_bytes = 4096;
+  for (int i = 0; i < 200; ++i) {
+    LOG(INFO) << "message " << i << ".";
+  }
+  FLAGS_flight_recorder_bytes = 0;
+
+  string dump;
+  flight_recorder_dump = &dump;
+  DumpFlightRecorder(&CaptureFlightRecorder);
+  EXPECT_EQ(string::npos, dump.find("] message 0."));
+  EXPECT_NE(string::npos, dump.find("] message 199.\n"));
+}
+
+namespace {
+struct LogsAtThreadExit {
+  ~LogsAtThreadExit() { LOG(INFO) << "after the ring was released"; }
+};
+}  // namespace
+
+TEST(FlightRecorder, IgnoresMessagesAfterRingIsReleased) {
+  FlagSaver saver;
+  FLAGS_logtostderr = false;
+  FLAGS_stderrthreshold = NUM_SEVERITIES;
+  FLAGS_flight_recorder_bytes = 4096;
+  std::thread([] {
+    // Constructed before the thread takes a ring, so destroyed after it.
+    static thread_local LogsAtThreadExit logs_at_exit;
+    (void)logs_at_exit;
+    LOG(INFO) << "before the thread exits";
+  }).join();
+  FLAGS_flight_recorder_bytes = 0;
+
+  string dump;
+  flight_recorder_dump = &dump;
+  DumpFlightRecorder(&CaptureFlightRecorder);
+  EXPECT_NE(string::npos, dump.find("] before the thread exits\n"));
+  EXPECT_EQ(string::npos, dump.find("after the ring was released"));
+}
+
+TEST(FlightRecorder, DumpedByLogFatal) {
+  ASSERT_DEATH(
+      {
+        FLAGS_flight_recorder_bytes = 4096;
+        LOG(INFO) << "before the crash";
+        LOG(FATAL) << "crash";
+      },
+      "Flight recorder: recent log messages by thread.*before the crash");
+}
+
+#if defined(HAVE_SYS_SOCKET_H) && defined(HAVE_SYS_UN_H)
+namespace {
+// A datagram socket standing in for the journal or syslog socket.
+class TestLogSocket {
+ public:
+  explicit TestLogSocket(const char* name)
+      : path_(FLAGS_test_tmpdir + "/" + name) {
+    unlink(path_.c_str());
+    fd_ = socket(AF_UNIX, SOCK_DGRAM, 0);
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    CHECK_LT(path_.size(), sizeof(address.sun_path));
+    memcpy(address.sun_path, path_.c_str(), path_.size());
+    CHECK_EQ(0, bind(fd_, reinterpret_cast<const sockaddr*>(&address),
+                     sizeof(address)));
+  }
+  ~TestLogSocket() {
+    close(fd_);
+    unlink(path_.c_str());
+  }
+
+  const string& path() const { return path_; }
+
+  // Returns the next datagram, or an empty string if there is none.
+  string Receive() {
+    char buf[65536];
+    const ssize_t size = recv(fd_, buf, sizeof(buf), MSG_DONTWAIT);
+    return size > 0 ? string(buf, static_cast<size_t>(size)) : string();
+  }
+
+ private:
+  const string path_;
+  int fd_;
+};
+}  // namespace
+
+TEST(SystemLogSinks, JournaldFields) {
+  FlagSaver saver;
+  FLAGS_logtostderr = false;
+  FLAGS_stderrthreshold = NUM_SEVERITIES;
+
+  TestLogSocket journal("journal.sock");
+  JournaldLogSink sink(journal.path().c_str());
+  AddLogSink(&sink);
+  const int line = __LINE__ + 1;
+  LOG(WARNING).With("request.id", 7) << "first\nsecond";
+  RemoveLogSink(&sink);
+
+  const string datagram = journal.Receive();
+  EXPECT_NE(string::npos, datagram.find("\nPRIORITY=4\n")) << datagram;
+  EXPECT_NE(string::npos, datagram.find("\nGLOG_SEVERITY=WARNING\n"));
+  EXPECT_NE(string::npos, datagram.find("\nCODE_FILE=" + string(__FILE__)));
+  EXPECT_NE(string::npos,
+            datagram.find("\nCODE_LINE=" + std::to_string(line) + "\n"));
+  EXPECT_NE(string::npos, datagram.find("\nTID="));
+  EXPECT_NE(string::npos, datagram.find("\nSYSLOG_IDENTIFIER="));
+  EXPECT_NE(string::npos, datagram.find("\nREQUEST_ID=7\n"));
+
+  // A message spanning lines is sent with its little-endian 64-bit size.
+  ASSERT_EQ(0, datagram.find("MESSAGE\n"));
+  uint64_t size = 0;
+  for (size_t i = 0; i < 8; ++i) {
+    size |= static_cast<uint64_t>(static_cast<unsigned char>(datagram[8 + i]))
+            << (8 * i);
+  }
+  // The fields are not repeated in the message.
+  const string message = datagram.substr(16, static_cast<size_t>(size));
+  EXPECT_EQ("first\nsecond", message);
+  EXPECT_EQ('\n', datagram[16 + size]);
+}
+
+TEST(SystemLogSinks, BatchesUntilFlush) {
+  FlagSaver saver;
+  FLAGS_logtostderr = false;
+  FLAGS_stderrthreshold = NUM_SEVERITIES;
+
+  TestLogSocket journal("journal.sock");
+  JournaldLogSink sink(journal.path().c_str());
+  AddLogSink(&sink);
+  LOG(INFO) << "batched 1";
+  LOG(INFO) << "batched 2";
+  EXPECT_EQ("", journal.Receive());
+  sink.Flush();
+  EXPECT_EQ(0, journal.Receive().find("MESSAGE=batched 1\n"));
+  EXPECT_EQ(0, journal.Receive().find("MESSAGE=batched 2\n"));
+
+  // A higher severity sends the batch.
+  LOG(INFO) << "batched 3";
+  LOG(ERROR) << "unbatched";
+  RemoveLogSink(&sink);
+  EXPECT_EQ(0, journal.Receive().find("MESSAGE=batched 3\n"));
+  EXPECT_EQ(0, journal.Receive().find("MESSAGE=unbatched\n"));
+
+  // So does FlushLogFiles().
+  AddLogSink(&sink);
+  LOG(INFO) << "batched 4";
+  RemoveLogSink(&sink);
+  EXPECT_EQ("", journal.Receive());
+  FlushLogFiles(GLOG_INFO);
+  EXPECT_EQ(0, journal.Receive().find("MESSAGE=batched 4\n"));
+  EXPECT_EQ(0, sink.dropped());
+}
+
+TEST(SystemLogSinks, DropsWithoutBlocking) {
+  FlagSaver saver;
+  FLAGS_logtostderr = false;
+  FLAGS_stderrthreshold = NUM_SEVERITIES;
+
+  // Nothing reads the socket: once its queue is full, the messages are
+  // dropped instead of blocking the logging threads.
+  TestLogSocket journal("journal.sock");
+  JournaldLogSink sink(journal.path().c_str());
+  AddLogSink(&sink);
+  for (int i = 0; i < 2000; ++i) {
+    LOG(INFO) << "unread " << i;
+  }
+  RemoveLogSink(&sink);
+  sink.Flush();
+  EXPECT_GT(sink.dropped(), 0);
+  EXPECT_EQ(0, journal.Receive().find("MESSAGE=unread 0\n"));
+}
+
+TEST(SystemLogSinks, Syslog) {
+  FlagSaver saver;
+  FLAGS_logtostderr = false;
+  FLAGS_stderrthreshold = NUM_SEVERITIES;
+
+  TestLogSocket syslog("syslog.sock");
+  SyslogLogSink sink(syslog.path().c_str());
+  AddLogSink(&sink);
+  const int line = __LINE__ + 1;
+  LOG(WARNING).With("quote", "a\"]b") << "hello";
+  RemoveLogSink(&sink);
+
+  const string datagram = syslog.Receive();
+  EXPECT_EQ(0, datagram.find("<12>1 ")) << datagram;
+  EXPECT_NE(string::npos,
+            datagram.find(" [glog@11129 file=\"logging_unittest.cc\" line=\"" +
+                          std::to_string(line) + "\" thread=\""))
+      << datagram;
+  const string end = " severity=\"WARNING\" quote=\"a\\\"\\]b\"] hello";
+  ASSERT_GE(datagram.size(), end.size());
+  EXPECT_EQ(end, datagram.substr(datagram.size() - end.size()));
+}
+
+TEST(SystemLogSinks, EnabledByFlags) {
+  FlagSaver saver;
+  FLAGS_logtostderr = false;
+  FLAGS_stderrthreshold = NUM_SEVERITIES;
+
+  TestLogSocket journal("journal.sock");
+  TestLogSocket syslog("syslog.sock");
+  FLAGS_journald_socket = journal.path();
+  FLAGS_syslog_socket = syslog.path();
+  FLAGS_logtojournald = true;
+  FLAGS_logtosyslog = true;
+  LOG(INFO) << "to system logs";
+  FlushLogFiles(GLOG_INFO);
+  FLAGS_logtojournald = false;
+  FLAGS_logtosyslog = false;
+  FLAGS_journald_socket = "/run/systemd/journal/socket";
+  FLAGS_syslog_socket = "/dev/log";
+
+  EXPECT_EQ(0, journal.Receive().find("MESSAGE=to system logs\n"));
+  const string datagram = syslog.Receive();
+  EXPECT_EQ(0, datagram.find("<14>1 ")) << datagram;
+  EXPECT_NE(string::npos, datagram.find("] to system logs")) << datagram;
+}
+namespace {
+// A Unix domain stream socket standing in for a log shipper.
+class TestStreamListener {
+ public:
+  explicit TestStreamListener(const char* name)
+      : path_(FLAGS_test_tmpdir + "/" + name) {
+    unlink(path_.c_str());
+  }
+  ~TestStreamListener() {
+    if (fd_ != -1) {
+      close(fd_);
+    }
+    if (listener_ != -1) {
+      close(listener_);
+    }
+    unlink(path_.c_str());
+  }
+
+  string address() const { return "unix:" + path_; }
+
+  void Listen() {
+    listener_ = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    CHECK_LT(path_.size(), sizeof(address.sun_path));
+    memcpy(address.sun_path, path_.c_str(), path_.size());
+    CHECK_EQ(0, bind(listener_, reinterpret_cast<const sockaddr*>(&address),
+                     sizeof(address)));
+    CHECK_EQ(0, listen(listener_, 1));
+  }
+
+  // Returns the next record, or an empty string after 5 seconds.
+  string ReceiveRecord() {
+    string size;
+    if (!Read(4, &size)) {
+      return "";
+    }
+    size_t record_size = 0;
+    for (char c : size) {
+      record_size = record_size << 8 | static_cast<unsigned char>(c);
+    }
+    string record;
+    return Read(record_size, &record) ? record : "";
+  }
+
+ private:
+  bool Read(size_t size, string* out) {
+    while (out->size() < size) {
+      pollfd p = {fd_ != -1 ? fd_ : listener_, POLLIN, 0};
+      if (poll(&p, 1, 5000) != 1) {
+        return false;
+      }
+      if (fd_ == -1) {
+        fd_ = accept(listener_, nullptr, nullptr);
+        continue;
+      }
+      char buf[4096];
+      const ssize_t n =
+          read(fd_, buf, std::min(sizeof(buf), size - out->size()));
+      if (n <= 0) {
+        return false;
+      }
+      out->append(buf, static_cast<size_t>(n));
+    }
+    return true;
+  }
+
+  const string path_;
+  int listener_ = -1;
+  int fd_ = -1;
+};
+}  // namespace
+
+TEST(StreamLogSink, SendsBinaryRecords) {
+  FlagSaver saver;
+  FLAGS_logtostderr = false;
+  FLAGS_stderrthreshold = NUM_SEVERITIES;
+
+  TestStreamListener shipper("shipper.sock");
+  shipper.Listen();
+  StreamLogSink sink(shipper.address().c_str(), StreamLogSink::kBinary);
+  AddLogSink(&sink);
+  const int line = __LINE__ + 1;
+  LOG(WARNING).With("id", 3) << "streamed";
+  EXPECT_TRUE(sink.Flush());
+  RemoveLogSink(&sink);
+
+  const string record = shipper.ReceiveRecord();
+  ASSERT_GT(record.size(), 38);
+  EXPECT_EQ(GLOG_WARNING, record[0]);
+  EXPECT_EQ(string({0, 0, static_cast<char>(line >> 8),
+                    static_cast<char>(line & 0xff)}),
+            record.substr(9, 4));
+  EXPECT_EQ(string("\0\x13logging_unittest.cc", 21), record.substr(13, 21));
+  EXPECT_EQ(0, record.compare(38, 8, "streamed"));
+  const string field("\0\x01\0\x02id\0\0\0\x01" "3", 11);
+  EXPECT_EQ(field, record.substr(record.size() - field.size()));
+  EXPECT_EQ(0, sink.dropped());
+}
+
+TEST(StreamLogSink, SpillsAndReplaysWhenPeerIsUnavailable) {
+  FlagSaver saver;
+  FLAGS_logtostderr = false;
+  FLAGS_stderrthreshold = NUM_SEVERITIES;
+
+  const string spill_file = FLAGS_test_tmpdir + "/shipper.spill";
+  unlink(spill_file.c_str());
+  TestStreamListener shipper("shipper.sock");
+  StreamLogSink sink(shipper.address().c_str(), StreamLogSink::kText,
+                     1024 * 1024, spill_file.c_str());
+  AddLogSink(&sink);
+  LOG(INFO) << "spilled";
+  EXPECT_TRUE(sink.Flush());
+  shipper.Listen();
+  LOG(INFO) << "live";
+  RemoveLogSink(&sink);
+
+  EXPECT_NE(string::npos, shipper.ReceiveRecord().find("] spilled"));
+  EXPECT_NE(string::npos, shipper.ReceiveRecord().find("] live"));
+  EXPECT_TRUE(sink.Flush());
+  EXPECT_EQ(0, sink.dropped());
+  unlink(spill_file.c_str());
+}
+
+TEST(StreamLogSink, DropsMessagesWhenBufferIsFull) {
+  FlagSaver saver;
+  FLAGS_logtostderr = false;
+  FLAGS_stderrthreshold = NUM_SEVERITIES;
+
+  TestStreamListener shipper("shipper.sock");
+  StreamLogSink sink(shipper.address().c_str(), StreamLogSink::kText, 256);
+  AddLogSink(&sink);
+  for (int i = 0; i < 20; ++i) {
+    LOG(INFO) << "buffered " << i;
+  }
+  RemoveLogSink(&sink);
+  EXPECT_GT(sink.dropped(), 0);
+}
+#endif
+
 TEST(Logging, FatalThrow) {
   auto const fail_func =
       InstallFailureFunction(+[]()
@@ -31,7 +31,9 @@
 //
 // logging_unittest.cc covers the functionality herein
 
+#include <algorithm>
 #include <cstdarg>
+#include <cstdint>
 #include <cstdio>
 #include <cstring>
 #include <iomanip>
@@ -39,6 +41,7 @@
 #include <ostream>
 #include <streambuf>
 #include <thread>
+#include <type_traits>
 
 #include "config.h"
 
@@ -81,29 +84,505 @@ namespace google {
 #  define GLOG_ATTRIBUTE_FORMAT_ARG(stringIndex)
 #endif
 
-// CAVEAT: std::vsnprintf called from *DoRawLog below has some (exotic) code
-// paths that invoke malloc() and getenv() that might acquire some locks. If
-// this becomes a problem we should reimplement a subset of std::vsnprintf that
-// does not need locks and malloc.
+// CAVEAT: std::vsnprintf has some (exotic) code paths that invoke malloc() and
+// getenv() that might acquire some locks. *DoRawLog below therefore formats the
+// conversions supported by RAW_LOG_TYPED itself, and only falls back to
+// std::vsnprintf for the others, such as those of floating-point numbers.
 
-// Helper for RawLog__ below.
-// *DoRawLog writes to *buf of *size and move them past the written portion.
-// It returns true iff there was no overflow or error.
-GLOG_ATTRIBUTE_FORMAT(printf, 3, 4)
-static bool DoRawLog(char** buf, size_t* size, const char* format, ...) {
-  va_list ap;
-  va_start(ap, format);
-  int n = std::vsnprintf(*buf, *size, format, ap);
-  va_end(ap);
-  if (n < 0 || static_cast<size_t>(n) > *size) return false;
-  *size -= static_cast<size_t>(n);
-  *buf += n;
+namespace {
+
+using logging::internal::RawLogArg;
+
+// Widths and precisions are capped so that the formatting cost is bounded.
+constexpr int kMaxRawFormatWidth = 1 << 16;
+
+// A conversion specification of a format.
+struct RawFormatSpec {
+  enum Length { kInt, kChar, kShort, kLong, kLongLong, kMax, kSize, kPtrdiff };
+
+  bool left{false};
+  bool plus{false};
+  bool space{false};
+  bool alternate{false};
+  bool zero{false};
+  bool width_arg{false};
+  bool precision_arg{false};
+  int width{0};
+  int precision{-1};
+  Length length{kInt};
+  char conversion{'\0'};
+};
+
+int ParseRawFormatNumber(const char** format) {
+  int value = 0;
+  for (; **format >= '0' && **format <= '9'; ++*format) {
+    value = std::min(value * 10 + (**format - '0'), kMaxRawFormatWidth);
+  }
+  return value;
+}
+
+// Parses the conversion specification following a '%' at *format and moves
+// *format past it. Returns false if the formatter does not support it.
+bool ParseRawFormatSpec(const char** format, RawFormatSpec* spec) {
+  const char* p = *format;
+  for (;; ++p) {
+    if (*p == '-') {
+      spec->left = true;
+    } else if (*p == '+') {
+      spec->plus = true;
+    } else if (*p == ' ') {
+      spec->space = true;
+    } else if (*p == '#') {
+      spec->alternate = true;
+    } else if (*p == '0') {
+      spec->zero = true;
+    } else {
+      break;
+    }
+  }
+  if (*p == '*') {
+    spec->width_arg = true;
+    ++p;
+  } else {
+    spec->width = ParseRawFormatNumber(&p);
+  }
+  if (*p == '.') {
+    ++p;
+    if (*p == '*') {
+      spec->precision_arg = true;
+      ++p;
+    } else {
+      spec->precision = ParseRawFormatNumber(&p);
+    }
+  }
+  switch (*p) {
+    case 'h':
+      spec->length = p[1] == 'h' ? RawFormatSpec::kChar : RawFormatSpec::kShort;
+      p += p[1] == 'h' ? 2 : 1;
+      break;
+    case 'l':
+      spec->length =
+          p[1] == 'l' ? RawFormatSpec::kLongLong : RawFormatSpec::kLong;
+      p += p[1] == 'l' ? 2 : 1;
+      break;
+    case 'j':
+      spec->length = RawFormatSpec::kMax;
+      ++p;
+      break;
+    case 'z':
+      spec->length = RawFormatSpec::kSize;
+      ++p;
+      break;
+    case 't':
+      spec->length = RawFormatSpec::kPtrdiff;
+      ++p;
+      break;
+    default:
+      break;
+  }
+  spec->conversion = *p;
+  switch (*p) {
+    case 'd':
+    case 'i':
+    case 'u':
+    case 'x':
+    case 'X':
+    case 'p':
+    case '%':
+      break;
+    case 'c':
+    case 's':
+      // Wide characters and strings are not supported.
+      if (spec->length != RawFormatSpec::kInt) {
+        return false;
+      }
+      break;
+    default:
+      return false;
+  }
+  *format = p + 1;
+  return true;
+}
+
+// Whether the formatter supports all the conversions of format.
+bool IsRawFormatSupported(const char* format) {
+  while ((format = strchr(format, '%')) != nullptr) {
+    ++format;
+    RawFormatSpec spec;
+    if (!ParseRawFormatSpec(&format, &spec)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Writes to a buffer of a fixed size, keeping it '\0'-terminated, and
+// remembers whether anything did not fit.
+class RawFormatBuffer {
+ public:
+  RawFormatBuffer(char* buf, size_t size) noexcept
+      : begin_{buf},
+        pos_{buf},
+        end_{size > 0 ? buf + size - 1 : buf},
+        terminate_{size > 0} {}
+
+  void Append(char c) noexcept { Fill(c, 1); }
+  void Append(const char* data, size_t size) noexcept {
+    const size_t n = std::min(size, static_cast<size_t>(end_ - pos_));
+    memcpy(pos_, data, n);
+    pos_ += n;
+    overflow_ |= n < size;
+  }
+  void Fill(char c, size_t size) noexcept {
+    const size_t n = std::min(size, static_cast<size_t>(end_ - pos_));
+    memset(pos_, c, n);
+    pos_ += n;
+    overflow_ |= n < size;
+  }
+  void Terminate() noexcept {
+    if (terminate_) {
+      *pos_ = '\0';
+    }
+  }
+
+  size_t size() const noexcept { return static_cast<size_t>(pos_ - begin_); }
+  bool overflow() const noexcept { return overflow_; }
+
+ private:
+  char* begin_;
+  char* pos_;
+  char* end_;
+  bool terminate_;
+  bool overflow_{false};
+};
+
+// Appends data, padded to the width of spec.
+void AppendRawPadded(RawFormatBuffer* out, const RawFormatSpec& spec,
+                     const char* data, size_t size) {
+  const size_t padding =
+      static_cast<size_t>(spec.width) > size ? spec.width - size : 0;
+  if (!spec.left) {
+    out->Fill(' ', padding);
+  }
+  out->Append(data, size);
+  if (spec.left) {
+    out->Fill(' ', padding);
+  }
+}
+
+void AppendRawString(RawFormatBuffer* out, const RawFormatSpec& spec,
+                     const char* str) {
+  if (str == nullptr) {
+    str = "(null)";
+  }
+  size_t size = 0;
+  while ((spec.precision < 0 || size < static_cast<size_t>(spec.precision)) &&
+         str[size] != '\0') {
+    ++size;
+  }
+  AppendRawPadded(out, spec, str, size);
+}
+
+// Appends an integer of the given magnitude and sign, as printf does for
+// the conversion and the flags of spec.
+void AppendRawInteger(RawFormatBuffer* out, const RawFormatSpec& spec,
+                      uint64 magnitude, bool negative) {
+  const bool hex = spec.conversion == 'x' || spec.conversion == 'X';
+  const char* const digit_chars =
+      spec.conversion == 'X' ? "0123456789ABCDEF" : "0123456789abcdef";
+  const unsigned base = hex ? 16 : 10;
+  char digits[24];
+  size_t num_digits = 0;
+  // Like printf, a precision of 0 prints no digits for 0.
+  if (magnitude != 0 || spec.precision != 0) {
+    do {
+      digits[num_digits++] = digit_chars[magnitude % base];
+      magnitude /= base;
+    } while (magnitude != 0);
+  }
+
+  char prefix[2];
+  size_t prefix_size = 0;
+  const bool is_signed = spec.conversion == 'd' || spec.conversion == 'i';
+  if (negative) {
+    prefix[prefix_size++] = '-';
+  } else if (is_signed && spec.plus) {
+    prefix[prefix_size++] = '+';
+  } else if (is_signed && spec.space) {
+    prefix[prefix_size++] = ' ';
+  } else if (hex && spec.alternate && num_digits > 0 &&
+             !(num_digits == 1 && digits[0] == '0')) {
+    prefix[prefix_size++] = '0';
+    prefix[prefix_size++] = spec.conversion;
+  }
+
+  size_t zeros = spec.precision > 0 &&
+                         static_cast<size_t>(spec.precision) > num_digits
+                     ? spec.precision - num_digits
+                     : 0;
+  size_t size = prefix_size + zeros + num_digits;
+  if (spec.zero && !spec.left && spec.precision < 0 &&
+      static_cast<size_t>(spec.width) > size) {
+    zeros += spec.width - size;
+    size = spec.width;
+  }
+  const size_t padding =
+      static_cast<size_t>(spec.width) > size ? spec.width - size : 0;
+  if (!spec.left) {
+    out->Fill(' ', padding);
+  }
+  out->Append(prefix, prefix_size);
+  out->Fill('0', zeros);
+  while (num_digits > 0) {
+    out->Append(digits[--num_digits]);
+  }
+  if (spec.left) {
+    out->Fill(' ', padding);
+  }
+}
+
+// Appends a pointer as the C library of the platform does for %p.
+void AppendRawPointer(RawFormatBuffer* out, RawFormatSpec spec,
+                      const void* pointer) {
+  const auto value = reinterpret_cast<std::uintptr_t>(pointer);
+#if defined(GLOG_OS_WINDOWS)
+  spec.conversion = 'X';
+  spec.precision = static_cast<int>(2 * sizeof(pointer));
+#else
+  if (value == 0) {
+#  if defined(__GLIBC__)
+    AppendRawPadded(out, spec, "(nil)", 5);
+#  else
+    AppendRawPadded(out, spec, "0x0", 3);
+#  endif
+    return;
+  }
+  spec.conversion = 'x';
+  spec.alternate = true;
+#endif
+  spec.plus = spec.space = false;
+  AppendRawInteger(out, spec, value, false);
+}
+
+// Appends arg, as the conversion of spec says if it applies to the type of
+// arg, and as its type says otherwise.
+void AppendRawArg(RawFormatBuffer* out, const RawFormatSpec& spec,
+                  const RawLogArg& arg) {
+  switch (arg.type()) {
+    case RawLogArg::kString:
+      if (spec.conversion == 'p') {
+        AppendRawPointer(out, spec, arg.string_value());
+      } else {
+        AppendRawString(out, spec, arg.string_value());
+      }
+      return;
+    case RawLogArg::kPointer:
+      AppendRawPointer(out, spec, arg.pointer_value());
+      return;
+    case RawLogArg::kSigned:
+    case RawLogArg::kChar:
+    case RawLogArg::kUnsigned:
+      break;
+  }
+
+  const bool negative =
+      arg.type() != RawLogArg::kUnsigned && arg.signed_value() < 0;
+  uint64 bits = arg.type() == RawLogArg::kUnsigned
+                    ? arg.unsigned_value()
+                    : static_cast<uint64>(arg.signed_value());
+  if (spec.conversion == 'c' ||
+      (spec.conversion == 's' && arg.type() == RawLogArg::kChar)) {
+    const char c = static_cast<char>(bits);
+    AppendRawPadded(out, spec, &c, 1);
+    return;
+  }
+  RawFormatSpec integer_spec = spec;
+  switch (spec.conversion) {
+    case 'p':
+      AppendRawPointer(out, spec,
+                       reinterpret_cast<const void*>(
+                           static_cast<std::uintptr_t>(bits)));
+      return;
+    case 'u':
+    case 'x':
+    case 'X':
+      if (negative) {
+        // As printf, print the bits of the argument as unsigned.
+        if (arg.size() < sizeof(bits)) {
+          bits &= (uint64{1} << (8 * arg.size())) - 1;
+        }
+        AppendRawInteger(out, spec, bits, false);
+        return;
+      }
+      break;
+    case 'd':
+    case 'i':
+      break;
+    default:
+      // %s prints integers in decimal as well.
+      integer_spec.conversion = 'd';
+      break;
+  }
+  AppendRawInteger(out, integer_spec, negative ? 0 - bits : bits, negative);
+}
+
+// The arguments of RawLog__, read as the conversions say.
+class RawVaArgs {
+ public:
+  explicit RawVaArgs(va_list ap) noexcept { va_copy(ap_, ap); }
+  ~RawVaArgs() { va_end(ap_); }
+  RawVaArgs(const RawVaArgs&) = delete;
+  RawVaArgs& operator=(const RawVaArgs&) = delete;
+
+  int NextInt() noexcept { return va_arg(ap_, int); }
+
+  RawLogArg Next(const RawFormatSpec& spec) noexcept {
+    switch (spec.conversion) {
+      case 'd':
+      case 'i':
+        switch (spec.length) {
+          case RawFormatSpec::kChar:
+            return static_cast<signed char>(va_arg(ap_, int));
+          case RawFormatSpec::kShort:
+            return static_cast<short>(va_arg(ap_, int));
+          case RawFormatSpec::kInt:
+            return va_arg(ap_, int);
+          case RawFormatSpec::kLong:
+            return va_arg(ap_, long);
+          case RawFormatSpec::kLongLong:
+            return va_arg(ap_, long long);
+          case RawFormatSpec::kMax:
+            return va_arg(ap_, std::intmax_t);
+          case RawFormatSpec::kSize:
+            return va_arg(ap_, std::make_signed_t<size_t>);
+          case RawFormatSpec::kPtrdiff:
+            return va_arg(ap_, std::ptrdiff_t);
+        }
+        break;
+      case 'u':
+      case 'x':
+      case 'X':
+        switch (spec.length) {
+          case RawFormatSpec::kChar:
+            return static_cast<unsigned char>(va_arg(ap_, unsigned));
+          case RawFormatSpec::kShort:
+            return static_cast<unsigned short>(va_arg(ap_, unsigned));
+          case RawFormatSpec::kInt:
+            return va_arg(ap_, unsigned);
+          case RawFormatSpec::kLong:
+            return va_arg(ap_, unsigned long);
+          case RawFormatSpec::kLongLong:
+            return va_arg(ap_, unsigned long long);
+          case RawFormatSpec::kMax:
+            return va_arg(ap_, std::uintmax_t);
+          case RawFormatSpec::kSize:
+            return va_arg(ap_, size_t);
+          case RawFormatSpec::kPtrdiff:
+            return va_arg(ap_, std::make_unsigned_t<std::ptrdiff_t>);
+        }
+        break;
+      case 'c':
+        return static_cast<char>(va_arg(ap_, int));
+      case 's':
+        return va_arg(ap_, const char*);
+      default:
+        break;
+    }
+    return va_arg(ap_, const void*);
+  }
+
+ private:
+  va_list ap_;
+};
+
+// The arguments of RawLogArgs__, read as their types say.
+class RawArrayArgs {
+ public:
+  RawArrayArgs(const RawLogArg* args, size_t num_args) noexcept
+      : args_{args}, num_args_{num_args} {}
+
+  int NextInt() noexcept {
+    if (next_ == num_args_) {
+      return 0;
+    }
+    const RawLogArg& arg = args_[next_++];
+    switch (arg.type()) {
+      case RawLogArg::kSigned:
+      case RawLogArg::kChar:
+        return static_cast<int>(arg.signed_value());
+      case RawLogArg::kUnsigned:
+        return static_cast<int>(arg.unsigned_value());
+      default:
+        return 0;
+    }
+  }
+
+  RawLogArg Next(const RawFormatSpec& /*spec*/) noexcept {
+    if (next_ == num_args_) {
+      return "(missing)";
+    }
+    return args_[next_++];
+  }
+
+ private:
+  const RawLogArg* args_;
+  size_t num_args_;
+  size_t next_{0};
+};
+
+// Formats the arguments as format says, like std::vsnprintf, into *buf of
+// *size and moves them past the written portion. It returns true iff there
+// was no overflow. Conversion specifications that are not supported are
+// written as they are.
+template <class Args>
+bool RawFormat(char** buf, size_t* size, const char* format, Args* args) {
+  RawFormatBuffer out(*buf, *size);
+  const char* p = format;
+  while (*p != '\0') {
+    const char* percent = strchr(p, '%');
+    if (percent == nullptr) {
+      out.Append(p, strlen(p));
+      break;
+    }
+    out.Append(p, static_cast<size_t>(percent - p));
+    p = percent + 1;
+    RawFormatSpec spec;
+    if (!ParseRawFormatSpec(&p, &spec)) {
+      out.Append('%');
+      continue;
+    }
+    if (spec.conversion == '%') {
+      out.Append('%');
+      continue;
+    }
+    if (spec.width_arg) {
+      const int width = args->NextInt();
+      spec.left |= width < 0;
+      spec.width = std::min(width < 0 ? -width : width, kMaxRawFormatWidth);
+    }
+    if (spec.precision_arg) {
+      const int precision = args->NextInt();
+      spec.precision =
+          precision < 0 ? -1 : std::min(precision, kMaxRawFormatWidth);
+    }
+    AppendRawArg(&out, spec, args->Next(spec));
+  }
+  out.Terminate();
+  if (out.overflow()) return false;
+  *size -= out.size();
+  *buf += out.size();
   return true;
 }
 
+}  // namespace
+
 // Helper for RawLog__ below.
 inline static bool VADoRawLog(char** buf, size_t* size, const char* format,
                               va_list ap) {
+  if (IsRawFormatSupported(format)) {
+    RawVaArgs args(ap);
+    return RawFormat(buf, size, format, &args);
+  }
 #if defined(__GNUC__)
 #  pragma GCC diagnostic push
 #  pragma GCC diagnostic ignored "-Wformat-nonliteral"
@@ -118,6 +597,18 @@ inline static bool VADoRawLog(char** buf, size_t* size, const char* format,
   return true;
 }
 
+// Helper for RawLog__ below.
+// *DoRawLog writes to *buf of *size and move them past the written portion.
+// It returns true iff there was no overflow or error.
+GLOG_ATTRIBUTE_FORMAT(printf, 3, 4)
+static bool DoRawLog(char** buf, size_t* size, const char* format, ...) {
+  va_list ap;
+  va_start(ap, format);
+  bool result = VADoRawLog(buf, size, format, ap);
+  va_end(ap);
+  return result;
+}
+
 static const int kLogBufSize = 3000;
 static std::once_flag crashed;
 static logging::internal::CrashReason crash_reason;
@@ -143,9 +634,11 @@ class StaticStringBuf : public std::streambuf {
 };
 }  // namespace
 
-GLOG_ATTRIBUTE_FORMAT(printf, 4, 5)
-void RawLog__(LogSeverity severity, const char* file, int line,
-              const char* format, ...) {
+// Writes a line with the prefix and the message formatted by
+// format_message(&buf, &size), which returns false if the message is too long.
+template <class FormatMessage>
+static void RawLogLine(LogSeverity severity, const char* file, int line,
+                       FormatMessage&& format_message) {
   if (!(FLAGS_logtostdout || FLAGS_logtostderr ||
         severity >= FLAGS_stderrthreshold || FLAGS_alsologtostderr ||
         !IsGoogleLoggingInitialized())) {
@@ -175,10 +668,7 @@ void RawLog__(LogSeverity severity, const char* file, int line,
   const char* msg_start = buf;
   const size_t msg_size = size;
 
-  va_list ap;
-  va_start(ap, format);
-  bool no_chop = VADoRawLog(&buf, &size, format, ap);
-  va_end(ap);
+  bool no_chop = format_message(&buf, &size);
   if (no_chop) {
     DoRawLog(&buf, &size, "\n");
   } else {
@@ -207,4 +697,25 @@ void RawLog__(LogSeverity severity, const char* file, int line,
   }
 }
 
+GLOG_ATTRIBUTE_FORMAT(printf, 4, 5)
+void RawLog__(LogSeverity severity, const char* file, int line,
+              const char* format, ...) {
+  va_list ap;
+  va_start(ap, format);
+  RawLogLine(severity, file, line, [format, &ap](char** buf, size_t* size) {
+    return VADoRawLog(buf, size, format, ap);
+  });
+  va_end(ap);
+}
+
+void RawLogArgs__(LogSeverity severity, const char* file, int line,
+                  const char* format, const logging::internal::RawLogArg* args,
+                  size_t num_args) {
+  RawLogLine(severity, file, line,
+             [format, args, num_args](char** buf, size_t* size) {
+               RawArrayArgs array_args(args, num_args);
+               return RawFormat(buf, size, format, &array_args);
+             });
+}
+
 }  // namespace google
@@ -0,0 +1,150 @@
+// Copyright (c) 2024, Google Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// Tests the LOG_EVERY_N macros with sharded counters.
+
+#define GLOG_SHARDED_LOG_EVERY_N
+
+#include <atomic>
+#include <cerrno>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "glog/logging.h"
+#include "googletest.h"
+
+#ifdef GLOG_USE_GFLAGS
+#  include <gflags/gflags.h>
+using namespace GFLAGS_NAMESPACE;
+#endif
+
+using namespace google;
+
+namespace {
+
+class CollectingLogSink : public LogSink {
+ public:
+  void send(LogSeverity /* severity */, const char* /* full_filename */,
+            const char* /* base_filename */, int /* line */,
+            const LogMessageTime& /* time */, const char* message,
+            size_t message_len) override {
+    std::lock_guard<std::mutex> l{mutex};
+    messages.emplace_back(message, message_len);
+  }
+
+  std::mutex mutex;
+  std::vector<std::string> messages;
+};
+
+}  // namespace
+
+TEST(ShardedLogEveryN, SingleThread) {
+  CollectingLogSink sink;
+  AddLogSink(&sink);
+  for (int i = 0; i < 1000; ++i) {
+    LOG_EVERY_N(INFO, 10) << "every " << google::COUNTER;
+  }
+  RemoveLogSink(&sink);
+
+  // The first occurrence is merged right away, then batches of 10.
+  ASSERT_EQ(100u, sink.messages.size());
+  EXPECT_EQ("every 1", sink.messages[0]);
+  EXPECT_EQ("every 11", sink.messages[1]);
+  EXPECT_EQ("every 991", sink.messages[99]);
+}
+
+TEST(ShardedLogEveryN, Conditional) {
+  CollectingLogSink sink;
+  AddLogSink(&sink);
+  for (int i = 0; i < 1000; ++i) {
+    LOG_IF_EVERY_N(INFO, i % 2 == 0, 10) << "even " << google::COUNTER;
+    LOG_IF_EVERY_N(INFO, false, 1) << "never";
+  }
+  RemoveLogSink(&sink);
+
+  // Only the 500 occurrences where the condition held are counted.
+  ASSERT_EQ(50u, sink.messages.size());
+  EXPECT_EQ("even 1", sink.messages[0]);
+  EXPECT_EQ("even 491", sink.messages[49]);
+}
+
+TEST(ShardedLogEveryN, Errno) {
+  CollectingLogSink sink;
+  AddLogSink(&sink);
+  for (int i = 0; i < 100; ++i) {
+    errno = ENOENT;
+    PLOG_EVERY_N(ERROR, 50) << "failed " << google::COUNTER;
+  }
+  RemoveLogSink(&sink);
+
+  ASSERT_EQ(2u, sink.messages.size());
+  EXPECT_EQ(0u, sink.messages[0].find("failed 1: "));
+  EXPECT_EQ(0u, sink.messages[1].find("failed 51: "));
+}
+
+TEST(ShardedLogEveryN, ManyThreads) {
+  constexpr int kThreads = 8;
+  constexpr int kIterations = 10000;
+  CollectingLogSink sink;
+  AddLogSink(&sink);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([] {
+      for (int i = 0; i < kIterations; ++i) {
+        LOG_EVERY_N(INFO, 1000) << "shared site";
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  RemoveLogSink(&sink);
+
+  // Each thread leaves at most a batch unmerged.
+  const size_t most = kThreads * kIterations / 1000;
+  const size_t least =
+      (kThreads * (kIterations - logging::internal::kShardedEveryNMaxBatch) +
+       999) /
+      1000;
+  EXPECT_LE(sink.messages.size(), most);
+  EXPECT_GE(sink.messages.size(), least);
+}
+
+int main(int argc, char** argv) {
+  FLAGS_logtostderr = true;
+  InitGoogleLogging(argv[0]);
+  InitGoogleTest(&argc, argv);
+#ifdef GLOG_USE_GFLAGS
+  ParseCommandLineFlags(&argc, &argv, true);
+#endif
+
+  return RUN_ALL_TESTS();
+}
@@ -32,12 +32,20 @@
 // Implementation of InstallFailureSignalHandler().
 
 #include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
 #include <csignal>
 #include <cstring>
 #include <ctime>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <sstream>
 #include <thread>
+#include <utility>
+#include <vector>
 
 #include "config.h"
 #include "glog/logging.h"
@@ -60,6 +68,12 @@
 #  include <sys/types.h>
 #endif
 
+#if defined(GLOG_OS_LINUX) && defined(HAVE_STACKTRACE) && \
+    defined(HAVE_SIGACTION) && defined(HAVE_SYS_SYSCALL_H) && defined(SIGRTMAX)
+#  include <fcntl.h>
+#  define HAVE_THREAD_STACK_DUMP
+#endif
+
 namespace google {
 
 namespace {
@@ -167,8 +181,10 @@ void WriteToStderr(const char* data, size_t size) {
   }
 }
 
+using FailureWriter = void (*)(const char* data, size_t size);
+
 // The writer function can be changed by InstallFailureWriter().
-void (*g_failure_writer)(const char* data, size_t size) = WriteToStderr;
+FailureWriter g_failure_writer = WriteToStderr;
 
 // Dumps time information.  We don't dump human-readable time information
 // as localtime() is not guaranteed to be async signal safe.
@@ -240,16 +256,19 @@ void DumpSignalInfo(int signal_number, siginfo_t* siginfo) {
 
 #endif  // HAVE_SIGACTION
 
-// Dumps information about the stack frame to STDERR.
-void DumpStackFrameInfo(const char* prefix, void* pc) {
+// Dumps information about the stack frame with |writer|.
+void DumpStackFrameInfo(const char* prefix, void* pc, FailureWriter writer) {
   // Get the symbol name.
   const char* symbol = "(unknown)";
 #if defined(HAVE_SYMBOLIZE)
   char symbolized[1024];  // Big enough for a sane symbol.
   // Symbolizes the previous address of pc because pc may be in the
   // next function.
-  if (Symbolize(reinterpret_cast<char*>(pc) - 1, symbolized,
-                sizeof(symbolized))) {
+  if (FLAGS_symbolize_offline) {
+    // Leave it to glog_symbolize; see DumpModuleMap().
+    symbol = "";
+  } else if (Symbolize(reinterpret_cast<char*>(pc) - 1, symbolized,
+                       sizeof(symbolized))) {
     symbol = symbolized;
   }
 #else
@@ -267,9 +286,496 @@ void DumpStackFrameInfo(const char* prefix, void* pc) {
   formatter.AppendString(" ");
   formatter.AppendString(symbol);
   formatter.AppendString("\n");
-  g_failure_writer(buf, formatter.num_bytes_written());
+  writer(buf, formatter.num_bytes_written());
+}
+
+#if defined(HAVE_SYMBOLIZE) && !defined(GLOG_OS_WINDOWS)
+void WriteModuleMapLine(const char* data, void* writer) {
+  (*static_cast<FailureWriter*>(writer))(data, strlen(data));
+}
+
+// Dumps the module map needed to symbolize the program counters offline if
+// --symbolize_offline is set.
+void DumpModuleMap(void* const* pcs, int n, FailureWriter writer) {
+  if (FLAGS_symbolize_offline) {
+    WriteModuleMap(pcs, n, WriteModuleMapLine, &writer);
+  }
+}
+#endif
+
+#ifdef HAVE_STACKTRACE
+// Dumps the stack trace |stack| of |depth| frames, taken where the program
+// counter was |pc| unless it is nullptr, with |writer|.
+void DumpStackTrace(void* pc, void* const* stack, int depth,
+                    FailureWriter writer) {
+  if (pc != nullptr) {
+    DumpStackFrameInfo("PC: ", pc, writer);
+  }
+  for (int i = 0; i < depth; ++i) {
+    DumpStackFrameInfo("    ", stack[i], writer);
+  }
+#if defined(HAVE_SYMBOLIZE) && !defined(GLOG_OS_WINDOWS)
+  // The module map must cover the PC as well.
+  void* pcs[33];
+  const int n =
+      std::max(0, std::min(depth, static_cast<int>(ARRAYSIZE(pcs)) - 1));
+  std::copy(stack, stack + n, pcs);
+  pcs[n] = pc;
+  DumpModuleMap(pcs, pc != nullptr ? n + 1 : n, writer);
+#endif
+}
+
+// Dumps the stack trace of the calling thread with |writer|, skipping
+// |skip_count| frames besides this function.
+void DumpCurrentThreadStack(int skip_count, FailureWriter writer) {
+  void* stack[32];
+  const int depth = GetStackTrace(stack, ARRAYSIZE(stack), skip_count + 1);
+  char buf[128];
+  MinimalFormatter formatter(buf, sizeof(buf));
+#  if defined(HAVE_SYS_SYSCALL_H) && defined(GLOG_OS_LINUX)
+  formatter.AppendString("*** Thread LWP ");
+  formatter.AppendUint64(static_cast<uint64>(syscall(SYS_gettid)), 10);
+  formatter.AppendString(" (current) stack trace: ***\n");
+#  else
+  formatter.AppendString("*** Current thread stack trace: ***\n");
+#  endif
+  writer(buf, formatter.num_bytes_written());
+  DumpStackTrace(nullptr, stack, depth, writer);
+}
+#endif  // HAVE_STACKTRACE
+
+#if defined(HAVE_THREAD_STACK_DUMP)
+
+// Other threads are asked to take their stack traces with this real-time
+// signal.
+int ThreadStackSignal() { return SIGRTMAX - 1; }
+
+// The stack trace of another thread.  A slot is requested for a thread by
+// the dumping thread and written by the signal handler of that thread.
+enum ThreadStackState : int {
+  kThreadStackFree,
+  kThreadStackRequested,
+  kThreadStackWriting,
+  kThreadStackDone,
+};
+
+struct ThreadStack {
+  std::atomic<pid_t> tid;
+  std::atomic<int> state;
+  bool requested;  // By the current dump; only used by the dumping thread.
+  void* pc;
+  int depth;
+  void* stack[32];
+};
+
+// Preallocated, since other threads may be dumped from a signal handler.
+constexpr int kMaxThreadStacks = 128;
+ThreadStack g_thread_stacks[kMaxThreadStacks];
+
+// Serializes the dumps of the stacks of other threads.
+std::atomic<bool> g_dumping_thread_stacks{false};
+
+// Whether ThreadStackSignalHandler() handles ThreadStackSignal().  The first
+// dump installs it, unless the program handles or ignores the signal itself,
+// in which case the stacks of other threads are never dumped.  Only accessed
+// by the thread dumping stacks.
+enum ThreadStackHandler : int {
+  kThreadStackHandlerUnknown,
+  kThreadStackHandlerInstalled,
+  kThreadStackHandlerUnavailable,
+};
+ThreadStackHandler g_thread_stack_handler = kThreadStackHandlerUnknown;
+
+// Returned by CollectThreadStacks() instead of the number of missed threads.
+constexpr int kThreadStacksBusy = -1;
+constexpr int kThreadStackSignalInUse = -2;
+
+// Takes the stack trace of the calling thread into its requested slot.
+void ThreadStackSignalHandler(int /*signal_number*/, siginfo_t* signal_info,
+                              void* ucontext) {
+  // Ignore the signal unless it was sent by DumpOtherThreadStacks().
+  if (signal_info->si_code != SI_TKILL || signal_info->si_pid != getpid()) {
+    return;
+  }
+  const int saved_errno = errno;
+  const auto tid = static_cast<pid_t>(syscall(SYS_gettid));
+  for (ThreadStack& slot : g_thread_stacks) {
+    int expected = kThreadStackRequested;
+    if (slot.state.load(std::memory_order_acquire) == kThreadStackRequested &&
+        slot.tid.load(std::memory_order_relaxed) == tid &&
+        slot.state.compare_exchange_strong(expected, kThreadStackWriting,
+                                           std::memory_order_acquire)) {
+      slot.pc = GetPC(ucontext);
+      // +1 to exclude this function.
+      slot.depth = GetStackTrace(slot.stack, ARRAYSIZE(slot.stack), 1);
+      slot.state.store(kThreadStackDone, std::memory_order_release);
+      break;
+    }
+  }
+  errno = saved_errno;
+}
+
+// Returns the milliseconds elapsed since |start|.
+int64 MillisecondsSince(const timespec& start) {
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return static_cast<int64>(now.tv_sec - start.tv_sec) * 1000 +
+         (now.tv_nsec - start.tv_nsec) / 1000000;
+}
+
+// Requests a slot for each thread of the process but the calling one from
+// /proc/self/task.  Returns the number of threads without a slot.
+int RequestThreadStacks() {
+  const int fd = open("/proc/self/task", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd == -1) {
+    return 0;
+  }
+  struct linux_dirent64 {
+    uint64 d_ino;
+    int64 d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[1];
+  };
+  // Not on the stack, which may be a small alternate signal stack.
+  alignas(linux_dirent64) static char buffer[4096];
+  const auto self = static_cast<pid_t>(syscall(SYS_gettid));
+  int next_slot = 0;
+  int missed = 0;
+  long size;
+  while ((size = syscall(SYS_getdents64, fd, buffer, sizeof(buffer))) > 0) {
+    for (long offset = 0; offset < size;) {
+      const auto* entry = reinterpret_cast<linux_dirent64*>(buffer + offset);
+      offset += entry->d_reclen;
+      pid_t tid = 0;
+      for (const char* c = entry->d_name; *c >= '0' && *c <= '9'; ++c) {
+        tid = tid * 10 + (*c - '0');
+      }
+      if (tid == 0 || tid == self) {
+        continue;
+      }
+      // Slots still written by threads that did not respond in time to a
+      // previous dump are skipped.
+      while (next_slot < kMaxThreadStacks &&
+             g_thread_stacks[next_slot].state.load(
+                 std::memory_order_acquire) != kThreadStackFree) {
+        ++next_slot;
+      }
+      if (next_slot == kMaxThreadStacks) {
+        ++missed;
+        continue;
+      }
+      ThreadStack& slot = g_thread_stacks[next_slot++];
+      slot.requested = true;
+      slot.tid.store(tid, std::memory_order_relaxed);
+      slot.state.store(kThreadStackRequested, std::memory_order_release);
+    }
+  }
+  close(fd);
+  return missed;
 }
 
+// Installs ThreadStackSignalHandler() for ThreadStackSignal() on the first
+// call if the signal still has its default disposition.  Returns whether it
+// is installed.
+bool InstallThreadStackSignalHandler() {
+  if (g_thread_stack_handler == kThreadStackHandlerUnknown) {
+    g_thread_stack_handler = kThreadStackHandlerUnavailable;
+    struct sigaction old_action;
+    if (sigaction(ThreadStackSignal(), nullptr, &old_action) == 0 &&
+        (old_action.sa_flags & SA_SIGINFO) == 0 &&
+        old_action.sa_handler == SIG_DFL) {
+      struct sigaction sig_action;
+      memset(&sig_action, 0, sizeof(sig_action));
+      sigemptyset(&sig_action.sa_mask);
+      sig_action.sa_flags = SA_SIGINFO | SA_RESTART;
+      sig_action.sa_sigaction = &ThreadStackSignalHandler;
+      if (sigaction(ThreadStackSignal(), &sig_action, nullptr) == 0) {
+        g_thread_stack_handler = kThreadStackHandlerInstalled;
+      }
+    }
+  }
+  return g_thread_stack_handler == kThreadStackHandlerInstalled;
+}
+
+// Requests the stack traces of all threads of the process but the calling
+// one, which each thread takes in the handler of ThreadStackSignal(), and
+// waits up to |timeout_ms| for them.  The stack traces are in the requested
+// slots until ReleaseThreadStacks().  Returns the number of threads without a
+// slot, kThreadStacksBusy if another thread is collecting stack traces, or
+// kThreadStackSignalInUse if the program uses ThreadStackSignal() itself.
+int CollectThreadStacks(int timeout_ms) {
+  if (g_dumping_thread_stacks.exchange(true, std::memory_order_acquire)) {
+    return kThreadStacksBusy;
+  }
+  if (!InstallThreadStackSignalHandler()) {
+    g_dumping_thread_stacks.store(false, std::memory_order_release);
+    return kThreadStackSignalInUse;
+  }
+
+  // Reclaim the slots of late responders to a previous dump.
+  for (ThreadStack& slot : g_thread_stacks) {
+    int expected = kThreadStackDone;
+    slot.state.compare_exchange_strong(expected, kThreadStackFree,
+                                       std::memory_order_relaxed);
+  }
+
+  const int missed = RequestThreadStacks();
+  const pid_t pid = getpid();
+  for (ThreadStack& slot : g_thread_stacks) {
+    if (slot.requested &&
+        syscall(SYS_tgkill, pid, slot.tid.load(std::memory_order_relaxed),
+                ThreadStackSignal()) == -1) {
+      // The thread has exited.
+      slot.requested = false;
+      slot.state.store(kThreadStackFree, std::memory_order_relaxed);
+    }
+  }
+
+  timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (;;) {
+    bool pending = false;
+    for (const ThreadStack& slot : g_thread_stacks) {
+      pending = pending ||
+                (slot.requested && slot.state.load(std::memory_order_acquire) !=
+                                       kThreadStackDone);
+    }
+    if (!pending || MillisecondsSince(start) >= timeout_ms) {
+      break;
+    }
+    const timespec interval = {0, 1000000};
+    nanosleep(&interval, nullptr);
+  }
+  return missed;
+}
+
+// Tells with |writer| that the stacks of other threads cannot be dumped.
+void WriteThreadStackSignalInUse(FailureWriter writer) {
+  static const char kMessage[] =
+      "*** Stack traces of other threads not dumped: signal SIGRTMAX - 1 is "
+      "in use by the program ***\n";
+  writer(kMessage, sizeof(kMessage) - 1);
+}
+
+// Releases the slots requested by CollectThreadStacks().
+void ReleaseThreadStacks() {
+  for (ThreadStack& slot : g_thread_stacks) {
+    if (!slot.requested) {
+      continue;
+    }
+    slot.requested = false;
+    // Give up on the slots of threads which did not respond, unless they are
+    // taking their stack traces.
+    int expected = kThreadStackRequested;
+    if (!slot.state.compare_exchange_strong(expected, kThreadStackFree,
+                                            std::memory_order_relaxed) &&
+        expected == kThreadStackDone) {
+      slot.state.store(kThreadStackFree, std::memory_order_relaxed);
+    }
+  }
+  g_dumping_thread_stacks.store(false, std::memory_order_release);
+}
+
+// Dumps the stack traces of all threads of the process but the calling one
+// with |writer|.  Threads which do not respond within |timeout_ms| are
+// reported as such.
+void DumpOtherThreadStacks(int timeout_ms, FailureWriter writer) {
+  const int missed = CollectThreadStacks(timeout_ms);
+  if (missed == kThreadStacksBusy) {
+    static const char kMessage[] =
+        "*** Stack traces of other threads are being dumped already ***\n";
+    writer(kMessage, sizeof(kMessage) - 1);
+    return;
+  }
+  if (missed == kThreadStackSignalInUse) {
+    WriteThreadStackSignalInUse(writer);
+    return;
+  }
+
+  for (const ThreadStack& slot : g_thread_stacks) {
+    if (!slot.requested) {
+      continue;
+    }
+    char buf[128];
+    MinimalFormatter formatter(buf, sizeof(buf));
+    formatter.AppendString("*** Thread LWP ");
+    formatter.AppendUint64(
+        static_cast<uint64>(slot.tid.load(std::memory_order_relaxed)), 10);
+    if (slot.state.load(std::memory_order_acquire) != kThreadStackDone) {
+      formatter.AppendString(" did not respond ***\n");
+      writer(buf, formatter.num_bytes_written());
+      continue;
+    }
+    formatter.AppendString(" stack trace: ***\n");
+    writer(buf, formatter.num_bytes_written());
+    DumpStackTrace(slot.pc, slot.stack, slot.depth, writer);
+  }
+
+  if (missed > 0) {
+    char buf[128];
+    MinimalFormatter formatter(buf, sizeof(buf));
+    formatter.AppendString("*** ");
+    formatter.AppendUint64(static_cast<uint64>(missed), 10);
+    formatter.AppendString(" more threads not dumped ***\n");
+    writer(buf, formatter.num_bytes_written());
+  }
+
+  ReleaseThreadStacks();
+}
+
+// The stack traces of other threads sampled by SampleAllThreadStacks() or by
+// a ThreadStackSampler, each distinct one counted once.
+class ThreadStackSamples {
+ public:
+  // Takes a sample of the stack traces of all other threads.  Returns false
+  // if no more samples can be taken since the program uses
+  // ThreadStackSignal() itself.
+  bool Take() {
+    const int missed = CollectThreadStacks(FLAGS_dump_all_threads_timeout_ms);
+    if (missed == kThreadStackSignalInUse) {
+      signal_in_use_ = true;
+      return false;
+    }
+    if (missed == kThreadStacksBusy) {
+      // Another thread is dumping stack traces; skip this sample.
+      return true;
+    }
+    num_missed_ += missed;
+    for (const ThreadStack& slot : g_thread_stacks) {
+      if (!slot.requested) {
+        continue;
+      }
+      if (slot.state.load(std::memory_order_acquire) != kThreadStackDone) {
+        ++num_missed_;
+        continue;
+      }
+      std::vector<void*> key(1, slot.pc);
+      key.insert(key.end(), slot.stack, slot.stack + slot.depth);
+      ++counts_[key];
+      ++num_taken_;
+    }
+    ReleaseThreadStacks();
+    return true;
+  }
+
+  // Dumps each distinct stack trace once with the number of samples it
+  // appeared in, most frequent first.
+  void Write(FailureWriter writer) const {
+    if (signal_in_use_) {
+      WriteThreadStackSignalInUse(writer);
+      return;
+    }
+    char buf[128];
+    MinimalFormatter formatter(buf, sizeof(buf));
+    std::vector<std::pair<int, const std::vector<void*>*>> samples;
+    samples.reserve(counts_.size());
+    for (const auto& count : counts_) {
+      samples.emplace_back(count.second, &count.first);
+    }
+    std::stable_sort(samples.begin(), samples.end(),
+                     [](const std::pair<int, const std::vector<void*>*>& a,
+                        const std::pair<int, const std::vector<void*>*>& b) {
+                       return a.first > b.first;
+                     });
+
+    formatter.AppendString("*** ");
+    formatter.AppendUint64(static_cast<uint64>(samples.size()), 10);
+    formatter.AppendString(" distinct stack traces in ");
+    formatter.AppendUint64(static_cast<uint64>(num_taken_), 10);
+    formatter.AppendString(" samples of other threads: ***\n");
+    writer(buf, formatter.num_bytes_written());
+    for (const auto& sample : samples) {
+      MinimalFormatter count_formatter(buf, sizeof(buf));
+      count_formatter.AppendString("*** ");
+      count_formatter.AppendUint64(static_cast<uint64>(sample.first), 10);
+      count_formatter.AppendString(" of ");
+      count_formatter.AppendUint64(static_cast<uint64>(num_taken_), 10);
+      count_formatter.AppendString(" samples: ***\n");
+      writer(buf, count_formatter.num_bytes_written());
+      const std::vector<void*>& key = *sample.second;
+      DumpStackTrace(key[0], key.data() + 1, static_cast<int>(key.size()) - 1,
+                     writer);
+    }
+    if (num_missed_ > 0) {
+      MinimalFormatter missed_formatter(buf, sizeof(buf));
+      missed_formatter.AppendString("*** ");
+      missed_formatter.AppendUint64(static_cast<uint64>(num_missed_), 10);
+      missed_formatter.AppendString(" samples missed ***\n");
+      writer(buf, missed_formatter.num_bytes_written());
+    }
+  }
+
+ private:
+  // Stack traces are keyed by the program counter followed by the frames, so
+  // that only identical stack traces are counted together.
+  std::map<std::vector<void*>, int> counts_;
+  int num_taken_ = 0;
+  int num_missed_ = 0;
+  bool signal_in_use_ = false;
+};
+
+// Samples the stack traces of all other threads every |interval| in a
+// background thread until Stop().
+class ThreadStackSampler {
+ public:
+  explicit ThreadStackSampler(std::chrono::milliseconds interval)
+      : interval_(interval), thread_(&ThreadStackSampler::Run, this) {}
+
+  ~ThreadStackSampler() { Stop(); }
+
+  // Stops sampling, and returns the samples taken.
+  const ThreadStackSamples& Stop() {
+    {
+      std::lock_guard<std::mutex> l{mutex_};
+      stop_ = true;
+    }
+    stop_requested_.notify_one();
+    if (thread_.joinable()) {
+      thread_.join();
+    }
+    return samples_;
+  }
+
+ private:
+  void Run() {
+    auto next = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> l{mutex_};
+    while (!stop_) {
+      l.unlock();
+      const bool more = samples_.Take();
+      l.lock();
+      if (!more) {
+        break;
+      }
+      next += interval_;
+      stop_requested_.wait_until(l, next, [this] { return stop_; });
+    }
+  }
+
+  const std::chrono::milliseconds interval_;
+  std::mutex mutex_;
+  std::condition_variable stop_requested_;
+  bool stop_ = false;           // Protected by mutex_.
+  ThreadStackSamples samples_;  // Only used by thread_ until it ends.
+  std::thread thread_;          // Last, so that Run() sees the members.
+};
+
+// The sampler started by StartThreadStackSampling(), if any.
+std::mutex g_thread_stack_sampler_mutex;
+std::unique_ptr<ThreadStackSampler> g_thread_stack_sampler;
+
+#else
+
+// Tells with |writer| that the stacks of other threads cannot be sampled.
+void WriteThreadStackSamplingUnsupported(FailureWriter writer) {
+  static const char kMessage[] =
+      "*** Sampling the stack traces of threads is not supported ***\n";
+  writer(kMessage, sizeof(kMessage) - 1);
+}
+
+#endif  // defined(HAVE_THREAD_STACK_DUMP)
+
 // Invoke the default signal handler.
 void InvokeDefaultSignalHandler(int signal_number) {
 #ifdef HAVE_SIGACTION
@@ -303,13 +809,18 @@ static void HandleSignal(int signal_number
   // TODO(satorux): We might want to set timeout here using alarm(), but
   // mixing alarm() and sleep() can be a bad idea.
 
+#ifdef HAVE_SYMBOLIZE
+  // The process terminates, so this is never undone.
+  EnterSignalSafeSymbolization();
+#endif
+
   // First dump time info.
   DumpTimeInfo();
 
 #if !defined(GLOG_OS_WINDOWS)
   // Get the program counter from ucontext.
   void* pc = GetPC(ucontext);
-  DumpStackFrameInfo("PC: ", pc);
+  DumpStackFrameInfo("PC: ", pc, g_failure_writer);
 #endif
 
 #ifdef HAVE_STACKTRACE
@@ -324,11 +835,26 @@ static void HandleSignal(int signal_number
 #  endif
   // Dump the stack traces.
   for (int i = 0; i < depth; ++i) {
-    DumpStackFrameInfo("    ", stack[i]);
+    DumpStackFrameInfo("    ", stack[i], g_failure_writer);
   }
+#  if defined(HAVE_SYMBOLIZE) && !defined(GLOG_OS_WINDOWS)
+  // The module map must cover the PC of the signal as well.
+  void* pcs[ARRAYSIZE(stack) + 1];
+  const int n =
+      std::max(0, std::min(depth, static_cast<int>(ARRAYSIZE(stack))));
+  std::copy(stack, stack + n, pcs);
+  pcs[n] = pc;
+  DumpModuleMap(pcs, n + 1, g_failure_writer);
+#  endif
+#  if defined(HAVE_THREAD_STACK_DUMP)
+  if (FLAGS_dump_all_threads_on_failure) {
+    DumpOtherThreadStacks(FLAGS_dump_all_threads_timeout_ms, g_failure_writer);
+  }
+#  endif
 #elif !defined(GLOG_OS_WINDOWS)
   (void)signal_info;
 #endif
+  WriteFlightRecorderOnCrash(g_failure_writer);
 
   // *** TRANSITION ***
   //
@@ -364,6 +890,38 @@ void FailureSignalHandler(int signal_number, siginfo_t* signal_info,
   );
 }
 
+#if defined(HAVE_STACKTRACE) && defined(HAVE_SIGACTION)
+// Dumps the stack traces of all threads when receiving the signal installed
+// by InstallStackDumpSignalHandler(), and lets the program continue.
+void StackDumpSignalHandler(int signal_number, siginfo_t* /*signal_info*/,
+                            void* /*ucontext*/) {
+  const int saved_errno = errno;
+  const time_t time_in_sec = time(nullptr);
+  char buf[256];
+  MinimalFormatter formatter(buf, sizeof(buf));
+  formatter.AppendString("*** Signal ");
+  formatter.AppendUint64(static_cast<uint64>(signal_number), 10);
+  formatter.AppendString(" received by PID ");
+  formatter.AppendUint64(static_cast<uint64>(getpid()), 10);
+  formatter.AppendString(" at ");
+  formatter.AppendUint64(static_cast<uint64>(time_in_sec), 10);
+  formatter.AppendString(" (unix time); stack traces of all threads: ***\n");
+  g_failure_writer(buf, formatter.num_bytes_written());
+#  ifdef HAVE_SYMBOLIZE
+  EnterSignalSafeSymbolization();
+#  endif
+  // +1 to exclude this function.
+  DumpCurrentThreadStack(1, g_failure_writer);
+#  if defined(HAVE_THREAD_STACK_DUMP)
+  DumpOtherThreadStacks(FLAGS_dump_all_threads_timeout_ms, g_failure_writer);
+#  endif
+#  ifdef HAVE_SYMBOLIZE
+  LeaveSignalSafeSymbolization();
+#  endif
+  errno = saved_errno;
+}
+#endif  // defined(HAVE_STACKTRACE) && defined(HAVE_SIGACTION)
+
 }  // namespace
 
 bool IsFailureSignalHandlerInstalled() {
@@ -383,6 +941,10 @@ bool IsFailureSignalHandlerInstalled() {
 }
 
 void InstallFailureSignalHandler() {
+#ifdef HAVE_SYMBOLIZE
+  // Index the symbol tables now rather than from the signal handler.
+  PrepareSymbolizeCache();
+#endif
 #ifdef HAVE_SIGACTION
   // Build the sigaction struct.
   struct sigaction sig_action;
@@ -409,4 +971,89 @@ void InstallFailureWriter(void (*writer)(const char* data, size_t size)) {
 #endif  // HAVE_SIGACTION
 }
 
+void DumpAllThreadStacks(void (*writer)(const char* data, size_t size)) {
+  if (writer == nullptr) {
+    writer = g_failure_writer;
+  }
+#ifdef HAVE_STACKTRACE
+  // +1 to exclude this function.
+  DumpCurrentThreadStack(1, writer);
+#endif
+#if defined(HAVE_THREAD_STACK_DUMP)
+  DumpOtherThreadStacks(FLAGS_dump_all_threads_timeout_ms, writer);
+#endif
+}
+
+void DumpFlightRecorder(void (*writer)(const char* data, size_t size)) {
+  WriteFlightRecorder(writer != nullptr ? writer : g_failure_writer);
+}
+
+void InstallStackDumpSignalHandler(int signal_number) {
+#if defined(HAVE_STACKTRACE) && defined(HAVE_SIGACTION)
+#  ifdef HAVE_SYMBOLIZE
+  PrepareSymbolizeCache();
+#  endif
+  struct sigaction sig_action;
+  memset(&sig_action, 0, sizeof(sig_action));
+  sigemptyset(&sig_action.sa_mask);
+  sig_action.sa_flags = SA_SIGINFO | SA_RESTART;
+  sig_action.sa_sigaction = &StackDumpSignalHandler;
+  CHECK_ERR(sigaction(signal_number, &sig_action, nullptr));
+#else
+  (void)signal_number;
+#endif  // defined(HAVE_STACKTRACE) && defined(HAVE_SIGACTION)
+}
+
+void SampleAllThreadStacks(int num_samples, std::chrono::milliseconds interval,
+                           void (*writer)(const char* data, size_t size)) {
+  if (writer == nullptr) {
+    writer = g_failure_writer;
+  }
+#if defined(HAVE_THREAD_STACK_DUMP)
+  ThreadStackSamples samples;
+  for (int i = 0; i < num_samples && samples.Take(); ++i) {
+    if (i + 1 < num_samples) {
+      std::this_thread::sleep_for(interval);
+    }
+  }
+  samples.Write(writer);
+#else
+  (void)num_samples;
+  (void)interval;
+  WriteThreadStackSamplingUnsupported(writer);
+#endif  // defined(HAVE_THREAD_STACK_DUMP)
+}
+
+bool StartThreadStackSampling(std::chrono::milliseconds interval) {
+#if defined(HAVE_THREAD_STACK_DUMP)
+  std::lock_guard<std::mutex> l{g_thread_stack_sampler_mutex};
+  if (g_thread_stack_sampler != nullptr) {
+    return false;
+  }
+  g_thread_stack_sampler = std::make_unique<ThreadStackSampler>(interval);
+  return true;
+#else
+  (void)interval;
+  return false;
+#endif  // defined(HAVE_THREAD_STACK_DUMP)
+}
+
+void StopThreadStackSampling(void (*writer)(const char* data, size_t size)) {
+  if (writer == nullptr) {
+    writer = g_failure_writer;
+  }
+#if defined(HAVE_THREAD_STACK_DUMP)
+  std::unique_ptr<ThreadStackSampler> sampler;
+  {
+    std::lock_guard<std::mutex> l{g_thread_stack_sampler_mutex};
+    sampler = std::move(g_thread_stack_sampler);
+  }
+  if (sampler != nullptr) {
+    sampler->Stop().Write(writer);
+  }
+#else
+  WriteThreadStackSamplingUnsupported(writer);
+#endif  // defined(HAVE_THREAD_STACK_DUMP)
+}
+
 }  // namespace google
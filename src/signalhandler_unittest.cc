@@ -32,6 +32,8 @@
 // This is a helper binary for testing signalhandler.cc.  The actual test
 // is done in signalhandler_unittest.sh.
 
+#include <atomic>
+#include <chrono>
 #include <csignal>
 #include <cstdio>
 #include <cstdlib>
@@ -47,6 +49,9 @@
 #if defined(HAVE_UNISTD_H)
 #  include <unistd.h>
 #endif
+#if defined(HAVE_SYS_WAIT_H)
+#  include <sys/wait.h>
+#endif
 #ifdef GLOG_USE_GFLAGS
 #  include <gflags/gflags.h>
 using namespace GFLAGS_NAMESPACE;
@@ -66,6 +71,25 @@ static void DieInThread(int* a) {
   fprintf(stderr, "We should have died: b=%d\n", b);
 }
 
+static std::atomic<int> g_parked_threads{0};
+
+static void ParkThread() {
+  ++g_parked_threads;
+  while (true) {
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+  }
+}
+
+// Starts |n| threads which wait forever and waits for them to start.
+static void ParkThreads(int n) {
+  for (int i = 0; i < n; i++) {
+    std::thread{&ParkThread}.detach();
+  }
+  while (g_parked_threads < n) {
+    std::this_thread::yield();
+  }
+}
+
 static void WriteToStdout(const char* data, size_t size) {
   if (write(fileno(stdout), data, size) < 0) {
     // Ignore errors.
@@ -97,6 +121,59 @@ int main(int argc, char** argv) {
   } else if (command == "dump_to_stdout") {
     InstallFailureWriter(WriteToStdout);
     abort();
+  } else if (command == "dump_all_threads") {
+#  if defined(HAVE_SYS_WAIT_H)
+    // Die in a child process, so that the test passes if it died as
+    // expected.
+    const pid_t pid = fork();
+    if (pid != 0) {
+      int status;
+      return waitpid(pid, &status, 0) == pid && WIFSIGNALED(status) &&
+                     WTERMSIG(status) == SIGABRT
+                 ? EXIT_SUCCESS
+                 : EXIT_FAILURE;
+    }
+#  endif
+    FLAGS_dump_all_threads_on_failure = true;
+    ParkThreads(2);
+    abort();
+  } else if (command == "flight_recorder") {
+#  if defined(HAVE_SYS_WAIT_H)
+    const pid_t pid = fork();
+    if (pid != 0) {
+      int status;
+      return waitpid(pid, &status, 0) == pid && WIFSIGNALED(status) &&
+                     WTERMSIG(status) == SIGSEGV
+                 ? EXIT_SUCCESS
+                 : EXIT_FAILURE;
+    }
+#  endif
+    // The message is only written to the log file, and to the standard error
+    // by the signal handler dumping the flight recorder.
+    FLAGS_flight_recorder_bytes = 4096;
+    LOG(INFO) << "recorded before segv";
+    raise(SIGSEGV);
+  } else if (command == "dump_all_threads_live") {
+    ParkThreads(2);
+    InstallStackDumpSignalHandler(SIGQUIT);
+    raise(SIGQUIT);
+    DumpAllThreadStacks(WriteToStdout);
+    SampleAllThreadStacks(5, std::chrono::milliseconds(10), WriteToStdout);
+    puts("sampling in the background");
+    fflush(stdout);
+    StartThreadStackSampling(std::chrono::milliseconds(10));
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    StopThreadStackSampling(WriteToStdout);
+    puts("still alive");
+  } else if (command == "dump_all_threads_signal_in_use") {
+    // The program ignores the signal reserved for the stack dumps, which
+    // must leave it ignored and only dump the current thread.
+    signal(SIGRTMAX - 1, SIG_IGN);
+    ParkThreads(1);
+    DumpAllThreadStacks(WriteToStdout);
+    if (signal(SIGRTMAX - 1, SIG_IGN) == SIG_IGN) {
+      puts("signal still ignored");
+    }
   } else if (command == "installed") {
     fprintf(stderr, "signal handler installed: %s\n",
             IsFailureSignalHandlerInstalled() ? "true" : "false");
@@ -128,4 +128,17 @@ for pattern in SIGABRT main "Aborted at [0-9]"; do
   fi
 done
 
+# Test for a case the stack traces of all threads are dumped.
+if [ x`uname` = "xLinux" ]; then
+  $BINARY dump_all_threads 2> signalhandler.out5
+  if [ `grep -c "Thread LWP [0-9]* stack trace" signalhandler.out5` != 2 ]; then
+    die "the stack traces of both threads should appear in the output"
+  fi
+  for pattern in SIGABRT ParkThread main; do
+    if ! grep --quiet "$pattern" signalhandler.out5; then
+      die "'$pattern' should appear in the output"
+    fi
+  done
+fi
+
 echo PASS
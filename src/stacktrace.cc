@@ -32,7 +32,12 @@
 
 #include "stacktrace.h"
 
+#include "glog/flags.h"
+
 // Make an implementation of stacktrace compiled.
 #if defined(STACKTRACE_H)
+#  if defined(HAVE_FRAME_POINTER_STACKTRACE)
+#    include "stacktrace_x86-inl.h"
+#  endif
 #  include STACKTRACE_H
 #endif
@@ -62,6 +62,15 @@
 #  define STACKTRACE_H "stacktrace_generic-inl.h"
 #endif
 
+// The frame pointer walker is also available at runtime on the architectures
+// whose frame records hold the previous frame pointer followed by the return
+// address, see --stacktrace_frame_pointers.
+#if !defined(NO_FRAME_POINTER) && defined(__GNUC__) && \
+    !defined(GLOG_OS_WINDOWS) &&                       \
+    (defined(__i386__) || defined(__x86_64__) || defined(__aarch64__))
+#  define HAVE_FRAME_POINTER_STACKTRACE
+#endif
+
 #if defined(STACKTRACE_H)
 #  define HAVE_STACKTRACE
 #endif
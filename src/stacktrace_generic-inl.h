@@ -42,6 +42,14 @@ inline namespace glog_internal_namespace_ {
 
 // If you change this function, also change GetStackFrames below.
 int GetStackTrace(void** result, int max_depth, int skip_count) {
+#if defined(HAVE_FRAME_POINTER_STACKTRACE)
+  if (FLAGS_stacktrace_frame_pointers) {
+    return GetStackTraceFromFramePointer(
+        static_cast<void**>(__builtin_frame_address(0)), result, max_depth,
+        skip_count);
+  }
+#endif
+
   static const int kStackLength = 64;
   void* stack[kStackLength];
   int size;
@@ -37,6 +37,7 @@ extern "C" {
 #define UNW_LOCAL_ONLY
 #include <libunwind.h>
 }
+#include "base/googleinit.h"
 #include "glog/raw_logging.h"
 #include "stacktrace.h"
 
@@ -54,8 +55,25 @@ inline namespace glog_internal_namespace_ {
 // Windows.
 static __thread bool g_tl_entered;  // Initialized to false.
 
+// Let libunwind cache the unwind information it looks up per PC, which is
+// otherwise looked up anew for every frame of every stack trace.  A cache per
+// thread needs no locking, so that stack traces can be taken from signal
+// handlers.  Note that this changes the policy of the local address space for
+// all users of libunwind in the process, as docs/unwinder.md documents.
+REGISTER_MODULE_INITIALIZER(stacktrace_libunwind,
+                            unw_set_caching_policy(unw_local_addr_space,
+                                                   UNW_CACHE_PER_THREAD))
+
 // If you change this function, also change GetStackFrames below.
 int GetStackTrace(void** result, int max_depth, int skip_count) {
+#if defined(HAVE_FRAME_POINTER_STACKTRACE)
+  if (FLAGS_stacktrace_frame_pointers) {
+    return GetStackTraceFromFramePointer(
+        static_cast<void**>(__builtin_frame_address(0)), result, max_depth,
+        skip_count);
+  }
+#endif
+
   void* ip;
   int n = 0;
   unw_cursor_t cursor;
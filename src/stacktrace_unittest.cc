@@ -29,18 +29,23 @@
 
 #include "stacktrace.h"
 
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
+#include <thread>
 
 #include "base/commandlineflags.h"
 #include "config.h"
 #include "glog/logging.h"
+#include "googletest.h"
 #include "utilities.h"
 
-#ifdef HAVE_EXECINFO_BACKTRACE_SYMBOLS
+#if defined(HAVE_EXECINFO_BACKTRACE_SYMBOLS) || defined(HAVE_EXECINFO_BACKTRACE)
 #  include <execinfo.h>
 #endif
 
+using namespace google;
+
 #ifdef HAVE_STACKTRACE
 
 // Obtain a backtrace, verify that the expected callers are present in the
@@ -227,11 +232,97 @@ static
 
 //-----------------------------------------------------------------------//
 
+// A stack trace taken again from the same call site, which the unwinder may
+// now take by the unwind rules cached the first time, is the same.
+static void ATTRIBUTE_NOINLINE CheckStackTraceIsRepeatable() {
+  const int STACK_LEN = 32;
+  void* stacks[2][STACK_LEN];
+  int sizes[2];
+  for (int i = 0; i < 2; i++) {
+    sizes[i] = google::GetStackTrace(stacks[i], STACK_LEN, 0);
+  }
+  CHECK_EQ(sizes[0], sizes[1]);
+  // The loop may be unrolled, so compare the callers only.
+  for (int i = 1; i < sizes[0]; i++) {
+    CHECK_EQ(stacks[0][i], stacks[1][i]);
+  }
+
+  void* stack[3];
+  for (int i = 0; i < 2; i++) {
+    CHECK_EQ(google::GetStackTrace(stack, 3, 1), std::min(sizes[0] - 1, 3));
+    for (int j = 0; j < std::min(sizes[0] - 1, 3); j++) {
+      CHECK_EQ(stack[j], stacks[0][j + 1]);
+    }
+  }
+}
+
+// Takes a stack trace below |depth| more frames.
+static int ATTRIBUTE_NOINLINE GetStackTraceAtDepth(int depth,
+                                                   int (*get)(void**, int)) {
+  if (depth > 0) {
+    return GetStackTraceAtDepth(depth - 1, get) + 1;
+  }
+  void* stack[32];
+  return get(stack, 32);
+}
+
+static int GetStackTraceNoSkip(void** result, int max_depth) {
+  return google::GetStackTrace(result, max_depth, 0);
+}
+
+static void BM_GetStackTrace(int iters) {
+  for (int i = 0; i < iters; ++i) {
+    GetStackTraceAtDepth(10, &GetStackTraceNoSkip);
+  }
+}
+BENCHMARK(BM_GetStackTrace)
+
+#  ifdef HAVE_FRAME_POINTER_STACKTRACE
+static void BM_GetStackTraceFramePointers(int iters) {
+  FLAGS_stacktrace_frame_pointers = true;
+  for (int i = 0; i < iters; ++i) {
+    GetStackTraceAtDepth(10, &GetStackTraceNoSkip);
+  }
+  FLAGS_stacktrace_frame_pointers = false;
+}
+BENCHMARK(BM_GetStackTraceFramePointers)
+#  endif
+
+#  ifdef HAVE_EXECINFO_BACKTRACE
+// The unwinder of glibc, for comparison.
+static void BM_Backtrace(int iters) {
+  for (int i = 0; i < iters; ++i) {
+    GetStackTraceAtDepth(10, &backtrace);
+  }
+}
+BENCHMARK(BM_Backtrace)
+#  endif
+
 int main(int, char** argv) {
   FLAGS_logtostderr = true;
   google::InitGoogleLogging(argv[0]);
 
   CheckStackTrace(0);
+  // Again, now that the unwinder may have cached the frames.
+  CheckStackTrace(0);
+  CheckStackTraceIsRepeatable();
+
+#  ifdef HAVE_FRAME_POINTER_STACKTRACE
+  FLAGS_stacktrace_frame_pointers = true;
+  CheckStackTrace(0);
+  FLAGS_stacktrace_frame_pointers = false;
+#  endif
+  // On the stack of another thread than the main one.
+  std::thread([] {
+    CheckStackTrace(0);
+#  ifdef HAVE_FRAME_POINTER_STACKTRACE
+    FLAGS_stacktrace_frame_pointers = true;
+    CheckStackTrace(0);
+    FLAGS_stacktrace_frame_pointers = false;
+#  endif
+  }).join();
+
+  RunSpecifiedBenchmarks();
 
   printf("PASS\n");
   return 0;
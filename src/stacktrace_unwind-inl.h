@@ -33,16 +33,242 @@
 
 #include <unwind.h>  // ABI defined unwinder
 
+#include <atomic>
+#include <cstdint>
+
 #include "stacktrace.h"
 
+#if defined(HAVE_FRAME_POINTER_STACKTRACE) && \
+    (defined(__x86_64__) || defined(__aarch64__))
+#  define HAVE_UNWIND_CACHE
+#endif
+
 namespace google {
 inline namespace glog_internal_namespace_ {
 
+#if defined(HAVE_UNWIND_CACHE)
+
+// _Unwind_Backtrace() looks up and interprets the CFI of every frame on each
+// call.  The CFI at a return address never changes, however, and for most
+// frames it amounts to one of a few simple rules for the CFA (the stack
+// pointer of the caller), the return address and the frame pointer.
+// GetOneFrame() derives these rules from the registers recovered by the
+// unwinder and caches them per return address.  Once the rules of all the
+// frames of a stack are known, GetStackTrace() applies them directly.
+//
+// The cache is a lock-free open-addressing hash table, so that it can be used
+// from signal handlers.  An entry packs the return address into the upper 48
+// bits, the offset of the CFA in words into the next 13 bits, a flag of the
+// rule into bit 2 and the rule into the lowest 2 bits.
+enum UnwindRule : uintptr_t {
+  // CFA = FP + offset; FP points to the frame pointer and the return address
+  // of the caller.
+  kUnwindRuleFramePointer = 1,
+  // CFA = SP + offset; the return address is the last word below the CFA.
+  // Only used on x86-64, where the call instruction pushes it there.
+  kUnwindRuleStackPointer = 2,
+  // The outermost frame.
+  kUnwindRuleEnd = 3,
+};
+
+constexpr uintptr_t kUnwindRuleMask = 3;
+// kUnwindRuleStackPointer: the frame pointer of the caller is the same.
+// kUnwindRuleEnd: the unwinder reports a null return address after the frame.
+constexpr uintptr_t kUnwindRuleFlag = 4;
+constexpr int kUnwindOffsetShift = 3;
+constexpr uintptr_t kUnwindOffsetMask = (uintptr_t{1} << 13) - 1;
+constexpr int kUnwindPcShift = 16;
+constexpr uintptr_t kUnwindMaxPc = uintptr_t{1} << (64 - kUnwindPcShift);
+constexpr size_t kUnwindCacheBits = 12;
+constexpr size_t kUnwindCacheSize = size_t{1} << kUnwindCacheBits;
+constexpr size_t kUnwindCacheProbes = 8;
+// Same as the limit of NextStackFrame<true>().
+constexpr uintptr_t kUnwindMaxFrameSize = 100000;
+
+#  if defined(__x86_64__)
+constexpr int kFramePointerRegister = 6;  // %rbp
+#  else
+constexpr int kFramePointerRegister = 29;  // x29
+#  endif
+
+static std::atomic<uintptr_t> g_unwind_cache[kUnwindCacheSize];
+
+static size_t UnwindCacheSlot(uintptr_t pc) {
+  return static_cast<size_t>((pc * UINT64_C(0x9e3779b97f4a7c15)) >>
+                             (64 - kUnwindCacheBits));
+}
+
+// Returns the cache entry of the return address |pc|, or 0 if there is none.
+static uintptr_t LookupUnwindRule(uintptr_t pc) {
+  const size_t slot = UnwindCacheSlot(pc);
+  for (size_t i = 0; i < kUnwindCacheProbes; ++i) {
+    const uintptr_t entry =
+        g_unwind_cache[(slot + i) & (kUnwindCacheSize - 1)].load(
+            std::memory_order_relaxed);
+    if (entry == 0) {
+      return 0;
+    }
+    if ((entry >> kUnwindPcShift) == pc) {
+      return entry;
+    }
+  }
+  return 0;
+}
+
+static void InsertUnwindRule(uintptr_t pc, uintptr_t rule, uintptr_t offset,
+                             bool flag) {
+  offset /= sizeof(void*);
+  if (pc == 0 || pc >= kUnwindMaxPc || offset > kUnwindOffsetMask) {
+    return;
+  }
+  const uintptr_t entry = pc << kUnwindPcShift |
+                          offset << kUnwindOffsetShift |
+                          (flag ? kUnwindRuleFlag : 0) | rule;
+  const size_t slot = UnwindCacheSlot(pc);
+  for (size_t i = 0; i < kUnwindCacheProbes; ++i) {
+    std::atomic<uintptr_t>& cell =
+        g_unwind_cache[(slot + i) & (kUnwindCacheSize - 1)];
+    uintptr_t expected = 0;
+    if (cell.compare_exchange_strong(expected, entry,
+                                     std::memory_order_relaxed) ||
+        (expected >> kUnwindPcShift) == pc) {
+      return;
+    }
+  }
+  // The probe sequence is full; leave the frame to the unwinder.
+}
+
+// The registers of a frame as recovered by the unwinder.
+struct UnwindFrame {
+  uintptr_t pc;  // Return address.
+  uintptr_t sp;  // Stack pointer at the call, i.e., the CFA of the callee.
+  uintptr_t fp;  // Frame pointer register.
+  // False for frames interrupted by a signal, whose PC is not a return
+  // address, and for the frames before the first one.
+  bool cacheable;
+};
+
+// Derives the unwind rule of |frame| from the registers of its |caller|.
+static void LearnUnwindRule(const UnwindFrame& frame,
+                            const UnwindFrame& caller) {
+  constexpr uintptr_t kWord = sizeof(void*);
+  if (!frame.cacheable || !caller.cacheable || frame.pc == 0) {
+    return;
+  }
+  // The outermost frame, whose return address is undefined.
+  if (caller.pc == 0) {
+    InsertUnwindRule(frame.pc, kUnwindRuleEnd, 0, true);
+    return;
+  }
+  const uintptr_t cfa = caller.sp;
+  if (frame.sp == 0 || cfa <= frame.sp ||
+      cfa - frame.sp > kUnwindMaxFrameSize || (cfa - frame.sp) % kWord != 0) {
+    return;
+  }
+  // Only memory inside of the frame is read.
+  if (frame.fp >= frame.sp && frame.fp % kWord == 0 &&
+      frame.fp + 2 * kWord <= cfa) {
+    const auto* record = reinterpret_cast<const uintptr_t*>(frame.fp);
+    if (record[0] == caller.fp && record[1] == caller.pc) {
+#  if defined(__x86_64__)
+      // A frame record elsewhere than right below the return address pushed
+      // by the call belongs to a realigned stack frame, whose CFA is not at a
+      // fixed offset from the frame pointer.
+      if (frame.fp + 2 * kWord != cfa) {
+        return;
+      }
+#  endif
+      InsertUnwindRule(frame.pc, kUnwindRuleFramePointer, cfa - frame.fp,
+                       false);
+    }
+    return;
+  }
+#  if defined(__x86_64__)
+  const auto* return_address = reinterpret_cast<const uintptr_t*>(cfa) - 1;
+  if (*return_address == caller.pc) {
+    InsertUnwindRule(frame.pc, kUnwindRuleStackPointer, cfa - frame.sp,
+                     frame.fp == caller.fp);
+  }
+#  endif
+}
+
+// Walks the stack from the caller of GetStackTrace(), whose frame pointer and
+// CFA are |fp| and |cfa|, by the cached unwind rules.  Returns false if a
+// frame has no cached rule or fails a sanity check.
+static bool GetStackTraceFromUnwindCache(void** fp, void* cfa, void** result,
+                                         int max_depth, int skip_count,
+                                         int* depth) {
+  constexpr uintptr_t kWord = sizeof(void*);
+  const StackBounds& bounds = GetThreadStackBounds(cfa);
+  auto pc = reinterpret_cast<uintptr_t>(fp[1]);
+  auto frame_fp = reinterpret_cast<uintptr_t>(fp[0]);
+  bool frame_fp_known = true;
+  auto sp = reinterpret_cast<uintptr_t>(cfa);
+  int n = 0;
+  while (n < max_depth) {
+    const uintptr_t entry = LookupUnwindRule(pc);
+    if (entry == 0) {
+      return false;
+    }
+    if (skip_count > 0) {
+      skip_count--;
+    } else {
+      result[n++] = reinterpret_cast<void*>(pc);
+    }
+    const uintptr_t rule = entry & kUnwindRuleMask;
+    if (rule == kUnwindRuleEnd) {
+      if ((entry & kUnwindRuleFlag) != 0 && n < max_depth) {
+        if (skip_count > 0) {
+          skip_count--;
+        } else {
+          result[n++] = nullptr;
+        }
+      }
+      break;
+    }
+    const uintptr_t offset =
+        (entry >> kUnwindOffsetShift & kUnwindOffsetMask) * kWord;
+    uintptr_t next_cfa;
+    if (rule == kUnwindRuleFramePointer) {
+      if (!frame_fp_known || frame_fp < sp || frame_fp % kWord != 0) {
+        return false;
+      }
+      next_cfa = frame_fp + offset;
+    } else {
+      next_cfa = sp + offset;
+    }
+    if (next_cfa <= sp || next_cfa - sp > kUnwindMaxFrameSize ||
+        !IsOnStack(bounds, reinterpret_cast<void*>(sp),
+                   reinterpret_cast<void*>(sp), next_cfa - sp)) {
+      return false;
+    }
+    if (rule == kUnwindRuleFramePointer) {
+      if (frame_fp + 2 * kWord > next_cfa) {
+        return false;
+      }
+      const auto* record = reinterpret_cast<const uintptr_t*>(frame_fp);
+      frame_fp = record[0];
+      pc = record[1];
+    } else {
+      frame_fp_known = frame_fp_known && (entry & kUnwindRuleFlag) != 0;
+      pc = reinterpret_cast<const uintptr_t*>(next_cfa)[-1];
+    }
+    sp = next_cfa;
+  }
+  *depth = n;
+  return true;
+}
+
+#endif  // defined(HAVE_UNWIND_CACHE)
+
 struct trace_arg_t {
   void** result;
   int max_depth;
   int skip_count;
   int count;
+#if defined(HAVE_UNWIND_CACHE)
+  UnwindFrame frame;  // The last frame seen.
+#endif
 };
 
 // Workaround for the malloc() in _Unwind_Backtrace() issue.
@@ -69,6 +295,18 @@ static StackTraceInit module_initializer;  // Force initialization
 static _Unwind_Reason_Code GetOneFrame(struct _Unwind_Context* uc, void* opq) {
   auto* targ = static_cast<trace_arg_t*>(opq);
 
+#if defined(HAVE_UNWIND_CACHE)
+  // The PC of a frame interrupted by a signal is not a return address.  The
+  // CFA reported by the unwinder is the one of the callee.
+  int ip_before_insn = 0;
+  const uintptr_t pc = _Unwind_GetIPInfo(uc, &ip_before_insn);
+  const UnwindFrame frame{pc, _Unwind_GetCFA(uc),
+                          _Unwind_GetGR(uc, kFramePointerRegister),
+                          ip_before_insn == 0};
+  LearnUnwindRule(targ->frame, frame);
+  targ->frame = frame;
+#endif
+
   if (targ->skip_count > 0) {
     targ->skip_count--;
   } else {
@@ -84,10 +322,27 @@ static _Unwind_Reason_Code GetOneFrame(struct _Unwind_Context* uc, void* opq) {
 
 // If you change this function, also change GetStackFrames below.
 int GetStackTrace(void** result, int max_depth, int skip_count) {
+#if defined(HAVE_FRAME_POINTER_STACKTRACE)
+  if (FLAGS_stacktrace_frame_pointers) {
+    return GetStackTraceFromFramePointer(
+        static_cast<void**>(__builtin_frame_address(0)), result, max_depth,
+        skip_count);
+  }
+#endif
+
   if (!ready_to_run) {
     return 0;
   }
 
+#if defined(HAVE_UNWIND_CACHE)
+  int depth;
+  if (GetStackTraceFromUnwindCache(
+          static_cast<void**>(__builtin_frame_address(0)),
+          __builtin_dwarf_cfa(), result, max_depth, skip_count, &depth)) {
+    return depth;
+  }
+#endif
+
   trace_arg_t targ;
 
   skip_count += 1;  // Do not include the "GetStackTrace" frame
@@ -96,9 +351,19 @@ int GetStackTrace(void** result, int max_depth, int skip_count) {
   targ.max_depth = max_depth;
   targ.skip_count = skip_count;
   targ.count = 0;
+#if defined(HAVE_UNWIND_CACHE)
+  targ.frame = UnwindFrame{0, 0, 0, false};
+#endif
 
   _Unwind_Backtrace(GetOneFrame, &targ);
 
+#if defined(HAVE_UNWIND_CACHE)
+  // The unwinder stopped before max_depth at the outermost frame.
+  if (targ.count < max_depth && targ.frame.cacheable) {
+    InsertUnwindRule(targ.frame.pc, kUnwindRuleEnd, 0, false);
+  }
+#endif
+
   return targ.count;
 }
 
@@ -27,15 +27,24 @@
 // (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
 // OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 //
-// Produce stack trace
+// Produce stack trace by walking the chain of frame pointers.  Used on i386
+// by default, and on x86-64 and aarch64 with --stacktrace_frame_pointers or
+// where the unwind tables confirmed the frame pointers of the callers.
+
+#ifndef GLOG_INTERNAL_STACKTRACE_X86_INL_H
+#define GLOG_INTERNAL_STACKTRACE_X86_INL_H
 
 #include <cstdint>  // for uintptr_t
 
 #include "utilities.h"  // for OS_* macros
 
 #if !defined(GLOG_OS_WINDOWS)
-#  include <sys/mman.h>
+#  include <fcntl.h>
 #  include <unistd.h>
+
+#  include <atomic>
+#  include <cerrno>
+#  include <cstring>
 #endif
 
 #include <cstdio>  // for nullptr
@@ -45,12 +54,187 @@
 namespace google {
 inline namespace glog_internal_namespace_ {
 
+// Bounds of the stack of a thread.  Empty if unknown.
+struct StackBounds {
+  uintptr_t low;
+  uintptr_t high;
+
+  bool Contains(const void* address, size_t size) const {
+    const auto start = reinterpret_cast<uintptr_t>(address);
+    return low <= start && start < high && size <= high - start;
+  }
+};
+
+#if defined(GLOG_OS_LINUX)
+// Parses the hexadecimal number at |*p| and advances |*p| past it.
+static uintptr_t ParseHex(const char** p, const char* end) {
+  uintptr_t value = 0;
+  for (; *p != end; ++*p) {
+    const char c = **p;
+    if (c >= '0' && c <= '9') {
+      value = value * 16 + static_cast<uintptr_t>(c - '0');
+    } else if (c >= 'a' && c <= 'f') {
+      value = value * 16 + static_cast<uintptr_t>(c - 'a' + 10);
+    } else {
+      break;
+    }
+  }
+  return value;
+}
+
+// Looks up the mapping which contains |address| in /proc/self/maps.  Only
+// uses open() and read(), so that it is async-signal-safe, unlike
+// pthread_getattr_np().  Returns false if there is none or the maps cannot be
+// read.
+static bool FindMapping(uintptr_t address, StackBounds* mapping) {
+  const int saved_errno = errno;
+  const int fd = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    errno = saved_errno;
+    return false;
+  }
+  bool found = false;
+  char buf[1024];
+  size_t size = 0;
+  bool skip = false;  // Whether the rest of the current line is skipped.
+  for (;;) {
+    ssize_t len;
+    do {
+      len = read(fd, buf + size, sizeof(buf) - size);
+    } while (len == -1 && errno == EINTR);
+    if (len <= 0) {
+      break;
+    }
+    size += static_cast<size_t>(len);
+    const char* line = buf;
+    const char* const end = buf + size;
+    for (;;) {
+      const auto* eol = static_cast<const char*>(
+          memchr(line, '\n', static_cast<size_t>(end - line)));
+      if (eol == nullptr && (line != buf || size < sizeof(buf))) {
+        break;  // Complete the line with the next read().
+      }
+      if (!skip) {
+        // Each line starts with "low-high ", which fits into the buffer.
+        const char* p = line;
+        const uintptr_t low = ParseHex(&p, end);
+        if (p != end && *p == '-') {
+          ++p;
+          const uintptr_t high = ParseHex(&p, end);
+          if (low <= address && address < high) {
+            mapping->low = low;
+            mapping->high = high;
+            found = true;
+            break;
+          }
+        }
+      }
+      if (eol == nullptr) {
+        // A line longer than the buffer.
+        skip = true;
+        line = end;
+        break;
+      }
+      skip = false;
+      line = eol + 1;
+    }
+    if (found) {
+      break;
+    }
+    size = static_cast<size_t>(end - line);
+    memmove(buf, line, size);
+  }
+  close(fd);
+  errno = saved_errno;
+  return found;
+}
+#endif
+
+// Returns the bounds of the stack of the calling thread, that is of the
+// mapping which contains its stack frame |sp|, or empty bounds if they are
+// unknown.  The bounds are cached per thread and looked up again once |sp| is
+// outside of them, e.g., on an alternate signal stack or below the part of
+// the stack of the main thread which was mapped so far.
+static const StackBounds& GetThreadStackBounds(const void* sp) {
+  static thread_local StackBounds bounds;
+#if defined(GLOG_OS_LINUX)
+  if (!bounds.Contains(sp, 0)) {
+    StackBounds mapping{0, 0};
+    if (FindMapping(reinterpret_cast<uintptr_t>(sp), &mapping)) {
+      bounds = mapping;
+    }
+  }
+#else
+  (void)sp;
+#endif
+  return bounds;
+}
+
+#if !defined(GLOG_OS_WINDOWS)
+// Returns whether the page at |page| is mapped and readable.  Like the
+// symbolizer reading ELF headers from process memory, reads a byte of it from
+// /proc/self/mem, which fails instead of faulting and is async-signal-safe.
+// Returns true if /proc/self/mem cannot be opened, since it is then unknown.
+static bool IsPageReadable(uintptr_t page) {
+  static std::atomic<int> mem_fd{-1};
+  int fd = mem_fd.load(std::memory_order_acquire);
+  if (fd == -1) {
+    const int saved_errno = errno;
+    fd = open("/proc/self/mem", O_RDONLY | O_CLOEXEC);
+    errno = saved_errno;
+    if (fd == -1) {
+      return true;
+    }
+    int expected = -1;
+    if (!mem_fd.compare_exchange_strong(expected, fd,
+                                        std::memory_order_acq_rel)) {
+      close(fd);
+      fd = expected;
+    }
+  }
+  const int saved_errno = errno;
+  char byte;
+  ssize_t len;
+  do {
+    len = pread(fd, &byte, 1, static_cast<off_t>(page));
+  } while (len == -1 && errno == EINTR);
+  errno = saved_errno;
+  return len == 1;
+}
+#endif
+
+// Returns whether the |size| bytes at |address|, which is above the stack
+// frame |sp|, are on the stack.  If the bounds of the stack are unknown, or
+// |sp| is outside of them, e.g., on an alternate signal stack, checks that
+// the memory is mapped instead.
+static bool IsOnStack(const StackBounds& bounds, const void* sp,
+                      const void* address, size_t size) {
+  if (bounds.Contains(sp, 0)) {
+    return bounds.Contains(address, size);
+  }
+#if !defined(GLOG_OS_WINDOWS)
+  static const auto page_size = static_cast<uintptr_t>(getpagesize());
+  const uintptr_t sp_page = reinterpret_cast<uintptr_t>(sp) & ~(page_size - 1);
+  const uintptr_t first_page =
+      reinterpret_cast<uintptr_t>(address) & ~(page_size - 1);
+  const uintptr_t last_page =
+      (reinterpret_cast<uintptr_t>(address) + size - 1) & ~(page_size - 1);
+  // The page of the frame itself is mapped.
+  for (uintptr_t page = first_page; page <= last_page; page += page_size) {
+    if (page != sp_page && !IsPageReadable(page)) {
+      return false;
+    }
+  }
+#endif
+  return true;
+}
+
 // Given a pointer to a stack frame, locate and return the calling
 // stackframe, or return nullptr if no stackframe can be found. Perform sanity
 // checks (the strictness of which is controlled by the boolean parameter
 // "STRICT_UNWINDING") to reduce the chance that a bad pointer is returned.
 template <bool STRICT_UNWINDING>
-static void** NextStackFrame(void** old_sp) {
+static void** NextStackFrame(void** old_sp, const StackBounds& bounds) {
   void** new_sp = static_cast<void**>(*old_sp);
 
   // Check that the transition from frame pointer old_sp to frame
@@ -79,6 +263,11 @@ static void** NextStackFrame(void** old_sp) {
   if (reinterpret_cast<uintptr_t>(new_sp) & (sizeof(void*) - 1)) {
     return nullptr;
   }
+  // The frame pointer and the return address of the caller must be readable.
+  if (STRICT_UNWINDING &&
+      !IsOnStack(bounds, old_sp, new_sp, 2 * sizeof(void*))) {
+    return nullptr;
+  }
 #ifdef __i386__
   // On 64-bit machines, the stack pointer can be very close to
   // 0xffffffff, so we explicitly check for a pointer into the
@@ -93,10 +282,8 @@ static void** NextStackFrame(void** old_sp) {
     // Note: NextStackFrame<false>() is only called while the program
     //       is already on its last leg, so it's ok to be slow here.
     static int page_size = getpagesize();
-    void* new_sp_aligned =
-        reinterpret_cast<void*>(reinterpret_cast<uintptr_t>(new_sp) &
-                                static_cast<uintptr_t>(~(page_size - 1)));
-    if (msync(new_sp_aligned, static_cast<size_t>(page_size), MS_ASYNC) == -1) {
+    if (!IsPageReadable(reinterpret_cast<uintptr_t>(new_sp) &
+                        static_cast<uintptr_t>(~(page_size - 1)))) {
       return nullptr;
     }
   }
@@ -104,41 +291,16 @@ static void** NextStackFrame(void** old_sp) {
   return new_sp;
 }
 
-// If you change this function, also change GetStackFrames below.
-int GetStackTrace(void** result, int max_depth, int skip_count) {
-  void** sp;
-
-#ifdef __GNUC__
-#  if __GNUC__ * 100 + __GNUC_MINOR__ >= 402
-#    define USE_BUILTIN_FRAME_ADDRESS
-#  endif
-#endif
-
-#ifdef USE_BUILTIN_FRAME_ADDRESS
-  sp = reinterpret_cast<void**>(__builtin_frame_address(0));
-#elif defined(__i386__)
-  // Stack frame format:
-  //    sp[0]   pointer to previous frame
-  //    sp[1]   caller address
-  //    sp[2]   first argument
-  //    ...
-  sp = (void**)&result - 2;
-#elif defined(__x86_64__)
-  // __builtin_frame_address(0) can return the wrong address on gcc-4.1.0-k8
-  unsigned long rbp;
-  // Move the value of the register %rbp into the local variable rbp.
-  // We need 'volatile' to prevent this instruction from getting moved
-  // around during optimization to before function prologue is done.
-  // An alternative way to achieve this
-  // would be (before this __asm__ instruction) to call Noop() defined as
-  //   static void Noop() __attribute__ ((noinline));  // prevent inlining
-  //   static void Noop() { asm(""); }  // prevent optimizing-away
-  __asm__ volatile("mov %%rbp, %0" : "=r"(rbp));
-  // Arguments are passed in registers on x86-64, so we can't just
-  // offset from &result
-  sp = (void**)rbp;
-#endif
-
+// Walks the frame pointers from the frame |sp| of the caller of
+// GetStackTrace(), whose return address is the first frame of the stack
+// trace.  Always inlined so that the frame stays live.
+//
+// Stack frame format (x86, x86-64 and the frame records of aarch64):
+//    sp[0]   pointer to previous frame
+//    sp[1]   caller address
+static inline __attribute__((always_inline)) int GetStackTraceFromFramePointer(
+    void** sp, void** result, int max_depth, int skip_count) {
+  const StackBounds& bounds = GetThreadStackBounds(sp);
   int n = 0;
   while (sp && n < max_depth) {
     if (*(sp + 1) == nullptr) {
@@ -152,9 +314,40 @@ int GetStackTrace(void** result, int max_depth, int skip_count) {
       result[n++] = *(sp + 1);
     }
     // Use strict unwinding rules.
-    sp = NextStackFrame<true>(sp);
+    sp = NextStackFrame<true>(sp, bounds);
   }
   return n;
 }
+
+// Frame pointers are the default unwinder on i386 without an unwinder
+// library, see stacktrace.h.
+#if defined(__i386__) && !defined(HAVE_LIBUNWIND) && !defined(HAVE_UNWIND)
+// If you change this function, also change GetStackFrames below.
+int GetStackTrace(void** result, int max_depth, int skip_count) {
+  void** sp;
+
+#  ifdef __GNUC__
+#    if __GNUC__ * 100 + __GNUC_MINOR__ >= 402
+#      define USE_BUILTIN_FRAME_ADDRESS
+#    endif
+#  endif
+
+#  ifdef USE_BUILTIN_FRAME_ADDRESS
+  sp = reinterpret_cast<void**>(__builtin_frame_address(0));
+#  else
+  // Stack frame format:
+  //    sp[0]   pointer to previous frame
+  //    sp[1]   caller address
+  //    sp[2]   first argument
+  //    ...
+  sp = (void**)&result - 2;
+#  endif
+
+  return GetStackTraceFromFramePointer(sp, result, max_depth, skip_count);
+}
+#endif
+
 }  // namespace glog_internal_namespace_
 }  // namespace google
+
+#endif  // GLOG_INTERNAL_STACKTRACE_X86_INL_H
@@ -29,10 +29,14 @@
 
 #include "glog/stl_logging.h"
 
+#include <cstdint>
+#include <deque>
 #include <functional>
 #include <iostream>
+#include <limits>
 #include <map>
 #include <ostream>
+#include <sstream>
 #include <string>
 #include <vector>
 
@@ -41,6 +45,7 @@
 #include "googletest.h"
 
 using namespace std;
+using namespace google;
 
 struct user_hash {
   size_t operator()(int x) const { return static_cast<size_t>(x); }
@@ -105,10 +110,146 @@ static void TestSTLLogging() {
     map<int, string, greater<>> copied_m(m);
     CHECK_EQ(m, copied_m);  // This must compile.
   }
+
+  {
+    // Test that nested containers share the budget of elements.
+    map<int, vector<int>> m;
+    for (int i = 0; i < 3; i++) {
+      m[i] = vector<int>(40, i);
+    }
+    auto repeat = [](const char* element, int count) {
+      string result = element;
+      for (int i = 1; i < count; i++) result += string(" ") + element;
+      return result;
+    };
+    ostringstream ss;
+    ss << m;
+    // The keys take three elements of the budget.
+    EXPECT_EQ(ss.str(), "(0, " + repeat("0", 40) + ") (1, " + repeat("1", 40) +
+                            ") (2, " + repeat("2", 17) + " ...)");
+  }
+
+  {
+    // Test the byte budget.
+    FLAGS_stl_logging_max_bytes = 10;
+    vector<int> v(100, 7);
+    ostringstream ss;
+    ss << "prefix ";
+    ss << v;
+    EXPECT_EQ(ss.str(), "prefix 7 7 7 7 7 7 ...");
+    deque<int> d(100, 7);
+    ostringstream ds;
+    ds << d;
+    EXPECT_EQ(ds.str(), "7 7 7 7 7 7 ...");
+    FLAGS_stl_logging_max_bytes = 0;
+  }
+
+  {
+    // Test that numbers formatted in bulk only take the elements written.
+    FLAGS_stl_logging_max_bytes = 4;
+    const vector<int> v(10, 1);
+    ostringstream ss;
+    google::logging::internal::SequenceBudget budget(ss);
+    google::logging::internal::PrintElements(ss, budget, v.data(),
+                                             v.data() + v.size());
+    EXPECT_EQ(ss.str(), "1 1 1 ...");
+    EXPECT_EQ(budget.ElementsLeft(), FLAGS_stl_logging_max_elements - 3);
+    FLAGS_stl_logging_max_bytes = 0;
+  }
+
+  {
+    // Test the element budget.
+    FLAGS_stl_logging_max_elements = 2;
+    vector<vector<int>> v{{1, 2, 3}, {4}};
+    ostringstream ss;
+    ss << v;
+    EXPECT_EQ(ss.str(), "1 ... ...");
+    FLAGS_stl_logging_max_elements = 100;
+  }
+
+  {
+    // Test that numbers formatted in bulk look like streamed ones.
+    vector<int64_t> v{0, -1, 42, std::numeric_limits<int64_t>::min(),
+                      std::numeric_limits<int64_t>::max()};
+    vector<unsigned short> u{0, 1, 65535};
+    vector<double> d{0.5, -1.25, 1e100, 3.14159265358979};
+    vector<char> c{'a', 'b'};
+    vector<bool> b{true, false};
+    for (bool hex : {false, true}) {
+      ostringstream ss;
+      ostringstream expected;
+      if (hex) {
+        ss << std::hex;
+        expected << std::hex;
+      }
+      ss << v << '|' << u << '|' << d << '|' << c << '|' << b;
+      for (size_t i = 0; i < v.size(); i++) expected << (i ? " " : "") << v[i];
+      expected << '|';
+      for (size_t i = 0; i < u.size(); i++) expected << (i ? " " : "") << u[i];
+      expected << '|';
+      for (size_t i = 0; i < d.size(); i++) expected << (i ? " " : "") << d[i];
+      expected << "|a b|1 0";
+      EXPECT_EQ(ss.str(), expected.str());
+    }
+  }
+
+  {
+    // Test ranges and spans.
+    const int a[] = {1, 2, 3};
+    ostringstream ss;
+    google::PrintSequence(ss, a);
+    ss << '|';
+    google::PrintSequence(ss, a + 1, 2);
+    ss << '|';
+    google::PrintSequence(ss, vector<string>{"x", "y"});
+    EXPECT_EQ(ss.str(), "1 2 3|2 3|x y");
+  }
+
+  {
+    // Test that the byte budget applies to log messages too.
+    FLAGS_stl_logging_max_bytes = 4;
+    CaptureTestStderr();
+    LOG(ERROR) << vector<int>(10, 1);
+    const string captured = GetCapturedTestStderr();
+    EXPECT_NE(captured.find("] 1 1 1 ...\n"), string::npos);
+    FLAGS_stl_logging_max_bytes = 0;
+  }
+
+  {
+    // Test that the containers of a log message share the budget, which is
+    // renewed for the next message.
+    FLAGS_stl_logging_max_elements = 3;
+    CaptureTestStderr();
+    LOG(ERROR) << vector<int>{1, 2} << '|' << deque<int>{3, 4};
+    LOG(ERROR) << vector<int>{5, 6} << '|' << vector<int>{7};
+    const string captured = GetCapturedTestStderr();
+    EXPECT_NE(captured.find("] 1 2|3 ...\n"), string::npos) << captured;
+    EXPECT_NE(captured.find("] 5 6|7\n"), string::npos) << captured;
+    FLAGS_stl_logging_max_elements = 100;
+  }
+}
+
+static void BM_PrintIntVector(int iters) {
+  const vector<int> v(100, 12345);
+  for (int i = 0; i < iters; i++) {
+    ostringstream ss;
+    ss << v;
+  }
+}
+BENCHMARK(BM_PrintIntVector)
+
+static void BM_PrintIntDeque(int iters) {
+  const deque<int> d(100, 12345);
+  for (int i = 0; i < iters; i++) {
+    ostringstream ss;
+    ss << d;
+  }
 }
+BENCHMARK(BM_PrintIntDeque)
 
 int main(int, char**) {
   TestSTLLogging();
+  RunSpecifiedBenchmarks();
   std::cout << "PASS\n";
   return 0;
 }
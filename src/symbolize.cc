@@ -62,8 +62,10 @@
 #  include <cstdlib>
 #  include <cstring>
 #  include <limits>
+#  include <utility>
 
 #  include "demangle.h"
+#  include "glog/flags.h"
 
 // We don't use assert() since it's not guaranteed to be
 // async-signal-safe.  Instead we define a minimal assertion
@@ -82,10 +84,13 @@ SymbolizeOpenObjectFileCallback g_symbolize_open_object_file_callback = nullptr;
 // where the input symbol is demangled in-place.
 // To keep stack consumption low, we would like this function to not
 // get inlined.
+// With --symbolize_cache, the demangled names are cached as well.
 ATTRIBUTE_NOINLINE
 void DemangleInplace(char* out, size_t out_size) {
   char demangled[256];  // Big enough for sane demangled symbols.
-  if (Demangle(out, demangled, sizeof(demangled))) {
+  if (FLAGS_symbolize_cache
+          ? DemangleWithCache(out, demangled, sizeof(demangled))
+          : Demangle(out, demangled, sizeof(demangled))) {
     // Demangling succeeded. Copy to out if the space allows.
     size_t len = strlen(demangled);
     if (len + 1 <= out_size) {  // +1 for '\0'.
@@ -115,10 +120,12 @@ void InstallSymbolizeOpenObjectFileCallback(
 #      include <dlfcn.h>
 #    endif
 #    include <fcntl.h>
+#    include <sys/mman.h>
 #    include <sys/stat.h>
 #    include <sys/types.h>
 #    include <unistd.h>
 
+#    include <atomic>
 #    include <cerrno>
 #    include <climits>
 #    include <cstddef>
@@ -126,8 +133,10 @@ void InstallSymbolizeOpenObjectFileCallback(
 #    include <cstdio>
 #    include <cstdlib>
 #    include <cstring>
+#    include <new>
 
 #    include "config.h"
+#    include "glog/flags.h"
 #    include "glog/raw_logging.h"
 #    include "symbolize.h"
 
@@ -327,6 +336,8 @@ static ATTRIBUTE_NOINLINE bool FindSymbol(uint64_t pc, const int fd, char* out,
       uint64_t end_address = start_address + symbol.st_size;
       if (symbol.st_value != 0 &&  // Skip null value symbols.
           symbol.st_shndx != 0 &&  // Skip undefined symbols.
+          // Skip thread-local symbols, whose values are TLS offsets.
+          ELF32_ST_TYPE(symbol.st_info) != STT_TLS &&
           start_address <= pc && pc < end_address) {
         ssize_t len1 = ReadFromOffset(fd, out, out_size,
                                       strtab->sh_offset + symbol.st_name);
@@ -385,6 +396,301 @@ static bool GetSymbolFromObjectFile(const int fd, uint64_t pc, char* out,
   return false;
 }
 
+// POSIX doesn't define any async-signal safe function for converting
+// an integer to ASCII. We'll have to define our own version.
+// itoa_r() converts an (unsigned) integer to ASCII. It returns "buf", if the
+// conversion was successful or nullptr otherwise. It never writes more than
+// "sz" bytes. Output will be truncated as needed, and a NUL character is always
+// appended.
+// NOTE: code from sandbox/linux/seccomp-bpf/demo.cc.
+static char* itoa_r(uintptr_t i, char* buf, size_t sz, unsigned base,
+                    size_t padding) {
+  // Make sure we can write at least one NUL byte.
+  size_t n = 1;
+  if (n > sz) {
+    return nullptr;
+  }
+
+  if (base < 2 || base > 16) {
+    buf[0] = '\000';
+    return nullptr;
+  }
+
+  char* start = buf;
+
+  // Loop until we have converted the entire number. Output at least one
+  // character (i.e. '0').
+  char* ptr = start;
+  do {
+    // Make sure there is still enough space left in our output buffer.
+    if (++n > sz) {
+      buf[0] = '\000';
+      return nullptr;
+    }
+
+    // Output the next digit.
+    *ptr++ = "0123456789abcdef"[i % base];
+    i /= base;
+
+    if (padding > 0) {
+      padding--;
+    }
+  } while (i > 0 || padding > 0);
+
+  // Terminate the output with a NUL character.
+  *ptr = '\000';
+
+  // Conversion to ASCII actually resulted in the digits being in reverse
+  // order. We can't easily generate them in forward order, as we can't tell
+  // the number of characters needed until we are done converting.
+  // So, now, we reverse the string (except for the possible "-" sign).
+  while (--ptr > start) {
+    char ch = *ptr;
+    *ptr = *start;
+    *start++ = ch;
+  }
+  return buf;
+}
+
+// Safely appends string |source| to string |dest|.  Never writes past the
+// buffer size |dest_size| and guarantees that |dest| is null-terminated.
+static void SafeAppendString(const char* source, char* dest, size_t dest_size) {
+  size_t dest_string_length = strlen(dest);
+  GLOG_SAFE_ASSERT(dest_string_length < dest_size);
+  dest += dest_string_length;
+  dest_size -= dest_string_length;
+  strncpy(dest, source, dest_size);
+  // Making sure |dest| is always null-terminated.
+  dest[dest_size - 1] = '\0';
+}
+
+// Converts a 64-bit value into a hex string, and safely appends it to |dest|.
+// Never writes past the buffer size |dest_size| and guarantees that |dest| is
+// null-terminated.
+static void SafeAppendHexNumber(uint64_t value, char* dest, size_t dest_size) {
+  // 64-bit numbers in hex can have up to 16 digits.
+  char buf[17] = {'\0'};
+  SafeAppendString(itoa_r(value, buf, sizeof(buf), 16, 0), dest, dest_size);
+}
+
+// Reads the GNU build-id note of the object file pointed by |fd| and writes
+// it as a hexadecimal string to |out|.  Returns true on success.
+static ATTRIBUTE_NOINLINE bool GetBuildIdFromObjectFile(const int fd, char* out,
+                                                        size_t out_size) {
+  ElfW(Shdr) note;
+  const char kBuildIdSection[] = ".note.gnu.build-id";
+  if (!GetSectionHeaderByName(fd, kBuildIdSection, sizeof(kBuildIdSection),
+                              &note) ||
+      note.sh_type != SHT_NOTE) {
+    return false;
+  }
+  ElfW(Nhdr) header;
+  if (!ReadFromOffsetExact(fd, &header, sizeof(header), note.sh_offset) ||
+      header.n_type != NT_GNU_BUILD_ID || header.n_descsz == 0) {
+    return false;
+  }
+  // The descriptor follows the name, which is padded to 4 bytes.
+  unsigned char build_id[64];
+  const size_t build_id_size =
+      std::min(static_cast<size_t>(header.n_descsz), sizeof(build_id));
+  const size_t desc_offset =
+      note.sh_offset + sizeof(header) + ((header.n_namesz + 3U) & ~3U);
+  if (2 * build_id_size + 1 > out_size ||
+      !ReadFromOffsetExact(fd, build_id, build_id_size, desc_offset)) {
+    return false;
+  }
+  for (size_t i = 0; i < build_id_size; ++i) {
+    out[2 * i] = "0123456789abcdef"[build_id[i] >> 4U];
+    out[2 * i + 1] = "0123456789abcdef"[build_id[i] & 0xFU];
+  }
+  out[2 * build_id_size] = '\0';
+  return true;
+}
+
+// Returns true if the object file pointed by |fd| has a regular symbol table,
+// that is, if it has not been stripped.
+static bool HasSymbolTable(const int fd) {
+  ElfW(Ehdr) elf_header;
+  ElfW(Shdr) symtab;
+  return ReadFromOffsetExact(fd, &elf_header, sizeof(elf_header), 0) &&
+         GetSectionHeaderByType(fd, elf_header.e_shnum, elf_header.e_shoff,
+                                SHT_SYMTAB, &symtab);
+}
+
+// Upper bound on the size of the debug files checked against the CRC-32 of
+// .gnu_debuglink, since the whole file is read, possibly from a signal
+// handler.  Debug files matched by build-id are not read.
+const size_t kMaxCrc32FileSize = 256 << 20;
+
+// Computes the CRC-32 of the file pointed by |fd| as recorded by
+// .gnu_debuglink.  Returns true on success, false on failure or if the file is
+// larger than kMaxCrc32FileSize.
+static bool GetFileCrc32(const int fd, uint32_t* crc) {
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0 ||
+      static_cast<uint64_t>(file_stat.st_size) > kMaxCrc32FileSize) {
+    return false;
+  }
+  // Lookup table of the CRC-32 polynomial 0xedb88320 for 4 bits at a time,
+  // which is small enough to not need any initialization.
+  static const uint32_t kCrcTable[16] = {
+      0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4,
+      0x4db26158, 0x5005713c, 0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+      0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c};
+  unsigned char buf[1024];
+  uint32_t value = 0xffffffff;
+  for (size_t offset = 0;;) {
+    const ssize_t len = ReadFromOffset(fd, buf, sizeof(buf), offset);
+    if (len < 0) {
+      return false;
+    }
+    if (len == 0) {
+      break;
+    }
+    for (size_t i = 0; i < static_cast<size_t>(len); ++i) {
+      value ^= buf[i];
+      value = (value >> 4U) ^ kCrcTable[value & 0xFU];
+      value = (value >> 4U) ^ kCrcTable[value & 0xFU];
+    }
+    offset += static_cast<size_t>(len);
+  }
+  *crc = ~value;
+  return true;
+}
+
+// Opens |path| if it is an unstripped object file matching the build-id
+// |build_id| or, if the stripped object file has no build-id, the CRC |crc|
+// recorded in its .gnu_debuglink section.
+static FileDescriptor OpenDebugFileCandidate(const char* path,
+                                             const char* build_id,
+                                             uint32_t crc) {
+  FileDescriptor debug_fd{
+      FailureRetry([path] { return open(path, O_RDONLY); })};
+  if (!debug_fd || FileGetElfType(debug_fd.get()) == -1 ||
+      !HasSymbolTable(debug_fd.get())) {
+    return nullptr;
+  }
+  if (build_id[0] != '\0') {
+    char debug_build_id[129];
+    if (!GetBuildIdFromObjectFile(debug_fd.get(), debug_build_id,
+                                  sizeof(debug_build_id)) ||
+        strcmp(build_id, debug_build_id) != 0) {
+      return nullptr;
+    }
+  } else {
+    uint32_t debug_crc;
+    if (!GetFileCrc32(debug_fd.get(), &debug_crc) || debug_crc != crc) {
+      return nullptr;
+    }
+  }
+  return debug_fd;
+}
+
+// Opens the separate debug file of the stripped object file |file_name|
+// pointed by |fd|, looking it up like GDB does: by build-id under
+// --symbolize_debug_root, then by the name recorded in the .gnu_debuglink
+// section in the directory of the object file, in its .debug subdirectory and
+// in the same directory under --symbolize_debug_root.  Returns an invalid file
+// descriptor if the object file has a regular symbol table, or no debug file
+// is found.
+static ATTRIBUTE_NOINLINE FileDescriptor OpenDebugFile(const int fd,
+                                                       const char* file_name) {
+  if (HasSymbolTable(fd)) {
+    return nullptr;
+  }
+  const char* debug_root = FLAGS_symbolize_debug_root.c_str();
+  char path[1024];
+  char build_id[129];
+  if (!GetBuildIdFromObjectFile(fd, build_id, sizeof(build_id))) {
+    build_id[0] = '\0';
+  } else if (debug_root[0] != '\0' && build_id[1] != '\0') {
+    // The debug root indexes debug files by build-id as
+    // .build-id/<first 2 digits>/<remaining digits>.debug.
+    const char build_id_dir[] = {build_id[0], build_id[1], '/', '\0'};
+    path[0] = '\0';
+    SafeAppendString(debug_root, path, sizeof(path));
+    SafeAppendString("/.build-id/", path, sizeof(path));
+    SafeAppendString(build_id_dir, path, sizeof(path));
+    SafeAppendString(build_id + 2, path, sizeof(path));
+    SafeAppendString(".debug", path, sizeof(path));
+    FileDescriptor debug_fd = OpenDebugFileCandidate(path, build_id, 0);
+    if (debug_fd) {
+      return debug_fd;
+    }
+  }
+
+  // The .gnu_debuglink section holds the name of the debug file, padded to 4
+  // bytes and followed by the CRC-32 of the debug file.
+  ElfW(Shdr) debuglink;
+  const char kDebuglinkSection[] = ".gnu_debuglink";
+  char link[256];
+  uint32_t crc;
+  if (!GetSectionHeaderByName(fd, kDebuglinkSection, sizeof(kDebuglinkSection),
+                              &debuglink)) {
+    return nullptr;
+  }
+  const size_t link_size =
+      std::min(static_cast<size_t>(debuglink.sh_size), sizeof(link));
+  if (!ReadFromOffsetExact(fd, link, link_size, debuglink.sh_offset)) {
+    return nullptr;
+  }
+  const void* link_end = memchr(link, '\0', link_size);
+  if (link_end == nullptr || link_end == link) {
+    return nullptr;
+  }
+  const size_t crc_offset =
+      (static_cast<size_t>(static_cast<const char*>(link_end) - link) + 4U) &
+      ~3U;
+  if (crc_offset + sizeof(crc) > debuglink.sh_size ||
+      !ReadFromOffsetExact(fd, &crc, sizeof(crc),
+                           debuglink.sh_offset + crc_offset)) {
+    return nullptr;
+  }
+
+  const char* base_name = strrchr(file_name, '/');
+  const size_t dir_len =
+      base_name == nullptr ? 0 : static_cast<size_t>(base_name - file_name + 1);
+  const char* const prefixes[] = {"", "", debug_root};
+  const char* const subdirs[] = {"", ".debug/", ""};
+  for (size_t i = 0; i < 3; ++i) {
+    if (i == 2 && debug_root[0] == '\0') {
+      break;
+    }
+    path[0] = '\0';
+    SafeAppendString(prefixes[i], path, sizeof(path));
+    const size_t prefix_len = strlen(path);
+    if (dir_len >= sizeof(path) - prefix_len) {
+      continue;
+    }
+    memcpy(path + prefix_len, file_name, dir_len);
+    path[prefix_len + dir_len] = '\0';
+    SafeAppendString(subdirs[i], path, sizeof(path));
+    SafeAppendString(link, path, sizeof(path));
+    FileDescriptor debug_fd = OpenDebugFileCandidate(path, build_id, crc);
+    if (debug_fd) {
+      return debug_fd;
+    }
+  }
+  return nullptr;
+}
+
+// Looks up the symbol of "pc" in the separate debug file of the stripped
+// object file |file_name| pointed by "fd".  On success, writes the symbol name
+// to "out" and returns true.  Otherwise, returns false and leaves "out"
+// untouched.  |file_name| may point into "out".
+static ATTRIBUTE_NOINLINE bool GetSymbolFromDebugFile(
+    const int fd, const char* file_name, uint64_t pc, char* out,
+    size_t out_size, uint64_t base_address) {
+  char object_file_name[1024];
+  object_file_name[0] = '\0';
+  SafeAppendString(file_name, object_file_name, sizeof(object_file_name));
+  // Debug files keep the addresses of the object file, so that the base
+  // address applies to both.
+  FileDescriptor debug_fd = OpenDebugFile(fd, object_file_name);
+  return debug_fd && GetSymbolFromObjectFile(debug_fd.get(), pc, out,
+                                             out_size, base_address);
+}
+
 namespace {
 
 // Helper class for reading lines from file.
@@ -498,41 +804,34 @@ static char* GetHex(const char* start, const char* end, uint64_t* hex) {
   return const_cast<char*>(p);
 }
 
-// Searches for the object file (from /proc/self/maps) that contains
-// the specified pc.  If found, sets |start_address| to the start address
-// of where this object file is mapped in memory, sets the module base
-// address into |base_address|, copies the object file name into
-// |out_file_name|, and attempts to open the object file.  If the object
-// file is opened successfully, returns the file descriptor.  Otherwise,
-// returns -1.  |out_file_name_size| is the size of the file name buffer
-// (including the null-terminator).
-static ATTRIBUTE_NOINLINE FileDescriptor
-OpenObjectFileContainingPcAndGetStartAddress(uint64_t pc,
-                                             uint64_t& start_address,
-                                             uint64_t& base_address,
-                                             char* out_file_name,
-                                             size_t out_file_name_size) {
+// Iterates over the "r*x" mappings of object files in /proc/self/maps and
+// calls |callback(start_address, end_address, base_address, file_name)| for
+// each of them until the callback returns true.  Returns true if the callback
+// did so, and false on EOF or a malformed line.
+template <class Callback>
+static ATTRIBUTE_NOINLINE bool ForEachExecutableMapping(Callback callback) {
   FileDescriptor maps_fd{
       FailureRetry([] { return open("/proc/self/maps", O_RDONLY); })};
   if (!maps_fd) {
-    return nullptr;
+    return false;
   }
 
   FileDescriptor mem_fd{
       FailureRetry([] { return open("/proc/self/mem", O_RDONLY); })};
   if (!mem_fd) {
-    return nullptr;
+    return false;
   }
 
   // Iterate over maps and look for the map containing the pc.  Then
   // look into the symbol tables inside.
   char buf[1024];  // Big enough for line of sane /proc/self/maps
   LineReader reader(maps_fd.get(), buf, sizeof(buf), 0);
+  uint64_t base_address = 0;
   while (true) {
     const char* cursor;
     const char* eol;
     if (!reader.ReadLine(&cursor, &eol)) {  // EOF or malformed line.
-      return nullptr;
+      return false;
     }
 
     // Start parsing line in /proc/self/maps.  Here is an example:
@@ -543,9 +842,10 @@ OpenObjectFileContainingPcAndGetStartAddress(uint64_t pc,
     // (r-xp) and file name (/bin/cat).
 
     // Read start address.
+    uint64_t start_address;
     cursor = GetHex(cursor, eol, &start_address);
     if (cursor == eol || *cursor != '-') {
-      return nullptr;  // Malformed line.
+      return false;  // Malformed line.
     }
     ++cursor;  // Skip '-'.
 
@@ -553,7 +853,7 @@ OpenObjectFileContainingPcAndGetStartAddress(uint64_t pc,
     uint64_t end_address;
     cursor = GetHex(cursor, eol, &end_address);
     if (cursor == eol || *cursor != ' ') {
-      return nullptr;  // Malformed line.
+      return false;  // Malformed line.
     }
     ++cursor;  // Skip ' '.
 
@@ -564,7 +864,7 @@ OpenObjectFileContainingPcAndGetStartAddress(uint64_t pc,
     }
     // We expect at least four letters for flags (ex. "r-xp").
     if (cursor == eol || cursor < flags_start + 4) {
-      return nullptr;  // Malformed line.
+      return false;  // Malformed line.
     }
 
     // Determine the base address by reading ELF headers in process memory.
@@ -605,128 +905,1212 @@ OpenObjectFileContainingPcAndGetStartAddress(uint64_t pc,
           break;
       }
     }
-
-    // Check start and end addresses.
-    if (start_address > pc || pc >= end_address) {
-      continue;  // We skip this map.  PC isn't in this map.
+
+    // Check flags.  We are only interested in "r*x" maps.
+    if (flags_start[0] != 'r' || flags_start[2] != 'x') {
+      continue;  // We skip this map.
+    }
+    ++cursor;  // Skip ' '.
+
+    // Read file offset.
+    uint64_t file_offset;
+    cursor = GetHex(cursor, eol, &file_offset);
+    if (cursor == eol || *cursor != ' ') {
+      return false;  // Malformed line.
+    }
+    ++cursor;  // Skip ' '.
+
+    // Skip to file name.  "cursor" now points to dev.  We need to
+    // skip at least two spaces for dev and inode.
+    int num_spaces = 0;
+    while (cursor < eol) {
+      if (*cursor == ' ') {
+        ++num_spaces;
+      } else if (num_spaces >= 2) {
+        // The first non-space character after skipping two spaces
+        // is the beginning of the file name.
+        break;
+      }
+      ++cursor;
+    }
+    if (cursor == eol) {
+      continue;  // Anonymous map.  There is no object file to look into.
+    }
+
+    // Finally, "cursor" now points to file name of our interest.
+    if (callback(start_address, end_address, base_address, cursor)) {
+      return true;
+    }
+  }
+}
+
+// Searches for the object file (from /proc/self/maps) that contains
+// the specified pc.  If found, sets |start_address| to the start address
+// of where this object file is mapped in memory, sets the module base
+// address into |base_address|, copies the object file name into
+// |out_file_name|, and attempts to open the object file.  If the object
+// file is opened successfully, returns the file descriptor.  Otherwise,
+// returns -1.  |out_file_name_size| is the size of the file name buffer
+// (including the null-terminator).
+static ATTRIBUTE_NOINLINE FileDescriptor
+OpenObjectFileContainingPcAndGetStartAddress(uint64_t pc,
+                                             uint64_t& start_address,
+                                             uint64_t& base_address,
+                                             char* out_file_name,
+                                             size_t out_file_name_size) {
+  FileDescriptor object_fd;
+  ForEachExecutableMapping([&](uint64_t map_start, uint64_t map_end,
+                               uint64_t map_base, const char* file_name) {
+    // Check start and end addresses.
+    if (map_start > pc || pc >= map_end) {
+      return false;  // We skip this map.  PC isn't in this map.
+    }
+    start_address = map_start;
+    base_address = map_base;
+
+    strncpy(out_file_name, file_name, out_file_name_size);
+    // Making sure |out_file_name| is always null-terminated.
+    out_file_name[out_file_name_size - 1] = '\0';
+
+    object_fd.reset(
+        FailureRetry([file_name] { return open(file_name, O_RDONLY); }));
+    return true;
+  });
+  return object_fd;
+}
+
+// Source line table of an object file decoded from its DWARF .debug_line
+// section.  Each row gives the line of the addresses up to the next row.
+// Strings are referenced by their offset in the mapped object file, and the
+// rows and files share one allocation.
+struct LineTable {
+  struct Row {
+    uint64_t address;
+    uint32_t file;  // Index into |files|.
+    uint32_t line;  // 0 for addresses without a line, e.g. between sequences.
+  };
+  struct File {
+    uint32_t directory;  // Offset of the directory name, or 0 if none.
+    uint32_t name;       // Offset of the file name.
+  };
+  Row* rows;
+  size_t num_rows;
+  File* files;
+  size_t num_files;
+};
+
+namespace {
+
+// Optional cache used when --symbolize_cache is set.  The first lookup
+// snapshots the executable mappings of /proc/self/maps into a module map.
+// Each object file is recorded once, however many mappings it has, and kept
+// open along with the separate debug file of a stripped one, so that the
+// debug root is searched once per object file.  On first use, each object
+// file (or its debug file) is mapped into memory once, its symbol tables are
+// indexed into a compact array sorted by address, and the files are closed.
+// A lookup is a binary search over the mappings followed by one over the
+// symbols of the object file, and the symbol name is read from the mapped
+// string table, so that no system calls are involved.
+//
+// Everything is allocated with mmap() and published with atomics instead of
+// being protected by a lock, so that the read path remains async-signal-safe:
+// a reader that finds the module map or an index still under construction
+// falls back to the uncached path.  When object files have been loaded or
+// unloaded since the module map was built, as reported by dl_iterate_phdr(),
+// the next lookup builds a new module map.  The object files still mapped
+// keep their indexes.  The previous module map is not freed since readers may
+// still use it.  Inside a signal handler the module map is used as it is.
+
+// Symbols are stored relative to the base address of their object file.
+struct CachedSymbol {
+  uint64_t start;
+  uint32_t size;
+  uint32_t name_offset;  // File offset of the symbol name.
+  uint32_t order;        // Position in the symbol tables, to break ties.
+};
+
+enum : int { kIndexUnbuilt, kIndexBuilding, kIndexReady, kIndexFailed };
+
+struct CachedObject {
+  // Identity of the object file.  Zero once it is unloaded before having been
+  // indexed.
+  dev_t device;
+  ino_t inode;
+  int fd;        // Closed once the object file is indexed.
+  int debug_fd;  // The separate debug file of a stripped object file, or -1.
+  std::atomic<int> state;
+  const char* image;  // The object file mapped into memory.
+  size_t image_size;
+  CachedSymbol* symbols;
+  size_t num_symbols;
+  std::atomic<int> line_state;
+  LineTable lines;
+};
+
+struct CachedMapping {
+  uint64_t start_address;
+  uint64_t end_address;
+  uint64_t base_address;
+  CachedObject* object;
+};
+
+// Upper bounds on the object files recorded over the lifetime of the process,
+// and on the executable mappings recorded in one module map.
+const size_t kMaxCachedObjects = 512;
+const size_t kMaxCachedMappings = 512;
+
+// Object files, shared by the successive module maps.  Only the thread
+// building a module map adds to it.
+struct ObjectPool {
+  size_t num_objects;
+  CachedObject objects[kMaxCachedObjects];
+};
+
+struct ModuleMap {
+  // dl_iterate_phdr() counts of loaded and unloaded object files when the map
+  // was built.
+  unsigned long long adds;  // NOLINT(runtime/int)
+  unsigned long long subs;  // NOLINT(runtime/int)
+  size_t num_mappings;
+  CachedMapping mappings[kMaxCachedMappings];
+};
+
+std::atomic<int> g_module_map_state{kIndexUnbuilt};
+std::atomic<ModuleMap*> g_module_map{nullptr};
+ObjectPool* g_object_pool = nullptr;
+std::atomic<int> g_signal_safe_symbolizations{0};
+
+void* AllocateCacheMemory(size_t size) {
+  void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  return memory == MAP_FAILED ? nullptr : memory;
+}
+
+// Stores the dl_iterate_phdr() counts of loaded and unloaded object files into
+// the ModuleMap |data|.
+int GetObjectFileCounts(struct dl_phdr_info* info, size_t size, void* data) {
+  if (size <
+      offsetof(struct dl_phdr_info, dlpi_subs) + sizeof(info->dlpi_subs)) {
+    return -1;
+  }
+  auto* map = static_cast<ModuleMap*>(data);
+  map->adds = info->dlpi_adds;
+  map->subs = info->dlpi_subs;
+  return 1;
+}
+
+// Returns true unless object files have been loaded or unloaded since |map|
+// was built.  Not async-signal-safe.
+bool IsModuleMapCurrent(const ModuleMap& map) {
+  ModuleMap counts;
+  return dl_iterate_phdr(&GetObjectFileCounts, &counts) != 1 ||
+         (counts.adds == map.adds && counts.subs == map.subs);
+}
+
+// Closes the object file and debug file of |object|, which are no longer
+// needed once it is indexed.
+void CloseObjectFiles(CachedObject* object) {
+  if (object->debug_fd != -1) {
+    close(object->debug_fd);
+    object->debug_fd = -1;
+  }
+  if (object->fd != -1) {
+    close(object->fd);
+    object->fd = -1;
+  }
+}
+
+// Returns the object of the object file |fd| refers to, adding it to the pool
+// if needed, or nullptr if the pool is full.  Takes ownership of |fd|.
+CachedObject* GetCachedObject(FileDescriptor fd, const char* file_name,
+                              const struct stat& file_stat) {
+  for (size_t i = 0; i < g_object_pool->num_objects; ++i) {
+    CachedObject& object = g_object_pool->objects[i];
+    if (object.device == file_stat.st_dev && object.inode == file_stat.st_ino) {
+      return &object;
+    }
+  }
+  if (g_object_pool->num_objects == kMaxCachedObjects) {
+    return nullptr;
+  }
+  CachedObject& object = g_object_pool->objects[g_object_pool->num_objects++];
+  object.device = file_stat.st_dev;
+  object.inode = file_stat.st_ino;
+  object.debug_fd = OpenDebugFile(fd.get(), file_name).release();
+  object.fd = fd.release();
+  return &object;
+}
+
+// Builds a module map of the object files currently mapped.  Returns nullptr
+// if memory is exhausted.
+ModuleMap* BuildModuleMap(const ModuleMap* previous) {
+  if (g_object_pool == nullptr) {
+    void* memory = AllocateCacheMemory(sizeof(ObjectPool));
+    if (memory == nullptr) {
+      return nullptr;
+    }
+    g_object_pool = new (memory) ObjectPool();
+  }
+  void* memory = AllocateCacheMemory(sizeof(ModuleMap));
+  if (memory == nullptr) {
+    return nullptr;
+  }
+  auto* map = new (memory) ModuleMap();
+  // Take the counts first so that object files loaded meanwhile cause another
+  // rebuild.
+  dl_iterate_phdr(&GetObjectFileCounts, map);
+  ForEachExecutableMapping([map](uint64_t start_address, uint64_t end_address,
+                                 uint64_t base_address, const char* file_name) {
+    FileDescriptor fd{
+        FailureRetry([file_name] { return open(file_name, O_RDONLY); })};
+    struct stat file_stat;
+    if (!fd || fstat(fd.get(), &file_stat) != 0 ||
+        FileGetElfType(fd.get()) == -1) {
+      return false;
+    }
+    CachedObject* object = GetCachedObject(std::move(fd), file_name, file_stat);
+    if (object == nullptr) {
+      return false;
+    }
+    CachedMapping& mapping = map->mappings[map->num_mappings++];
+    mapping.start_address = start_address;
+    mapping.end_address = end_address;
+    mapping.base_address = base_address;
+    mapping.object = object;
+    return map->num_mappings == kMaxCachedMappings;
+  });
+  // /proc/self/maps lists the mappings in ascending order, so the mappings are
+  // sorted by address already.
+
+  // Close the files of the object files unloaded before being indexed.
+  // Readers still using |previous| symbolize them by the uncached path.
+  if (previous != nullptr) {
+    for (size_t i = 0; i < g_object_pool->num_objects; ++i) {
+      CachedObject& object = g_object_pool->objects[i];
+      const CachedMapping* begin = map->mappings;
+      const CachedMapping* end = begin + map->num_mappings;
+      int state = kIndexUnbuilt;
+      if (std::find_if(begin, end,
+                       [&object](const CachedMapping& mapping) {
+                         return mapping.object == &object;
+                       }) == end &&
+          object.state.compare_exchange_strong(state, kIndexFailed,
+                                               std::memory_order_acquire)) {
+        CloseObjectFiles(&object);
+        object.device = 0;
+        object.inode = 0;
+      }
+    }
+  }
+  return map;
+}
+
+// Returns the module map, building it first if nobody did so yet or if it is
+// out of date.  Returns nullptr if the map is unavailable or being built
+// concurrently.
+const ModuleMap* GetModuleMap() {
+  int state = g_module_map_state.load(std::memory_order_acquire);
+  const ModuleMap* previous = nullptr;
+  if (state == kIndexReady) {
+    previous = g_module_map.load(std::memory_order_acquire);
+    if (g_signal_safe_symbolizations.load(std::memory_order_relaxed) > 0 ||
+        IsModuleMapCurrent(*previous)) {
+      return previous;
+    }
+  } else if (state != kIndexUnbuilt) {
+    return nullptr;
+  }
+  if (!g_module_map_state.compare_exchange_strong(state, kIndexBuilding,
+                                                  std::memory_order_acquire)) {
+    return nullptr;
+  }
+  ModuleMap* map = BuildModuleMap(previous);
+  if (map == nullptr) {
+    g_module_map_state.store(kIndexFailed, std::memory_order_release);
+    return nullptr;
+  }
+  g_module_map.store(map, std::memory_order_release);
+  g_module_map_state.store(kIndexReady, std::memory_order_release);
+  return map;
+}
+
+// Returns true if the section headers of the object file mapped at |image| are
+// within the bounds of the file.
+bool HasMappedSectionHeaders(const char* image, size_t image_size) {
+  const auto* elf_header = reinterpret_cast<const ElfW(Ehdr)*>(image);
+  return elf_header->e_shentsize == sizeof(ElfW(Shdr)) &&
+         elf_header->e_shoff <= image_size &&
+         elf_header->e_shnum <=
+             (image_size - elf_header->e_shoff) / sizeof(ElfW(Shdr));
+}
+
+// Returns the section header |index| of the object file mapped at |image|, or
+// nullptr if the section is out of the bounds of the file.  The section
+// headers must have been checked with HasMappedSectionHeaders().
+const ElfW(Shdr) * GetMappedSection(const char* image, size_t image_size,
+                                    size_t index) {
+  const auto* elf_header = reinterpret_cast<const ElfW(Ehdr)*>(image);
+  if (index >= elf_header->e_shnum) {
+    return nullptr;
+  }
+  const auto* section = reinterpret_cast<const ElfW(Shdr)*>(
+      image + elf_header->e_shoff + index * sizeof(ElfW(Shdr)));
+  if (section->sh_type != SHT_NOBITS &&
+      (section->sh_offset > image_size ||
+       section->sh_size > image_size - section->sh_offset)) {
+    return nullptr;
+  }
+  return section;
+}
+
+// Appends the symbols of the symbol table |symtab| to |object|.
+void IndexSymbolTable(CachedObject* object, const ElfW(Shdr) & symtab,
+                      uint32_t* order) {
+  const ElfW(Shdr)* strtab =
+      GetMappedSection(object->image, object->image_size, symtab.sh_link);
+  if (strtab == nullptr) {
+    return;
+  }
+  const auto* symbols =
+      reinterpret_cast<const ElfW(Sym)*>(object->image + symtab.sh_offset);
+  const size_t num_symbols = symtab.sh_size / sizeof(ElfW(Sym));
+  for (size_t i = 0; i < num_symbols; ++i, ++*order) {
+    const ElfW(Sym)& symbol = symbols[i];
+    // Skip null value, undefined and empty symbols which cannot contain a pc
+    // anyway, and thread-local symbols, whose values are TLS offsets.
+    if (symbol.st_value == 0 || symbol.st_shndx == 0 || symbol.st_size == 0 ||
+        ELF32_ST_TYPE(symbol.st_info) == STT_TLS ||
+        symbol.st_name >= strtab->sh_size) {
+      continue;
+    }
+    CachedSymbol& cached = object->symbols[object->num_symbols++];
+    cached.start = symbol.st_value;
+    cached.size = static_cast<uint32_t>(std::min<uint64_t>(
+        symbol.st_size, std::numeric_limits<uint32_t>::max()));
+    cached.name_offset =
+        static_cast<uint32_t>(strtab->sh_offset + symbol.st_name);
+    cached.order = *order;
+  }
+}
+
+// Builds the symbol index of |object| unless done already.  Returns true if
+// the index can be used.
+bool EnsureSymbolIndex(CachedObject* object) {
+  int state = object->state.load(std::memory_order_acquire);
+  if (state == kIndexReady) {
+    return true;
+  }
+  if (state != kIndexUnbuilt ||
+      !object->state.compare_exchange_strong(state, kIndexBuilding,
+                                             std::memory_order_acquire)) {
+    return false;
+  }
+  // Map the whole object file, or the debug file of a stripped one, once.
+  // Name offsets are 32 bits wide, which limits the file size to 4 GiB.
+  const int fd = object->debug_fd != -1 ? object->debug_fd : object->fd;
+  struct stat file_stat;
+  void* image = MAP_FAILED;
+  if (fstat(fd, &file_stat) == 0 &&
+      static_cast<size_t>(file_stat.st_size) >= sizeof(ElfW(Ehdr)) &&
+      static_cast<uint64_t>(file_stat.st_size) <=
+          std::numeric_limits<uint32_t>::max()) {
+    image = mmap(nullptr, static_cast<size_t>(file_stat.st_size), PROT_READ,
+                 MAP_PRIVATE, fd, 0);
+  }
+  CloseObjectFiles(object);
+  if (image == MAP_FAILED) {
+    object->state.store(kIndexFailed, std::memory_order_release);
+    return false;
+  }
+  object->image = static_cast<const char*>(image);
+  object->image_size = static_cast<size_t>(file_stat.st_size);
+
+  // Like GetSymbolFromObjectFile(), prefer the regular symbol table over the
+  // dynamic one, and earlier symbols over later ones.
+  const auto* elf_header = static_cast<const ElfW(Ehdr)*>(image);
+  const ElfW(Shdr)* symtab = nullptr;
+  const ElfW(Shdr)* dynsym = nullptr;
+  size_t capacity = 0;
+  if (HasMappedSectionHeaders(object->image, object->image_size)) {
+    for (size_t i = 0; i < elf_header->e_shnum; ++i) {
+      const ElfW(Shdr)* section =
+          GetMappedSection(object->image, object->image_size, i);
+      if (section == nullptr || section->sh_entsize != sizeof(ElfW(Sym))) {
+        continue;
+      }
+      if (section->sh_type == SHT_SYMTAB && symtab == nullptr) {
+        symtab = section;
+      } else if (section->sh_type == SHT_DYNSYM && dynsym == nullptr) {
+        dynsym = section;
+      } else {
+        continue;
+      }
+      capacity += section->sh_size / sizeof(ElfW(Sym));
+    }
+  }
+  if (capacity != 0) {
+    object->symbols = static_cast<CachedSymbol*>(
+        AllocateCacheMemory(capacity * sizeof(CachedSymbol)));
+  }
+  if (object->symbols == nullptr) {
+    object->state.store(kIndexFailed, std::memory_order_release);
+    return false;
+  }
+  uint32_t order = 0;
+  if (symtab != nullptr) {
+    IndexSymbolTable(object, *symtab, &order);
+  }
+  if (dynsym != nullptr) {
+    IndexSymbolTable(object, *dynsym, &order);
+  }
+  std::sort(object->symbols, object->symbols + object->num_symbols,
+            [](const CachedSymbol& lhs, const CachedSymbol& rhs) {
+              return lhs.start < rhs.start ||
+                     (lhs.start == rhs.start && lhs.order < rhs.order);
+            });
+  object->state.store(kIndexReady, std::memory_order_release);
+  return true;
+}
+
+// Returns the mapping of the module map containing |pc|, or nullptr if there
+// is none.
+const CachedMapping* FindCachedMapping(uint64_t pc) {
+  const ModuleMap* map = GetModuleMap();
+  if (map == nullptr) {
+    return nullptr;
+  }
+  const CachedMapping* end = map->mappings + map->num_mappings;
+  const CachedMapping* it =
+      std::upper_bound(map->mappings, end, pc,
+                       [](uint64_t address, const CachedMapping& mapping) {
+                         return address < mapping.start_address;
+                       });
+  if (it == map->mappings || pc >= (--it)->end_address) {
+    return nullptr;
+  }
+  return it;
+}
+
+// Number of preceding symbols inspected for one that contains a pc, to find
+// the pc within nested or overlapping symbols.
+const size_t kMaxEnclosingSymbols = 16;
+
+// Looks up the symbol name of |pc| in the cache.  On success, writes the
+// symbol name to |out| and returns true.  Otherwise, returns false and leaves
+// the symbolization to the uncached path.
+bool SymbolizeFromCache(uint64_t pc, char* out, size_t out_size) {
+  const CachedMapping* mapping = FindCachedMapping(pc);
+  if (mapping == nullptr || !EnsureSymbolIndex(mapping->object)) {
+    return false;
+  }
+
+  const CachedObject* object = mapping->object;
+  const uint64_t address = pc - mapping->base_address;
+  const CachedSymbol* first = object->symbols;
+  const CachedSymbol* last = std::upper_bound(
+      first, first + object->num_symbols, address,
+      [](uint64_t value, const CachedSymbol& symbol) {
+        return value < symbol.start;
+      });
+  const CachedSymbol* found = nullptr;
+  for (size_t i = 0; last != first && i < kMaxEnclosingSymbols; ++i) {
+    const CachedSymbol& symbol = *--last;
+    if (address - symbol.start < symbol.size &&
+        (found == nullptr || symbol.order < found->order)) {
+      found = &symbol;
+    }
+  }
+  if (found == nullptr) {
+    return false;
+  }
+  const char* name = object->image + found->name_offset;
+  const size_t max_len =
+      std::min(out_size, object->image_size - found->name_offset);
+  const void* name_end = memchr(name, '\0', max_len);
+  if (name_end == nullptr) {
+    return false;
+  }
+  memcpy(out, name, static_cast<size_t>(static_cast<const char*>(name_end) -
+                                        name + 1));
+  return true;
+}
+
+
+// DWARF line tables are decoded lazily, once per object file, when source
+// lines are requested with --symbolize_line_numbers.  The rows are sorted by
+// address so that a lookup is a binary search.
+
+// Upper bound on the memory used by the line tables of all object files.
+// Object files whose line table does not fit anymore are symbolized without
+// source lines.
+const size_t kMaxLineTableBytes = 64 << 20;
+
+std::atomic<size_t> g_line_table_bytes{0};
+
+// DWARF constants used to decode line tables.
+enum : uint8_t {
+  kLnsCopy = 1,
+  kLnsAdvancePc = 2,
+  kLnsAdvanceLine = 3,
+  kLnsSetFile = 4,
+  kLnsConstAddPc = 8,
+  kLnsFixedAdvancePc = 9,
+  kLneEndSequence = 1,
+  kLneSetAddress = 2,
+  kLnctPath = 1,
+  kLnctDirectoryIndex = 2,
+  kFormBlock2 = 0x03,
+  kFormBlock4 = 0x04,
+  kFormData2 = 0x05,
+  kFormData4 = 0x06,
+  kFormData8 = 0x07,
+  kFormString = 0x08,
+  kFormBlock = 0x09,
+  kFormBlock1 = 0x0a,
+  kFormData1 = 0x0b,
+  kFormStrp = 0x0e,
+  kFormUdata = 0x0f,
+  kFormData16 = 0x1e,
+  kFormLineStrp = 0x1f,
+};
+
+// Reads DWARF data within bounds.  Reading past the end yields zeros and
+// makes ok() return false.
+class DwarfReader {
+ public:
+  DwarfReader(const char* data, const char* end) : data_{data}, end_{end} {}
+
+  const char* data() const { return data_; }
+  bool ok() const { return ok_; }
+  bool empty() const { return data_ == end_; }
+
+  template <typename T>
+  T Read() {
+    T value{};
+    if (sizeof(T) > Remaining()) {
+      Fail();
+    } else {
+      memcpy(&value, data_, sizeof(T));
+      data_ += sizeof(T);
+    }
+    return value;
+  }
+
+  uint64_t ReadULEB128() {
+    uint64_t value = 0;
+    for (unsigned shift = 0;; shift += 7) {
+      const auto byte = Read<uint8_t>();
+      if (shift < 64) {
+        value |= static_cast<uint64_t>(byte & 0x7FU) << shift;
+      }
+      if ((byte & 0x80U) == 0) {
+        return value;
+      }
+    }
+  }
+
+  int64_t ReadSLEB128() {
+    uint64_t value = 0;
+    for (unsigned shift = 0;; shift += 7) {
+      const auto byte = Read<uint8_t>();
+      if (shift < 64) {
+        value |= static_cast<uint64_t>(byte & 0x7FU) << shift;
+      }
+      if ((byte & 0x80U) == 0) {
+        if (shift + 7 < 64 && (byte & 0x40U) != 0) {
+          value |= ~uint64_t{0} << (shift + 7);
+        }
+        return static_cast<int64_t>(value);
+      }
+    }
+  }
+
+  uint64_t ReadOffset(bool dwarf64) {
+    return dwarf64 ? Read<uint64_t>() : Read<uint32_t>();
+  }
+
+  uint64_t ReadAddress(size_t size) {
+    if (size == 4) {
+      return Read<uint32_t>();
+    }
+    if (size == 8) {
+      return Read<uint64_t>();
+    }
+    Skip(size);
+    return 0;
+  }
+
+  // Returns the null-terminated string at the current position, or nullptr.
+  const char* ReadString() {
+    const void* end = memchr(data_, '\0', Remaining());
+    if (end == nullptr) {
+      Fail();
+      return nullptr;
+    }
+    const char* str = data_;
+    data_ = static_cast<const char*>(end) + 1;
+    return str;
+  }
+
+  void Skip(uint64_t size) {
+    if (size > Remaining()) {
+      Fail();
+    } else {
+      data_ += size;
+    }
+  }
+
+ private:
+  size_t Remaining() const { return static_cast<size_t>(end_ - data_); }
+  void Fail() {
+    ok_ = false;
+    data_ = end_;
+  }
+
+  const char* data_;
+  const char* end_;
+  bool ok_ = true;
+};
+
+// Returns the section |name| of the object file mapped at |image|, or nullptr.
+const ElfW(Shdr) * FindMappedSection(const char* image, size_t image_size,
+                                     const char* name) {
+  const auto* elf_header = reinterpret_cast<const ElfW(Ehdr)*>(image);
+  const ElfW(Shdr)* names =
+      GetMappedSection(image, image_size, elf_header->e_shstrndx);
+  if (names == nullptr || names->sh_type == SHT_NOBITS) {
+    return nullptr;
+  }
+  const size_t name_len = strlen(name);
+  for (size_t i = 0; i < elf_header->e_shnum; ++i) {
+    const ElfW(Shdr)* section = GetMappedSection(image, image_size, i);
+    if (section != nullptr && section->sh_name < names->sh_size &&
+        name_len < names->sh_size - section->sh_name &&
+        memcmp(image + names->sh_offset + section->sh_name, name,
+               name_len + 1) == 0) {
+      // Compressed sections are not supported.
+      if (section->sh_type == SHT_NOBITS ||
+          (section->sh_flags & SHF_COMPRESSED) != 0) {
+        return nullptr;
+      }
+      return section;
+    }
+  }
+  return nullptr;
+}
+
+// Returns the null-terminated string at |offset| of the object file mapped at
+// |image|, or nullptr if it is out of the bounds of the file.
+const char* GetMappedString(const char* image, size_t image_size,
+                            uint64_t offset) {
+  if (offset == 0 || offset >= image_size ||
+      memchr(image + offset, '\0', image_size - offset) == nullptr) {
+    return nullptr;
+  }
+  return image + offset;
+}
+
+struct DwarfSections {
+  const char* image;
+  const ElfW(Shdr) * line;
+  const ElfW(Shdr) * line_str;
+  const ElfW(Shdr) * str;
+};
+
+// Collects the files and rows of a line table.  Until the arrays of |table|
+// are allocated, only counts them.
+class LineTableBuilder {
+ public:
+  explicit LineTableBuilder(LineTable* table) : table_{table} {}
+
+  void AddFile(uint32_t directory, uint32_t name) {
+    if (table_->files != nullptr) {
+      table_->files[table_->num_files] = LineTable::File{directory, name};
+    }
+    ++table_->num_files;
+  }
+
+  // Rows at the same address replace each other, and the rows of sequences
+  // starting at address 0, which belong to code discarded by the linker, are
+  // dropped.
+  void AddRow(uint64_t address, uint32_t file, uint32_t line) {
+    if (!in_sequence_) {
+      in_sequence_ = true;
+      discard_sequence_ = address == 0;
+    }
+    if (discard_sequence_) {
+      return;
+    }
+    if (has_pending_row_ && pending_row_.address != address) {
+      Flush();
+    }
+    pending_row_ = LineTable::Row{address, file, line};
+    has_pending_row_ = true;
+  }
+
+  void EndSequence(uint64_t address) {
+    AddRow(address, 0, 0);
+    if (has_pending_row_) {
+      Flush();
+    }
+    in_sequence_ = false;
+  }
+
+  // Drops the rows of an unterminated sequence.
+  void Reset() {
+    has_pending_row_ = false;
+    in_sequence_ = false;
+  }
+
+ private:
+  void Flush() {
+    if (table_->rows != nullptr) {
+      table_->rows[table_->num_rows] = pending_row_;
+    }
+    ++table_->num_rows;
+    has_pending_row_ = false;
+  }
+
+  LineTable* table_;
+  LineTable::Row pending_row_{};
+  bool has_pending_row_ = false;
+  bool in_sequence_ = false;
+  bool discard_sequence_ = false;
+};
+
+// Reads an attribute of the form |form| from a directory or file entry of a
+// version 5 line table header into |value|.  For strings, |value| is set to
+// the offset of the string in the object file, or 0 if it is unavailable.
+// Returns false if the form is not supported.
+bool ReadEntryAttribute(DwarfReader& reader, uint64_t form, bool dwarf64,
+                        const DwarfSections& sections, uint64_t* value) {
+  *value = 0;
+  switch (form) {
+    case kFormString: {
+      const char* str = reader.ReadString();
+      if (str != nullptr) {
+        *value = static_cast<uint64_t>(str - sections.image);
+      }
+      return true;
+    }
+    case kFormLineStrp:
+    case kFormStrp: {
+      const uint64_t offset = reader.ReadOffset(dwarf64);
+      const ElfW(Shdr)* section =
+          form == kFormLineStrp ? sections.line_str : sections.str;
+      if (section != nullptr && offset < section->sh_size) {
+        *value = section->sh_offset + offset;
+      }
+      return true;
     }
+    case kFormData1:
+      *value = reader.Read<uint8_t>();
+      return true;
+    case kFormData2:
+      *value = reader.Read<uint16_t>();
+      return true;
+    case kFormData4:
+      *value = reader.Read<uint32_t>();
+      return true;
+    case kFormData8:
+      *value = reader.Read<uint64_t>();
+      return true;
+    case kFormUdata:
+      *value = reader.ReadULEB128();
+      return true;
+    case kFormData16:
+      reader.Skip(16);
+      return true;
+    case kFormBlock:
+      reader.Skip(reader.ReadULEB128());
+      return true;
+    case kFormBlock1:
+      reader.Skip(reader.Read<uint8_t>());
+      return true;
+    case kFormBlock2:
+      reader.Skip(reader.Read<uint16_t>());
+      return true;
+    case kFormBlock4:
+      reader.Skip(reader.Read<uint32_t>());
+      return true;
+    default:
+      return false;
+  }
+}
 
-    // Check flags.  We are only interested in "r*x" maps.
-    if (flags_start[0] != 'r' || flags_start[2] != 'x') {
-      continue;  // We skip this map.
+// Reads the directory or file entries of a version 5 line table header and
+// calls |callback(path, directory_index)| for each of them.
+template <typename Callback>
+bool ReadEntries(DwarfReader& reader, bool dwarf64,
+                 const DwarfSections& sections, Callback callback) {
+  const size_t kMaxFormats = 16;
+  uint64_t content_types[kMaxFormats];
+  uint64_t forms[kMaxFormats];
+  const auto num_formats = reader.Read<uint8_t>();
+  if (num_formats > kMaxFormats) {
+    return false;
+  }
+  for (size_t i = 0; i < num_formats; ++i) {
+    content_types[i] = reader.ReadULEB128();
+    forms[i] = reader.ReadULEB128();
+  }
+  const uint64_t count = reader.ReadULEB128();
+  for (uint64_t i = 0; i < count && reader.ok(); ++i) {
+    uint64_t path = 0;
+    uint64_t directory = 0;
+    for (size_t j = 0; j < num_formats; ++j) {
+      uint64_t value;
+      if (!ReadEntryAttribute(reader, forms[j], dwarf64, sections, &value)) {
+        return false;
+      }
+      if (content_types[j] == kLnctPath) {
+        path = value;
+      } else if (content_types[j] == kLnctDirectoryIndex) {
+        directory = value;
+      }
     }
-    ++cursor;  // Skip ' '.
+    callback(path, directory);
+  }
+  return reader.ok();
+}
 
-    // Read file offset.
-    uint64_t file_offset;
-    cursor = GetHex(cursor, eol, &file_offset);
-    if (cursor == eol || *cursor != ' ') {
-      return nullptr;  // Malformed line.
-    }
-    ++cursor;  // Skip ' '.
+// Decodes the line number program of one unit of .debug_line, from its header
+// on, into |builder|.
+void DecodeLineTableUnit(DwarfReader& unit, bool dwarf64,
+                         const DwarfSections& sections,
+                         LineTableBuilder& builder, LineTable& table) {
+  const auto version = unit.Read<uint16_t>();
+  if (version < 2 || version > 5) {
+    return;
+  }
+  if (version >= 5) {
+    unit.Read<uint8_t>();  // address_size
+    unit.Read<uint8_t>();  // segment_selector_size
+  }
+  const uint64_t header_length = unit.ReadOffset(dwarf64);
+  DwarfReader program = unit;
+  program.Skip(header_length);
+  const auto min_instruction_length = unit.Read<uint8_t>();
+  if (version >= 4) {
+    unit.Read<uint8_t>();  // maximum_operations_per_instruction
+  }
+  unit.Read<uint8_t>();  // default_is_stmt
+  const auto line_base = unit.Read<int8_t>();
+  const auto line_range = unit.Read<uint8_t>();
+  const auto opcode_base = unit.Read<uint8_t>();
+  const char* standard_opcode_lengths = unit.data();
+  unit.Skip(opcode_base > 0 ? opcode_base - 1U : 0U);
+  if (!unit.ok() || !program.ok() || line_range == 0 || opcode_base == 0) {
+    return;
+  }
 
-    // Skip to file name.  "cursor" now points to dev.  We need to
-    // skip at least two spaces for dev and inode.
-    int num_spaces = 0;
-    while (cursor < eol) {
-      if (*cursor == ' ') {
-        ++num_spaces;
-      } else if (num_spaces >= 2) {
-        // The first non-space character after skipping two spaces
-        // is the beginning of the file name.
+  // Directory 0 is the compilation directory, which is omitted to keep the
+  // file names short.
+  const size_t kMaxDirectories = 256;
+  uint32_t directories[kMaxDirectories] = {};
+  size_t num_directories = 0;
+  const size_t first_file = table.num_files;
+  auto add_file = [&](uint64_t path, uint64_t directory) {
+    builder.AddFile(directory != 0 && directory < num_directories
+                        ? directories[directory]
+                        : 0,
+                    static_cast<uint32_t>(path));
+  };
+  if (version >= 5) {
+    if (!ReadEntries(unit, dwarf64, sections,
+                     [&](uint64_t path, uint64_t /*directory*/) {
+                       if (num_directories < kMaxDirectories) {
+                         directories[num_directories++] =
+                             static_cast<uint32_t>(path);
+                       }
+                     }) ||
+        !ReadEntries(unit, dwarf64, sections, add_file)) {
+      return;
+    }
+  } else {
+    num_directories = 1;
+    for (const char* path; (path = unit.ReadString()) != nullptr && *path;) {
+      if (num_directories < kMaxDirectories) {
+        directories[num_directories++] =
+            static_cast<uint32_t>(path - sections.image);
+      }
+    }
+    for (const char* path; (path = unit.ReadString()) != nullptr && *path;) {
+      const uint64_t directory = unit.ReadULEB128();
+      unit.ReadULEB128();  // Modification time.
+      unit.ReadULEB128();  // File size.
+      add_file(static_cast<uint64_t>(path - sections.image), directory);
+    }
+  }
+  const size_t num_files = table.num_files - first_file;
+
+  // Run the line number program.  Files are numbered from 1 before version 5.
+  uint64_t address = 0;
+  uint64_t file = 1;
+  int64_t line = 1;
+  auto add_row = [&] {
+    const uint64_t index = version >= 5 ? file : file - 1;
+    builder.AddRow(
+        address,
+        index < num_files ? static_cast<uint32_t>(first_file + index)
+                          : std::numeric_limits<uint32_t>::max(),
+        line > 0 && line <= std::numeric_limits<uint32_t>::max()
+            ? static_cast<uint32_t>(line)
+            : 0);
+  };
+  while (!program.empty() && program.ok()) {
+    const auto opcode = program.Read<uint8_t>();
+    if (opcode >= opcode_base) {
+      const unsigned adjusted_opcode = opcode - opcode_base;
+      address += min_instruction_length * (adjusted_opcode / line_range);
+      line += line_base + static_cast<int>(adjusted_opcode % line_range);
+      add_row();
+      continue;
+    }
+    switch (opcode) {
+      case 0: {  // Extended opcode.
+        const uint64_t length = program.ReadULEB128();
+        DwarfReader operands = program;
+        program.Skip(length);
+        if (length == 0) {
+          break;
+        }
+        const auto extended_opcode = operands.Read<uint8_t>();
+        if (extended_opcode == kLneEndSequence) {
+          builder.EndSequence(address);
+          address = 0;
+          file = 1;
+          line = 1;
+        } else if (extended_opcode == kLneSetAddress) {
+          address = operands.ReadAddress(static_cast<size_t>(length - 1));
+        }
         break;
       }
-      ++cursor;
+      case kLnsCopy:
+        add_row();
+        break;
+      case kLnsAdvancePc:
+        address += min_instruction_length * program.ReadULEB128();
+        break;
+      case kLnsAdvanceLine:
+        line += program.ReadSLEB128();
+        break;
+      case kLnsSetFile:
+        file = program.ReadULEB128();
+        break;
+      case kLnsConstAddPc:
+        address += min_instruction_length * ((255U - opcode_base) / line_range);
+        break;
+      case kLnsFixedAdvancePc:
+        address += program.Read<uint16_t>();
+        break;
+      default:
+        // Skip the operands of the other standard opcodes.
+        for (uint8_t i = 0;
+             i < static_cast<uint8_t>(standard_opcode_lengths[opcode - 1]);
+             ++i) {
+          program.ReadULEB128();
+        }
+        break;
     }
-    if (cursor == eol) {
-      return nullptr;  // Malformed line.
+  }
+  builder.Reset();
+}
+
+// Decodes all units of the .debug_line section into |table|.
+void DecodeLineTable(const DwarfSections& sections, LineTable& table) {
+  LineTableBuilder builder{&table};
+  const char* data = sections.image + sections.line->sh_offset;
+  DwarfReader reader{data, data + sections.line->sh_size};
+  while (!reader.empty()) {
+    uint64_t unit_length = reader.Read<uint32_t>();
+    const bool dwarf64 = unit_length == 0xffffffff;
+    if (dwarf64) {
+      unit_length = reader.Read<uint64_t>();
     }
+    DwarfReader unit = reader;
+    reader.Skip(unit_length);
+    if (!reader.ok()) {
+      return;
+    }
+    DwarfReader unit_data{unit.data(), reader.data()};
+    DecodeLineTableUnit(unit_data, dwarf64, sections, builder, table);
+  }
+}
 
-    strncpy(out_file_name, cursor, out_file_name_size);
-    // Making sure |out_file_name| is always null-terminated.
-    out_file_name[out_file_name_size - 1] = '\0';
+size_t LineTableBytes(const LineTable& table) {
+  return table.num_rows * sizeof(LineTable::Row) +
+         table.num_files * sizeof(LineTable::File);
+}
 
-    // Finally, "cursor" now points to file name of our interest.
-    return FileDescriptor{
-        FailureRetry([cursor] { return open(cursor, O_RDONLY); })};
+// Decodes the line table of the object file mapped at |image| into |table|.
+// Returns false if the object file has no line table, or the line table does
+// not fit into the remaining memory budget.
+bool BuildLineTable(const char* image, size_t image_size, LineTable* table) {
+  *table = LineTable{};
+  if (!HasMappedSectionHeaders(image, image_size)) {
+    return false;
+  }
+  DwarfSections sections{
+      image, FindMappedSection(image, image_size, ".debug_line"),
+      FindMappedSection(image, image_size, ".debug_line_str"),
+      FindMappedSection(image, image_size, ".debug_str")};
+  if (sections.line == nullptr) {
+    return false;
+  }
+  // Count the rows and files first to allocate the table at its exact size.
+  DecodeLineTable(sections, *table);
+  const size_t num_rows = table->num_rows;
+  const size_t num_files = table->num_files;
+  const size_t size = LineTableBytes(*table);
+  *table = LineTable{};
+  if (num_rows == 0 ||
+      g_line_table_bytes.fetch_add(size, std::memory_order_relaxed) + size >
+          kMaxLineTableBytes) {
+    g_line_table_bytes.fetch_sub(size, std::memory_order_relaxed);
+    return false;
   }
+  void* memory = AllocateCacheMemory(size);
+  if (memory == nullptr) {
+    g_line_table_bytes.fetch_sub(size, std::memory_order_relaxed);
+    return false;
+  }
+  table->rows = static_cast<LineTable::Row*>(memory);
+  table->files = reinterpret_cast<LineTable::File*>(table->rows + num_rows);
+  DecodeLineTable(sections, *table);
+  GLOG_SAFE_ASSERT(table->num_rows == num_rows &&
+                   table->num_files == num_files);
+  // Where sequences meet, the row ending one sequence sorts before the row
+  // starting the next one.
+  std::sort(table->rows, table->rows + table->num_rows,
+            [](const LineTable::Row& lhs, const LineTable::Row& rhs) {
+              return lhs.address < rhs.address ||
+                     (lhs.address == rhs.address && lhs.line == 0 &&
+                      rhs.line != 0);
+            });
+  return true;
 }
 
-// POSIX doesn't define any async-signal safe function for converting
-// an integer to ASCII. We'll have to define our own version.
-// itoa_r() converts an (unsigned) integer to ASCII. It returns "buf", if the
-// conversion was successful or nullptr otherwise. It never writes more than
-// "sz" bytes. Output will be truncated as needed, and a NUL character is always
-// appended.
-// NOTE: code from sandbox/linux/seccomp-bpf/demo.cc.
-static char* itoa_r(uintptr_t i, char* buf, size_t sz, unsigned base,
-                    size_t padding) {
-  // Make sure we can write at least one NUL byte.
-  size_t n = 1;
-  if (n > sz) {
-    return nullptr;
+void FreeLineTable(LineTable* table) {
+  if (table->rows != nullptr) {
+    const size_t size = LineTableBytes(*table);
+    munmap(table->rows, size);
+    g_line_table_bytes.fetch_sub(size, std::memory_order_relaxed);
   }
+  *table = LineTable{};
+}
 
-  if (base < 2 || base > 16) {
-    buf[0] = '\000';
-    return nullptr;
+// Appends " (<file>:<line>)" for the address |address| of the object file
+// mapped at |image| to |out|, if the line table |table| covers it and the
+// source line fits.  Returns true on success.
+bool AppendSourceLine(const char* image, size_t image_size,
+                      const LineTable& table, uint64_t address, char* out,
+                      size_t out_size) {
+  const LineTable::Row* row = std::upper_bound(
+      table.rows, table.rows + table.num_rows, address,
+      [](uint64_t value, const LineTable::Row& row) {
+        return value < row.address;
+      });
+  if (row == table.rows || (--row)->line == 0 ||
+      row->file >= table.num_files) {
+    return false;
   }
+  const LineTable::File& file = table.files[row->file];
+  const char* name = GetMappedString(image, image_size, file.name);
+  if (name == nullptr) {
+    return false;
+  }
+  const char* directory =
+      name[0] != '/' ? GetMappedString(image, image_size, file.directory)
+                     : nullptr;
+  char line[11];
+  itoa_r(row->line, line, sizeof(line), 10, 0);
+  const size_t len = strlen(out) + sizeof(" (:)") - 1 +
+                     (directory != nullptr ? strlen(directory) + 1 : 0) +
+                     strlen(name) + strlen(line);
+  if (len >= out_size) {
+    return false;
+  }
+  SafeAppendString(" (", out, out_size);
+  if (directory != nullptr) {
+    SafeAppendString(directory, out, out_size);
+    SafeAppendString("/", out, out_size);
+  }
+  SafeAppendString(name, out, out_size);
+  SafeAppendString(":", out, out_size);
+  SafeAppendString(line, out, out_size);
+  SafeAppendString(")", out, out_size);
+  return true;
+}
 
-  char* start = buf;
-
-  // Loop until we have converted the entire number. Output at least one
-  // character (i.e. '0').
-  char* ptr = start;
-  do {
-    // Make sure there is still enough space left in our output buffer.
-    if (++n > sz) {
-      buf[0] = '\000';
-      return nullptr;
-    }
+// Builds the line table of |object| unless done already.  Returns true if the
+// line table can be used.
+bool EnsureLineTable(CachedObject* object) {
+  int state = object->line_state.load(std::memory_order_acquire);
+  if (state == kIndexReady) {
+    return true;
+  }
+  // The line table refers to the object file mapped by the symbol index.
+  if (state != kIndexUnbuilt || !EnsureSymbolIndex(object) ||
+      !object->line_state.compare_exchange_strong(state, kIndexBuilding,
+                                                  std::memory_order_acquire)) {
+    return false;
+  }
+  if (!BuildLineTable(object->image, object->image_size, &object->lines)) {
+    object->line_state.store(kIndexFailed, std::memory_order_release);
+    return false;
+  }
+  object->line_state.store(kIndexReady, std::memory_order_release);
+  return true;
+}
 
-    // Output the next digit.
-    *ptr++ = "0123456789abcdef"[i % base];
-    i /= base;
+// Appends the source file and line of |pc| to |out| from the line table of
+// the object file containing it.  Returns true on success.
+bool AppendSourceLineFromCache(uint64_t pc, char* out, size_t out_size) {
+  const CachedMapping* mapping = FindCachedMapping(pc);
+  if (mapping == nullptr || !EnsureLineTable(mapping->object)) {
+    return false;
+  }
+  const CachedObject* object = mapping->object;
+  return AppendSourceLine(object->image, object->image_size, object->lines,
+                          pc - mapping->base_address, out, out_size);
+}
 
-    if (padding > 0) {
-      padding--;
-    }
-  } while (i > 0 || padding > 0);
+// Returns true if symbol names are followed by source lines.  Source lines are
+// looked up in the module map, which does not apply with callbacks installed.
+bool WantSourceLines(SymbolizeOptions options) {
+  return FLAGS_symbolize_line_numbers &&
+         (options & SymbolizeOptions::kNoLineNumbers) !=
+             SymbolizeOptions::kNoLineNumbers &&
+         !g_symbolize_open_object_file_callback && !g_symbolize_callback;
+}
 
-  // Terminate the output with a NUL character.
-  *ptr = '\000';
+}  // namespace
 
-  // Conversion to ASCII actually resulted in the digits being in reverse
-  // order. We can't easily generate them in forward order, as we can't tell
-  // the number of characters needed until we are done converting.
-  // So, now, we reverse the string (except for the possible "-" sign).
-  while (--ptr > start) {
-    char ch = *ptr;
-    *ptr = *start;
-    *start++ = ch;
+void PrepareSymbolizeCache() {
+  if (!FLAGS_symbolize_cache && !FLAGS_symbolize_line_numbers) {
+    return;
+  }
+  const ModuleMap* map = GetModuleMap();
+  if (map == nullptr) {
+    return;
+  }
+  for (size_t i = 0; i < map->num_mappings; ++i) {
+    CachedObject* object = map->mappings[i].object;
+    if (FLAGS_symbolize_line_numbers) {
+      EnsureLineTable(object);
+    } else {
+      EnsureSymbolIndex(object);
+    }
   }
-  return buf;
 }
 
-// Safely appends string |source| to string |dest|.  Never writes past the
-// buffer size |dest_size| and guarantees that |dest| is null-terminated.
-static void SafeAppendString(const char* source, char* dest, size_t dest_size) {
-  size_t dest_string_length = strlen(dest);
-  GLOG_SAFE_ASSERT(dest_string_length < dest_size);
-  dest += dest_string_length;
-  dest_size -= dest_string_length;
-  strncpy(dest, source, dest_size);
-  // Making sure |dest| is always null-terminated.
-  dest[dest_size - 1] = '\0';
+void EnterSignalSafeSymbolization() {
+  g_signal_safe_symbolizations.fetch_add(1, std::memory_order_relaxed);
 }
 
-// Converts a 64-bit value into a hex string, and safely appends it to |dest|.
-// Never writes past the buffer size |dest_size| and guarantees that |dest| is
-// null-terminated.
-static void SafeAppendHexNumber(uint64_t value, char* dest, size_t dest_size) {
-  // 64-bit numbers in hex can have up to 16 digits.
-  char buf[17] = {'\0'};
-  SafeAppendString(itoa_r(value, buf, sizeof(buf), 16, 0), dest, dest_size);
+void LeaveSignalSafeSymbolization() {
+  g_signal_safe_symbolizations.fetch_sub(1, std::memory_order_relaxed);
 }
 
 // The implementation of our symbolization routine.  If it
@@ -738,7 +2122,7 @@ static void SafeAppendHexNumber(uint64_t value, char* dest, size_t dest_size) {
 // To keep stack consumption low, we would like this function to not
 // get inlined.
 static ATTRIBUTE_NOINLINE bool SymbolizeAndDemangle(
-    void* pc, char* out, size_t out_size, SymbolizeOptions /*options*/) {
+    void* pc, char* out, size_t out_size, SymbolizeOptions options) {
   auto pc0 = reinterpret_cast<uintptr_t>(pc);
   uint64_t start_address = 0;
   uint64_t base_address = 0;
@@ -747,6 +2131,15 @@ static ATTRIBUTE_NOINLINE bool SymbolizeAndDemangle(
   if (out_size < 1) {
     return false;
   }
+  if (FLAGS_symbolize_cache && !g_symbolize_open_object_file_callback &&
+      !g_symbolize_callback && SymbolizeFromCache(pc0, out, out_size)) {
+    // Symbolization succeeded.  Now we try to demangle the symbol.
+    DemangleInplace(out, out_size);
+    if (WantSourceLines(options)) {
+      AppendSourceLineFromCache(pc0, out, out_size);
+    }
+    return true;
+  }
   out[0] = '\0';
   SafeAppendString("(", out, out_size);
 
@@ -794,8 +2187,13 @@ static ATTRIBUTE_NOINLINE bool SymbolizeAndDemangle(
       out_size -= static_cast<size_t>(num_bytes_written);
     }
   }
+  // Unless a callback wrote to it, |out| still holds the object file name
+  // after the opening parenthesis.
   if (!GetSymbolFromObjectFile(object_fd.get(), pc0, out, out_size,
-                               base_address)) {
+                               base_address) &&
+      (g_symbolize_callback ||
+       !GetSymbolFromDebugFile(object_fd.get(), out + 1, pc0, out, out_size,
+                               base_address))) {
     if (out[1] && !g_symbolize_callback) {
       // The object file containing PC was opened successfully however the
       // symbol was not found. The object may have been stripped. This is still
@@ -812,9 +2210,269 @@ static ATTRIBUTE_NOINLINE bool SymbolizeAndDemangle(
 
   // Symbolization succeeded.  Now we try to demangle the symbol.
   DemangleInplace(out, out_size);
+  if (WantSourceLines(options)) {
+    AppendSourceLineFromCache(pc0, out, out_size);
+  }
+  return true;
+}
+
+// Maximum number of program counters that SymbolizeBatchFromObjectFiles()
+// resolves in one pass over /proc/self/maps.
+const size_t kMaxBatchSize = 64;
+
+// Looks up the symbols containing the sorted program counters |pcs| in a
+// single pass over the symbol table |symtab|.  For each pc not resolved yet,
+// stores the file offset of the name of the first containing symbol into
+// |name_offsets| (0 means unresolved).
+static ATTRIBUTE_NOINLINE void FindSymbols(const uint64_t* pcs, size_t num_pcs,
+                                           const int fd,
+                                           uint64_t symbol_offset,
+                                           const ElfW(Shdr) & strtab,
+                                           const ElfW(Shdr) & symtab,
+                                           uint64_t* name_offsets) {
+  const size_t num_symbols = symtab.sh_size / symtab.sh_entsize;
+  for (size_t i = 0; i < num_symbols;) {
+    ElfW(Sym) buf[32];
+    const size_t num_symbols_to_read =
+        std::min(sizeof(buf) / sizeof(buf[0]), num_symbols - i);
+    const ssize_t len =
+        ReadFromOffset(fd, &buf, sizeof(buf[0]) * num_symbols_to_read,
+                       symtab.sh_offset + i * symtab.sh_entsize);
+    if (len <= 0 || static_cast<size_t>(len) % sizeof(buf[0]) != 0) {
+      return;
+    }
+    const size_t num_symbols_in_buf = static_cast<size_t>(len) / sizeof(buf[0]);
+    for (size_t j = 0; j < num_symbols_in_buf; ++j) {
+      const ElfW(Sym)& symbol = buf[j];
+      if (symbol.st_value == 0 || symbol.st_shndx == 0 ||
+          ELF32_ST_TYPE(symbol.st_info) == STT_TLS) {
+        continue;  // Skip null value, undefined and thread-local symbols.
+      }
+      const uint64_t start_address = symbol.st_value + symbol_offset;
+      const uint64_t end_address = start_address + symbol.st_size;
+      for (size_t k = static_cast<size_t>(
+               std::lower_bound(pcs, pcs + num_pcs, start_address) - pcs);
+           k < num_pcs && pcs[k] < end_address; ++k) {
+        if (name_offsets[k] == 0) {
+          name_offsets[k] = strtab.sh_offset + symbol.st_name;
+        }
+      }
+    }
+    i += num_symbols_in_buf;
+  }
+}
+
+// Resolves up to kMaxBatchSize program counters, opening every object file
+// containing some of them once.  Symbol names are written one after another
+// to |out|; see SymbolizeBatch().
+static ATTRIBUTE_NOINLINE int SymbolizeBatchFromObjectFiles(
+    void* const* pcs, int n, char*& out, size_t& out_size, const char** symbols,
+    SymbolizeOptions options) {
+  // Sort the program counters so that those of one object file are adjacent.
+  size_t order[kMaxBatchSize];
+  uint64_t sorted_pcs[kMaxBatchSize];
+  const auto num_pcs = static_cast<size_t>(n);
+  for (size_t i = 0; i < num_pcs; ++i) {
+    symbols[i] = nullptr;
+    order[i] = i;
+  }
+  std::sort(order, order + num_pcs, [pcs](size_t lhs, size_t rhs) {
+    return pcs[lhs] < pcs[rhs];
+  });
+  for (size_t i = 0; i < num_pcs; ++i) {
+    sorted_pcs[i] = reinterpret_cast<uintptr_t>(pcs[order[i]]);
+  }
+
+  int num_symbolized = 0;
+  ForEachExecutableMapping([&](uint64_t start_address, uint64_t end_address,
+                               uint64_t base_address, const char* file_name) {
+    const size_t first = static_cast<size_t>(
+        std::lower_bound(sorted_pcs, sorted_pcs + num_pcs, start_address) -
+        sorted_pcs);
+    const size_t last = static_cast<size_t>(
+        std::lower_bound(sorted_pcs, sorted_pcs + num_pcs, end_address) -
+        sorted_pcs);
+    if (first == last) {
+      return false;  // None of the program counters is in this map.
+    }
+
+    uint64_t name_offsets[kMaxBatchSize] = {};
+    FileDescriptor object_fd{
+        FailureRetry([file_name] { return open(file_name, O_RDONLY); })};
+    if (object_fd && FileGetElfType(object_fd.get()) == -1) {
+      return last == num_pcs;  // Not an object file we can symbolize.
+    }
+    if (object_fd) {
+      // Read the symbols of a stripped object file from its debug file.
+      FileDescriptor debug_fd = OpenDebugFile(object_fd.get(), file_name);
+      if (debug_fd) {
+        object_fd = std::move(debug_fd);
+      }
+    }
+    ElfW(Ehdr) elf_header;
+    if (object_fd && ReadFromOffsetExact(object_fd.get(), &elf_header,
+                                         sizeof(elf_header), 0)) {
+      // Consult a regular symbol table first, then a dynamic one.
+      for (ElfW(Word) type : {SHT_SYMTAB, SHT_DYNSYM}) {
+        ElfW(Shdr) symtab, strtab;
+        if (GetSectionHeaderByType(object_fd.get(), elf_header.e_shnum,
+                                   elf_header.e_shoff, type, &symtab) &&
+            symtab.sh_entsize != 0 &&
+            ReadFromOffsetExact(
+                object_fd.get(), &strtab, sizeof(strtab),
+                elf_header.e_shoff + symtab.sh_link * sizeof(symtab))) {
+          FindSymbols(sorted_pcs + first, last - first, object_fd.get(),
+                      base_address, strtab, symtab, name_offsets + first);
+        }
+      }
+    }
+
+    for (size_t i = first; i < last && out_size > 1; ++i) {
+      out[0] = '\0';
+      if (name_offsets[i] != 0) {
+        const ssize_t len =
+            ReadFromOffset(object_fd.get(), out, out_size, name_offsets[i]);
+        if (len <= 0 ||
+            memchr(out, '\0', static_cast<size_t>(len)) == nullptr) {
+          out[0] = '\0';
+        } else {
+          DemangleInplace(out, out_size);
+          if (WantSourceLines(options)) {
+            AppendSourceLineFromCache(sorted_pcs[i], out, out_size);
+          }
+        }
+      }
+      if (out[0] == '\0') {
+        // As in SymbolizeAndDemangle(), fall back to the object file name and
+        // offset which tools like asan_symbolize.py can symbolize.
+        SafeAppendString("(", out, out_size);
+        SafeAppendString(file_name, out, out_size);
+        SafeAppendString("+0x", out, out_size);
+        SafeAppendHexNumber(sorted_pcs[i] - base_address, out, out_size);
+        SafeAppendString(")", out, out_size);
+      }
+      symbols[order[i]] = out;
+      ++num_symbolized;
+      const size_t len = strlen(out) + 1;
+      out += len;
+      out_size -= len;
+    }
+    return last == num_pcs;  // Stop after the last program counter.
+  });
+  return num_symbolized;
+}
+
+void WriteModuleMap(void* const* pcs, int n, ModuleMapWriter* writer,
+                    void* arg) {
+  writer("*** Module map (symbolize offline with glog_symbolize): ***\n", arg);
+  ForEachExecutableMapping([pcs, n, writer, arg](
+                               uint64_t start_address, uint64_t end_address,
+                               uint64_t base_address, const char* file_name) {
+    bool contains_pc = false;
+    for (int i = 0; i < n && !contains_pc; ++i) {
+      const auto pc = reinterpret_cast<uintptr_t>(pcs[i]);
+      contains_pc = start_address <= pc && pc < end_address;
+    }
+    if (!contains_pc) {
+      return false;
+    }
+    // A missing build-id is written as "-".
+    char build_id[129] = "-";
+    FileDescriptor object_fd{
+        FailureRetry([file_name] { return open(file_name, O_RDONLY); })};
+    if (object_fd) {
+      GetBuildIdFromObjectFile(object_fd.get(), build_id, sizeof(build_id));
+    }
+    char line[1024];
+    line[0] = '\0';
+    SafeAppendString("    module 0x", line, sizeof(line));
+    SafeAppendHexNumber(start_address, line, sizeof(line));
+    SafeAppendString("-0x", line, sizeof(line));
+    SafeAppendHexNumber(end_address, line, sizeof(line));
+    SafeAppendString(" base 0x", line, sizeof(line));
+    SafeAppendHexNumber(base_address, line, sizeof(line));
+    SafeAppendString(" build-id ", line, sizeof(line));
+    SafeAppendString(build_id, line, sizeof(line));
+    SafeAppendString(" ", line, sizeof(line));
+    SafeAppendString(file_name, line, sizeof(line));
+    SafeAppendString("\n", line, sizeof(line));
+    writer(line, arg);
+    return false;
+  });
+}
+
+bool GetObjectFileBuildId(const char* file_name, char* out, size_t out_size) {
+  FileDescriptor object_fd{
+      FailureRetry([file_name] { return open(file_name, O_RDONLY); })};
+  return object_fd &&
+         GetBuildIdFromObjectFile(object_fd.get(), out, out_size);
+}
+
+bool SymbolizeObjectFileAddress(const char* file_name, uint64_t pc,
+                                uint64_t base_address, char* out,
+                                size_t out_size) {
+  FileDescriptor object_fd{
+      FailureRetry([file_name] { return open(file_name, O_RDONLY); })};
+  if (!object_fd || out_size < 1 || FileGetElfType(object_fd.get()) == -1 ||
+      (!GetSymbolFromObjectFile(object_fd.get(), pc, out, out_size,
+                                base_address) &&
+       !GetSymbolFromDebugFile(object_fd.get(), file_name, pc, out, out_size,
+                               base_address))) {
+    return false;
+  }
+  DemangleInplace(out, out_size);
   return true;
 }
 
+ObjectFileLineTable::ObjectFileLineTable(const char* file_name) {
+  FileDescriptor fd{
+      FailureRetry([file_name] { return open(file_name, O_RDONLY); })};
+  if (!fd || FileGetElfType(fd.get()) == -1) {
+    return;
+  }
+  FileDescriptor debug_fd = OpenDebugFile(fd.get(), file_name);
+  if (debug_fd) {
+    fd = std::move(debug_fd);
+  }
+  // As in the module map, string offsets are 32 bits wide.
+  struct stat file_stat;
+  if (fstat(fd.get(), &file_stat) != 0 ||
+      static_cast<size_t>(file_stat.st_size) < sizeof(ElfW(Ehdr)) ||
+      static_cast<uint64_t>(file_stat.st_size) >
+          std::numeric_limits<uint32_t>::max()) {
+    return;
+  }
+  void* image = mmap(nullptr, static_cast<size_t>(file_stat.st_size),
+                     PROT_READ, MAP_PRIVATE, fd.get(), 0);
+  if (image == MAP_FAILED) {
+    return;
+  }
+  image_ = static_cast<const char*>(image);
+  image_size_ = static_cast<size_t>(file_stat.st_size);
+  lines_ = new LineTable;
+  if (!BuildLineTable(image_, image_size_, lines_)) {
+    delete lines_;
+    lines_ = nullptr;
+  }
+}
+
+ObjectFileLineTable::~ObjectFileLineTable() {
+  if (lines_ != nullptr) {
+    FreeLineTable(lines_);
+    delete lines_;
+  }
+  if (image_ != nullptr) {
+    munmap(const_cast<char*>(image_), image_size_);
+  }
+}
+
+bool ObjectFileLineTable::AppendSourceLine(uint64_t pc, uint64_t base_address,
+                                           char* out, size_t out_size) const {
+  return lines_ != nullptr &&
+         google::AppendSourceLine(image_, image_size_, *lines_,
+                                  pc - base_address, out, out_size);
+}
+
 }  // namespace glog_internal_namespace_
 }  // namespace google
 
@@ -957,6 +2615,43 @@ bool Symbolize(void* pc, char* out, size_t out_size, SymbolizeOptions options) {
   return SymbolizeAndDemangle(pc, out, out_size, options);
 }
 
+int SymbolizeBatch(void* const* pcs, int n, char* out, size_t out_size,
+                   const char** symbols, SymbolizeOptions options) {
+  int num_symbolized = 0;
+#  if defined(HAVE_LINK_H)
+  // With the cache or callbacks in place, symbolize one by one.
+  if (!FLAGS_symbolize_cache && !g_symbolize_open_object_file_callback &&
+      !g_symbolize_callback) {
+    for (int i = 0; i < n; i += static_cast<int>(kMaxBatchSize)) {
+      num_symbolized += SymbolizeBatchFromObjectFiles(
+          pcs + i, std::min(n - i, static_cast<int>(kMaxBatchSize)), out,
+          out_size, symbols + i, options);
+    }
+    return num_symbolized;
+  }
+#  endif
+  for (int i = 0; i < n; ++i) {
+    symbols[i] = nullptr;
+    if (out_size > 1 && Symbolize(pcs[i], out, out_size, options)) {
+      symbols[i] = out;
+      ++num_symbolized;
+      const size_t len = strlen(out) + 1;
+      out += len;
+      out_size -= len;
+    }
+  }
+  return num_symbolized;
+}
+
+#  if !defined(HAVE_LINK_H)
+void PrepareSymbolizeCache() {}
+void EnterSignalSafeSymbolization() {}
+void LeaveSignalSafeSymbolization() {}
+
+void WriteModuleMap(void* const* /*pcs*/, int /*n*/,
+                    ModuleMapWriter* /*writer*/, void* /*arg*/) {}
+#  endif
+
 }  // namespace glog_internal_namespace_
 }  // namespace google
 
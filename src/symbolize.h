@@ -124,6 +124,42 @@ GLOG_NO_EXPORT
 bool GetSectionHeaderByName(int fd, const char* name, size_t name_len,
                             ElfW(Shdr) * out);
 
+// Writes the GNU build-id of the object file |file_name| as a hexadecimal
+// string to |out|.  Returns true on success.
+GLOG_NO_EXPORT
+bool GetObjectFileBuildId(const char* file_name, char* out, size_t out_size);
+
+// Symbolizes |pc| in the object file |file_name| loaded at |base_address|,
+// which need not be mapped into the current process.  Used for offline
+// symbolization of the output of --symbolize_offline.
+GLOG_NO_EXPORT
+bool SymbolizeObjectFileAddress(const char* file_name, uint64_t pc,
+                                uint64_t base_address, char* out,
+                                size_t out_size);
+
+struct LineTable;
+
+// The DWARF line table of the object file |file_name|, or of its separate
+// debug file, decoded once for symbolizing many addresses offline.
+class GLOG_NO_EXPORT ObjectFileLineTable final {
+ public:
+  explicit ObjectFileLineTable(const char* file_name);
+  ~ObjectFileLineTable();
+
+  ObjectFileLineTable(const ObjectFileLineTable&) = delete;
+  ObjectFileLineTable& operator=(const ObjectFileLineTable&) = delete;
+
+  // Appends " (<file>:<line>)" for |pc| of the object file loaded at
+  // |base_address| to |out|.  Returns true on success.
+  bool AppendSourceLine(uint64_t pc, uint64_t base_address, char* out,
+                        size_t out_size) const;
+
+ private:
+  const char* image_ = nullptr;
+  size_t image_size_ = 0;
+  LineTable* lines_ = nullptr;
+};
+
 }  // namespace glog_internal_namespace_
 }  // namespace google
 
@@ -202,6 +238,41 @@ GLOG_NO_EXPORT bool Symbolize(
     void* pc, char* out, size_t out_size,
     SymbolizeOptions options = SymbolizeOptions::kNone);
 
+// Symbolizes the |n| program counters in |pcs| at once, which is faster than
+// calling Symbolize() for each of them because every object file is opened
+// and its symbol table read only once.  The symbol names are written one after
+// another to |out| and symbols[i] is set to the name of pcs[i], or nullptr if
+// it could not be symbolized or |out| ran out of space.  Returns the number of
+// symbolized program counters.
+GLOG_NO_EXPORT int SymbolizeBatch(
+    void* const* pcs, int n, char* out, size_t out_size, const char** symbols,
+    SymbolizeOptions options = SymbolizeOptions::kNone);
+
+// Writes a line of the form
+//
+//     module 0x<start>-0x<end> base 0x<base> build-id <hex> <path>
+//
+// for each executable mapping containing one of the |n| program counters in
+// |pcs|, after a header line.  glog_symbolize resolves program counters
+// offline from these lines.  The writer receives '\0'-terminated lines.  This
+// function is async-signal-safe.
+using ModuleMapWriter = void(const char* data, void* arg);
+GLOG_NO_EXPORT void WriteModuleMap(void* const* pcs, int n,
+                                   ModuleMapWriter* writer, void* arg);
+
+// Builds the module map and symbol indexes used by Symbolize() when
+// --symbolize_cache is set, so that later calls, e.g., from a signal handler,
+// need not allocate memory.  Does nothing if the flag is not set or the cache
+// is not supported on this platform.
+GLOG_NO_EXPORT void PrepareSymbolizeCache();
+
+// Symbolize() checks whether object files have been loaded or unloaded since
+// the module map of --symbolize_cache was built, which is not
+// async-signal-safe.  Signal handlers call Symbolize() between these two
+// functions to use the module map as it is instead.
+GLOG_NO_EXPORT void EnterSignalSafeSymbolization();
+GLOG_NO_EXPORT void LeaveSignalSafeSymbolization();
+
 #endif  // defined(HAVE_SYMBOLIZE)
 
 }  // namespace glog_internal_namespace_
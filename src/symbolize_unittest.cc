@@ -33,15 +33,28 @@
 
 #include "symbolize.h"
 
+#include <algorithm>
+#include <cctype>
 #include <csignal>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <random>
+#include <vector>
 
 #include "config.h"
+#include "demangle.h"
 #include "glog/logging.h"
 #include "googletest.h"
 #include "utilities.h"
 #include "stacktrace.h"
 
+#ifdef HAVE_DLFCN_H
+#  include <dlfcn.h>
+#  include <fcntl.h>
+#endif
+
 #ifdef GLOG_USE_GFLAGS
 #  include <gflags/gflags.h>
 using namespace GFLAGS_NAMESPACE;
@@ -157,6 +170,447 @@ TEST(Symbolize, SymbolizeWithDemangling) {
 }
 #    endif
 
+#    if defined(HAVE_DLFCN_H)
+static int CountOpenFiles() {
+  int count = 0;
+  for (int fd = 0; fd < 1024; ++fd) {
+    count += fcntl(fd, F_GETFD) != -1;
+  }
+  return count;
+}
+
+TEST(Symbolize, SymbolizeWithCacheAfterDlclose) {
+  void* handle = dlopen("libz.so.1", RTLD_NOW | RTLD_LOCAL);
+  if (handle == nullptr) {
+    return;  // zlib is not installed.
+  }
+  void* pc = dlsym(handle, "zlibVersion");
+  ASSERT_TRUE(pc != nullptr);
+  const int num_open_files = CountOpenFiles();
+  FLAGS_symbolize_cache = true;
+  PrepareSymbolizeCache();
+  // The object files are closed once indexed.
+  EXPECT_EQ(num_open_files, CountOpenFiles());
+  EXPECT_STREQ("zlibVersion", TrySymbolize(pc));
+  // The module map forgets the object files unloaded since it was built.
+  dlclose(handle);
+  EXPECT_TRUE(TrySymbolize(pc) == nullptr);
+  // And covers those loaded since.
+  handle = dlopen("libz.so.1", RTLD_NOW | RTLD_LOCAL);
+  ASSERT_TRUE(handle != nullptr);
+  pc = dlsym(handle, "zlibVersion");
+  EXPECT_STREQ("zlibVersion", TrySymbolize(pc));
+  EXPECT_EQ(num_open_files, CountOpenFiles());
+  dlclose(handle);
+  FLAGS_symbolize_cache = false;
+}
+#    endif
+
+TEST(Symbolize, SymbolizeWithCache) {
+  void* const pcs[] = {
+      reinterpret_cast<void*>(&nonstatic_func),
+      reinterpret_cast<void*>(&static_func),
+      reinterpret_cast<char*>(&Foo::func) + 1,
+      reinterpret_cast<void*>(&TrySymbolize),
+      reinterpret_cast<void*>(&strlen),
+      nullptr,
+  };
+  string uncached[ARRAYSIZE(pcs)];
+  for (size_t i = 0; i < ARRAYSIZE(pcs); ++i) {
+    const char* symbol = TrySymbolize(pcs[i]);
+    uncached[i] = symbol ? symbol : "(null)";
+  }
+
+  FLAGS_symbolize_cache = true;
+  PrepareSymbolizeCache();
+  for (size_t i = 0; i < ARRAYSIZE(pcs); ++i) {
+    const char* symbol = TrySymbolize(pcs[i]);
+    EXPECT_EQ(uncached[i], symbol ? symbol : "(null)");
+  }
+  FLAGS_symbolize_cache = false;
+}
+
+TEST(Symbolize, DemangleWithCache) {
+  char expected[256];
+  char demangled[256];
+  for (int i = 0; i < 2; ++i) {
+    EXPECT_TRUE(DemangleWithCache("_Z6foobarv", demangled, sizeof(demangled)));
+    EXPECT_STREQ("foobar()", demangled);
+    // Not enough space, whether the name is cached or not.
+    EXPECT_FALSE(DemangleWithCache("_Z6foobarv", demangled,
+                                   sizeof("foobar()") - 1));
+    EXPECT_FALSE(DemangleWithCache("foobar", demangled, sizeof(demangled)));
+  }
+  // More names than the cache holds, twice.
+  for (int i = 0; i < 2; ++i) {
+    for (int j = 0; j < 1000; ++j) {
+      const string name = "f" + std::to_string(j);
+      const string mangled =
+          "_ZN3Foo" + std::to_string(name.size()) + name + "Ev";
+      ASSERT_TRUE(Demangle(mangled.c_str(), expected, sizeof(expected)));
+      ASSERT_TRUE(
+          DemangleWithCache(mangled.c_str(), demangled, sizeof(demangled)));
+      EXPECT_STREQ(expected, demangled);
+    }
+  }
+}
+
+TEST(Symbolize, SymbolizeBatch) {
+  void* const pcs[] = {
+      reinterpret_cast<void*>(&TrySymbolize),
+      reinterpret_cast<void*>(&nonstatic_func),
+      nullptr,
+      reinterpret_cast<char*>(&Foo::func) + 1,
+      reinterpret_cast<void*>(&strlen),
+      reinterpret_cast<void*>(&nonstatic_func),
+      reinterpret_cast<void*>(&static_func),
+  };
+  char buf[4096];
+  const char* symbols[ARRAYSIZE(pcs)];
+  int num_symbolized = 0;
+  for (void* pc : pcs) {
+    num_symbolized += TrySymbolize(pc) != nullptr;
+  }
+  EXPECT_EQ(num_symbolized,
+            SymbolizeBatch(pcs, ARRAYSIZE(pcs), buf, sizeof(buf), symbols));
+  for (size_t i = 0; i < ARRAYSIZE(pcs); ++i) {
+    const char* symbol = TrySymbolize(pcs[i]);
+    EXPECT_EQ(symbol ? symbol : "(null)",
+              string(symbols[i] ? symbols[i] : "(null)"));
+  }
+
+  // Names that do not fit are left unsymbolized.
+  void* const same_pcs[] = {
+      reinterpret_cast<void*>(&nonstatic_func),
+      reinterpret_cast<void*>(&nonstatic_func),
+  };
+  EXPECT_EQ(1, SymbolizeBatch(same_pcs, 2, buf, sizeof("nonstatic_func") + 1,
+                              symbols));
+  ASSERT_NE(symbols[0] == nullptr, symbols[1] == nullptr);
+  EXPECT_STREQ("nonstatic_func", symbols[0] ? symbols[0] : symbols[1]);
+}
+
+static void AppendToString(const char* data, void* arg) {
+  static_cast<string*>(arg)->append(data);
+}
+
+TEST(Symbolize, SymbolizeOffline) {
+  // Program counters are return addresses and symbolized at pc - 1.
+  void* const pc = reinterpret_cast<char*>(&nonstatic_func) + 1;
+  string module_map;
+  WriteModuleMap(&pc, 1, &AppendToString, &module_map);
+
+  unsigned long long start_address, end_address, base_address;
+  char build_id[129];
+  char file_name[1024];
+  const size_t eol = module_map.find('\n');
+  ASSERT_NE(string::npos, eol);
+  ASSERT_EQ(5, sscanf(module_map.c_str() + eol + 1,
+                      " module 0x%llx-0x%llx base 0x%llx build-id %128s %1023s",
+                      &start_address, &end_address, &base_address, build_id,
+                      file_name));
+  EXPECT_LE(start_address, reinterpret_cast<uintptr_t>(pc));
+  EXPECT_GT(end_address, reinterpret_cast<uintptr_t>(pc));
+
+  char expected_build_id[129] = "-";
+  GetObjectFileBuildId(file_name, expected_build_id, sizeof(expected_build_id));
+  EXPECT_STREQ(expected_build_id, build_id);
+
+  char symbol[1024];
+  ASSERT_TRUE(SymbolizeObjectFileAddress(
+      file_name, reinterpret_cast<uintptr_t>(pc) - 1, base_address, symbol,
+      sizeof(symbol)));
+  EXPECT_STREQ("nonstatic_func", symbol);
+}
+
+// Computes the CRC-32 of |data| as recorded by .gnu_debuglink.
+static uint32_t Crc32(const string& data) {
+  uint32_t crc = 0xffffffff;
+  for (unsigned char c : data) {
+    crc ^= c;
+    for (int i = 0; i < 8; ++i) {
+      crc = (crc >> 1) ^ (0xedb88320 & (0 - (crc & 1)));
+    }
+  }
+  return ~crc;
+}
+
+static string g_stripped_file_name;
+static uint64_t g_stripped_start_address;
+static uint64_t g_stripped_base_address;
+
+static int OpenStrippedObjectFile(uint64_t /*pc*/, uint64_t& start_address,
+                                  uint64_t& base_address, char* out_file_name,
+                                  size_t out_file_name_size) {
+  start_address = g_stripped_start_address;
+  base_address = g_stripped_base_address;
+  strncpy(out_file_name, g_stripped_file_name.c_str(), out_file_name_size);
+  out_file_name[out_file_name_size - 1] = '\0';
+  return open(g_stripped_file_name.c_str(), O_RDONLY);
+}
+
+TEST(Symbolize, SymbolizeFromDebugFile) {
+  // static_func is missing from the dynamic symbol table, so that it can be
+  // symbolized from the regular symbol table only.
+  void* const pc = reinterpret_cast<char*>(&static_func) + 1;
+  string module_map;
+  WriteModuleMap(&pc, 1, &AppendToString, &module_map);
+  unsigned long long start_address, end_address, base_address;
+  char build_id[129];
+  char file_name[1024];
+  const size_t eol = module_map.find('\n');
+  ASSERT_NE(string::npos, eol);
+  ASSERT_EQ(5, sscanf(module_map.c_str() + eol + 1,
+                      " module 0x%llx-0x%llx base 0x%llx build-id %128s %1023s",
+                      &start_address, &end_address, &base_address, build_id,
+                      file_name));
+  if (strlen(build_id) < 3) {
+    return;  // The test binary has no build-id.
+  }
+
+  // Strip the test binary by hiding its regular symbol table, and install the
+  // original as the debug file indexed by build-id.
+  std::ifstream in(file_name, std::ios::binary);
+  string image{std::istreambuf_iterator<char>(in),
+               std::istreambuf_iterator<char>()};
+  ASSERT_GE(image.size(), sizeof(ElfW(Ehdr)));
+  ElfW(Ehdr) elf_header;
+  memcpy(&elf_header, image.data(), sizeof(elf_header));
+  string stripped = image;
+  for (size_t i = 0; i < elf_header.e_shnum; ++i) {
+    const size_t offset = elf_header.e_shoff + i * sizeof(ElfW(Shdr));
+    ASSERT_LE(offset + sizeof(ElfW(Shdr)), stripped.size());
+    ElfW(Shdr) section;
+    memcpy(&section, stripped.data() + offset, sizeof(section));
+    if (section.sh_type == SHT_SYMTAB) {
+      section.sh_type = SHT_PROGBITS;
+      memcpy(&stripped[offset], &section, sizeof(section));
+    }
+  }
+  g_stripped_file_name = FLAGS_test_tmpdir + "/symbolize_stripped";
+  g_stripped_start_address = start_address;
+  g_stripped_base_address = base_address;
+  std::ofstream(g_stripped_file_name, std::ios::binary) << stripped;
+
+  const string debug_root = FLAGS_test_tmpdir + "/symbolize_debug";
+  const string build_id_dir =
+      debug_root + "/.build-id/" + string(build_id, 2) + "/";
+  mkdir(debug_root.c_str(), 0755);
+  mkdir((debug_root + "/.build-id").c_str(), 0755);
+  mkdir(build_id_dir.c_str(), 0755);
+  std::ofstream(build_id_dir + (build_id + 2) + ".debug", std::ios::binary)
+      << image;
+
+  const string saved_debug_root = FLAGS_symbolize_debug_root;
+  FLAGS_symbolize_debug_root = "";
+  char symbol[1024];
+  EXPECT_FALSE(SymbolizeObjectFileAddress(
+      g_stripped_file_name.c_str(), reinterpret_cast<uintptr_t>(pc) - 1,
+      base_address, symbol, sizeof(symbol)));
+
+  FLAGS_symbolize_debug_root = debug_root;
+  ASSERT_TRUE(SymbolizeObjectFileAddress(
+      g_stripped_file_name.c_str(), reinterpret_cast<uintptr_t>(pc) - 1,
+      base_address, symbol, sizeof(symbol)));
+  EXPECT_STREQ("static_func", symbol);
+
+  InstallSymbolizeOpenObjectFileCallback(&OpenStrippedObjectFile);
+  EXPECT_STREQ("static_func",
+               TrySymbolize(reinterpret_cast<char*>(pc) - 1));
+  InstallSymbolizeOpenObjectFileCallback(nullptr);
+
+  // Without a build-id, the debug file is looked up by the name recorded in
+  // the .gnu_debuglink section, next to the object file, and must match the
+  // CRC-32 recorded there.  Turn the build-id note into such a section.
+  ASSERT_LT(elf_header.e_shstrndx, elf_header.e_shnum);
+  ElfW(Shdr) shstrtab;
+  memcpy(&shstrtab,
+         stripped.data() + elf_header.e_shoff +
+             elf_header.e_shstrndx * sizeof(ElfW(Shdr)),
+         sizeof(shstrtab));
+  const char kLink[] = "symbolize.debug";
+  bool has_debuglink = false;
+  for (size_t i = 0; i < elf_header.e_shnum && !has_debuglink; ++i) {
+    const size_t offset = elf_header.e_shoff + i * sizeof(ElfW(Shdr));
+    ElfW(Shdr) section;
+    memcpy(&section, stripped.data() + offset, sizeof(section));
+    char* name = &stripped[shstrtab.sh_offset + section.sh_name];
+    if (strcmp(name, ".note.gnu.build-id") != 0) {
+      continue;
+    }
+    ASSERT_GE(section.sh_size, sizeof(kLink) + sizeof(uint32_t));
+    strcpy(name, ".gnu_debuglink");
+    section.sh_type = SHT_PROGBITS;
+    memcpy(&stripped[offset], &section, sizeof(section));
+    const uint32_t crc = Crc32(image);
+    memcpy(&stripped[section.sh_offset], kLink, sizeof(kLink));
+    memcpy(&stripped[section.sh_offset + sizeof(kLink)], &crc, sizeof(crc));
+    has_debuglink = true;
+  }
+  ASSERT_TRUE(has_debuglink);
+  std::ofstream(g_stripped_file_name, std::ios::binary) << stripped;
+  std::ofstream(FLAGS_test_tmpdir + "/" + kLink, std::ios::binary) << image;
+  FLAGS_symbolize_debug_root = "";
+  EXPECT_TRUE(SymbolizeObjectFileAddress(
+      g_stripped_file_name.c_str(), reinterpret_cast<uintptr_t>(pc) - 1,
+      base_address, symbol, sizeof(symbol)));
+  EXPECT_STREQ("static_func", symbol);
+
+  // A debug file not matching the CRC-32 is ignored.
+  std::ofstream(FLAGS_test_tmpdir + "/" + kLink, std::ios::binary)
+      << image << '\0';
+  EXPECT_FALSE(SymbolizeObjectFileAddress(
+      g_stripped_file_name.c_str(), reinterpret_cast<uintptr_t>(pc) - 1,
+      base_address, symbol, sizeof(symbol)));
+  FLAGS_symbolize_debug_root = saved_debug_root;
+}
+
+#    if defined(HAVE_DLFCN_H)
+TEST(Symbolize, SymbolizeWithCacheFromDebugFile) {
+  // libcrypt is not loaded by the test otherwise, and has a build-id and no
+  // regular symbol table.
+  void* handle = dlopen("libcrypt.so.1", RTLD_NOW | RTLD_LOCAL);
+  if (handle == nullptr) {
+    return;  // libcrypt is not installed.
+  }
+  void* pc = dlsym(handle, "crypt_r");
+  ASSERT_TRUE(pc != nullptr);
+  const char* symbol = TrySymbolize(pc);
+  ASSERT_TRUE(symbol != nullptr);
+  string expected = symbol;
+  std::transform(expected.begin(), expected.end(), expected.begin(),
+                 [](unsigned char c) { return toupper(c); });
+
+  string module_map;
+  WriteModuleMap(&pc, 1, &AppendToString, &module_map);
+  char build_id[129];
+  char file_name[1024];
+  const size_t eol = module_map.find('\n');
+  ASSERT_NE(string::npos, eol);
+  ASSERT_EQ(2, sscanf(module_map.c_str() + eol + 1,
+                      " module %*s base %*s build-id %128s %1023s", build_id,
+                      file_name));
+  if (strlen(build_id) < 3) {
+    dlclose(handle);
+    return;  // libcrypt has no build-id.
+  }
+
+  // Install a copy of libcrypt as its debug file, with its dynamic symbol
+  // table turned into a regular one and the symbol names in upper case, so
+  // that the names show where they were read from.
+  std::ifstream in(file_name, std::ios::binary);
+  string image{std::istreambuf_iterator<char>(in),
+               std::istreambuf_iterator<char>()};
+  ASSERT_GE(image.size(), sizeof(ElfW(Ehdr)));
+  ElfW(Ehdr) elf_header;
+  memcpy(&elf_header, image.data(), sizeof(elf_header));
+  for (size_t i = 0; i < elf_header.e_shnum; ++i) {
+    const size_t offset = elf_header.e_shoff + i * sizeof(ElfW(Shdr));
+    ASSERT_LE(offset + sizeof(ElfW(Shdr)), image.size());
+    ElfW(Shdr) section;
+    memcpy(&section, image.data() + offset, sizeof(section));
+    if (section.sh_type != SHT_DYNSYM) {
+      continue;
+    }
+    section.sh_type = SHT_SYMTAB;
+    memcpy(&image[offset], &section, sizeof(section));
+    ElfW(Shdr) strtab;
+    memcpy(&strtab,
+           image.data() + elf_header.e_shoff +
+               section.sh_link * sizeof(ElfW(Shdr)),
+           sizeof(strtab));
+    ASSERT_LE(strtab.sh_offset + strtab.sh_size, image.size());
+    std::transform(image.begin() + static_cast<ptrdiff_t>(strtab.sh_offset),
+                   image.begin() + static_cast<ptrdiff_t>(strtab.sh_offset +
+                                                          strtab.sh_size),
+                   image.begin() + static_cast<ptrdiff_t>(strtab.sh_offset),
+                   [](unsigned char c) { return toupper(c); });
+  }
+  const string debug_root = FLAGS_test_tmpdir + "/symbolize_cache_debug";
+  const string build_id_dir =
+      debug_root + "/.build-id/" + string(build_id, 2) + "/";
+  mkdir(debug_root.c_str(), 0755);
+  mkdir((debug_root + "/.build-id").c_str(), 0755);
+  mkdir(build_id_dir.c_str(), 0755);
+  std::ofstream(build_id_dir + (build_id + 2) + ".debug", std::ios::binary)
+      << image;
+
+  const string saved_debug_root = FLAGS_symbolize_debug_root;
+  FLAGS_symbolize_debug_root = debug_root;
+  FLAGS_symbolize_cache = true;
+  symbol = TrySymbolize(pc);
+  EXPECT_EQ(expected, symbol ? symbol : "(null)");
+  FLAGS_symbolize_cache = false;
+  FLAGS_symbolize_debug_root = saved_debug_root;
+  dlclose(handle);
+}
+#    endif
+
+static ATTRIBUTE_NOINLINE void* GetReturnAddress() {
+  return __builtin_return_address(0);
+}
+
+TEST(Symbolize, SymbolizeSourceLines) {
+  // Symbolize the call instruction, which is before the return address.
+  void* const return_address = GetReturnAddress();
+  const int line = __LINE__ - 1;
+  void* const pc = static_cast<char*>(return_address) - 1;
+  const char* symbol = TrySymbolize(pc);
+  ASSERT_NE(nullptr, symbol);
+  const string function = symbol;
+
+  FLAGS_symbolize_line_numbers = true;
+  symbol = TrySymbolize(pc);
+  ASSERT_NE(nullptr, symbol);
+  const string with_line = symbol;
+  const string suffix = "symbolize_unittest.cc:" + std::to_string(line) + ")";
+  // The test is built with -g, so that it has a DWARF line table.
+  ASSERT_NE(function, with_line);
+  EXPECT_EQ(0u, with_line.find(function + " ("));
+  ASSERT_GE(with_line.size(), suffix.size());
+  EXPECT_EQ(suffix, with_line.substr(with_line.size() - suffix.size()));
+
+  EXPECT_STREQ(function.c_str(),
+               TrySymbolize(pc, SymbolizeOptions::kNoLineNumbers));
+  char buf[1024];
+  const char* symbols[1];
+  ASSERT_EQ(1, SymbolizeBatch(&pc, 1, buf, sizeof(buf), symbols));
+  EXPECT_EQ(with_line, symbols[0]);
+  FLAGS_symbolize_cache = true;
+  EXPECT_EQ(with_line, TrySymbolize(pc));
+  FLAGS_symbolize_cache = false;
+  FLAGS_symbolize_line_numbers = false;
+
+  // Source lines are decoded offline as well.
+  string module_map;
+  WriteModuleMap(&return_address, 1, &AppendToString, &module_map);
+  unsigned long long start_address, end_address, base_address;
+  char build_id[129];
+  char file_name[1024];
+  const size_t eol = module_map.find('\n');
+  ASSERT_NE(string::npos, eol);
+  ASSERT_EQ(5, sscanf(module_map.c_str() + eol + 1,
+                      " module 0x%llx-0x%llx base 0x%llx build-id %128s %1023s",
+                      &start_address, &end_address, &base_address, build_id,
+                      file_name));
+  const ObjectFileLineTable line_table(file_name);
+  char offline_symbol[1024];
+  ASSERT_TRUE(SymbolizeObjectFileAddress(
+      file_name, reinterpret_cast<uintptr_t>(pc), base_address, offline_symbol,
+      sizeof(offline_symbol)));
+  EXPECT_TRUE(line_table.AppendSourceLine(reinterpret_cast<uintptr_t>(pc),
+                                          base_address, offline_symbol,
+                                          sizeof(offline_symbol)));
+  EXPECT_EQ(with_line, offline_symbol);
+
+  // Source lines which do not fit are left out.
+  strcpy(offline_symbol, function.c_str());
+  EXPECT_FALSE(line_table.AppendSourceLine(reinterpret_cast<uintptr_t>(pc),
+                                           base_address, offline_symbol,
+                                           function.size() + 4));
+  EXPECT_EQ(function, offline_symbol);
+}
+
 // Tests that verify that Symbolize footprint is within some limit.
 
 // To measure the stack footprint of the Symbolize function, we create
@@ -407,6 +861,56 @@ static void ATTRIBUTE_NOINLINE TestWithReturnAddress() {
 #    endif
 }
 
+// Random program counters spread over the code of this binary, which links
+// in the whole library.
+static const vector<void*>& RandomPCs() {
+  static const vector<void*> pcs = [] {
+    const uintptr_t functions[] = {
+        reinterpret_cast<uintptr_t>(&nonstatic_func),
+        reinterpret_cast<uintptr_t>(&static_func),
+        reinterpret_cast<uintptr_t>(&Foo::func),
+        reinterpret_cast<uintptr_t>(&TrySymbolize),
+        reinterpret_cast<uintptr_t>(&google::InitGoogleLogging),
+        reinterpret_cast<uintptr_t>(&google::ShutdownGoogleLogging),
+        reinterpret_cast<uintptr_t>(&TestWithReturnAddress),
+    };
+    const auto range =
+        std::minmax_element(std::begin(functions), std::end(functions));
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<uintptr_t> address(*range.first,
+                                                     *range.second);
+    vector<void*> result(10000);
+    for (void*& pc : result) {
+      pc = reinterpret_cast<void*>(address(rng));
+    }
+    return result;
+  }();
+  return pcs;
+}
+
+static void BM_Symbolize(int iters) {
+  const vector<void*>& pcs = RandomPCs();
+  char symbol[1024];
+  for (int i = 0; i < iters; ++i) {
+    Symbolize(pcs[static_cast<size_t>(i) % pcs.size()], symbol,
+              sizeof(symbol));
+  }
+}
+BENCHMARK(BM_Symbolize)
+
+static void BM_SymbolizeCached(int iters) {
+  const vector<void*>& pcs = RandomPCs();
+  char symbol[1024];
+  FLAGS_symbolize_cache = true;
+  PrepareSymbolizeCache();
+  for (int i = 0; i < iters; ++i) {
+    Symbolize(pcs[static_cast<size_t>(i) % pcs.size()], symbol,
+              sizeof(symbol));
+  }
+  FLAGS_symbolize_cache = false;
+}
+BENCHMARK(BM_SymbolizeCached)
+
 #  elif defined(GLOG_OS_WINDOWS) || defined(GLOG_OS_CYGWIN)
 
 #    ifdef _MSC_VER
@@ -466,6 +970,7 @@ int main(int argc, char** argv) {
   TestWithPCInsideInlineFunction();
   TestWithPCInsideNonInlineFunction();
   TestWithReturnAddress();
+  RunSpecifiedBenchmarks();
   return RUN_ALL_TESTS();
 #  elif defined(GLOG_OS_WINDOWS) || defined(GLOG_OS_CYGWIN)
   TestWithReturnAddress();
@@ -0,0 +1,929 @@
+// Copyright (c) 2024, Google Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+//     * Neither the name of Google Inc. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Sinks sending the log messages over sockets: to the systemd journal, to
+// syslog and to log shippers.
+// logging_unittest.cc covers the functionality herein
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "config.h"
+#include "glog/logging.h"
+#include "utilities.h"
+
+#if defined(HAVE_SYS_SOCKET_H) && defined(HAVE_SYS_UN_H)
+#  include <netdb.h>
+#  include <sys/socket.h>
+#  include <sys/un.h>
+#  define GLOG_HAVE_UNIX_SOCKETS
+#endif
+#if defined(HAVE_SYS_SYSCALL_H)
+#  include <sys/syscall.h>
+#endif
+#if defined(HAVE_UNISTD_H)
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+
+namespace google {
+
+// Batches datagrams and sends them to a Unix domain socket, connecting on
+// first use and again after an error.  The socket is never waited for, since
+// the datagrams are sent while log_mutex is held.  Thread-safe.
+class SystemLogSender {
+ public:
+  explicit SystemLogSender(const char* socket_path);
+  ~SystemLogSender();
+
+  SystemLogSender(const SystemLogSender&) = delete;
+  SystemLogSender& operator=(const SystemLogSender&) = delete;
+
+  // Adds the datagram composed by "compose" into a string to the batch.
+  template <typename Compose>
+  void Add(LogSeverity severity, Compose compose) {
+    std::lock_guard<std::mutex> l{mutex_};
+    datagram_.clear();
+    compose(&datagram_);
+    AddDatagram(severity);
+  }
+
+  void Flush() {
+    std::lock_guard<std::mutex> l{mutex_};
+    SendBatch();
+  }
+
+  // Sends the batches of all senders.
+  static void FlushAll();
+
+  uint64 dropped() const { return dropped_; }
+
+ private:
+  static constexpr size_t kMaxBatchBytes = 64 * 1024;
+  static constexpr size_t kMaxBatchDatagrams = 32;
+
+  void AddDatagram(LogSeverity severity);
+  void SendBatch();
+  bool Connect();
+
+  static std::mutex senders_mutex_;
+  static std::vector<SystemLogSender*>* senders_;
+
+  std::mutex mutex_;
+  const std::string socket_path_;
+  int fd_ = -1;
+  std::string datagram_;             // The datagram being composed.
+  std::string batch_;                // The datagrams of the batch...
+  std::vector<size_t> batch_ends_;   // ...ending at these offsets.
+  std::chrono::steady_clock::time_point batch_start_;
+  std::atomic<uint64> dropped_{0};
+};
+
+std::mutex SystemLogSender::senders_mutex_;
+std::vector<SystemLogSender*>* SystemLogSender::senders_ = nullptr;
+
+SystemLogSender::SystemLogSender(const char* socket_path)
+    : socket_path_(socket_path) {
+  std::lock_guard<std::mutex> l{senders_mutex_};
+  if (senders_ == nullptr) {
+    senders_ = new std::vector<SystemLogSender*>;
+  }
+  senders_->push_back(this);
+}
+
+SystemLogSender::~SystemLogSender() {
+  {
+    std::lock_guard<std::mutex> l{senders_mutex_};
+    senders_->erase(std::find(senders_->begin(), senders_->end(), this));
+  }
+  SendBatch();
+#ifdef GLOG_HAVE_UNIX_SOCKETS
+  if (fd_ != -1) {
+    close(fd_);
+  }
+#endif
+}
+
+void SystemLogSender::FlushAll() {
+  std::lock_guard<std::mutex> l{senders_mutex_};
+  if (senders_ != nullptr) {
+    for (SystemLogSender* sender : *senders_) {
+      sender->Flush();
+    }
+  }
+}
+
+void SystemLogSender::AddDatagram(LogSeverity severity) {
+  if (!batch_ends_.empty() &&
+      (batch_.size() + datagram_.size() > kMaxBatchBytes ||
+       batch_ends_.size() == kMaxBatchDatagrams)) {
+    SendBatch();
+  }
+  if (batch_ends_.empty()) {
+    batch_start_ = std::chrono::steady_clock::now();
+  }
+  batch_ += datagram_;
+  batch_ends_.push_back(batch_.size());
+  // Send the batch when log files would be flushed.
+  if (severity > FLAGS_logbuflevel ||
+      std::chrono::steady_clock::now() - batch_start_ >=
+          std::chrono::seconds(FLAGS_logbufsecs)) {
+    SendBatch();
+  }
+}
+
+bool SystemLogSender::Connect() {
+#ifdef GLOG_HAVE_UNIX_SOCKETS
+  if (fd_ != -1) {
+    return true;
+  }
+  sockaddr_un address;
+  std::memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (socket_path_.size() >= sizeof(address.sun_path)) {
+    return false;
+  }
+  std::memcpy(address.sun_path, socket_path_.c_str(), socket_path_.size());
+#  if defined(SOCK_NONBLOCK) && defined(SOCK_CLOEXEC)
+  fd_ = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd_ == -1) {
+    return false;
+  }
+#  else
+  fd_ = socket(AF_UNIX, SOCK_DGRAM, 0);
+  if (fd_ == -1) {
+    return false;
+  }
+  fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL) | O_NONBLOCK);
+#    ifdef FD_CLOEXEC
+  fcntl(fd_, F_SETFD, FD_CLOEXEC);
+#    endif
+#  endif
+  if (connect(fd_, reinterpret_cast<const sockaddr*>(&address),
+              sizeof(address)) == -1) {
+    close(fd_);
+    fd_ = -1;
+    return false;
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+void SystemLogSender::SendBatch() {
+  if (batch_ends_.empty()) {
+    return;
+  }
+  size_t sent = 0;
+#ifdef GLOG_HAVE_UNIX_SOCKETS
+  if (Connect()) {
+#  ifdef GLOG_OS_LINUX
+    // All datagrams with a single system call.
+    iovec iovs[kMaxBatchDatagrams];
+    mmsghdr messages[kMaxBatchDatagrams];
+    std::memset(messages, 0, sizeof(messages));
+    size_t begin = 0;
+    for (size_t i = 0; i < batch_ends_.size(); ++i) {
+      iovs[i].iov_base = &batch_[begin];
+      iovs[i].iov_len = batch_ends_[i] - begin;
+      messages[i].msg_hdr.msg_iov = &iovs[i];
+      messages[i].msg_hdr.msg_iovlen = 1;
+      begin = batch_ends_[i];
+    }
+    while (sent < batch_ends_.size()) {
+      const int result =
+          sendmmsg(fd_, messages + sent,
+                   static_cast<unsigned>(batch_ends_.size() - sent),
+                   MSG_NOSIGNAL | MSG_DONTWAIT);
+      if (result == -1 && errno == EINTR) {
+        continue;
+      }
+      if (result <= 0) {
+        break;
+      }
+      sent += static_cast<size_t>(result);
+    }
+#  else
+    size_t begin = 0;
+    for (size_t end : batch_ends_) {
+      if (send(fd_, &batch_[begin], end - begin, MSG_DONTWAIT) == -1) {
+        break;
+      }
+      begin = end;
+      ++sent;
+    }
+#  endif
+    // The rest of the batch is dropped if the daemon does not keep up, and
+    // the socket is reconnected after other errors, for instance if the
+    // daemon was restarted.
+    if (sent < batch_ends_.size() && errno != EAGAIN && errno != EWOULDBLOCK) {
+      close(fd_);
+      fd_ = -1;
+    }
+  }
+#endif
+  dropped_ += batch_ends_.size() - sent;
+  batch_.clear();
+  batch_ends_.clear();
+}
+
+namespace {
+
+// Syslog severities of the log severities, as SendToSyslogAndLog() uses.
+constexpr int kSyslogSeverities[] = {6 /* info */, 4 /* warning */,
+                                     3 /* err */, 0 /* emerg */};
+
+void AppendFieldValue(std::string* out, const LogField& field) {
+  char buf[32];
+  switch (field.type()) {
+    case LogField::kBool:
+      out->append(field.bool_value() ? "true" : "false");
+      return;
+    case LogField::kInt:
+      std::snprintf(buf, sizeof(buf), "%lld",
+                    static_cast<long long>(field.int_value()));
+      break;
+    case LogField::kUInt:
+      std::snprintf(buf, sizeof(buf), "%llu",
+                    static_cast<unsigned long long>(field.uint_value()));
+      break;
+    case LogField::kDouble:
+      std::snprintf(buf, sizeof(buf), "%.17g", field.double_value());
+      break;
+    case LogField::kString:
+      out->append(field.string_value(), field.string_size());
+      return;
+  }
+  out->append(buf);
+}
+
+std::string CurrentThreadId() {
+  std::ostringstream id;
+  id << std::this_thread::get_id();
+  return id.str();
+}
+
+// Appends a journal field, in the binary form if the value spans lines.
+void AppendJournalField(std::string* out, const char* key, const char* value,
+                        size_t size) {
+  out->append(key);
+  if (std::memchr(value, '\n', size) == nullptr) {
+    out->push_back('=');
+  } else {
+    out->push_back('\n');
+    for (int i = 0; i < 8; ++i) {
+      out->push_back(
+          static_cast<char>((static_cast<uint64_t>(size) >> (8 * i)) & 0xff));
+    }
+  }
+  out->append(value, size);
+  out->push_back('\n');
+}
+
+void AppendJournalField(std::string* out, const char* key,
+                        const std::string& value) {
+  AppendJournalField(out, key, value.data(), value.size());
+}
+
+// Journal field names consist of upper case letters, digits and underscores,
+// and start with a letter.
+std::string JournalFieldName(const char* key) {
+  std::string name;
+  if (!(*key >= 'a' && *key <= 'z') && !(*key >= 'A' && *key <= 'Z')) {
+    name = "GLOG_";
+  }
+  for (; *key != '\0' && name.size() < 64; ++key) {
+    const char c = *key;
+    if (c >= 'a' && c <= 'z') {
+      name.push_back(static_cast<char>(c - 'a' + 'A'));
+    } else if ((c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')) {
+      name.push_back(c);
+    } else {
+      name.push_back('_');
+    }
+  }
+  return name;
+}
+
+// Appends an RFC 5424 structured data parameter.  Parameter names are
+// printable ASCII other than '=', ' ', ']' and '"', of at most 32 characters.
+void AppendSyslogParam(std::string* out, const char* name, const char* value,
+                       size_t size) {
+  out->push_back(' ');
+  for (size_t i = 0; name[i] != '\0' && i < 32; ++i) {
+    const char c = name[i];
+    out->push_back(c <= ' ' || c > '~' || c == '=' || c == ']' || c == '"'
+                       ? '_'
+                       : c);
+  }
+  out->append("=\"");
+  for (size_t i = 0; i < size; ++i) {
+    if (value[i] == '"' || value[i] == '\\' || value[i] == ']') {
+      out->push_back('\\');
+    }
+    out->push_back(value[i]);
+  }
+  out->push_back('"');
+}
+
+void AppendSyslogParam(std::string* out, const char* name,
+                       const std::string& value) {
+  AppendSyslogParam(out, name, value.data(), value.size());
+}
+
+// Appends the time in the RFC 3339 format required by RFC 5424.
+void AppendSyslogTime(std::string* out, const LogMessageTime& time) {
+  char buf[48];
+  std::snprintf(buf, sizeof(buf), "%04d-%02d-%02dT%02d:%02d:%02d.%06ld",
+                1900 + time.year(), 1 + time.month(), time.day(), time.hour(),
+                time.min(), time.sec(), static_cast<long>(time.usec()));
+  out->append(buf);
+  const long offset = static_cast<long>(time.gmtoffset().count()) / 60;
+  if (offset == 0) {
+    out->push_back('Z');
+  } else {
+    const long minutes = offset < 0 ? -offset : offset;
+    std::snprintf(buf, sizeof(buf), "%c%02ld:%02ld", offset < 0 ? '-' : '+',
+                  minutes / 60, minutes % 60);
+    out->append(buf);
+  }
+}
+
+}  // namespace
+
+JournaldLogSink::JournaldLogSink(const char* socket_path)
+    : sender_(new SystemLogSender(socket_path)) {}
+
+JournaldLogSink::~JournaldLogSink() = default;
+
+void JournaldLogSink::send(LogSeverity severity, const char* full_filename,
+                           const char* base_filename, int line,
+                           const LogMessageTime& time, const char* message,
+                           size_t message_len) {
+  SendWithFields(severity, full_filename, base_filename, line, time, message,
+                 message_len, LogFields());
+}
+
+void JournaldLogSink::SendWithFields(LogSeverity severity,
+                                     const char* full_filename,
+                                     const char* /*base_filename*/, int line,
+                                     const LogMessageTime& /*time*/,
+                                     const char* message, size_t message_len,
+                                     const LogFields& fields) {
+  sender_->Add(severity, [&](std::string* out) {
+    AppendJournalField(out, "MESSAGE", message, message_len);
+    AppendJournalField(
+        out, "PRIORITY",
+        std::to_string(kSyslogSeverities[static_cast<int>(severity)]));
+    AppendJournalField(out, "GLOG_SEVERITY", GetLogSeverityName(severity),
+                       std::strlen(GetLogSeverityName(severity)));
+    AppendJournalField(out, "CODE_FILE", full_filename,
+                       std::strlen(full_filename));
+    AppendJournalField(out, "CODE_LINE", std::to_string(line));
+#if defined(HAVE_SYS_SYSCALL_H) && defined(SYS_gettid)
+    AppendJournalField(out, "TID", std::to_string(syscall(SYS_gettid)));
+#else
+    AppendJournalField(out, "TID", CurrentThreadId());
+#endif
+    const char* identifier =
+        glog_internal_namespace_::ProgramInvocationShortName();
+    AppendJournalField(out, "SYSLOG_IDENTIFIER", identifier,
+                       std::strlen(identifier));
+    std::string value;
+    for (const LogField& field : fields) {
+      value.clear();
+      AppendFieldValue(&value, field);
+      AppendJournalField(out, JournalFieldName(field.key()).c_str(), value);
+    }
+  });
+}
+
+void JournaldLogSink::Flush() { sender_->Flush(); }
+
+uint64 JournaldLogSink::dropped() const { return sender_->dropped(); }
+
+SyslogLogSink::SyslogLogSink(const char* socket_path, int facility)
+    : sender_(new SystemLogSender(socket_path)), facility_(facility) {
+  char hostname[256] = "-";
+#ifdef HAVE_UNISTD_H
+  if (gethostname(hostname, sizeof(hostname)) != 0 || hostname[0] == '\0') {
+    std::strcpy(hostname, "-");
+  }
+  hostname[sizeof(hostname) - 1] = '\0';
+#endif
+  hostname_ = hostname;
+}
+
+SyslogLogSink::~SyslogLogSink() = default;
+
+void SyslogLogSink::send(LogSeverity severity, const char* full_filename,
+                         const char* base_filename, int line,
+                         const LogMessageTime& time, const char* message,
+                         size_t message_len) {
+  SendWithFields(severity, full_filename, base_filename, line, time, message,
+                 message_len, LogFields());
+}
+
+void SyslogLogSink::SendWithFields(LogSeverity severity,
+                                   const char* /*full_filename*/,
+                                   const char* base_filename, int line,
+                                   const LogMessageTime& time,
+                                   const char* message, size_t message_len,
+                                   const LogFields& fields) {
+  sender_->Add(severity, [&](std::string* out) {
+    // <PRI>VERSION TIMESTAMP HOSTNAME APP-NAME PROCID MSGID
+    out->push_back('<');
+    out->append(std::to_string(
+        facility_ * 8 + kSyslogSeverities[static_cast<int>(severity)]));
+    out->append(">1 ");
+    AppendSyslogTime(out, time);
+    out->push_back(' ');
+    out->append(hostname_);
+    out->push_back(' ');
+    out->append(glog_internal_namespace_::ProgramInvocationShortName());
+    out->push_back(' ');
+#ifdef HAVE_UNISTD_H
+    out->append(std::to_string(getpid()));
+#else
+    out->push_back('-');
+#endif
+    out->append(" - [glog@11129");
+    AppendSyslogParam(out, "file", base_filename, std::strlen(base_filename));
+    AppendSyslogParam(out, "line", std::to_string(line));
+    AppendSyslogParam(out, "thread", CurrentThreadId());
+    AppendSyslogParam(out, "severity", GetLogSeverityName(severity),
+                      std::strlen(GetLogSeverityName(severity)));
+    std::string value;
+    for (const LogField& field : fields) {
+      value.clear();
+      AppendFieldValue(&value, field);
+      AppendSyslogParam(out, field.key(), value);
+    }
+    out->append("] ");
+    out->append(message, message_len);
+  });
+}
+
+void SyslogLogSink::Flush() { sender_->Flush(); }
+
+uint64 SyslogLogSink::dropped() const { return sender_->dropped(); }
+
+inline namespace glog_internal_namespace_ {
+
+void FlushSystemLogSinks() { SystemLogSender::FlushAll(); }
+
+}  // namespace glog_internal_namespace_
+
+// Sends the records of a StreamLogSink from a background thread.
+class StreamSender {
+ public:
+  StreamSender(const char* address, size_t buffer_bytes,
+               const char* spill_file);
+  ~StreamSender();
+
+  StreamSender(const StreamSender&) = delete;
+  StreamSender& operator=(const StreamSender&) = delete;
+
+  // Appends the record composed by "compose" into a string, preceded by its
+  // size, or drops it if the buffer is full.
+  template <typename Compose>
+  void Add(Compose compose) {
+    static thread_local std::string record;
+    record.assign(4, '\0');
+    compose(&record);
+    const size_t size = record.size() - 4;
+    for (size_t i = 0; i < 4; ++i) {
+      record[i] = static_cast<char>((size >> (8 * (3 - i))) & 0xff);
+    }
+    std::lock_guard<std::mutex> l{mutex_};
+    if (pending_.size() + record.size() > buffer_bytes_) {
+      ++dropped_;
+      return;
+    }
+    const bool was_empty = pending_.empty();
+    pending_ += record;
+    if (was_empty && !Forked()) {
+      wake_.notify_one();
+    }
+  }
+
+  bool Flush();
+  uint64 dropped() const { return dropped_; }
+#ifdef HAVE_UNISTD_H
+  bool Forked() const { return pid_ != getpid(); }
+#else
+  bool Forked() const { return false; }
+#endif
+
+ private:
+  static constexpr std::chrono::seconds kIdlePeriod{1};
+  static constexpr std::chrono::seconds kFlushTimeout{10};
+  static constexpr std::chrono::milliseconds kMinBackoff{100};
+  static constexpr std::chrono::milliseconds kMaxBackoff{30000};
+  static constexpr size_t kReplayChunkBytes = 64 * 1024;
+
+  void Run();
+  bool Deliver();
+  bool Connect();
+  void Disconnect();
+  bool WriteAll(const char* data, size_t size);
+  bool ReplaySpill();
+  void Spill();
+
+  const std::string address_;
+  const size_t buffer_bytes_;
+  const std::string spill_path_;
+#ifdef HAVE_UNISTD_H
+  const pid_t pid_ = getpid();
+#endif
+
+  std::mutex mutex_;
+  std::condition_variable wake_;  // Signals the thread.
+  std::condition_variable idle_;  // Signaled by the thread.
+  std::string pending_;           // Records not yet taken by the thread.
+  bool busy_ = false;             // Whether the thread has records to send.
+  bool stop_ = false;
+  bool done_ = false;
+  std::atomic<uint64> dropped_{0};
+  int fd_ = -1;  // Written by the thread under mutex_.
+
+  // Used by the thread only.
+  std::string writing_;
+  FILE* spill_ = nullptr;
+  size_t spilled_bytes_ = 0;
+  std::chrono::milliseconds backoff_ = kMinBackoff;
+  std::chrono::steady_clock::time_point next_connect_;
+
+  std::thread thread_;
+};
+
+constexpr std::chrono::seconds StreamSender::kIdlePeriod;
+constexpr std::chrono::seconds StreamSender::kFlushTimeout;
+constexpr std::chrono::milliseconds StreamSender::kMinBackoff;
+constexpr std::chrono::milliseconds StreamSender::kMaxBackoff;
+constexpr size_t StreamSender::kReplayChunkBytes;
+
+StreamSender::StreamSender(const char* address, size_t buffer_bytes,
+                           const char* spill_file)
+    : address_(address),
+      buffer_bytes_(buffer_bytes),
+      spill_path_(spill_file != nullptr ? spill_file : "") {
+  pending_.reserve(buffer_bytes_);
+  writing_.reserve(buffer_bytes_);
+  if (!spill_path_.empty()) {
+    // Records spilled by a previous process are replayed as well.
+    spill_ = std::fopen(spill_path_.c_str(), "ab");
+    if (spill_ != nullptr) {
+      std::fseek(spill_, 0, SEEK_END);
+      const long size = std::ftell(spill_);
+      spilled_bytes_ = size > 0 ? static_cast<size_t>(size) : 0;
+    }
+  }
+  thread_ = std::thread(&StreamSender::Run, this);
+}
+
+StreamSender::~StreamSender() {
+  {
+    std::unique_lock<std::mutex> l{mutex_};
+    stop_ = true;
+    wake_.notify_one();
+    // Unblock a write to a peer which does not read.
+    if (!idle_.wait_for(l, kFlushTimeout, [this] { return done_; }) &&
+        fd_ != -1) {
+#ifdef GLOG_HAVE_UNIX_SOCKETS
+      shutdown(fd_, SHUT_RDWR);
+#endif
+    }
+  }
+  thread_.join();
+  Disconnect();
+  if (spill_ != nullptr) {
+    std::fclose(spill_);
+  }
+}
+
+bool StreamSender::Flush() {
+  std::unique_lock<std::mutex> l{mutex_};
+  if (Forked()) {
+    return false;
+  }
+  wake_.notify_one();
+  return idle_.wait_for(l, kFlushTimeout,
+                        [this] { return pending_.empty() && !busy_; });
+}
+
+void StreamSender::Run() {
+  std::unique_lock<std::mutex> l{mutex_};
+  for (;;) {
+    if (writing_.empty()) {
+      writing_.swap(pending_);
+    }
+    busy_ = !writing_.empty();
+    if (!busy_ && spilled_bytes_ == 0) {
+      idle_.notify_all();
+      if (stop_) {
+        break;
+      }
+      wake_.wait_for(l, kIdlePeriod);
+      continue;
+    }
+    // Reconnect with backoff, but spill the records in the meantime.
+    const bool connect =
+        stop_ || std::chrono::steady_clock::now() >= next_connect_;
+    l.unlock();
+    const bool sent = (fd_ != -1 || connect) && Deliver();
+    if (!sent) {
+      Spill();
+    }
+    l.lock();
+    busy_ = !writing_.empty();
+    if (sent) {
+      backoff_ = kMinBackoff;
+      continue;
+    }
+    if (connect) {
+      next_connect_ = std::chrono::steady_clock::now() + backoff_;
+      backoff_ = std::min(backoff_ * 2, kMaxBackoff);
+    }
+    idle_.notify_all();
+    if (stop_) {
+      break;
+    }
+    wake_.wait_until(l, next_connect_);
+  }
+  done_ = true;
+  idle_.notify_all();
+}
+
+bool StreamSender::Deliver() {
+  if (fd_ == -1 && !Connect()) {
+    return false;
+  }
+  if ((spilled_bytes_ > 0 && !ReplaySpill()) ||
+      !WriteAll(writing_.data(), writing_.size())) {
+    Disconnect();
+    return false;
+  }
+  writing_.clear();
+  return true;
+}
+
+bool StreamSender::Connect() {
+#ifdef GLOG_HAVE_UNIX_SOCKETS
+  int fd = -1;
+  if (address_.compare(0, 5, "unix:") == 0) {
+    const std::string path = address_.substr(5);
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+      return false;
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.size());
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd != -1 && connect(fd, reinterpret_cast<const sockaddr*>(&address),
+                            sizeof(address)) == -1) {
+      close(fd);
+      fd = -1;
+    }
+  } else {
+    const size_t colon = address_.rfind(':');
+    if (colon == std::string::npos) {
+      return false;
+    }
+    std::string host = address_.substr(0, colon);
+    if (host.size() >= 2 && host.front() == '[' && host.back() == ']') {
+      host = host.substr(1, host.size() - 2);
+    }
+    addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* addresses = nullptr;
+    if (getaddrinfo(host.c_str(), address_.c_str() + colon + 1, &hints,
+                    &addresses) != 0) {
+      return false;
+    }
+    for (addrinfo* a = addresses; a != nullptr && fd == -1; a = a->ai_next) {
+      fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+      if (fd != -1 && connect(fd, a->ai_addr, a->ai_addrlen) == -1) {
+        close(fd);
+        fd = -1;
+      }
+    }
+    freeaddrinfo(addresses);
+  }
+  if (fd == -1) {
+    return false;
+  }
+#  ifdef FD_CLOEXEC
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+#  endif
+#  ifdef SO_NOSIGPIPE
+  const int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#  endif
+  std::lock_guard<std::mutex> l{mutex_};
+  fd_ = fd;
+  return true;
+#else
+  return false;
+#endif
+}
+
+void StreamSender::Disconnect() {
+#ifdef GLOG_HAVE_UNIX_SOCKETS
+  std::lock_guard<std::mutex> l{mutex_};
+  if (fd_ != -1) {
+    close(fd_);
+    fd_ = -1;
+  }
+#endif
+}
+
+bool StreamSender::WriteAll(const char* data, size_t size) {
+#ifdef GLOG_HAVE_UNIX_SOCKETS
+#  ifdef MSG_NOSIGNAL
+  constexpr int kFlags = MSG_NOSIGNAL;
+#  else
+  constexpr int kFlags = 0;
+#  endif
+  while (size > 0) {
+    const ssize_t written = ::send(fd_, data, size, kFlags);
+    if (written == -1 && errno == EINTR) {
+      continue;
+    }
+    if (written <= 0) {
+      return false;
+    }
+    data += written;
+    size -= static_cast<size_t>(written);
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool StreamSender::ReplaySpill() {
+  std::fflush(spill_);
+  FILE* in = std::fopen(spill_path_.c_str(), "rb");
+  if (in == nullptr) {
+    return false;
+  }
+  std::vector<char> chunk(kReplayChunkBytes);
+  bool sent = true;
+  size_t size;
+  while (sent && (size = std::fread(chunk.data(), 1, chunk.size(), in)) > 0) {
+    sent = WriteAll(chunk.data(), size);
+  }
+  std::fclose(in);
+  if (sent) {
+    std::fclose(spill_);
+    spill_ = std::fopen(spill_path_.c_str(), "wb");
+    spilled_bytes_ = 0;
+  }
+  return sent;
+}
+
+void StreamSender::Spill() {
+  if (spill_ == nullptr || writing_.empty()) {
+    // Keep the records until the peer is available again; new records are
+    // dropped once the buffer is full.
+    return;
+  }
+  const size_t max_bytes =
+      static_cast<size_t>(std::max(FLAGS_max_log_size, 1U)) * 1024 * 1024;
+  if (spilled_bytes_ + writing_.size() <= max_bytes &&
+      std::fwrite(writing_.data(), 1, writing_.size(), spill_) ==
+          writing_.size() &&
+      std::fflush(spill_) == 0) {
+    spilled_bytes_ += writing_.size();
+  } else {
+    for (size_t begin = 0; begin + 4 <= writing_.size(); ++dropped_) {
+      size_t size = 0;
+      for (size_t i = 0; i < 4; ++i) {
+        size = size << 8 | static_cast<unsigned char>(writing_[begin + i]);
+      }
+      begin += 4 + size;
+    }
+  }
+  writing_.clear();
+}
+
+namespace {
+
+template <typename T>
+void AppendBigEndian(std::string* out, T value) {
+  for (size_t i = sizeof(T); i-- > 0;) {
+    out->push_back(static_cast<char>(
+        (static_cast<uint64_t>(value) >> (8 * i)) & 0xff));
+  }
+}
+
+}  // namespace
+
+StreamLogSink::StreamLogSink(const char* address, Format format,
+                             size_t buffer_bytes, const char* spill_file)
+    : sender_(new StreamSender(address, buffer_bytes, spill_file)),
+      format_(format) {}
+
+StreamLogSink::~StreamLogSink() {
+  if (sender_->Forked()) {
+    // The thread does not exist in a forked child, and destroying the
+    // condition variables may hang.
+    sender_.release();
+  }
+}
+
+void StreamLogSink::send(LogSeverity severity, const char* full_filename,
+                         const char* base_filename, int line,
+                         const LogMessageTime& time, const char* message,
+                         size_t message_len) {
+  SendWithFields(severity, full_filename, base_filename, line, time, message,
+                 message_len, LogFields());
+}
+
+void StreamLogSink::SendWithFields(LogSeverity severity,
+                                   const char* /*full_filename*/,
+                                   const char* base_filename, int line,
+                                   const LogMessageTime& time,
+                                   const char* message, size_t message_len,
+                                   const LogFields& fields) {
+  if (format_ == kText) {
+    sender_->Add([&](std::string* out) {
+      out->append(
+          ToString(severity, base_filename, line, time, message, message_len));
+    });
+    return;
+  }
+  sender_->Add([&](std::string* out) {
+    out->push_back(static_cast<char>(severity));
+    AppendBigEndian(out, static_cast<int64_t>(
+                             std::chrono::duration_cast<
+                                 std::chrono::microseconds>(
+                                 time.when().time_since_epoch())
+                                 .count()));
+    AppendBigEndian(out, static_cast<uint32_t>(line));
+    const size_t file_size = std::strlen(base_filename);
+    AppendBigEndian(out, static_cast<uint16_t>(file_size));
+    out->append(base_filename, file_size);
+    AppendBigEndian(out, static_cast<uint32_t>(message_len));
+    out->append(message, message_len);
+    AppendBigEndian(out, static_cast<uint16_t>(fields.size()));
+    std::string value;
+    for (const LogField& field : fields) {
+      const size_t key_size = std::strlen(field.key());
+      AppendBigEndian(out, static_cast<uint16_t>(key_size));
+      out->append(field.key(), key_size);
+      value.clear();
+      AppendFieldValue(&value, field);
+      AppendBigEndian(out, static_cast<uint32_t>(value.size()));
+      out->append(value);
+    }
+  });
+}
+
+bool StreamLogSink::Flush() { return sender_->Flush(); }
+
+uint64 StreamLogSink::dropped() const { return sender_->dropped(); }
+
+}  // namespace google
@@ -33,6 +33,7 @@
 
 #include "utilities.h"
 
+#include <algorithm>
 #include <atomic>
 #include <cerrno>
 #include <csignal>
@@ -141,21 +142,35 @@ static void DebugWriteToString(const char* data, void* arg) {
 }
 
 #  ifdef HAVE_SYMBOLIZE
-// Print a program counter and its symbol name.
-static void DumpPCAndSymbol(DebugWriter* writerfn, void* arg, void* pc,
-                            const char* const prefix) {
-  char tmp[1024];
-  const char* symbol = "(unknown)";
+// Print program counters and their symbol names.
+static void DumpPCsAndSymbols(DebugWriter* writerfn, void* arg,
+                              void* const* pcs, int n,
+                              const char* const prefix) {
   // Symbolizes the previous address of pc because pc may be in the
   // next function.  The overrun happens when the function ends with
   // a call to a function annotated noreturn (e.g. CHECK).
-  if (Symbolize(reinterpret_cast<char*>(pc) - 1, tmp, sizeof(tmp))) {
-    symbol = tmp;
+  void* prev_pcs[32] = {};
+  n = std::max(0, std::min(n, static_cast<int>(ARRAYSIZE(prev_pcs))));
+  for (int i = 0; i < n; i++) {
+    prev_pcs[i] = reinterpret_cast<char*>(pcs[i]) - 1;
+  }
+  char tmp[8192];
+  const char* symbols[ARRAYSIZE(prev_pcs)];
+  SymbolizeBatch(prev_pcs, n, tmp, sizeof(tmp), symbols);
+  for (int i = 0; i < n; i++) {
+    // The frames whose names did not fit into tmp anymore are symbolized one
+    // by one.
+    char symbol[1024];
+    if (symbols[i] == nullptr &&
+        Symbolize(prev_pcs[i], symbol, sizeof(symbol))) {
+      symbols[i] = symbol;
+    }
+    char buf[1024];
+    std::snprintf(buf, sizeof(buf), "%s@ %*p  %s\n", prefix,
+                  kPrintfPointerFieldWidth, pcs[i],
+                  symbols[i] != nullptr ? symbols[i] : "(unknown)");
+    writerfn(buf, arg);
   }
-  char buf[1024];
-  std::snprintf(buf, sizeof(buf), "%s@ %*p  %s\n", prefix,
-                kPrintfPointerFieldWidth, pc, symbol);
-  writerfn(buf, arg);
 }
 #  endif
 
@@ -172,17 +187,20 @@ static void DumpStackTrace(int skip_count, DebugWriter* writerfn, void* arg) {
   // Print stack trace
   void* stack[32];
   int depth = GetStackTrace(stack, ARRAYSIZE(stack), skip_count + 1);
-  for (int i = 0; i < depth; i++) {
 #  if defined(HAVE_SYMBOLIZE)
-    if (FLAGS_symbolize_stacktrace) {
-      DumpPCAndSymbol(writerfn, arg, stack[i], "    ");
-    } else {
-      DumpPC(writerfn, arg, stack[i], "    ");
-    }
-#  else
-    DumpPC(writerfn, arg, stack[i], "    ");
+  if (FLAGS_symbolize_stacktrace && !FLAGS_symbolize_offline) {
+    DumpPCsAndSymbols(writerfn, arg, stack, depth, "    ");
+    return;
+  }
 #  endif
+  for (int i = 0; i < depth; i++) {
+    DumpPC(writerfn, arg, stack[i], "    ");
   }
+#  if defined(HAVE_SYMBOLIZE)
+  if (FLAGS_symbolize_stacktrace) {
+    WriteModuleMap(stack, depth, writerfn, arg);
+  }
+#  endif
 }
 
 #  ifdef __GNUC__
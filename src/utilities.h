@@ -128,6 +128,8 @@ struct CrashReason {
 }  // namespace internal
 }  // namespace logging
 
+class LogMessageTime;
+
 inline namespace glog_internal_namespace_ {
 
 #if defined(__has_attribute)
@@ -164,6 +166,24 @@ const char* const_basename(const char* filepath);
 
 void SetCrashReason(const logging::internal::CrashReason* r);
 
+// Whether the flags are constructed.  LOG() and VLOG() statements in static
+// initializers may run before, and must not read the string flags then.
+bool FlagsConstructed();
+
+// Records a message in the flight recorder of the calling thread if
+// --flight_recorder_bytes is set.
+void RecordInFlightRecorder(LogSeverity severity, const char* file, int line,
+                            const LogMessageTime& time, const char* message,
+                            size_t message_size);
+// Writes the messages of the flight recorder.  Async-signal-safe.
+void WriteFlightRecorder(void (*writer)(const char* data, size_t size));
+// Writes them unless they were already written because of a crash.
+void WriteFlightRecorderOnCrash(void (*writer)(const char* data, size_t size));
+
+// Sends the batched messages of all JournaldLogSink and SyslogLogSink
+// instances.
+void FlushSystemLogSinks();
+
 void InitGoogleLoggingUtilities(const char* argv0);
 void ShutdownGoogleLoggingUtilities();
 
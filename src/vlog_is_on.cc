@@ -40,6 +40,7 @@
 #include <string>
 
 #include "glog/raw_logging.h"
+#include "utilities.h"
 
 // glog doesn't have annotation
 #define ANNOTATE_BENIGN_RACE(address, description)
@@ -86,7 +87,8 @@ GLOG_NO_EXPORT bool SafeFNMatch_(const char* pattern, size_t patt_len,
 
 using glog_internal_namespace_::SafeFNMatch_;
 
-// List of per-module log levels from FLAGS_vmodule.
+// List of per-module log levels from FLAGS_vmodule (or
+// FLAGS_minloglevel_module).
 // Once created each element is never deleted/modified
 // except for the vlog_level: other threads will read VModuleInfo blobs
 // w/o locks and we'll store pointers to vlog_level at VLOG locations
@@ -101,22 +103,31 @@ struct VModuleInfo {
   const VModuleInfo* next;
 };
 
+// Per-module overrides of one global level flag: --vmodule overrides --v and
+// --minloglevel_module overrides --minloglevel. Both share the same site
+// caching scheme.
+struct ModuleLevels {
+  // Pointer to head of the VModuleInfo list.
+  // It's a map from module pattern to logging level for those module(s).
+  VModuleInfo* list;
+  // Sites still bound to the global default, so that later Set*Level calls
+  // can redirect them to a new module override.
+  SiteFlag* cached_site_list;
+  // Boolean initialization flag.
+  bool inited;
+};
+
 // This protects the following global variables.
 static std::mutex vmodule_mutex;
-// Pointer to head of the VModuleInfo list.
-// It's a map from module pattern to logging level for those module(s).
-static VModuleInfo* vmodule_list = nullptr;
-static SiteFlag* cached_site_list = nullptr;
-
-// Boolean initialization flag.
-static bool inited_vmodule = false;
+static ModuleLevels vmodule_levels = {nullptr, nullptr, false};
+static ModuleLevels minloglevel_module_levels = {nullptr, nullptr, false};
 
 // L >= vmodule_mutex.
-static void VLOG2Initializer() {
-  // Can now parse --vmodule flag and initialize mapping of module-specific
+static void VLOG2Initializer(ModuleLevels* levels, const string& flag) {
+  // Can now parse the flag and initialize mapping of module-specific
   // logging levels.
-  inited_vmodule = false;
-  const char* vmodule = FLAGS_vmodule.c_str();
+  levels->inited = false;
+  const char* vmodule = flag.c_str();
   const char* sep;
   VModuleInfo* head = nullptr;
   VModuleInfo* tail = nullptr;
@@ -140,72 +151,89 @@ static void VLOG2Initializer() {
     vmodule++;  // Skip past ","
   }
   if (head) {  // Put them into the list at the head:
-    tail->next = vmodule_list;
-    vmodule_list = head;
+    tail->next = levels->list;
+    levels->list = head;
   }
-  inited_vmodule = true;
+  levels->inited = true;
 }
 
-// This can be called very early, so we use SpinLock and RAW_VLOG here.
-int SetVLOGLevel(const char* module_pattern, int log_level) {
-  int result = FLAGS_v;
+// Sets the level of module_pattern in levels and returns the level that
+// previously applied to it, or result if none did.
+static int SetModuleLevel(ModuleLevels* levels, const char* module_pattern,
+                          int log_level, int result) {
   size_t const pattern_len = strlen(module_pattern);
   bool found = false;
-  {
-    std::lock_guard<std::mutex> l(
-        vmodule_mutex);  // protect whole read-modify-write
-    for (const VModuleInfo* info = vmodule_list; info != nullptr;
-         info = info->next) {
-      if (info->module_pattern == module_pattern) {
-        if (!found) {
-          result = info->vlog_level;
-          found = true;
-        }
-        info->vlog_level = log_level;
-      } else if (!found && SafeFNMatch_(info->module_pattern.c_str(),
-                                        info->module_pattern.size(),
-                                        module_pattern, pattern_len)) {
+  std::lock_guard<std::mutex> l(
+      vmodule_mutex);  // protect whole read-modify-write
+  for (const VModuleInfo* info = levels->list; info != nullptr;
+       info = info->next) {
+    if (info->module_pattern == module_pattern) {
+      if (!found) {
         result = info->vlog_level;
         found = true;
       }
-    }
-    if (!found) {
-      auto* info = new VModuleInfo;
-      info->module_pattern = module_pattern;
       info->vlog_level = log_level;
-      info->next = vmodule_list;
-      vmodule_list = info;
-
-      SiteFlag** item_ptr = &cached_site_list;
-      SiteFlag* item = cached_site_list;
-
-      // We traverse the list fully because the pattern can match several items
-      // from the list.
-      while (item) {
-        if (SafeFNMatch_(module_pattern, pattern_len, item->base_name,
-                         item->base_len)) {
-          // Redirect the cached value to its module override.
-          item->level = &info->vlog_level;
-          *item_ptr = item->next;  // Remove the item from the list.
-        } else {
-          item_ptr = &item->next;
-        }
-        item = *item_ptr;
+    } else if (!found && SafeFNMatch_(info->module_pattern.c_str(),
+                                      info->module_pattern.size(),
+                                      module_pattern, pattern_len)) {
+      result = info->vlog_level;
+      found = true;
+    }
+  }
+  if (!found) {
+    auto* info = new VModuleInfo;
+    info->module_pattern = module_pattern;
+    info->vlog_level = log_level;
+    info->next = levels->list;
+    levels->list = info;
+
+    SiteFlag** item_ptr = &levels->cached_site_list;
+    SiteFlag* item = levels->cached_site_list;
+
+    // We traverse the list fully because the pattern can match several items
+    // from the list.
+    while (item) {
+      if (SafeFNMatch_(module_pattern, pattern_len, item->base_name,
+                       item->base_len)) {
+        // Redirect the cached value to its module override.
+        item->level = &info->vlog_level;
+        *item_ptr = item->next;  // Remove the item from the list.
+      } else {
+        item_ptr = &item->next;
       }
+      item = *item_ptr;
     }
   }
+  return result;
+}
+
+// This can be called very early, so we use SpinLock and RAW_VLOG here.
+int SetVLOGLevel(const char* module_pattern, int log_level) {
+  int result =
+      SetModuleLevel(&vmodule_levels, module_pattern, log_level, FLAGS_v);
   RAW_VLOG(1, "Set VLOG level for \"%s\" to %d", module_pattern, log_level);
   return result;
 }
 
-// NOTE: Individual VLOG statements cache the integer log level pointers.
-// NOTE: This function must not allocate memory or require any locks.
-bool InitVLOG3__(SiteFlag* site_flag, int32* level_default, const char* fname,
-                 int32 verbose_level) {
+int SetModuleMinLogLevel(const char* module_pattern, int min_log_level) {
+  int result = SetModuleLevel(&minloglevel_module_levels, module_pattern,
+                              min_log_level, FLAGS_minloglevel);
+  RAW_VLOG(1, "Set minloglevel for \"%s\" to %d", module_pattern,
+           min_log_level);
+  return result;
+}
+
+// Binds site_flag to the level that controls the source file fname: either
+// a module-specific level from levels or level_default.
+static int32* InitSiteFlag(ModuleLevels* levels, const string& flag,
+                           SiteFlag* site_flag, int32* level_default,
+                           const char* fname) {
   std::lock_guard<std::mutex> l(vmodule_mutex);
-  bool read_vmodule_flag = inited_vmodule;
-  if (!read_vmodule_flag) {
-    VLOG2Initializer();
+  bool read_vmodule_flag = levels->inited;
+  // Until the flag is constructed, only the levels set through Set*Level
+  // apply, and site_flag is not bound.
+  if (!read_vmodule_flag && FlagsConstructed()) {
+    VLOG2Initializer(levels, flag);
   }
 
   // protect the errno global in case someone writes:
@@ -239,7 +267,7 @@ bool InitVLOG3__(SiteFlag* site_flag, int32* level_default, const char* fname,
 
   // find target in vector of modules, replace site_flag_value with
   // a module-specific verbose level, if any.
-  for (const VModuleInfo* info = vmodule_list; info != nullptr;
+  for (const VModuleInfo* info = levels->list; info != nullptr;
        info = info->next) {
     if (SafeFNMatch_(info->module_pattern.c_str(), info->module_pattern.size(),
                      base, base_length)) {
@@ -264,15 +292,31 @@ bool InitVLOG3__(SiteFlag* site_flag, int32* level_default, const char* fname,
     if (site_flag_value == level_default && !site_flag->base_name) {
       site_flag->base_name = base;
       site_flag->base_len = base_length;
-      site_flag->next = cached_site_list;
-      cached_site_list = site_flag;
+      site_flag->next = levels->cached_site_list;
+      levels->cached_site_list = site_flag;
     }
   }
 
   // restore the errno in case something recoverable went wrong during
   // the initialization of the VLOG mechanism (see above note "protect the..")
   errno = old_errno;
-  return *site_flag_value >= verbose_level;
+  return site_flag_value;
+}
+
+// NOTE: Individual VLOG statements cache the integer log level pointers.
+// NOTE: This function must not allocate memory or require any locks.
+bool InitVLOG3__(SiteFlag* site_flag, int32* level_default, const char* fname,
+                 int32 verbose_level) {
+  return *InitSiteFlag(&vmodule_levels, FLAGS_vmodule, site_flag,
+                       level_default, fname) >= verbose_level;
+}
+
+// NOTE: Individual LOG statements cache the integer log level pointers.
+bool InitMinLogLevel__(SiteFlag* site_flag, int32* level_default,
+                       const char* fname, int32 severity) {
+  return severity >= *InitSiteFlag(&minloglevel_module_levels,
+                                   FLAGS_minloglevel_module, site_flag,
+                                   level_default, fname);
 }
 
 }  // namespace google